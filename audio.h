@@ -0,0 +1,26 @@
+
+/*
+ *  Name: audio.h
+ *  Description:
+ *  Types describing the PCM audio that sample feeds to MusicID-Stream.
+ */
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+
+/* Format of the PCM handed to the channel */
+typedef struct
+{
+    uint32_t sample_rate;
+    uint32_t bits_per_sample;
+    uint32_t channels;
+
+} audio_format_t;
+
+/* Bytes in one interleaved frame (one sample for every channel) */
+#define AUDIO_FRAME_SIZE(p_format) \
+    (((p_format)->bits_per_sample / 8) * (p_format)->channels)
+
+#endif /* AUDIO_H */
@@ -0,0 +1,502 @@
+/*
+ *  Name: batch.c
+ *  Description:
+ *  The --batch worker pool. Workers claim inputs one at a time from a
+ *  shared list (or a runner's claim hook) and render each input's
+ *  records into a private buffer, written in one piece so that records
+ *  from different workers never interleave.
+ */
+
+#include "batch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/***************************************************************************
+ *
+ *    BATCH_INIT
+ *
+ ***************************************************************************/
+void
+batch_init(
+    batch_t*             batch,
+    query_context_t*     context,
+    const batch_hooks_t* hooks,
+    void*                owner
+    )
+{
+    memset(batch, 0, sizeof(*batch));
+
+    batch->context = context;
+    batch->hooks   = hooks;
+    batch->owner   = owner;
+
+    pthread_mutex_init(&batch->lock, GNSDK_NULL);
+    pthread_mutex_init(&batch->sdk_lock, GNSDK_NULL);
+
+}   /* batch_init() */
+
+/***************************************************************************
+ *
+ *    BATCH_CLOSE
+ *
+ ***************************************************************************/
+void
+batch_close(
+    batch_t* batch
+    )
+{
+    size_t i = 0;
+
+    for (i = 0; i < batch->file_count; i++)
+    {
+        free(batch->files[i]);
+    }
+    free(batch->files);
+    batch->files      = GNSDK_NULL;
+    batch->file_count = 0;
+
+    pthread_mutex_destroy(&batch->lock);
+    pthread_mutex_destroy(&batch->sdk_lock);
+
+    if (batch->b_sdk_started && 0 == batch->sdk_rc)
+    {
+        query_stop_sdk(batch->context, batch->user_handle);
+    }
+    batch->b_sdk_started = GNSDK_FALSE;
+
+}   /* batch_close() */
+
+/***************************************************************************
+ *
+ *    _BATCH_ADD_FILE
+ *
+ ***************************************************************************/
+static int
+_batch_add_file(
+    batch_t*    batch,
+    const char* path
+    )
+{
+    char** files = GNSDK_NULL;
+
+    if (batch->file_count == batch->file_capacity)
+    {
+        batch->file_capacity = batch->file_capacity ? 2 * batch->file_capacity : 256;
+        files = realloc(batch->files, batch->file_capacity * sizeof(char*));
+        if (files == GNSDK_NULL)
+        {
+            return -1;
+        }
+        batch->files = files;
+    }
+
+    batch->files[batch->file_count] = strdup(path);
+    if (batch->files[batch->file_count] == GNSDK_NULL)
+    {
+        return -1;
+    }
+    batch->file_count++;
+
+    return 0;
+
+}   /* _batch_add_file() */
+
+/***************************************************************************
+ *
+ *    _COMPARE_NAMES
+ *
+ ***************************************************************************/
+static int
+_compare_names(
+    const void* a,
+    const void* b
+    )
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+
+}   /* _compare_names() */
+
+/***************************************************************************
+ *
+ *    BATCH_ADD_INPUT
+ *
+ ***************************************************************************/
+int
+batch_add_input(
+    batch_t*    batch,
+    const char* path
+    )
+{
+    char           line[4096]    = {0};
+    char*          child         = GNSDK_NULL;
+    DIR*           dir           = GNSDK_NULL;
+    struct dirent* entry         = GNSDK_NULL;
+    struct stat    st;
+    char**         names         = GNSDK_NULL;
+    char**         grown         = GNSDK_NULL;
+    size_t         name_count    = 0;
+    size_t         name_capacity = 0;
+    size_t         line_len      = 0;
+    size_t         i             = 0;
+    int            rc            = 0;
+
+    if (0 == strcmp(path, "-"))
+    {
+        while (0 == rc && fgets(line, sizeof(line), stdin))
+        {
+            line_len = strcspn(line, "\r\n");
+            line[line_len] = '\0';
+            if (line_len > 0)
+            {
+                rc = _batch_add_file(batch, line);
+            }
+        }
+        return rc;
+    }
+
+    if (0 != stat(path, &st) || !S_ISDIR(st.st_mode))
+    {
+        /* missing files get their error record from the worker */
+        return _batch_add_file(batch, path);
+    }
+
+    dir = opendir(path);
+    if (dir == GNSDK_NULL)
+    {
+        record_stringf(query_context_begin_record(batch->context), "error", "Failed to open directory %s: %s", path, strerror(errno));
+        query_context_end_record(batch->context);
+        return 0;
+    }
+
+    /* listed by name, not in the order the file system keeps them, so
+     * results and --split units come out the same on every run */
+    while (0 == rc && (entry = readdir(dir)) != GNSDK_NULL)
+    {
+        /* skip ".", ".." and hidden files */
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        if (name_count == name_capacity)
+        {
+            grown = realloc(names, (name_capacity ? 2 * name_capacity : 64) * sizeof(char*));
+            if (grown == GNSDK_NULL)
+            {
+                rc = -1;
+                break;
+            }
+            names         = grown;
+            name_capacity = name_capacity ? 2 * name_capacity : 64;
+        }
+        names[name_count] = strdup(entry->d_name);
+        if (names[name_count] == GNSDK_NULL)
+        {
+            rc = -1;
+            break;
+        }
+        name_count++;
+    }
+    closedir(dir);
+
+    qsort(names, name_count, sizeof(char*), _compare_names);
+
+    for (i = 0; 0 == rc && i < name_count; i++)
+    {
+        child = malloc(strlen(path) + strlen(names[i]) + 2);
+        if (child == GNSDK_NULL)
+        {
+            rc = -1;
+            break;
+        }
+        sprintf(child, "%s/%s", path, names[i]);
+
+        if (0 == stat(child, &st) && (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)))
+        {
+            rc = batch_add_input(batch, child);
+        }
+        free(child);
+    }
+
+    for (i = 0; i < name_count; i++)
+    {
+        free(names[i]);
+    }
+    free(names);
+
+    return rc;
+
+}   /* batch_add_input() */
+
+/***************************************************************************
+ *
+ *    BATCH_ADD_INPUTS
+ *
+ ***************************************************************************/
+int
+batch_add_inputs(
+    batch_t* batch,
+    int      input_count,
+    char**   inputs
+    )
+{
+    int i  = 0;
+    int rc = 0;
+
+    for (i = 0; i < input_count && 0 == rc; i++)
+    {
+        rc = batch_add_input(batch, inputs[i]);
+    }
+    if (0 != rc)
+    {
+        record_string(query_context_begin_record(batch->context), "error", "Out of memory listing inputs");
+        query_context_end_record(batch->context);
+    }
+
+    return rc;
+
+}   /* batch_add_inputs() */
+
+/***************************************************************************
+ *
+ *    BATCH_START_SDK
+ *
+ * Called by the first worker with an input to identify, and every one
+ * after that.
+ *
+ ***************************************************************************/
+int
+batch_start_sdk(
+    batch_t* batch
+    )
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&batch->sdk_lock);
+    if (!batch->b_sdk_started)
+    {
+        batch->b_sdk_started = GNSDK_TRUE;
+        batch->sdk_rc        = query_start_sdk(batch->context, &batch->user_handle);
+    }
+    rc = batch->sdk_rc;
+    pthread_mutex_unlock(&batch->sdk_lock);
+
+    return rc;
+
+}   /* batch_start_sdk() */
+
+/***************************************************************************
+ *
+ *    _BATCH_CLAIM
+ *
+ * The next input on the list for a worker, or NULL once there are no
+ * more.
+ *
+ ***************************************************************************/
+static const char*
+_batch_claim(
+    batch_t* batch,
+    size_t*  p_index
+    )
+{
+    const char* path = GNSDK_NULL;
+
+    pthread_mutex_lock(&batch->lock);
+    *p_index = batch->next_file++;
+    path     = (*p_index < batch->file_count) ? batch->files[*p_index] : GNSDK_NULL;
+    pthread_mutex_unlock(&batch->lock);
+
+    return path;
+
+}   /* _batch_claim() */
+
+/***************************************************************************
+ *
+ *    _BATCH_WORKER
+ *
+ * Identify inputs on one channel, created when the first input misses
+ * the cache and the local index and reused for every input after that,
+ * until there are no more (or hand each to the process hook). Each
+ * input's records are rendered into a private buffer and written to
+ * stdout in one piece, or handed to the finish hook.
+ *
+ ***************************************************************************/
+static void*
+_batch_worker(
+    void* arg
+    )
+{
+    batch_t*                             batch          = (batch_t*)arg;
+    const batch_hooks_t*                 hooks          = batch->hooks;
+    gnsdk_musicidstream_channel_handle_t channel_handle = GNSDK_NULL;
+    query_t                              query          = {0};
+    audio_input_t                        input;
+    void*                                unit           = GNSDK_NULL;
+    char*                                record_buf     = GNSDK_NULL;
+    size_t                               record_size    = 0;
+    size_t                               index          = 0;
+    long                                 record_len     = 0;
+
+    query.context    = batch->context;
+    query.b_tag_file = GNSDK_TRUE;
+    query.priority   = batch->context->priority;
+    query.out        = open_memstream(&record_buf, &record_size);
+    if (query.out == GNSDK_NULL)
+    {
+        return GNSDK_NULL;
+    }
+
+    for (;;)
+    {
+        unit             = GNSDK_NULL;
+        query.audio_file = (hooks && hooks->claim) ? hooks->claim(batch, &unit, &index) : _batch_claim(batch, &index);
+        if (query.audio_file == GNSDK_NULL)
+        {
+            break;
+        }
+
+        query.records    = 0;
+        query_trace_start(&query);
+        if (hooks && hooks->process)
+        {
+            hooks->process(batch, &query);
+        }
+        else if (0 == query_prepare_input(&query, &input))
+        {
+            if (0 == batch_start_sdk(batch))
+            {
+                query_identify_input(batch->user_handle, &channel_handle, &query, &input);
+            }
+            else
+            {
+                record_string(query_begin_record(&query), "error", "The Gracenote SDK failed to start");
+                query_end_record(&query);
+            }
+            query_close_input(&input);
+        }
+
+        if (0 == query.records)
+        {
+            record_null(query_begin_record(&query), "result");
+            query_end_record(&query);
+        }
+        query_trace_finish(&query);
+
+        /* the buffer may have moved as it grew; it's only valid after a flush */
+        fflush(query.out);
+        record_len = ftell(query.out);
+
+        if (hooks && hooks->finish)
+        {
+            hooks->finish(batch, unit, index, record_buf, (size_t)record_len);
+        }
+        else
+        {
+            pthread_mutex_lock(&batch->lock);
+            fwrite(record_buf, 1, (size_t)record_len, stdout);
+            fflush(stdout);
+            pthread_mutex_unlock(&batch->lock);
+        }
+
+        rewind(query.out);
+    }
+
+    if (channel_handle)
+    {
+        gnsdk_musicidstream_channel_release(channel_handle);
+    }
+
+    fclose(query.out);
+    free(record_buf);
+
+    return GNSDK_NULL;
+
+}   /* _batch_worker() */
+
+/***************************************************************************
+ *
+ *    BATCH_RUN_WORKERS
+ *
+ ***************************************************************************/
+int
+batch_run_workers(
+    batch_t* batch,
+    long     jobs
+    )
+{
+    pthread_t* workers = calloc((size_t)jobs, sizeof(pthread_t));
+    long       started = 0;
+    int        rc      = 0;
+
+    for (started = 0; workers && started < jobs; started++)
+    {
+        if (0 != pthread_create(&workers[started], GNSDK_NULL, _batch_worker, batch))
+        {
+            break;
+        }
+    }
+
+    if (0 == started)
+    {
+        record_string(query_context_begin_record(batch->context), "error", "Failed to start batch workers");
+        query_context_end_record(batch->context);
+        rc = -1;
+    }
+
+    while (started > 0)
+    {
+        pthread_join(workers[--started], GNSDK_NULL);
+    }
+    free(workers);
+
+    return rc;
+
+}   /* batch_run_workers() */
+
+/***************************************************************************
+ *
+ *    BATCH_RUN
+ *
+ * The SDK is started by the first input that needs it and shut down
+ * here.
+ *
+ ***************************************************************************/
+int
+batch_run(
+    query_context_t* context,
+    long             jobs,
+    int              input_count,
+    char**           inputs
+    )
+{
+    batch_t batch = {0};
+    int     rc    = 0;
+
+    batch_init(&batch, context, GNSDK_NULL, GNSDK_NULL);
+
+    rc = batch_add_inputs(&batch, input_count, inputs);
+
+    if (jobs <= 0)
+    {
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs > (long)batch.file_count)
+    {
+        jobs = (long)batch.file_count;
+    }
+
+    if (0 == rc && jobs > 0)
+    {
+        rc = batch_run_workers(&batch, jobs);
+    }
+
+    batch_close(&batch);
+
+    return rc;
+
+}   /* batch_run() */
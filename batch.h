@@ -0,0 +1,123 @@
+/*
+ *  Name: batch.h
+ *  Description:
+ *  A pool of worker threads identifying a list of inputs (--batch), each
+ *  on a channel of its own that it keeps from one input to the next. The
+ *  SDK is started by the first input that misses the cache and the local
+ *  index, so a batch answered without the service never pays for it.
+ *
+ *  Other runners reuse the pool through batch_hooks_t: --work takes its
+ *  inputs from a work queue and hands their records back to it, and
+ *  --fingerprint spools each input's fingerprint instead of identifying
+ *  it. --tracklist and --build-index only use its list of inputs.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "query.h"
+
+typedef struct batch_s batch_t;
+
+/*
+ * How a runner built on the pool departs from --batch. Each may be NULL,
+ * and all are called from the worker threads.
+ */
+typedef struct
+{
+    /* The next input, or NULL once there are no more; *p_unit and
+     * *p_index are handed back to finish() with its records */
+    const char* (*claim)(batch_t* batch, void** p_unit, size_t* p_index);
+
+    /* The records of an input, rendered into a buffer in one piece;
+     * without it they are written to stdout */
+    void (*finish)(batch_t* batch, void* unit, size_t index, const char* records, size_t size);
+
+    /* Do query's input in place of identifying it */
+    void (*process)(batch_t* batch, query_t* query);
+
+} batch_hooks_t;
+
+struct batch_s
+{
+    query_context_t*     context;
+    const batch_hooks_t* hooks;        /* NULL for --batch */
+    void*                owner;        /* what the hooks are working for */
+    gnsdk_user_handle_t  user_handle;  /* once b_sdk_started, if sdk_rc is 0 */
+    gnsdk_bool_t         b_sdk_started;
+    int                  sdk_rc;
+    pthread_mutex_t      sdk_lock;     /* guards starting the SDK */
+    char**               files;
+    size_t               file_count;
+    size_t               file_capacity;
+    size_t               next_file;    /* first file not yet claimed by a worker */
+    pthread_mutex_t      lock;         /* guards next_file and stdout */
+};
+
+/* An empty list of inputs for the queries of context */
+void
+batch_init(
+    batch_t*             batch,
+    query_context_t*     context,
+    const batch_hooks_t* hooks,
+    void*                owner
+    );
+
+/* Free the list, and stop the SDK if one of the workers started it */
+void
+batch_close(
+    batch_t* batch
+    );
+
+/*
+ * Add a file, every file under a directory, or with "-" every path
+ * listed on stdin (one per line). A directory that can't be read is
+ * reported and skipped. Returns -1 if out of memory.
+ */
+int
+batch_add_input(
+    batch_t*    batch,
+    const char* path
+    );
+
+/*
+ * batch_add_input() each of inputs in turn. Returns -1 if out of memory,
+ * which is reported.
+ */
+int
+batch_add_inputs(
+    batch_t* batch,
+    int      input_count,
+    char**   inputs
+    );
+
+/*
+ * Start the SDK for the batch if it hasn't been yet. Returns -1 if it
+ * couldn't be started (reported the first time).
+ */
+int
+batch_start_sdk(
+    batch_t* batch
+    );
+
+/* Run jobs workers on the batch until they are all done */
+int
+batch_run_workers(
+    batch_t* batch,
+    long     jobs
+    );
+
+/*
+ * --batch: identify every input with jobs channels in flight (one per
+ * core if jobs is 0, never more than there are files), writing each
+ * file's records to stdout tagged with its path.
+ */
+int
+batch_run(
+    query_context_t* context,
+    long             jobs,
+    int              input_count,
+    char**           inputs
+    );
+
+#endif /* BATCH_H */
@@ -0,0 +1,893 @@
+
+/*
+ *  Name: bench
+ *  Description:
+ *  Micro-benchmarks for the local stages of sample, measured on synthetic
+ *  audio so that the remote lookup doesn't hide them. Each stage is run a
+ *  number of times and reported as one JSON line giving its latency
+ *  percentiles in microseconds and, where PCM passes through it, its
+ *  throughput in MB/s. Compare the output of two builds to spot regressions.
+ *
+ *  Command-line Syntax:
+ *  bench [--iterations <n>] [--init-iterations <n>] [--audio-seconds <s>]
+ *        [--feed-size <bytes>] [--render-xml <file>] [stage...]
+ *
+ *  Stages (all of them by default):
+ *  wav_open       open, parse and map a WAV file (query_open_input)
+ *  convert        resample the audio as if it were 48kHz (convert_process)
+ *  condition      trim silence and apply gain to the audio (condition_process)
+ *  feed_mapped    write a mapped WAV to a channel in feed-size slices
+ *  feed_stream    read() a WAV and write it to a channel (query_feed_stream)
+ *  audio_write    each gnsdk_musicidstream_channel_audio_write() call
+ *  render         build (query_add_album_gdo) and write (query_end_record) one album record
+ *  init_shutdown  query_start_sdk() followed by query_stop_sdk()
+ *
+ *  The channels are never asked to identify, so no query leaves the machine
+ *  apart from whatever query_start_sdk() itself needs.
+ */
+
+/* The stages are sample's own identification (query.h) */
+#include "query.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* album used by the render stage unless --render-xml gives another */
+#define BENCH_ALBUM_XML \
+    "<ALBUM>" \
+    "<TITLE_OFFICIAL><DISPLAY>Benchmark Album</DISPLAY></TITLE_OFFICIAL>" \
+    "<ARTIST><NAME_OFFICIAL><DISPLAY>Benchmark Artist</DISPLAY></NAME_OFFICIAL></ARTIST>" \
+    "<TRACK_MATCHED_NUM>1</TRACK_MATCHED_NUM>" \
+    "<TRACK_MATCHED><TRACK_NUM>1</TRACK_NUM>" \
+    "<TITLE_OFFICIAL><DISPLAY>Benchmark Track</DISPLAY></TITLE_OFFICIAL>" \
+    "</TRACK_MATCHED>" \
+    "</ALBUM>"
+
+/* Timings collected for one stage */
+typedef struct
+{
+    const char* name;
+    double*     samples;     /* seconds per operation */
+    size_t      count;
+    size_t      capacity;
+    uint64_t    bytes;       /* PCM bytes processed over all operations */
+
+} bench_stage_t;
+
+typedef struct
+{
+    long          iterations;
+    long          init_iterations;
+    long          audio_seconds;
+    const char*   render_xml;
+    char          wav_path[64];
+    audio_format_t format;
+
+} bench_config_t;
+
+/* in the order they run; indexes s_stage_names */
+enum
+{
+    STAGE_WAV_OPEN,
+    STAGE_CONVERT,
+    STAGE_CONDITION,
+    STAGE_FEED_MAPPED,
+    STAGE_FEED_STREAM,
+    STAGE_AUDIO_WRITE,
+    STAGE_RENDER,
+    STAGE_INIT_SHUTDOWN,
+    BENCH_STAGE_COUNT
+};
+
+static const char* s_stage_names[BENCH_STAGE_COUNT] =
+{
+    "wav_open",
+    "convert",
+    "condition",
+    "feed_mapped",
+    "feed_stream",
+    "audio_write",
+    "render",
+    "init_shutdown"
+};
+
+/* the settings the stages run with: --feed-size and sample's defaults */
+static query_context_t s_context;
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+static int
+_compare_double(
+    const void* a,
+    const void* b
+    )
+{
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+
+    return (da > db) - (da < db);
+}
+
+/******************************************************************
+ *
+ *    _STAGE_ADD
+ *
+ *    Record one operation of elapsed seconds.
+ *
+ *****************************************************************/
+static int
+_stage_add(
+    bench_stage_t* stage,
+    double         elapsed
+    )
+{
+    double* grown = GNSDK_NULL;
+
+    if (stage->count == stage->capacity)
+    {
+        stage->capacity = stage->capacity ? stage->capacity * 2 : 64;
+        grown = realloc(stage->samples, stage->capacity * sizeof(double));
+        if (grown == GNSDK_NULL)
+        {
+            return -1;
+        }
+        stage->samples = grown;
+    }
+    stage->samples[stage->count++] = elapsed;
+
+    return 0;
+
+} /* _stage_add() */
+
+/******************************************************************
+ *
+ *    _STAGE_REPORT
+ *
+ *    Write the stage as a JSON line. Percentiles are nearest-rank.
+ *
+ *****************************************************************/
+static void
+_stage_report(
+    bench_stage_t* stage
+    )
+{
+    static const double percentiles[] = { 50, 90, 99 };
+    double              total         = 0;
+    size_t              rank          = 0;
+    size_t              i             = 0;
+
+    if (0 == stage->count)
+    {
+        printf("{\"bench\": \"%s\", \"error\": \"no samples\"}\n", stage->name);
+        return;
+    }
+
+    for (i = 0; i < stage->count; i++)
+    {
+        total += stage->samples[i];
+    }
+    qsort(stage->samples, stage->count, sizeof(double), _compare_double);
+
+    printf("{\"bench\": \"%s\", \"operations\": %lu, \"seconds\": %.6f", stage->name, (unsigned long)stage->count, total);
+    if (stage->bytes > 0)
+    {
+        printf(", \"bytes\": %llu, \"mb_per_s\": %.2f",
+            (unsigned long long)stage->bytes,
+            total > 0 ? (double)stage->bytes / (1024.0 * 1024.0) / total : 0.0
+            );
+    }
+
+    printf(", \"latency_us\": {\"min\": %.3f", stage->samples[0] * 1e6);
+    for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        rank = (size_t)ceil(percentiles[i] / 100.0 * (double)stage->count);
+        rank = rank ? rank - 1 : 0;
+        printf(", \"p%.0f\": %.3f", percentiles[i], stage->samples[rank] * 1e6);
+    }
+    printf(", \"max\": %.3f, \"mean\": %.3f}}\n",
+        stage->samples[stage->count - 1] * 1e6,
+        total / (double)stage->count * 1e6
+        );
+    fflush(stdout);
+
+} /* _stage_report() */
+
+/******************************************************************
+ *
+ *    _WRITE_SYNTHETIC_WAV
+ *
+ *    A few seconds of two detuned tones plus noise, so the fingerprinter
+ *    sees something music-like rather than silence. Deterministic, so
+ *    runs of different builds feed identical audio.
+ *
+ *****************************************************************/
+static int
+_write_synthetic_wav(
+    bench_config_t* config
+    )
+{
+    unsigned char  header[44]  = {0};
+    int16_t        frame[2]    = {0};
+    uint32_t       frame_size  = AUDIO_FRAME_SIZE(&config->format);
+    uint64_t       frames      = (uint64_t)config->format.sample_rate * (uint64_t)config->audio_seconds;
+    uint32_t       data_size   = (uint32_t)(frames * frame_size);
+    uint32_t       noise       = 0x12345678;
+    FILE*          file        = GNSDK_NULL;
+    int            fd          = -1;
+    uint64_t       i           = 0;
+    double         t           = 0;
+
+    snprintf(config->wav_path, sizeof(config->wav_path), "/tmp/sample-bench-XXXXXX");
+    fd = mkstemp(config->wav_path);
+    if (fd < 0 || (file = fdopen(fd, "wb")) == GNSDK_NULL)
+    {
+        return -1;
+    }
+
+    memcpy(header, "RIFF", 4);
+    header[4]  = (unsigned char)(data_size + 36);
+    header[5]  = (unsigned char)((data_size + 36) >> 8);
+    header[6]  = (unsigned char)((data_size + 36) >> 16);
+    header[7]  = (unsigned char)((data_size + 36) >> 24);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    header[16] = 16;
+    header[20] = WAV_FORMAT_PCM;
+    header[22] = (unsigned char)config->format.channels;
+    header[24] = (unsigned char)config->format.sample_rate;
+    header[25] = (unsigned char)(config->format.sample_rate >> 8);
+    header[26] = (unsigned char)(config->format.sample_rate >> 16);
+    header[28] = (unsigned char)(config->format.sample_rate * frame_size);
+    header[29] = (unsigned char)((config->format.sample_rate * frame_size) >> 8);
+    header[30] = (unsigned char)((config->format.sample_rate * frame_size) >> 16);
+    header[32] = (unsigned char)frame_size;
+    header[34] = (unsigned char)config->format.bits_per_sample;
+    memcpy(header + 36, "data", 4);
+    header[40] = (unsigned char)data_size;
+    header[41] = (unsigned char)(data_size >> 8);
+    header[42] = (unsigned char)(data_size >> 16);
+    header[43] = (unsigned char)(data_size >> 24);
+    fwrite(header, 1, sizeof(header), file);
+
+    /* little-endian hosts only, which is all sample runs on */
+    for (i = 0; i < frames; i++)
+    {
+        t        = (double)i / (double)config->format.sample_rate;
+        noise    = noise * 1664525u + 1013904223u;
+        frame[0] = (int16_t)(8000.0 * sin(2 * M_PI * 440.0 * t) + 4000.0 * sin(2 * M_PI * 660.0 * t) + (double)(noise >> 22) - 512.0);
+        frame[1] = (int16_t)(8000.0 * sin(2 * M_PI * 441.5 * t) + 4000.0 * sin(2 * M_PI * 330.0 * t) + (double)(noise >> 22) - 512.0);
+        fwrite(frame, 1, sizeof(frame), file);
+    }
+
+    if (0 != fclose(file))
+    {
+        unlink(config->wav_path);
+        return -1;
+    }
+
+    return 0;
+
+} /* _write_synthetic_wav() */
+
+/******************************************************************
+ *
+ *    _BENCH_WAV_OPEN
+ *
+ *****************************************************************/
+static void
+_bench_wav_open(
+    bench_config_t* config,
+    bench_stage_t*  stage
+    )
+{
+    query_t       query = {0};
+    audio_input_t input;
+    double        start = 0;
+    long          i     = 0;
+
+    query.context    = &s_context;
+    query.audio_file = config->wav_path;
+    query.out        = stdout;
+
+    for (i = 0; i < config->iterations; i++)
+    {
+        start = query_now();
+        if (0 != query_open_input(&query, &input))
+        {
+            return;
+        }
+        query_close_input(&input);
+        _stage_add(stage, query_now() - start);
+    }
+
+} /* _bench_wav_open() */
+
+/******************************************************************
+ *
+ *    _BENCH_CONVERT
+ *
+ *    Run the synthetic audio through the converter as though it had
+ *    been recorded at 48kHz, so every slice is resampled to 44.1kHz.
+ *
+ *****************************************************************/
+static void
+_bench_convert(
+    bench_config_t* config,
+    bench_stage_t*  stage
+    )
+{
+    query_t             query      = {0};
+    audio_input_t       input;
+    audio_format_t      in_format  = config->format;
+    audio_format_t      out_format;
+    convert_t*          convert    = GNSDK_NULL;
+    const int16_t*      p_out      = GNSDK_NULL;
+    const gnsdk_byte_t* p_audio    = GNSDK_NULL;
+    gnsdk_size_t        remaining  = 0;
+    gnsdk_size_t        slice_size = 0;
+    gnsdk_size_t        write_size = 0;
+    double              start      = 0;
+    long                i          = 0;
+
+    query.context    = &s_context;
+    query.audio_file = config->wav_path;
+    query.out        = stdout;
+
+    if (0 != query_open_input(&query, &input))
+    {
+        return;
+    }
+    if (input.p_map == GNSDK_NULL)
+    {
+        printf("{\"bench\": \"%s\", \"error\": \"could not map %s\"}\n", stage->name, config->wav_path);
+        query_close_input(&input);
+        return;
+    }
+
+    slice_size = s_context.feed_size - (s_context.feed_size % input.info.block_align);
+    if (0 == slice_size)
+    {
+        slice_size = input.info.block_align;
+    }
+
+    in_format.sample_rate = 48000;
+    for (i = 0; i < config->iterations; i++)
+    {
+        convert = convert_open(&in_format, 0, CHANNEL_SAMPLE_RATE, &out_format);
+        if (convert == GNSDK_NULL)
+        {
+            break;
+        }
+
+        p_audio   = input.p_audio;
+        remaining = input.audio_size;
+
+        start = query_now();
+        while (remaining > 0)
+        {
+            write_size = (remaining < slice_size) ? remaining : slice_size;
+            convert_process(convert, p_audio, write_size, &p_out);
+            p_audio   += write_size;
+            remaining -= write_size;
+        }
+        _stage_add(stage, query_now() - start);
+        stage->bytes += input.audio_size;
+
+        convert_close(convert);
+    }
+
+    query_close_input(&input);
+
+} /* _bench_convert() */
+
+/******************************************************************
+ *
+ *    _BENCH_CONDITION
+ *
+ *    Run the whole file through a fresh conditioner per iteration,
+ *    in feed-size slices, with the default --condition settings.
+ *
+ *****************************************************************/
+static void
+_bench_condition(
+    bench_config_t* config,
+    bench_stage_t*  stage
+    )
+{
+    query_t             query      = {0};
+    audio_input_t       input;
+    condition_t*        condition  = GNSDK_NULL;
+    const int16_t*      p_out      = GNSDK_NULL;
+    const gnsdk_byte_t* p_audio    = GNSDK_NULL;
+    gnsdk_size_t        remaining  = 0;
+    gnsdk_size_t        slice_size = 0;
+    gnsdk_size_t        write_size = 0;
+    double              start      = 0;
+    long                i          = 0;
+
+    query.context    = &s_context;
+    query.audio_file = config->wav_path;
+    query.out        = stdout;
+
+    if (0 != query_open_input(&query, &input))
+    {
+        return;
+    }
+    if (input.p_map == GNSDK_NULL)
+    {
+        printf("{\"bench\": \"%s\", \"error\": \"could not map %s\"}\n", stage->name, config->wav_path);
+        query_close_input(&input);
+        return;
+    }
+
+    slice_size = s_context.feed_size - (s_context.feed_size % input.info.block_align);
+    if (0 == slice_size)
+    {
+        slice_size = input.info.block_align;
+    }
+
+    for (i = 0; i < config->iterations; i++)
+    {
+        condition = condition_open(config->format.sample_rate, config->format.channels, s_context.silence_db, s_context.max_gain_db);
+        if (condition == GNSDK_NULL)
+        {
+            break;
+        }
+
+        p_audio   = input.p_audio;
+        remaining = input.audio_size;
+
+        start = query_now();
+        while (remaining > 0)
+        {
+            write_size = (remaining < slice_size) ? remaining : slice_size;
+            condition_process(condition, (const int16_t*)p_audio, write_size, &p_out);
+            p_audio   += write_size;
+            remaining -= write_size;
+        }
+        condition_flush(condition, &p_out);
+        _stage_add(stage, query_now() - start);
+        stage->bytes += input.audio_size;
+
+        condition_close(condition);
+    }
+
+    query_close_input(&input);
+
+} /* _bench_condition() */
+
+/******************************************************************
+ *
+ *    _BENCH_FEED
+ *
+ *    Feed the whole file to a fresh fingerprint per iteration, either
+ *    from the mapping (_write_audio) or by reading it (_feed_stream).
+ *    With b_per_write each audio_write call is timed on its own.
+ *
+ *****************************************************************/
+static void
+_bench_feed(
+    gnsdk_user_handle_t user_handle,
+    bench_config_t*     config,
+    bench_stage_t*      stage,
+    gnsdk_bool_t        b_mapped,
+    gnsdk_bool_t        b_per_write
+    )
+{
+    gnsdk_musicidstream_channel_handle_t channel_handle = GNSDK_NULL;
+    gnsdk_error_t       error      = GNSDK_SUCCESS;
+    query_t             query      = {0};
+    audio_input_t       input;
+    const gnsdk_byte_t* p_audio    = GNSDK_NULL;
+    gnsdk_size_t        remaining  = 0;
+    gnsdk_size_t        write_size = 0;
+    gnsdk_size_t        slice_size = 0;
+    double              start      = 0;
+    long                i          = 0;
+
+    query.context    = &s_context;
+    query.audio_file = config->wav_path;
+    query.out        = stdout;
+
+    if (0 != query_open_input(&query, &input))
+    {
+        return;
+    }
+    if (b_mapped && input.p_map == GNSDK_NULL)
+    {
+        printf("{\"bench\": \"%s\", \"error\": \"could not map %s\"}\n", stage->name, config->wav_path);
+        query_close_input(&input);
+        return;
+    }
+
+    if (GNSDK_SUCCESS != query_create_channel(user_handle, &query, &channel_handle))
+    {
+        query_display_last_error(&query);
+        query_close_input(&input);
+        return;
+    }
+
+    slice_size = s_context.feed_size - (s_context.feed_size % input.info.block_align);
+    if (0 == slice_size)
+    {
+        slice_size = input.info.block_align;
+    }
+
+    for (i = 0; i < config->iterations && GNSDK_SUCCESS == error; i++)
+    {
+        error = gnsdk_musicidstream_channel_audio_begin(
+            channel_handle,
+            input.info.format.sample_rate,
+            input.info.format.bits_per_sample,
+            input.info.format.channels
+            );
+        if (GNSDK_SUCCESS != error)
+        {
+            break;
+        }
+
+        if (b_per_write)
+        {
+            p_audio   = input.p_audio;
+            remaining = input.audio_size;
+            while (remaining > 0 && GNSDK_SUCCESS == error)
+            {
+                write_size = (remaining < slice_size) ? remaining : slice_size;
+
+                start = query_now();
+                error = gnsdk_musicidstream_channel_audio_write(channel_handle, p_audio, write_size);
+                _stage_add(stage, query_now() - start);
+
+                stage->bytes += write_size;
+                p_audio      += write_size;
+                remaining    -= write_size;
+            }
+        }
+        else if (b_mapped)
+        {
+            start = query_now();
+            error = query_write_audio(channel_handle, &query, input.p_audio, input.audio_size, input.info.block_align);
+            _stage_add(stage, query_now() - start);
+            stage->bytes += input.audio_size;
+        }
+        else
+        {
+            /* back to the start of the samples and read them again */
+            if (lseek(input.fd, (off_t)input.info.data_offset, SEEK_SET) < 0)
+            {
+                break;
+            }
+            start = query_now();
+            error = query_feed_stream(channel_handle, &query, input.fd, &input.info);
+            _stage_add(stage, query_now() - start);
+            stage->bytes += input.info.data_size;
+        }
+
+        if (GNSDK_SUCCESS == error)
+        {
+            error = gnsdk_musicidstream_channel_audio_end(channel_handle);
+        }
+    }
+
+    if (GNSDK_SUCCESS != error)
+    {
+        query_display_last_error(&query);
+    }
+
+    gnsdk_musicidstream_channel_release(channel_handle);
+    query_close_input(&input);
+
+} /* _bench_feed() */
+
+/******************************************************************
+ *
+ *    _LOAD_RENDER_XML
+ *
+ *****************************************************************/
+static char*
+_load_render_xml(
+    const char* path
+    )
+{
+    FILE*  file   = GNSDK_NULL;
+    char*  xml    = GNSDK_NULL;
+    long   size   = 0;
+
+    file = fopen(path, "rb");
+    if (file == GNSDK_NULL)
+    {
+        return GNSDK_NULL;
+    }
+    if (0 == fseek(file, 0, SEEK_END) && (size = ftell(file)) >= 0 && 0 == fseek(file, 0, SEEK_SET))
+    {
+        xml = malloc((size_t)size + 1);
+        if (xml && fread(xml, 1, (size_t)size, file) == (size_t)size)
+        {
+            xml[size] = '\0';
+        }
+        else
+        {
+            free(xml);
+            xml = GNSDK_NULL;
+        }
+    }
+    fclose(file);
+
+    return xml;
+
+} /* _load_render_xml() */
+
+/******************************************************************
+ *
+ *    _BENCH_RENDER
+ *
+ *    Build one album record per iteration and write it to /dev/null
+ *    in the --format chosen, through the same single write and flush
+ *    as real output.
+ *
+ *****************************************************************/
+static void
+_bench_render(
+    bench_config_t* config,
+    bench_stage_t*  stage
+    )
+{
+    gnsdk_gdo_handle_t album_gdo = GNSDK_NULL;
+    query_t            query     = {0};
+    char*              xml       = GNSDK_NULL;
+    double             start     = 0;
+    long               i         = 0;
+    long               renders   = config->iterations * 100;
+
+    if (config->render_xml)
+    {
+        xml = _load_render_xml(config->render_xml);
+        if (xml == GNSDK_NULL)
+        {
+            printf("{\"bench\": \"%s\", \"error\": \"could not read %s\"}\n", stage->name, config->render_xml);
+            return;
+        }
+    }
+
+    if (GNSDK_SUCCESS != gnsdk_manager_gdo_create_from_xml(xml ? xml : BENCH_ALBUM_XML, &album_gdo))
+    {
+        record_string(query_context_begin_record(&s_context), "error", gnsdk_manager_error_info()->error_description);
+        query_context_end_record(&s_context);
+        free(xml);
+        return;
+    }
+    free(xml);
+
+    query.context    = &s_context;
+    query.audio_file = config->wav_path;
+    query.out        = fopen("/dev/null", "w");
+    if (query.out == GNSDK_NULL)
+    {
+        gnsdk_manager_gdo_release(album_gdo);
+        return;
+    }
+
+    /* renders are short, so run a hundred per iteration */
+    for (i = 0; i < renders; i++)
+    {
+        start = query_now();
+        query_add_album_gdo(query_begin_record(&query), "result", album_gdo, GNSDK_FALSE);
+        query_end_record(&query);
+        _stage_add(stage, query_now() - start);
+    }
+
+    fclose(query.out);
+    gnsdk_manager_gdo_release(album_gdo);
+
+} /* _bench_render() */
+
+/******************************************************************
+ *
+ *    _BENCH_INIT_SHUTDOWN
+ *
+ *****************************************************************/
+static void
+_bench_init_shutdown(
+    bench_config_t* config,
+    bench_stage_t*  stage
+    )
+{
+    gnsdk_user_handle_t user_handle = GNSDK_NULL;
+    double              start       = 0;
+    long                i           = 0;
+
+    for (i = 0; i < config->init_iterations; i++)
+    {
+        start = query_now();
+        if (0 != query_start_sdk(&s_context, &user_handle))
+        {
+            return;
+        }
+        query_stop_sdk(&s_context, user_handle);
+        _stage_add(stage, query_now() - start);
+    }
+
+} /* _bench_init_shutdown() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ ******************************************************************/
+int
+main(int argc, char* argv[])
+{
+    gnsdk_user_handle_t user_handle = GNSDK_NULL;
+    bench_config_t      config      = {0};
+    bench_stage_t       stages[BENCH_STAGE_COUNT];
+    int                 b_run[BENCH_STAGE_COUNT];
+    int                 b_need_sdk  = 0;
+    int                 b_usage     = 0;
+    int                 opt         = 0;
+    int                 rc          = 0;
+    size_t              i           = 0;
+    size_t              j           = 0;
+    static const struct option long_options[] =
+    {
+        { "iterations",      required_argument, GNSDK_NULL, 'n' },
+        { "init-iterations", required_argument, GNSDK_NULL, 'I' },
+        { "audio-seconds",   required_argument, GNSDK_NULL, 'a' },
+        { "feed-size",       required_argument, GNSDK_NULL, 'F' },
+        { "render-xml",      required_argument, GNSDK_NULL, 'x' },
+        { GNSDK_NULL, 0, GNSDK_NULL, 0 }
+    };
+
+    query_context_init(&s_context);
+
+    config.iterations      = 20;
+    config.init_iterations = 3;
+    config.audio_seconds   = 30;
+    config.format          = s_context.raw_format;
+
+    while (-1 != (opt = getopt_long(argc, argv, "n:", long_options, GNSDK_NULL)))
+    {
+        switch (opt)
+        {
+        case 'n':
+            config.iterations = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case 'I':
+            config.init_iterations = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case 'a':
+            config.audio_seconds = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case 'F':
+            s_context.feed_size = (gnsdk_size_t)strtoul(optarg, GNSDK_NULL, 10);
+            break;
+        case 'x':
+            config.render_xml = optarg;
+            break;
+        default:
+            b_usage = 1;
+            break;
+        }
+    }
+
+    memset(stages, 0, sizeof(stages));
+    for (i = 0; i < BENCH_STAGE_COUNT; i++)
+    {
+        stages[i].name = s_stage_names[i];
+        b_run[i]       = (optind == argc);
+    }
+    for (j = (size_t)optind; j < (size_t)argc; j++)
+    {
+        for (i = 0; i < BENCH_STAGE_COUNT && 0 != strcmp(argv[j], s_stage_names[i]); i++)
+        {
+        }
+        if (i == BENCH_STAGE_COUNT)
+        {
+            b_usage = 1;
+            break;
+        }
+        b_run[i] = 1;
+    }
+
+    if (b_usage || config.iterations <= 0 || config.init_iterations <= 0
+        || config.audio_seconds <= 0 || 0 == s_context.feed_size)
+    {
+        printf("\nUsage:\n");
+        printf("%s [--iterations n] [--init-iterations n] [--audio-seconds s]\n", argv[0]);
+        printf("    [--feed-size bytes] [--render-xml file] [stage...]\n");
+        printf("\nStages:");
+        for (i = 0; i < BENCH_STAGE_COUNT; i++)
+        {
+            printf(" %s", s_stage_names[i]);
+        }
+        printf("\n");
+        return -1;
+    }
+
+    if (0 != _write_synthetic_wav(&config))
+    {
+        printf("{\"error\": \"Failed to write synthetic audio: %s\"}\n", strerror(errno));
+        return -1;
+    }
+
+    printf("{\"bench_config\": {\"iterations\": %ld, \"init_iterations\": %ld, \"audio_seconds\": %ld, "
+        "\"feed_size\": %lu, \"sample_rate\": %u, \"bits_per_sample\": %u, \"channels\": %u}}\n",
+        config.iterations,
+        config.init_iterations,
+        config.audio_seconds,
+        (unsigned long)s_context.feed_size,
+        config.format.sample_rate,
+        config.format.bits_per_sample,
+        config.format.channels
+        );
+
+    if (b_run[STAGE_WAV_OPEN])
+    {
+        _bench_wav_open(&config, &stages[STAGE_WAV_OPEN]);
+        _stage_report(&stages[STAGE_WAV_OPEN]);
+    }
+    if (b_run[STAGE_CONVERT])
+    {
+        _bench_convert(&config, &stages[STAGE_CONVERT]);
+        _stage_report(&stages[STAGE_CONVERT]);
+    }
+    if (b_run[STAGE_CONDITION])
+    {
+        _bench_condition(&config, &stages[STAGE_CONDITION]);
+        _stage_report(&stages[STAGE_CONDITION]);
+    }
+
+    /* init_shutdown brings the SDK up itself, so it runs on its own */
+    for (i = STAGE_FEED_MAPPED; i < STAGE_INIT_SHUTDOWN; i++)
+    {
+        b_need_sdk |= b_run[i];
+    }
+    if (b_need_sdk)
+    {
+        rc = query_start_sdk(&s_context, &user_handle);
+        if (0 == rc)
+        {
+            if (b_run[STAGE_FEED_MAPPED])
+            {
+                _bench_feed(user_handle, &config, &stages[STAGE_FEED_MAPPED], GNSDK_TRUE, GNSDK_FALSE);
+                _stage_report(&stages[STAGE_FEED_MAPPED]);
+            }
+            if (b_run[STAGE_FEED_STREAM])
+            {
+                _bench_feed(user_handle, &config, &stages[STAGE_FEED_STREAM], GNSDK_FALSE, GNSDK_FALSE);
+                _stage_report(&stages[STAGE_FEED_STREAM]);
+            }
+            if (b_run[STAGE_AUDIO_WRITE])
+            {
+                _bench_feed(user_handle, &config, &stages[STAGE_AUDIO_WRITE], GNSDK_TRUE, GNSDK_TRUE);
+                _stage_report(&stages[STAGE_AUDIO_WRITE]);
+            }
+            if (b_run[STAGE_RENDER])
+            {
+                _bench_render(&config, &stages[STAGE_RENDER]);
+                _stage_report(&stages[STAGE_RENDER]);
+            }
+            query_stop_sdk(&s_context, user_handle);
+        }
+    }
+
+    if (0 == rc && b_run[STAGE_INIT_SHUTDOWN])
+    {
+        _bench_init_shutdown(&config, &stages[STAGE_INIT_SHUTDOWN]);
+        _stage_report(&stages[STAGE_INIT_SHUTDOWN]);
+    }
+
+    unlink(config.wav_path);
+    for (i = 0; i < BENCH_STAGE_COUNT; i++)
+    {
+        free(stages[i].samples);
+    }
+
+    return rc;
+
+}  /* main() */
@@ -0,0 +1,726 @@
+
+/*
+ *  Name: cache.c
+ *  Description:
+ *  On-disk cache of identification results.
+ *
+ *  Each entry is a file holding the fields of one record, named after the hash of
+ *  the audio it answers: <dir>/match/<ab>/<key> for matches and
+ *  <dir>/nomatch/<ab>/<key> for "no match" answers, which expire on their
+ *  own (usually shorter) schedule. An entry's age is its mtime. Entries
+ *  are written to a temporary name and renamed into place, so several
+ *  processes can share a cache directory.
+ */
+
+#include "cache.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* samples quieter than this (scaled to 16 bit, about -66dBFS) are silence */
+#define SILENCE_THRESHOLD 16
+
+/* leading silence skipped before the key starts, at most */
+#define KEY_MAX_SILENCE_SECONDS 60
+
+/* trim to this share of max_bytes so every store doesn't trigger a trim */
+#define TRIM_TARGET(max_bytes) ((max_bytes) / 10 * 9)
+
+static const char* const s_kinds[2] = { "match", "nomatch" };
+
+struct cache_s
+{
+    char*           dir;
+    long            ttl[2];        /* indexed like s_kinds */
+    uint64_t        max_bytes;
+    uint64_t        size;          /* bytes on disk, valid once b_sized */
+    int             b_sized;
+    cache_stats_t   stats;
+    pthread_mutex_t lock;          /* guards size and stats */
+};
+
+/* an entry found while scanning the cache */
+typedef struct
+{
+    char*    path;
+    time_t   mtime;
+    uint64_t size;
+
+} cache_entry_t;
+
+/**********************************************
+ *    Hashing
+ **********************************************/
+
+#define HASH_P1 0x9E3779B185EBCA87ULL
+#define HASH_P2 0xC2B2AE3D27D4EB4FULL
+
+static uint64_t
+_rotl(
+    uint64_t x,
+    int      r
+    )
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* MurmurHash3 finalizer */
+static uint64_t
+_fmix(
+    uint64_t k
+    )
+{
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDULL;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/******************************************************************
+ *
+ *    _SAMPLE_LEVEL
+ *
+ *    Magnitude of one little-endian sample, scaled to 16 bit.
+ *
+ *****************************************************************/
+static int32_t
+_sample_level(
+    const unsigned char* p,
+    uint32_t             bits
+    )
+{
+    int32_t value = 0;
+
+    if (bits == 8)
+    {
+        /* 8 bit WAV is unsigned */
+        value = ((int32_t)p[0] - 128) * 256;
+    }
+    else
+    {
+        /* the top two bytes are the 16 bit value */
+        value = (int16_t)(p[bits / 8 - 2] | (p[bits / 8 - 1] << 8));
+    }
+
+    return value < 0 ? -value : value;
+
+} /* _sample_level() */
+
+/******************************************************************
+ *
+ *    _SKIP_SILENCE
+ *
+ *    Offset of the first frame with any channel above the threshold.
+ *
+ *****************************************************************/
+static size_t
+_skip_silence(
+    const audio_format_t* p_format,
+    const unsigned char*  pcm,
+    size_t                size
+    )
+{
+    size_t   frame_size  = AUDIO_FRAME_SIZE(p_format);
+    size_t   sample_size = p_format->bits_per_sample / 8;
+    size_t   offset      = 0;
+    size_t   i           = 0;
+
+    for (offset = 0; offset + frame_size <= size; offset += frame_size)
+    {
+        for (i = 0; i < frame_size; i += sample_size)
+        {
+            if (_sample_level(pcm + offset + i, p_format->bits_per_sample) > SILENCE_THRESHOLD)
+            {
+                return offset;
+            }
+        }
+    }
+
+    return offset;
+
+} /* _skip_silence() */
+
+/******************************************************************
+ *
+ *    CACHE_KEY
+ *
+ *****************************************************************/
+void
+cache_key(
+    const audio_format_t* p_format,
+    const void*           pcm,
+    size_t                size,
+    uint32_t              variant,
+    char                  key[CACHE_KEY_SIZE]
+    )
+{
+    const unsigned char* p      = pcm;
+    uint64_t             h1     = 0;
+    uint64_t             h2     = 0;
+    uint64_t             word   = 0;
+    size_t               skip   = 0;
+    size_t               window = 0;
+    size_t               total  = 0;
+    size_t               length = 0;
+
+    /* neither the silence nor the audio after it is read past a bounded
+     * window, so a long archive costs no more to key than a clip */
+    window = (size_t)KEY_MAX_SILENCE_SECONDS * p_format->sample_rate * AUDIO_FRAME_SIZE(p_format);
+    skip   = _skip_silence(p_format, p, (size < window) ? size : window);
+    p     += skip;
+    total  = size - skip;
+    window = (size_t)CACHE_KEY_SECONDS * p_format->sample_rate * AUDIO_FRAME_SIZE(p_format);
+    length = (total < window) ? total : window;
+
+    /* the same bytes in a different format are different audio */
+    h1 = HASH_P1 ^ p_format->sample_rate;
+    h2 = HASH_P2 ^ ((uint64_t)p_format->bits_per_sample << 32 | p_format->channels);
+
+    /* variant 0 leaves the key as it has always been */
+    h1 ^= (uint64_t)variant << 32;
+
+    for (size = length; size >= 8; size -= 8, p += 8)
+    {
+        memcpy(&word, p, 8);
+        h1 = _rotl(h1 ^ (word * HASH_P1), 31) * HASH_P2;
+        h2 = _rotl(h2 ^ (word * HASH_P2), 27) * HASH_P1 + h1;
+    }
+    if (size > 0)
+    {
+        word = 0;
+        memcpy(&word, p, size);
+        h1 = _rotl(h1 ^ (word * HASH_P1), 31) * HASH_P2;
+        h2 = _rotl(h2 ^ (word * HASH_P2), 27) * HASH_P1 + h1;
+    }
+
+    /* audio that only starts the same is told apart by its length; for
+     * audio no longer than the window this is the key it always had */
+    h1 ^= length;
+    h2 ^= total;
+    h1  = _fmix(h1 + h2);
+    h2  = _fmix(h2 + h1);
+
+    snprintf(key, CACHE_KEY_SIZE, "%016llx%016llx", (unsigned long long)h1, (unsigned long long)h2);
+
+} /* cache_key() */
+
+/**********************************************
+ *    Storage
+ **********************************************/
+
+/******************************************************************
+ *
+ *    _ENTRY_PATH
+ *
+ *    <dir>/<kind>/<first two key digits>[/<key>]
+ *
+ *****************************************************************/
+static char*
+_entry_path(
+    cache_t*    cache,
+    int         kind,
+    const char* key,
+    int         b_dir_only
+    )
+{
+    size_t len  = strlen(cache->dir) + strlen(s_kinds[kind]) + CACHE_KEY_SIZE + 8;
+    char*  path = malloc(len);
+
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    if (b_dir_only)
+    {
+        snprintf(path, len, "%s/%s/%.2s", cache->dir, s_kinds[kind], key);
+    }
+    else
+    {
+        snprintf(path, len, "%s/%s/%.2s/%s", cache->dir, s_kinds[kind], key, key);
+    }
+
+    return path;
+
+} /* _entry_path() */
+
+/******************************************************************
+ *
+ *    _MKDIR
+ *
+ *****************************************************************/
+static int
+_mkdir(
+    const char* path
+    )
+{
+    if (0 == mkdir(path, 0755) || errno == EEXIST)
+    {
+        return 0;
+    }
+    return -1;
+
+} /* _mkdir() */
+
+/******************************************************************
+ *
+ *    _SCAN
+ *
+ *    Total up the bytes held by the cache, removing expired entries
+ *    as they are found. With p_entries, also return every remaining
+ *    entry so the caller can evict the oldest. Called with the lock
+ *    held.
+ *
+ *****************************************************************/
+static uint64_t
+_scan(
+    cache_t*        cache,
+    cache_entry_t** p_entries,
+    size_t*         p_count
+    )
+{
+    cache_entry_t* entries  = NULL;
+    cache_entry_t* grown    = NULL;
+    size_t         count    = 0;
+    size_t         capacity = 0;
+    uint64_t       total    = 0;
+    time_t         now      = time(NULL);
+    DIR*           kind_dir = NULL;
+    DIR*           fan_dir  = NULL;
+    struct dirent* fan      = NULL;
+    struct dirent* entry    = NULL;
+    struct stat    st;
+    char           path[4096];
+    int            kind     = 0;
+    int            len      = 0;
+
+    for (kind = 0; kind < 2; kind++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, s_kinds[kind]);
+        kind_dir = opendir(path);
+        if (kind_dir == NULL)
+        {
+            continue;
+        }
+
+        while ((fan = readdir(kind_dir)) != NULL)
+        {
+            if (fan->d_name[0] == '.')
+            {
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s/%s", cache->dir, s_kinds[kind], fan->d_name);
+            fan_dir = opendir(path);
+            if (fan_dir == NULL)
+            {
+                continue;
+            }
+
+            while ((entry = readdir(fan_dir)) != NULL)
+            {
+                if (entry->d_name[0] == '.')
+                {
+                    continue;
+                }
+                len = snprintf(path, sizeof(path), "%s/%s/%s/%s", cache->dir, s_kinds[kind], fan->d_name, entry->d_name);
+                if (len <= 0 || (size_t)len >= sizeof(path) || 0 != stat(path, &st))
+                {
+                    continue;
+                }
+
+                /* a kind this process keeps none of may still be wanted
+                 * by others sharing the directory: leave it to their ttl */
+                if (cache->ttl[kind] > 0 && now - st.st_mtime > cache->ttl[kind])
+                {
+                    if (0 == unlink(path))
+                    {
+                        cache->stats.evictions++;
+                    }
+                    continue;
+                }
+
+                total += (uint64_t)st.st_size;
+
+                if (p_entries && count == capacity)
+                {
+                    /* out of memory: the oldest of those listed so far
+                     * are evicted instead */
+                    grown = realloc(entries, (capacity ? 2 * capacity : 1024) * sizeof(cache_entry_t));
+                    if (grown != NULL)
+                    {
+                        entries  = grown;
+                        capacity = capacity ? 2 * capacity : 1024;
+                    }
+                }
+                if (p_entries && count < capacity)
+                {
+                    entries[count].path  = strdup(path);
+                    entries[count].mtime = st.st_mtime;
+                    entries[count].size  = (uint64_t)st.st_size;
+                    if (entries[count].path)
+                    {
+                        count++;
+                    }
+                }
+            }
+            closedir(fan_dir);
+        }
+        closedir(kind_dir);
+    }
+
+    if (p_entries)
+    {
+        *p_entries = entries;
+        *p_count   = count;
+    }
+
+    return total;
+
+} /* _scan() */
+
+static int
+_compare_age(
+    const void* a,
+    const void* b
+    )
+{
+    time_t ta = ((const cache_entry_t*)a)->mtime;
+    time_t tb = ((const cache_entry_t*)b)->mtime;
+
+    return (ta > tb) - (ta < tb);
+}
+
+/******************************************************************
+ *
+ *    _TRIM
+ *
+ *    Evict the oldest entries until the cache is comfortably under
+ *    max_bytes. Called with the lock held.
+ *
+ *****************************************************************/
+static void
+_trim(
+    cache_t* cache
+    )
+{
+    cache_entry_t* entries = NULL;
+    size_t         count   = 0;
+    size_t         i       = 0;
+
+    cache->size = _scan(cache, &entries, &count);
+
+    qsort(entries, count, sizeof(cache_entry_t), _compare_age);
+
+    for (i = 0; i < count; i++)
+    {
+        if (cache->size > TRIM_TARGET(cache->max_bytes) && 0 == unlink(entries[i].path))
+        {
+            cache->size -= entries[i].size;
+            cache->stats.evictions++;
+        }
+        free(entries[i].path);
+    }
+    free(entries);
+
+} /* _trim() */
+
+/******************************************************************
+ *
+ *    _SHRINK
+ *
+ *    Take bytes removed from the cache off its size, once it has been
+ *    measured. Called with the lock held.
+ *
+ *****************************************************************/
+static void
+_shrink(
+    cache_t* cache,
+    uint64_t bytes
+    )
+{
+    if (cache->b_sized)
+    {
+        cache->size = (bytes < cache->size) ? cache->size - bytes : 0;
+    }
+
+} /* _shrink() */
+
+/******************************************************************
+ *
+ *    CACHE_OPEN
+ *
+ *****************************************************************/
+cache_t*
+cache_open(
+    const char* dir,
+    long        ttl,
+    long        negative_ttl,
+    uint64_t    max_bytes
+    )
+{
+    cache_t* cache = NULL;
+
+    if (0 != _mkdir(dir))
+    {
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(cache_t));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    cache->dir = strdup(dir);
+    if (cache->dir == NULL)
+    {
+        free(cache);
+        return NULL;
+    }
+    cache->ttl[0]    = ttl;
+    cache->ttl[1]    = negative_ttl;
+    cache->max_bytes = max_bytes;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+
+} /* cache_open() */
+
+/******************************************************************
+ *
+ *    CACHE_CLOSE
+ *
+ *****************************************************************/
+void
+cache_close(
+    cache_t* cache
+    )
+{
+    if (cache)
+    {
+        pthread_mutex_destroy(&cache->lock);
+        free(cache->dir);
+        free(cache);
+    }
+
+} /* cache_close() */
+
+/******************************************************************
+ *
+ *    CACHE_LOOKUP
+ *
+ *****************************************************************/
+int
+cache_lookup(
+    cache_t*    cache,
+    const char* key,
+    void**      p_record,
+    size_t*     p_size
+    )
+{
+    char*       path     = NULL;
+    char*       record   = NULL;
+    struct stat st;
+    ssize_t     got      = 0;
+    int         fd       = -1;
+    int         kind     = 0;
+    int         hit_kind = -1;
+    int         aged     = 0;
+    uint64_t    freed    = 0;
+
+    for (kind = 0; kind < 2 && hit_kind < 0; kind++)
+    {
+        /* a ttl of 0 means this process keeps none of that kind, not
+         * that other processes' entries of it have expired */
+        if (cache->ttl[kind] <= 0)
+        {
+            continue;
+        }
+
+        path = _entry_path(cache, kind, key, 0);
+        fd   = path ? open(path, O_RDONLY) : -1;
+        free(path);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        if (0 != fstat(fd, &st) || st.st_size <= 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        if (time(NULL) - st.st_mtime > cache->ttl[kind])
+        {
+            /* expired: drop it so the next store starts afresh */
+            path = _entry_path(cache, kind, key, 0);
+            if (path && 0 == unlink(path))
+            {
+                aged++;
+                freed += (uint64_t)st.st_size;
+            }
+            free(path);
+        }
+        else if ((record = malloc((size_t)st.st_size)) != NULL)
+        {
+            got = read(fd, record, (size_t)st.st_size);
+            if (got == (ssize_t)st.st_size)
+            {
+                hit_kind = kind;
+            }
+            else
+            {
+                free(record);
+                record = NULL;
+            }
+        }
+        close(fd);
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache->stats.evictions += (unsigned long)aged;
+    _shrink(cache, freed);
+    if (hit_kind < 0)
+    {
+        cache->stats.misses++;
+    }
+    else if (hit_kind == 0)
+    {
+        cache->stats.hits++;
+    }
+    else
+    {
+        cache->stats.negative_hits++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    *p_record = record;
+    *p_size   = (hit_kind < 0) ? 0 : (size_t)got;
+
+    return (hit_kind < 0) ? -1 : 0;
+
+} /* cache_lookup() */
+
+/******************************************************************
+ *
+ *    CACHE_STORE
+ *
+ *****************************************************************/
+void
+cache_store(
+    cache_t*    cache,
+    const char* key,
+    const void* record,
+    size_t      len,
+    int         b_negative
+    )
+{
+    int         kind     = b_negative ? 1 : 0;
+    char*       path     = NULL;
+    char*       dir      = NULL;
+    char*       tmp_path = NULL;
+    size_t      tmp_len  = 0;
+    int         fd       = -1;
+    int         b_stored = 0;
+    uint64_t    replaced = 0;
+    struct stat st;
+    char        kind_dir[4096];
+
+    /* a ttl of 0 turns caching of that kind of answer off */
+    if (cache->ttl[kind] <= 0)
+    {
+        return;
+    }
+
+    path = _entry_path(cache, kind, key, 0);
+    dir  = _entry_path(cache, kind, key, 1);
+    if (path == NULL || dir == NULL)
+    {
+        free(path);
+        free(dir);
+        return;
+    }
+
+    snprintf(kind_dir, sizeof(kind_dir), "%s/%s", cache->dir, s_kinds[kind]);
+    tmp_len  = strlen(path) + 32;
+    tmp_path = malloc(tmp_len);
+
+    if (tmp_path && 0 == _mkdir(kind_dir) && 0 == _mkdir(dir))
+    {
+        /* unique per process and thread, renamed into place when complete */
+        snprintf(tmp_path, tmp_len, "%s.%ld.%p", path, (long)getpid(), (void*)&fd);
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            b_stored = (write(fd, record, len) == (ssize_t)len);
+            close(fd);
+            /* an entry already under this key is replaced, not added to */
+            if (b_stored && 0 == stat(path, &st))
+            {
+                replaced = (uint64_t)st.st_size;
+            }
+            b_stored = b_stored && (0 == rename(tmp_path, path));
+            if (!b_stored)
+            {
+                unlink(tmp_path);
+            }
+        }
+    }
+
+    free(tmp_path);
+    free(path);
+    free(dir);
+
+    if (!b_stored)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache->stats.stores++;
+    if (!cache->b_sized)
+    {
+        /* measured on the first store rather than at open, so
+         * processes that only read from the cache never pay for it */
+        cache->size    = _scan(cache, NULL, NULL);
+        cache->b_sized = 1;
+    }
+    else
+    {
+        _shrink(cache, replaced);
+        cache->size += len;
+    }
+    if (cache->size > cache->max_bytes)
+    {
+        _trim(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+} /* cache_store() */
+
+/******************************************************************
+ *
+ *    CACHE_GET_STATS
+ *
+ *****************************************************************/
+void
+cache_get_stats(
+    cache_t*       cache,
+    cache_stats_t* p_stats
+    )
+{
+    pthread_mutex_lock(&cache->lock);
+    *p_stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+
+} /* cache_get_stats() */
@@ -0,0 +1,104 @@
+
+/*
+ *  Name: cache.h
+ *  Description:
+ *  On-disk cache of identification results, keyed by a hash of the PCM
+ *  that was identified. Entries are opaque bytes: sample stores the
+ *  encoded fields of a record (see record.h).
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio.h"
+
+/* hex digest plus terminator */
+#define CACHE_KEY_SIZE 33
+
+/* audio after leading silence that goes into a key, at most */
+#define CACHE_KEY_SECONDS 30
+
+typedef struct cache_s cache_t;
+
+typedef struct
+{
+    unsigned long hits;           /* lookups answered with a match */
+    unsigned long negative_hits;  /* lookups answered with "no match" */
+    unsigned long misses;
+    unsigned long stores;
+    unsigned long evictions;      /* entries removed for age or size */
+
+} cache_stats_t;
+
+/*
+ * Open (creating if needed) the cache in dir. Matches are kept for
+ * ttl seconds and "no match" answers for negative_ttl seconds (0 keeps
+ * none of that kind: they are neither looked up nor stored, and entries
+ * of it left by other processes are not expired); the oldest entries are
+ * evicted once the cache holds more than max_bytes.
+ * Returns NULL if the directory can't be created.
+ */
+cache_t*
+cache_open(
+    const char* dir,
+    long        ttl,
+    long        negative_ttl,
+    uint64_t    max_bytes
+    );
+
+void
+cache_close(
+    cache_t* cache
+    );
+
+/*
+ * Compute the key for a block of interleaved PCM. Leading silence is
+ * skipped, so the same audio captured with a different amount of lead-in
+ * (or wrapped in a different header) gets the same key. Only the first
+ * CACHE_KEY_SECONDS after it are hashed, with the length of the rest, so
+ * keying a long recording doesn't read it all. Answers that
+ * differ for the same audio (more detail asked for, say) are kept apart
+ * by a non-zero variant.
+ */
+void
+cache_key(
+    const audio_format_t* p_format,
+    const void*           pcm,
+    size_t                size,
+    uint32_t              variant,
+    char                  key[CACHE_KEY_SIZE]
+    );
+
+/*
+ * Look up key. On a hit returns 0, a malloc'd copy of the stored
+ * record in *p_record, which the caller frees, and its size in *p_size.
+ * Returns -1 on a miss.
+ */
+int
+cache_lookup(
+    cache_t*    cache,
+    const char* key,
+    void**      p_record,
+    size_t*     p_size
+    );
+
+/* Store size bytes of record under key; b_negative marks a "no match" answer */
+void
+cache_store(
+    cache_t*    cache,
+    const char* key,
+    const void* record,
+    size_t      size,
+    int         b_negative
+    );
+
+void
+cache_get_stats(
+    cache_t*       cache,
+    cache_stats_t* p_stats
+    );
+
+#endif /* CACHE_H */
@@ -0,0 +1,358 @@
+
+/*
+ *  Name: capture.c
+ *  Description:
+ *  Ring buffer of live PCM. One thread reads the input and writes it into
+ *  the ring continuously; identifications read from it at their own pace
+ *  from a position of their choosing, so audio that played before a
+ *  request arrived can be fed to the fingerprinter straight away.
+ */
+
+#include "capture.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct capture_s
+{
+    int             fd;
+    size_t          frame_size;
+    size_t          read_size;
+    unsigned char*  ring;
+    size_t          capacity;      /* bytes, a whole number of frames */
+    uint64_t        written;       /* bytes ever written; the ring holds the last capacity of them */
+    int             b_eof;
+    int             b_stop;        /* set by capture_close() */
+    unsigned long   overruns;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  more;          /* broadcast when audio arrives or the input ends */
+};
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+/******************************************************************
+ *
+ *    _RING_WRITE
+ *
+ *    Append size bytes, wrapping round and overwriting the oldest.
+ *    Called with the lock held.
+ *
+ *****************************************************************/
+static void
+_ring_write(
+    capture_t*           capture,
+    const unsigned char* data,
+    size_t               size
+    )
+{
+    size_t offset = 0;
+    size_t part   = 0;
+
+    /* only the tail of an oversized write can survive */
+    if (size > capture->capacity)
+    {
+        capture->written += size - capture->capacity;
+        data             += size - capture->capacity;
+        size              = capture->capacity;
+    }
+
+    while (size > 0)
+    {
+        offset = (size_t)(capture->written % capture->capacity);
+        part   = capture->capacity - offset;
+        if (part > size)
+        {
+            part = size;
+        }
+        memcpy(capture->ring + offset, data, part);
+
+        capture->written += part;
+        data             += part;
+        size             -= part;
+    }
+
+} /* _ring_write() */
+
+/******************************************************************
+ *
+ *    _CAPTURE_READER
+ *
+ *    Thread reading the input into the ring. Only whole frames go in;
+ *    a partial frame from a short read waits for the rest.
+ *
+ *****************************************************************/
+static void*
+_capture_reader(
+    void* arg
+    )
+{
+    capture_t*     capture  = (capture_t*)arg;
+    unsigned char* buf      = NULL;
+    size_t         buffered = 0;
+    size_t         whole    = 0;
+    ssize_t        got      = 0;
+
+    buf = malloc(capture->read_size);
+
+    while (buf)
+    {
+        got = read(capture->fd, buf + buffered, capture->read_size - buffered);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+
+        buffered += (size_t)got;
+        whole     = buffered - (buffered % capture->frame_size);
+        if (0 == whole)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&capture->lock);
+        if (capture->b_stop)
+        {
+            pthread_mutex_unlock(&capture->lock);
+            break;
+        }
+        _ring_write(capture, buf, whole);
+        pthread_cond_broadcast(&capture->more);
+        pthread_mutex_unlock(&capture->lock);
+
+        buffered -= whole;
+        memmove(buf, buf + whole, buffered);
+    }
+
+    free(buf);
+
+    pthread_mutex_lock(&capture->lock);
+    capture->b_eof = 1;
+    pthread_cond_broadcast(&capture->more);
+    pthread_mutex_unlock(&capture->lock);
+
+    return NULL;
+
+} /* _capture_reader() */
+
+/******************************************************************
+ *
+ *    CAPTURE_OPEN
+ *
+ *****************************************************************/
+capture_t*
+capture_open(
+    int                   fd,
+    const audio_format_t* p_format,
+    uint32_t              seconds,
+    size_t                read_size
+    )
+{
+    capture_t* capture    = NULL;
+    size_t     frame_size = AUDIO_FRAME_SIZE(p_format);
+
+    if (0 == frame_size || 0 == seconds)
+    {
+        return NULL;
+    }
+
+    capture = calloc(1, sizeof(*capture));
+    if (capture == NULL)
+    {
+        return NULL;
+    }
+
+    capture->fd         = fd;
+    capture->frame_size = frame_size;
+    capture->read_size  = (read_size > frame_size) ? read_size - (read_size % frame_size) : frame_size;
+    capture->capacity   = (size_t)p_format->sample_rate * seconds * frame_size;
+    capture->ring       = malloc(capture->capacity);
+    if (capture->ring == NULL)
+    {
+        free(capture);
+        return NULL;
+    }
+
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->more, NULL);
+
+    if (0 != pthread_create(&capture->thread, NULL, _capture_reader, capture))
+    {
+        pthread_cond_destroy(&capture->more);
+        pthread_mutex_destroy(&capture->lock);
+        free(capture->ring);
+        free(capture);
+        return NULL;
+    }
+
+    return capture;
+
+} /* capture_open() */
+
+/******************************************************************
+ *
+ *    CAPTURE_CLOSE
+ *
+ *****************************************************************/
+void
+capture_close(
+    capture_t* capture
+    )
+{
+    if (capture == NULL)
+    {
+        return;
+    }
+
+    /* the reader may be blocked in read(); a signal or the end of the
+     * input gets it out, otherwise leave it to exit with the process */
+    pthread_mutex_lock(&capture->lock);
+    capture->b_stop = 1;
+    if (capture->b_eof)
+    {
+        pthread_mutex_unlock(&capture->lock);
+        pthread_join(capture->thread, NULL);
+    }
+    else
+    {
+        pthread_mutex_unlock(&capture->lock);
+        pthread_detach(capture->thread);
+        return;
+    }
+
+    pthread_cond_destroy(&capture->more);
+    pthread_mutex_destroy(&capture->lock);
+    free(capture->ring);
+    free(capture);
+
+} /* capture_close() */
+
+/******************************************************************
+ *
+ *    CAPTURE_OLDEST
+ *
+ *****************************************************************/
+uint64_t
+capture_oldest(
+    capture_t* capture
+    )
+{
+    uint64_t oldest = 0;
+
+    pthread_mutex_lock(&capture->lock);
+    if (capture->written > capture->capacity)
+    {
+        oldest = capture->written - capture->capacity;
+    }
+    pthread_mutex_unlock(&capture->lock);
+
+    return oldest;
+
+} /* capture_oldest() */
+
+/******************************************************************
+ *
+ *    CAPTURE_READ
+ *
+ *****************************************************************/
+long
+capture_read(
+    capture_t* capture,
+    uint64_t*  p_position,
+    void*      buf,
+    size_t     size,
+    long       timeout_ms
+    )
+{
+    struct timespec deadline = {0};
+    unsigned char*  out      = buf;
+    uint64_t        oldest   = 0;
+    size_t          copied   = 0;
+    size_t          offset   = 0;
+    size_t          part     = 0;
+
+    size -= size % capture->frame_size;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&capture->lock);
+
+    while (*p_position >= capture->written && !capture->b_eof)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&capture->more, &capture->lock, &deadline))
+        {
+            break;
+        }
+    }
+
+    if (*p_position >= capture->written)
+    {
+        pthread_mutex_unlock(&capture->lock);
+        return capture->b_eof ? -1 : 0;
+    }
+
+    oldest = (capture->written > capture->capacity) ? capture->written - capture->capacity : 0;
+    if (*p_position < oldest)
+    {
+        *p_position = oldest;
+        capture->overruns++;
+    }
+
+    while (copied < size && *p_position < capture->written)
+    {
+        offset = (size_t)(*p_position % capture->capacity);
+        part   = capture->capacity - offset;
+        if (part > size - copied)
+        {
+            part = size - copied;
+        }
+        if (part > capture->written - *p_position)
+        {
+            part = (size_t)(capture->written - *p_position);
+        }
+        memcpy(out + copied, capture->ring + offset, part);
+
+        copied      += part;
+        *p_position += part;
+    }
+
+    pthread_mutex_unlock(&capture->lock);
+
+    return (long)copied;
+
+} /* capture_read() */
+
+/******************************************************************
+ *
+ *    CAPTURE_GET_STATS
+ *
+ *****************************************************************/
+void
+capture_get_stats(
+    capture_t*       capture,
+    capture_stats_t* p_stats
+    )
+{
+    pthread_mutex_lock(&capture->lock);
+    p_stats->bytes_captured = capture->written;
+    p_stats->overruns       = capture->overruns;
+    pthread_mutex_unlock(&capture->lock);
+
+} /* capture_get_stats() */
@@ -0,0 +1,78 @@
+/*
+ *  Name: capture.h
+ *  Description:
+ *  Continuous capture of live PCM into a ring buffer holding the last
+ *  few seconds, so an identification can start from audio that has
+ *  already played and carry on with the audio that follows.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio.h"
+
+typedef struct capture_s capture_t;
+
+typedef struct
+{
+    uint64_t      bytes_captured;  /* total read from the input */
+    unsigned long overruns;        /* readers that fell a whole buffer behind */
+
+} capture_stats_t;
+
+/*
+ * Start a thread reading interleaved PCM in p_format from fd, keeping the
+ * most recent seconds of it. read_size is how much is read at a time.
+ * Returns NULL if the buffer or thread can't be created.
+ */
+capture_t*
+capture_open(
+    int                   fd,
+    const audio_format_t* p_format,
+    uint32_t              seconds,
+    size_t                read_size
+    );
+
+/* Stop the reader thread and free the buffer. fd is not closed. */
+void
+capture_close(
+    capture_t* capture
+    );
+
+/*
+ * Position of the oldest audio still buffered, to start reading from.
+ * Positions count bytes since the capture started and are always on a
+ * frame boundary.
+ */
+uint64_t
+capture_oldest(
+    capture_t* capture
+    );
+
+/*
+ * Copy up to size bytes (whole frames) from *p_position on into buf and
+ * advance *p_position. If no audio is waiting, waits up to timeout_ms for
+ * some. If *p_position has already been overwritten the reader skips
+ * forward to the oldest audio left and an overrun is counted.
+ * Returns the bytes copied, 0 on timeout or -1 once the input has ended
+ * and everything has been read.
+ */
+long
+capture_read(
+    capture_t* capture,
+    uint64_t*  p_position,
+    void*      buf,
+    size_t     size,
+    long       timeout_ms
+    );
+
+void
+capture_get_stats(
+    capture_t*       capture,
+    capture_stats_t* p_stats
+    );
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,530 @@
+/*
+ *  Name: condition.c
+ *  Description:
+ *  Silence trimming and automatic gain for the audio being fingerprinted.
+ *
+ *  Audio is cut into blocks of CONDITION_BLOCK_MS. The energy and peak of
+ *  each block are measured (with SSE2 where available) and blocks at or
+ *  below the silence threshold are dropped until the first sound. After
+ *  that, silent blocks are held back and only written once more sound
+ *  follows, so trailing silence never reaches the fingerprinter. Sound is
+ *  scaled by a gain that follows a slow running level towards
+ *  CONDITION_TARGET_DB, bounded by the maximum gain and by the block's
+ *  peak, and ramped across each block so it doesn't click.
+ */
+
+#include "condition.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define CONDITION_BLOCK_MS 50
+
+/* level quiet sound is brought up towards, dBFS RMS */
+#define CONDITION_TARGET_DB -20.0
+
+/* time constant of the running level the gain follows */
+#define CONDITION_LEVEL_SECONDS 3.0
+
+/* silence in the middle of the audio held back for longer than this is
+ * written after all rather than buffered indefinitely */
+#define CONDITION_MAX_HOLD_SECONDS 10
+
+struct condition_s
+{
+    uint32_t sample_rate;
+    uint32_t channels;
+    size_t   block_samples;
+    int16_t* block;           /* a partial block waiting for the rest */
+    size_t   block_fill;
+    int16_t* out;             /* held silence followed by audio ready to write */
+    size_t   out_fill;        /* samples in out */
+    size_t   out_capacity;
+    size_t   held;            /* samples of silence at the end of out not yet to be written */
+    size_t   max_held;
+    size_t   ready;           /* samples handed back by the last call */
+    double   silence_ms;      /* mean square at or below which a block is silence */
+    double   target_ms;
+    double   max_gain;
+    double   alpha;           /* weight of one block in the running level */
+    double   level_ms;        /* running mean square of the sound */
+    double   gain;            /* gain at the end of the last block */
+    int      b_sound;         /* a block of sound has been seen */
+
+    uint64_t frames_in;
+    uint64_t leading_frames;
+    uint64_t trailing_frames;
+    uint64_t sound_frames;
+    double   sound_energy;
+    double   gain_db_sum;     /* gain in dB times frames, over the sound */
+    double   max_gain_seen;
+};
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+/******************************************************************
+ *
+ *    _MEAN_SQUARE
+ *
+ *    Mean square of a level in dBFS, full scale being 32768.
+ *
+ *****************************************************************/
+static double
+_mean_square(
+    double db
+    )
+{
+    double rms = 32768.0 * pow(10.0, db / 20.0);
+
+    return rms * rms;
+
+} /* _mean_square() */
+
+/******************************************************************
+ *
+ *    _MEASURE
+ *
+ *    Sum of squares and absolute peak of count samples.
+ *
+ *****************************************************************/
+static void
+_measure(
+    const int16_t* in,
+    size_t         count,
+    uint64_t*      p_energy,
+    int32_t*       p_peak
+    )
+{
+    uint64_t energy = 0;
+    int32_t  high   = 0;
+    int32_t  low    = 0;
+    size_t   i      = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero    = _mm_setzero_si128();
+    __m128i       sums    = _mm_setzero_si128();
+    __m128i       maxima  = _mm_set1_epi16(0);
+    __m128i       minima  = _mm_set1_epi16(0);
+    __m128i       v       = zero;
+    __m128i       squares = zero;
+    uint64_t      lanes[2];
+    int16_t       extremes[8];
+    int           j       = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        v = _mm_loadu_si128((const __m128i*)(in + i));
+
+        /* pairs of squares fit 32 bits unsigned; widen before adding up */
+        squares = _mm_madd_epi16(v, v);
+        sums    = _mm_add_epi64(sums, _mm_unpacklo_epi32(squares, zero));
+        sums    = _mm_add_epi64(sums, _mm_unpackhi_epi32(squares, zero));
+
+        maxima = _mm_max_epi16(maxima, v);
+        minima = _mm_min_epi16(minima, v);
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, sums);
+    energy = lanes[0] + lanes[1];
+
+    _mm_storeu_si128((__m128i*)extremes, maxima);
+    for (j = 0; j < 8; j++)
+    {
+        high = (extremes[j] > high) ? extremes[j] : high;
+    }
+    _mm_storeu_si128((__m128i*)extremes, minima);
+    for (j = 0; j < 8; j++)
+    {
+        low = (extremes[j] < low) ? extremes[j] : low;
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        energy += (uint64_t)((int32_t)in[i] * (int32_t)in[i]);
+        high    = (in[i] > high) ? in[i] : high;
+        low     = (in[i] < low) ? in[i] : low;
+    }
+
+    *p_energy = energy;
+    *p_peak   = (-low > high) ? -low : high;
+
+} /* _measure() */
+
+/******************************************************************
+ *
+ *    _APPLY_GAIN
+ *
+ *    out = in scaled by a gain starting at gain and changing by step
+ *    per sample, saturated to 16 bits.
+ *
+ *****************************************************************/
+static void
+_apply_gain(
+    const int16_t* in,
+    int16_t*       out,
+    size_t         count,
+    float          gain,
+    float          step
+    )
+{
+    float  value = 0;
+    size_t i     = 0;
+
+    if (1.0f == gain && 0.0f == step)
+    {
+        memcpy(out, in, count * sizeof(*in));
+        return;
+    }
+
+#if defined(__SSE2__)
+    {
+        const __m128 advance = _mm_set1_ps(8.0f * step);
+        __m128       gain_lo = _mm_setr_ps(gain, gain + step, gain + 2.0f * step, gain + 3.0f * step);
+        __m128       gain_hi = _mm_add_ps(gain_lo, _mm_set1_ps(4.0f * step));
+        __m128i      v       = _mm_setzero_si128();
+        __m128i      lo      = _mm_setzero_si128();
+        __m128i      hi      = _mm_setzero_si128();
+
+        for (; i + 8 <= count; i += 8)
+        {
+            v  = _mm_loadu_si128((const __m128i*)(in + i));
+            lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), gain_lo));
+            hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), gain_hi));
+            _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+
+            gain_lo = _mm_add_ps(gain_lo, advance);
+            gain_hi = _mm_add_ps(gain_hi, advance);
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        value  = (float)in[i] * (gain + step * (float)i);
+        value  = (value > 32767.0f) ? 32767.0f : (value < -32768.0f) ? -32768.0f : value;
+        out[i] = (int16_t)lrintf(value);
+    }
+
+} /* _apply_gain() */
+
+/******************************************************************
+ *
+ *    _APPEND
+ *
+ *    Add count samples to out with the gain ramping from gain to
+ *    end_gain. Returns 0, or -1 if out can't grow.
+ *
+ *****************************************************************/
+static int
+_append(
+    condition_t*   condition,
+    const int16_t* in,
+    size_t         count,
+    double         gain,
+    double         end_gain
+    )
+{
+    int16_t* grown    = NULL;
+    size_t   capacity = condition->out_capacity;
+
+    if (condition->out_fill + count > capacity)
+    {
+        while (condition->out_fill + count > capacity)
+        {
+            capacity = capacity ? capacity * 2 : condition->block_samples * 16;
+        }
+        grown = realloc(condition->out, capacity * sizeof(*grown));
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        condition->out          = grown;
+        condition->out_capacity = capacity;
+    }
+
+    _apply_gain(in, condition->out + condition->out_fill, count, (float)gain, (float)((end_gain - gain) / (double)count));
+    condition->out_fill += count;
+
+    return 0;
+
+} /* _append() */
+
+/******************************************************************
+ *
+ *    _CONDITION_BLOCK
+ *
+ *****************************************************************/
+static void
+_condition_block(
+    condition_t*   condition,
+    const int16_t* in,
+    size_t         count
+    )
+{
+    uint64_t energy = 0;
+    int32_t  peak   = 0;
+    uint64_t frames = count / condition->channels;
+    double   ms     = 0;
+    double   gain   = 0;
+
+    _measure(in, count, &energy, &peak);
+    ms = (double)energy / (double)count;
+
+    if (ms <= condition->silence_ms)
+    {
+        if (!condition->b_sound)
+        {
+            condition->leading_frames += frames;
+            return;
+        }
+
+        if (0 == _append(condition, in, count, condition->gain, condition->gain))
+        {
+            condition->held += count;
+            if (condition->held > condition->max_held)
+            {
+                condition->held = 0;
+            }
+        }
+        return;
+    }
+
+    condition->level_ms = condition->b_sound ? condition->level_ms + condition->alpha * (ms - condition->level_ms) : ms;
+
+    gain = sqrt(condition->target_ms / condition->level_ms);
+    gain = (gain > condition->max_gain) ? condition->max_gain : gain;
+    if (peak > 0 && gain * peak > 32767.0)
+    {
+        gain = 32767.0 / peak;
+    }
+    gain = (gain < 1.0) ? 1.0 : gain;
+
+    /* nothing has been written yet to ramp from */
+    if (!condition->b_sound)
+    {
+        condition->gain    = gain;
+        condition->b_sound = 1;
+    }
+
+    if (0 == _append(condition, in, count, condition->gain, gain))
+    {
+        condition->held = 0;
+    }
+    condition->gain = gain;
+
+    condition->sound_frames  += frames;
+    condition->sound_energy  += (double)energy;
+    condition->gain_db_sum   += 20.0 * log10(gain) * (double)frames;
+    condition->max_gain_seen  = (gain > condition->max_gain_seen) ? gain : condition->max_gain_seen;
+
+} /* _condition_block() */
+
+/******************************************************************
+ *
+ *    _DROP_WRITTEN
+ *
+ *    Forget what the last call handed back, keeping held silence.
+ *
+ *****************************************************************/
+static void
+_drop_written(
+    condition_t* condition
+    )
+{
+    if (condition->ready > 0)
+    {
+        memmove(condition->out, condition->out + condition->ready, condition->held * sizeof(*condition->out));
+        condition->out_fill = condition->held;
+        condition->ready    = 0;
+    }
+
+} /* _drop_written() */
+
+/******************************************************************
+ *
+ *    CONDITION_OPEN
+ *
+ *****************************************************************/
+condition_t*
+condition_open(
+    uint32_t sample_rate,
+    uint32_t channels,
+    double   silence_db,
+    double   max_gain_db
+    )
+{
+    condition_t* condition    = NULL;
+    size_t       block_frames = (size_t)sample_rate * CONDITION_BLOCK_MS / 1000;
+
+    if (0 == channels || 0 == block_frames)
+    {
+        return NULL;
+    }
+
+    condition = calloc(1, sizeof(*condition));
+    if (condition == NULL)
+    {
+        return NULL;
+    }
+
+    condition->sample_rate   = sample_rate;
+    condition->channels      = channels;
+    condition->block_samples = block_frames * channels;
+    condition->max_held      = (size_t)sample_rate * channels * CONDITION_MAX_HOLD_SECONDS;
+    condition->silence_ms    = _mean_square(silence_db);
+    condition->target_ms     = _mean_square(CONDITION_TARGET_DB);
+    condition->max_gain      = pow(10.0, ((max_gain_db > 0) ? max_gain_db : 0) / 20.0);
+    condition->alpha         = (CONDITION_BLOCK_MS / 1000.0) / CONDITION_LEVEL_SECONDS;
+    condition->gain          = 1.0;
+
+    condition->block = malloc(condition->block_samples * sizeof(*condition->block));
+    if (condition->block == NULL)
+    {
+        free(condition);
+        return NULL;
+    }
+
+    return condition;
+
+} /* condition_open() */
+
+/******************************************************************
+ *
+ *    CONDITION_CLOSE
+ *
+ *****************************************************************/
+void
+condition_close(
+    condition_t* condition
+    )
+{
+    if (condition == NULL)
+    {
+        return;
+    }
+
+    free(condition->out);
+    free(condition->block);
+    free(condition);
+
+} /* condition_close() */
+
+/******************************************************************
+ *
+ *    CONDITION_PROCESS
+ *
+ *****************************************************************/
+size_t
+condition_process(
+    condition_t*    condition,
+    const int16_t*  pcm,
+    size_t          size,
+    const int16_t** p_out
+    )
+{
+    size_t samples = size / sizeof(*pcm);
+    size_t part    = 0;
+
+    _drop_written(condition);
+    condition->frames_in += samples / condition->channels;
+
+    while (samples > 0)
+    {
+        part = condition->block_samples - condition->block_fill;
+        part = (part < samples) ? part : samples;
+
+        /* whole blocks are worked on in place */
+        if (0 == condition->block_fill && part == condition->block_samples)
+        {
+            _condition_block(condition, pcm, part);
+        }
+        else
+        {
+            memcpy(condition->block + condition->block_fill, pcm, part * sizeof(*pcm));
+            condition->block_fill += part;
+            if (condition->block_fill == condition->block_samples)
+            {
+                _condition_block(condition, condition->block, condition->block_samples);
+                condition->block_fill = 0;
+            }
+        }
+
+        pcm     += part;
+        samples -= part;
+    }
+
+    condition->ready = condition->out_fill - condition->held;
+    *p_out           = condition->out;
+
+    return condition->ready * sizeof(*pcm);
+
+} /* condition_process() */
+
+/******************************************************************
+ *
+ *    CONDITION_FLUSH
+ *
+ *****************************************************************/
+size_t
+condition_flush(
+    condition_t*    condition,
+    const int16_t** p_out
+    )
+{
+    _drop_written(condition);
+
+    if (condition->block_fill > 0)
+    {
+        _condition_block(condition, condition->block, condition->block_fill);
+        condition->block_fill = 0;
+    }
+
+    condition->trailing_frames += condition->held / condition->channels;
+    condition->out_fill        -= condition->held;
+    condition->held             = 0;
+
+    condition->ready = condition->out_fill;
+    *p_out           = condition->out;
+
+    return condition->ready * sizeof(**p_out);
+
+} /* condition_flush() */
+
+/******************************************************************
+ *
+ *    CONDITION_GET_STATS
+ *
+ *****************************************************************/
+void
+condition_get_stats(
+    condition_t*       condition,
+    condition_stats_t* p_stats
+    )
+{
+    double rate = (double)condition->sample_rate;
+
+    p_stats->seconds_in               = (double)condition->frames_in / rate;
+    p_stats->leading_silence_seconds  = (double)condition->leading_frames / rate;
+    p_stats->trailing_silence_seconds = (double)(condition->trailing_frames + condition->held / condition->channels) / rate;
+    p_stats->level_db                 = -INFINITY;
+    p_stats->mean_gain_db             = 0;
+    p_stats->max_gain_db              = 0;
+
+    if (condition->sound_frames > 0)
+    {
+        p_stats->level_db     = 10.0 * log10(condition->sound_energy / ((double)condition->sound_frames * condition->channels) / (32768.0 * 32768.0));
+        p_stats->mean_gain_db = condition->gain_db_sum / (double)condition->sound_frames;
+        p_stats->max_gain_db  = 20.0 * log10(condition->max_gain_seen);
+    }
+
+} /* condition_get_stats() */
@@ -0,0 +1,78 @@
+/*
+ *  Name: condition.h
+ *  Description:
+ *  Signal conditioning of the 16 bit audio written to MusicID-Stream:
+ *  leading and trailing silence is dropped and quiet material is
+ *  brought up by a bounded automatic gain.
+ */
+
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct condition_s condition_t;
+
+typedef struct
+{
+    double seconds_in;                /* audio given to the conditioner */
+    double leading_silence_seconds;   /* dropped before the first sound */
+    double trailing_silence_seconds;  /* held back after the last sound and never written */
+    double level_db;                  /* RMS of the sound kept, dBFS, before gain (-inf if none) */
+    double mean_gain_db;              /* averaged over the sound kept */
+    double max_gain_db;
+
+} condition_stats_t;
+
+/*
+ * Set up conditioning of interleaved 16 bit audio. Blocks whose RMS is
+ * at or below silence_db (dBFS) count as silence; quiet sound is raised
+ * towards a fixed target level by at most max_gain_db, and never so far
+ * that it clips. Returns NULL if out of memory.
+ */
+condition_t*
+condition_open(
+    uint32_t sample_rate,
+    uint32_t channels,
+    double   silence_db,
+    double   max_gain_db
+    );
+
+void
+condition_close(
+    condition_t* condition
+    );
+
+/*
+ * Condition size bytes of whole frames. The audio ready to be written is
+ * returned in *p_out and its size in bytes is returned; it stays valid
+ * until the next call. Audio is worked on in blocks, and silence after
+ * sound is held back until more sound follows, so the result can be
+ * shorter than the input or empty.
+ */
+size_t
+condition_process(
+    condition_t*    condition,
+    const int16_t*  pcm,
+    size_t          size,
+    const int16_t** p_out
+    );
+
+/*
+ * At the end of the audio: condition any partial block left over and
+ * return what is still to be written. Silence still held is dropped.
+ */
+size_t
+condition_flush(
+    condition_t*    condition,
+    const int16_t** p_out
+    );
+
+void
+condition_get_stats(
+    condition_t*       condition,
+    condition_stats_t* p_stats
+    );
+
+#endif /* CONDITION_H */
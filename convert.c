@@ -0,0 +1,609 @@
+
+/*
+ *  Name: convert.c
+ *  Description:
+ *  Sample format conversion, downmix and resampling.
+ *
+ *  Input frames are first turned into float by a kernel chosen for the
+ *  (sample format, channel count) pair: each kernel is generated by
+ *  CONVERT_KERNELS below with the sample size, the decoding and the
+ *  channel layout fixed at compile time, so the loops are simple enough
+ *  for the compiler to vectorize. The float audio then goes through a
+ *  windowed-sinc polyphase resampler if the rate differs, and is packed
+ *  back to 16 bit (with SSE2 where available).
+ */
+
+#include "convert.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* resampler: taps per output sample and filter phases between input samples */
+#define HALF_TAPS 16
+#define TAPS      (2 * HALF_TAPS)
+#define PHASES    256
+
+/* keep a little below the output Nyquist frequency */
+#define CUTOFF_MARGIN 0.97
+
+typedef void (*convert_kernel_t)(const unsigned char* in, float* out, size_t frames, uint32_t channels);
+
+typedef enum
+{
+    SAMPLE_U8,
+    SAMPLE_S16,
+    SAMPLE_S24,
+    SAMPLE_S32,
+    SAMPLE_F32,
+    SAMPLE_FORMAT_COUNT
+
+} sample_format_t;
+
+/* how input channels are turned into output channels */
+typedef enum
+{
+    LAYOUT_MONO,
+    LAYOUT_STEREO,
+    LAYOUT_5_1,       /* FL FR FC LFE BL BR, mixed down to stereo */
+    LAYOUT_DOWNMIX,   /* anything else: even channels left, odd channels right */
+    LAYOUT_COUNT
+
+} layout_t;
+
+struct convert_s
+{
+    size_t           in_frame_size;
+    uint32_t         in_channels;
+    uint32_t         out_channels;
+    convert_kernel_t kernel;
+
+    /* resampling, only when the rates differ */
+    int              b_resample;
+    double           step;         /* input frames per output frame */
+    double           position;     /* of the next output frame, in work frames */
+    float*           coef;         /* (PHASES + 1) rows of TAPS */
+    float*           work;         /* float input frames, history first */
+    size_t           work_frames;
+    size_t           work_capacity;
+
+    float*           staged;       /* float frames converted from one call */
+    size_t           staged_capacity;
+    int16_t*         out;
+    size_t           out_capacity; /* samples */
+};
+
+/**********************************************
+ *    Format kernels
+ **********************************************/
+
+/* decoders for one little-endian sample at p, scaled to [-1, 1) */
+#define LOAD_U8(p)  (((float)(p)[0] - 128.0f) * (1.0f / 128.0f))
+#define LOAD_S16(p) ((float)(int16_t)((uint16_t)(p)[0] | ((uint16_t)(p)[1] << 8)) * (1.0f / 32768.0f))
+#define LOAD_S24(p) ((float)((int32_t)(((uint32_t)(p)[0] << 8) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 24)) >> 8) * (1.0f / 8388608.0f))
+#define LOAD_S32(p) ((float)(int32_t)((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24)) * (1.0f / 2147483648.0f))
+#define LOAD_F32(p) _load_f32(p)
+
+static float
+_load_f32(
+    const unsigned char* p
+    )
+{
+    uint32_t bits  = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    float    value = 0;
+
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+/* -3dB for the centre and surround channels */
+#define MIX_SIDE 0.70710678f
+
+/*
+ * One set of kernels per sample format. Mono and stereo are straight
+ * conversions with the channel count fixed; 5.1 uses the usual ITU
+ * downmix (LFE dropped); any other count averages the even-numbered
+ * channels into the left and the odd-numbered ones into the right.
+ */
+#define CONVERT_KERNELS(name, SIZE, LOAD)                                               \
+static void                                                                             \
+_mono_##name(const unsigned char* in, float* out, size_t frames, uint32_t channels)     \
+{                                                                                       \
+    size_t i = 0;                                                                       \
+    (void)channels;                                                                     \
+    for (i = 0; i < frames; i++)                                                        \
+    {                                                                                   \
+        out[i] = LOAD(in + i * (SIZE));                                                 \
+    }                                                                                   \
+}                                                                                       \
+static void                                                                             \
+_stereo_##name(const unsigned char* in, float* out, size_t frames, uint32_t channels)   \
+{                                                                                       \
+    size_t i = 0;                                                                       \
+    (void)channels;                                                                     \
+    for (i = 0; i < frames * 2; i++)                                                    \
+    {                                                                                   \
+        out[i] = LOAD(in + i * (SIZE));                                                 \
+    }                                                                                   \
+}                                                                                       \
+static void                                                                             \
+_surround51_##name(const unsigned char* in, float* out, size_t frames, uint32_t channels) \
+{                                                                                       \
+    const unsigned char* p = in;                                                        \
+    size_t               i = 0;                                                         \
+    (void)channels;                                                                     \
+    for (i = 0; i < frames; i++, p += 6 * (SIZE))                                       \
+    {                                                                                   \
+        out[2 * i]     = 0.5f * (LOAD(p) + MIX_SIDE * (LOAD(p + 2 * (SIZE)) + LOAD(p + 4 * (SIZE)))); \
+        out[2 * i + 1] = 0.5f * (LOAD(p + (SIZE)) + MIX_SIDE * (LOAD(p + 2 * (SIZE)) + LOAD(p + 5 * (SIZE)))); \
+    }                                                                                   \
+}                                                                                       \
+static void                                                                             \
+_downmix_##name(const unsigned char* in, float* out, size_t frames, uint32_t channels)  \
+{                                                                                       \
+    const unsigned char* p     = in;                                                    \
+    float                left  = 0;                                                     \
+    float                right = 0;                                                     \
+    size_t               i     = 0;                                                     \
+    uint32_t             c     = 0;                                                     \
+    for (i = 0; i < frames; i++)                                                        \
+    {                                                                                   \
+        left  = 0;                                                                      \
+        right = 0;                                                                      \
+        for (c = 0; c + 1 < channels; c += 2, p += 2 * (SIZE))                          \
+        {                                                                               \
+            left  += LOAD(p);                                                           \
+            right += LOAD(p + (SIZE));                                                  \
+        }                                                                               \
+        if (c < channels)                                                               \
+        {                                                                               \
+            left  += LOAD(p);                                                           \
+            p     += (SIZE);                                                            \
+        }                                                                               \
+        out[2 * i]     = left / (float)((channels + 1) / 2);                            \
+        out[2 * i + 1] = right / (float)(channels / 2);                                 \
+    }                                                                                   \
+}
+
+CONVERT_KERNELS(u8,  1, LOAD_U8)
+CONVERT_KERNELS(s16, 2, LOAD_S16)
+CONVERT_KERNELS(s24, 3, LOAD_S24)
+CONVERT_KERNELS(s32, 4, LOAD_S32)
+CONVERT_KERNELS(f32, 4, LOAD_F32)
+
+#define KERNEL_ROW(name) { _mono_##name, _stereo_##name, _surround51_##name, _downmix_##name }
+
+static const convert_kernel_t s_kernels[SAMPLE_FORMAT_COUNT][LAYOUT_COUNT] =
+{
+    KERNEL_ROW(u8),
+    KERNEL_ROW(s16),
+    KERNEL_ROW(s24),
+    KERNEL_ROW(s32),
+    KERNEL_ROW(f32)
+};
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+static int
+_sample_format(
+    const audio_format_t* p_format,
+    int                   b_float,
+    sample_format_t*      p_sample_format
+    )
+{
+    if (b_float)
+    {
+        *p_sample_format = SAMPLE_F32;
+        return (p_format->bits_per_sample == 32) ? 0 : -1;
+    }
+
+    switch (p_format->bits_per_sample)
+    {
+    case 8:
+        *p_sample_format = SAMPLE_U8;
+        return 0;
+    case 16:
+        *p_sample_format = SAMPLE_S16;
+        return 0;
+    case 24:
+        *p_sample_format = SAMPLE_S24;
+        return 0;
+    case 32:
+        *p_sample_format = SAMPLE_S32;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static void*
+_reserve(
+    void*   buf,
+    size_t* p_capacity,
+    size_t  needed,
+    size_t  item_size
+    )
+{
+    void* grown = NULL;
+
+    if (needed <= *p_capacity)
+    {
+        return buf;
+    }
+
+    grown = realloc(buf, needed * item_size);
+    if (grown != NULL)
+    {
+        *p_capacity = needed;
+    }
+
+    return grown;
+}
+
+/******************************************************************
+ *
+ *    _MAKE_FILTER
+ *
+ *    Blackman-windowed sinc, tabulated at PHASES + 1 fractional
+ *    offsets so the resampler can interpolate between neighbouring
+ *    rows. Each row is normalised to unity gain.
+ *
+ *****************************************************************/
+static void
+_make_filter(
+    float* coef,
+    double cutoff
+    )
+{
+    double x     = 0;
+    double u     = 0;
+    double value = 0;
+    double sum   = 0;
+    int    phase = 0;
+    int    tap   = 0;
+
+    for (phase = 0; phase <= PHASES; phase++)
+    {
+        sum = 0;
+        for (tap = 0; tap < TAPS; tap++)
+        {
+            /* taps sit at input offsets -HALF_TAPS + 1 .. HALF_TAPS */
+            x     = (double)(tap - HALF_TAPS + 1) - (double)phase / PHASES;
+            u     = x / HALF_TAPS;
+            value = (x == 0) ? cutoff : sin(M_PI * cutoff * x) / (M_PI * x);
+            value *= (fabs(u) >= 1) ? 0 : 0.42 + 0.5 * cos(M_PI * u) + 0.08 * cos(2 * M_PI * u);
+
+            coef[phase * TAPS + tap] = (float)value;
+            sum += value;
+        }
+        for (tap = 0; tap < TAPS; tap++)
+        {
+            coef[phase * TAPS + tap] = (float)(coef[phase * TAPS + tap] / sum);
+        }
+    }
+
+} /* _make_filter() */
+
+/******************************************************************
+ *
+ *    _RESAMPLE
+ *
+ *    Produce every output frame the work buffer has enough input
+ *    for, then drop the input that is no longer needed.
+ *
+ *****************************************************************/
+static size_t
+_resample(
+    convert_t* convert,
+    float*     out
+    )
+{
+    const uint32_t channels = convert->out_channels;
+    const float*   row0     = NULL;
+    const float*   row1     = NULL;
+    const float*   in       = NULL;
+    size_t         produced = 0;
+    size_t         base     = 0;
+    size_t         drop     = 0;
+    double         phase    = 0;
+    float          t        = 0;
+    float          weight   = 0;
+    float          acc[2]   = {0};
+    int            row      = 0;
+    int            tap      = 0;
+    uint32_t       c        = 0;
+
+    for (;;)
+    {
+        base = (size_t)convert->position;
+        if (base + HALF_TAPS >= convert->work_frames)
+        {
+            break;
+        }
+
+        phase = (convert->position - (double)base) * PHASES;
+        row   = (int)phase;
+        t     = (float)(phase - row);
+        row0  = convert->coef + row * TAPS;
+        row1  = row0 + TAPS;
+        in    = convert->work + (base - HALF_TAPS + 1) * channels;
+
+        acc[0] = 0;
+        acc[1] = 0;
+        for (tap = 0; tap < TAPS; tap++)
+        {
+            weight = row0[tap] + t * (row1[tap] - row0[tap]);
+            for (c = 0; c < channels; c++)
+            {
+                acc[c] += weight * in[tap * channels + c];
+            }
+        }
+        for (c = 0; c < channels; c++)
+        {
+            out[produced * channels + c] = acc[c];
+        }
+
+        produced++;
+        convert->position += convert->step;
+    }
+
+    /* keep the taps the next output frame will need */
+    base = (size_t)convert->position;
+    drop = (base + 1 > HALF_TAPS) ? base + 1 - HALF_TAPS : 0;
+    if (drop > convert->work_frames)
+    {
+        drop = convert->work_frames;
+    }
+    memmove(convert->work, convert->work + drop * channels, (convert->work_frames - drop) * channels * sizeof(float));
+    convert->work_frames -= drop;
+    convert->position    -= (double)drop;
+
+    return produced;
+
+} /* _resample() */
+
+/******************************************************************
+ *
+ *    _PACK_S16
+ *
+ *    Float to 16 bit with saturation.
+ *
+ *****************************************************************/
+static void
+_pack_s16(
+    const float* in,
+    int16_t*     out,
+    size_t       count
+    )
+{
+    size_t i     = 0;
+    float  value = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale  = _mm_set1_ps(32768.0f);
+    const __m128 top    = _mm_set1_ps(32767.0f);
+    const __m128 bottom = _mm_set1_ps(-32768.0f);
+    __m128i      low    = _mm_setzero_si128();
+    __m128i      high   = _mm_setzero_si128();
+
+    for (; i + 8 <= count; i += 8)
+    {
+        low  = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), top), bottom));
+        high = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), top), bottom));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(low, high));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        value = in[i] * 32768.0f;
+        value = (value > 32767.0f) ? 32767.0f : (value < -32768.0f) ? -32768.0f : value;
+        out[i] = (int16_t)lrintf(value);
+    }
+
+} /* _pack_s16() */
+
+/******************************************************************
+ *
+ *    CONVERT_NEEDED
+ *
+ *****************************************************************/
+int
+convert_needed(
+    const audio_format_t* p_format,
+    int                   b_float,
+    uint32_t              out_rate
+    )
+{
+    return b_float
+        || p_format->bits_per_sample != 16
+        || p_format->channels > 2
+        || p_format->sample_rate != out_rate;
+
+} /* convert_needed() */
+
+/******************************************************************
+ *
+ *    CONVERT_OPEN
+ *
+ *****************************************************************/
+convert_t*
+convert_open(
+    const audio_format_t* p_format,
+    int                   b_float,
+    uint32_t              out_rate,
+    audio_format_t*       p_out_format
+    )
+{
+    convert_t*      convert       = NULL;
+    sample_format_t sample_format = SAMPLE_S16;
+    layout_t        layout        = LAYOUT_MONO;
+    double          ratio         = 0;
+
+    if (0 != _sample_format(p_format, b_float, &sample_format)
+        || 0 == p_format->channels
+        || 0 == p_format->sample_rate
+        || 0 == out_rate)
+    {
+        return NULL;
+    }
+
+    switch (p_format->channels)
+    {
+    case 1:
+        layout = LAYOUT_MONO;
+        break;
+    case 2:
+        layout = LAYOUT_STEREO;
+        break;
+    case 6:
+        layout = LAYOUT_5_1;
+        break;
+    default:
+        layout = LAYOUT_DOWNMIX;
+        break;
+    }
+
+    convert = calloc(1, sizeof(*convert));
+    if (convert == NULL)
+    {
+        return NULL;
+    }
+
+    convert->in_frame_size = AUDIO_FRAME_SIZE(p_format);
+    convert->in_channels   = p_format->channels;
+    convert->out_channels  = (p_format->channels == 1) ? 1 : 2;
+    convert->kernel        = s_kernels[sample_format][layout];
+
+    if (p_format->sample_rate != out_rate)
+    {
+        convert->b_resample = 1;
+        convert->step       = (double)p_format->sample_rate / (double)out_rate;
+        ratio               = (out_rate < p_format->sample_rate) ? (double)out_rate / p_format->sample_rate : 1.0;
+
+        convert->coef = malloc((PHASES + 1) * TAPS * sizeof(float));
+        if (convert->coef == NULL)
+        {
+            free(convert);
+            return NULL;
+        }
+        _make_filter(convert->coef, ratio * CUTOFF_MARGIN);
+
+        /* start with silence before the first sample so the first
+         * output frame lines up with it */
+        convert->work = _reserve(NULL, &convert->work_capacity, HALF_TAPS * convert->out_channels, sizeof(float));
+        if (convert->work == NULL)
+        {
+            free(convert->coef);
+            free(convert);
+            return NULL;
+        }
+        memset(convert->work, 0, HALF_TAPS * convert->out_channels * sizeof(float));
+        convert->work_frames   = HALF_TAPS - 1;
+        convert->position      = HALF_TAPS - 1;
+    }
+
+    p_out_format->sample_rate     = out_rate;
+    p_out_format->bits_per_sample = 16;
+    p_out_format->channels        = convert->out_channels;
+
+    return convert;
+
+} /* convert_open() */
+
+/******************************************************************
+ *
+ *    CONVERT_CLOSE
+ *
+ *****************************************************************/
+void
+convert_close(
+    convert_t* convert
+    )
+{
+    if (convert == NULL)
+    {
+        return;
+    }
+
+    free(convert->coef);
+    free(convert->work);
+    free(convert->staged);
+    free(convert->out);
+    free(convert);
+
+} /* convert_close() */
+
+/******************************************************************
+ *
+ *    CONVERT_PROCESS
+ *
+ *****************************************************************/
+size_t
+convert_process(
+    convert_t*      convert,
+    const void*     pcm,
+    size_t          size,
+    const int16_t** p_out
+    )
+{
+    const uint32_t channels = convert->out_channels;
+    size_t         frames   = size / convert->in_frame_size;
+    size_t         produced = frames;
+    size_t         most     = 0;
+    void*          grown    = NULL;
+
+    *p_out = NULL;
+
+    if (convert->b_resample)
+    {
+        /* decode straight onto the end of the resampler's input */
+        grown = _reserve(convert->work, &convert->work_capacity, (convert->work_frames + frames) * channels, sizeof(float));
+        if (grown == NULL)
+        {
+            return 0;
+        }
+        convert->work = grown;
+        convert->kernel(pcm, convert->work + convert->work_frames * channels, frames, convert->in_channels);
+        convert->work_frames += frames;
+
+        most  = (size_t)((double)convert->work_frames / convert->step) + 2;
+        grown = _reserve(convert->staged, &convert->staged_capacity, most * channels, sizeof(float));
+        if (grown == NULL)
+        {
+            return 0;
+        }
+        convert->staged = grown;
+        produced        = _resample(convert, convert->staged);
+    }
+    else
+    {
+        grown = _reserve(convert->staged, &convert->staged_capacity, frames * channels, sizeof(float));
+        if (grown == NULL)
+        {
+            return 0;
+        }
+        convert->staged = grown;
+        convert->kernel(pcm, convert->staged, frames, convert->in_channels);
+    }
+
+    grown = _reserve(convert->out, &convert->out_capacity, produced * channels + 1, sizeof(int16_t));
+    if (grown == NULL)
+    {
+        return 0;
+    }
+    convert->out = grown;
+    _pack_s16(convert->staged, convert->out, produced * channels);
+
+    *p_out = convert->out;
+
+    return produced * channels * sizeof(int16_t);
+
+} /* convert_process() */
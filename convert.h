@@ -0,0 +1,61 @@
+/*
+ *  Name: convert.h
+ *  Description:
+ *  Sample format conversion, downmix and resampling of interleaved PCM
+ *  into the 16 bit mono or stereo audio written to MusicID-Stream.
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio.h"
+
+typedef struct convert_s convert_t;
+
+/*
+ * Whether audio in p_format (float samples if b_float) has to be
+ * converted before it can be written to a channel running at out_rate.
+ */
+int
+convert_needed(
+    const audio_format_t* p_format,
+    int                   b_float,
+    uint32_t              out_rate
+    );
+
+/*
+ * Set up a conversion from p_format to 16 bit samples at out_rate, with
+ * more than two channels mixed down to stereo. The format produced is
+ * returned in p_out_format. Returns NULL if the input format isn't
+ * supported (8, 16, 24 or 32 bit integer, or 32 bit float).
+ */
+convert_t*
+convert_open(
+    const audio_format_t* p_format,
+    int                   b_float,
+    uint32_t              out_rate,
+    audio_format_t*       p_out_format
+    );
+
+void
+convert_close(
+    convert_t* convert
+    );
+
+/*
+ * Convert size bytes of whole input frames. The result stays valid
+ * until the next call and its size in bytes is returned; it can be
+ * 0 while the resampler fills up.
+ */
+size_t
+convert_process(
+    convert_t*      convert,
+    const void*     pcm,
+    size_t          size,
+    const int16_t** p_out
+    );
+
+#endif /* CONVERT_H */
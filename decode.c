@@ -0,0 +1,762 @@
+/*
+ *  Name: decode.c
+ *  Description:
+ *  Streaming FLAC, MP3 and Ogg Vorbis decoding on top of libFLAC,
+ *  libmpg123 and libvorbisfile.
+ *
+ *  Each decoder pulls the compressed stream from the file descriptor as it
+ *  needs it, through _read_input(), which first hands back the bytes that
+ *  were read to recognise the format; so pipes work as well as files.
+ *  Only one block of decoded audio is held at a time: a FLAC frame, or
+ *  up to DECODE_BLOCK_SIZE bytes of MP3 or Vorbis output.
+ */
+
+#include "decode.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(SAMPLE_WITH_FLAC)
+#include <FLAC/stream_decoder.h>
+#endif
+
+#if defined(SAMPLE_WITH_MP3)
+#include <pthread.h>
+#include <mpg123.h>
+#endif
+
+#if defined(SAMPLE_WITH_VORBIS)
+#include <vorbis/vorbisfile.h>
+#endif
+
+/* decoded bytes returned at a time by the MP3 and Vorbis decoders */
+#define DECODE_BLOCK_SIZE (32 * 1024)
+
+/* compressed bytes read at a time for the MP3 decoder */
+#define DECODE_INPUT_SIZE (16 * 1024)
+
+#if defined(SAMPLE_WITH_FLAC) || defined(SAMPLE_WITH_MP3) || defined(SAMPLE_WITH_VORBIS)
+#define DECODE_ANY 1
+#endif
+
+struct decode_s
+{
+    int                fd;
+    decode_container_t container;
+    unsigned char*     magic;                     /* already read from fd */
+    size_t             magic_size;
+    size_t             magic_used;
+    audio_format_t     format;
+    unsigned char*     pcm;                       /* the block being returned */
+    size_t             pcm_size;
+    size_t             pcm_capacity;
+
+#if defined(SAMPLE_WITH_FLAC)
+    FLAC__StreamDecoder* flac;
+    int                  b_flac_info;            /* STREAMINFO has been seen */
+    int                  b_flac_failed;
+#endif
+#if defined(SAMPLE_WITH_MP3)
+    mpg123_handle*       mp3;
+    unsigned char*       mp3_input;
+#endif
+#if defined(SAMPLE_WITH_VORBIS)
+    OggVorbis_File       vorbis;
+    int                  b_vorbis_open;
+#endif
+};
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+#if defined(DECODE_ANY)
+
+/******************************************************************
+ *
+ *    _READ_INPUT
+ *
+ *    Read up to size bytes of the compressed stream, starting with
+ *    the bytes decode_detect() was given. Returns 0 at the end.
+ *
+ *****************************************************************/
+static size_t
+_read_input(
+    decode_t* decode,
+    void*     buf,
+    size_t    size
+    )
+{
+    size_t  part = decode->magic_size - decode->magic_used;
+    ssize_t got  = 0;
+
+    if (part > 0)
+    {
+        part = (part < size) ? part : size;
+        memcpy(buf, decode->magic + decode->magic_used, part);
+        decode->magic_used += part;
+        return part;
+    }
+
+    do
+    {
+        got = read(decode->fd, buf, size);
+    }
+    while (got < 0 && errno == EINTR);
+
+    return (got > 0) ? (size_t)got : 0;
+
+} /* _read_input() */
+
+/******************************************************************
+ *
+ *    _RESERVE_PCM
+ *
+ *****************************************************************/
+static int
+_reserve_pcm(
+    decode_t* decode,
+    size_t    size
+    )
+{
+    unsigned char* grown = NULL;
+
+    if (size > decode->pcm_capacity)
+    {
+        grown = realloc(decode->pcm, size);
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        decode->pcm          = grown;
+        decode->pcm_capacity = size;
+    }
+
+    return 0;
+
+} /* _reserve_pcm() */
+
+#endif /* DECODE_ANY */
+
+#if defined(SAMPLE_WITH_FLAC)
+
+static FLAC__StreamDecoderReadStatus
+_flac_read(
+    const FLAC__StreamDecoder* flac,
+    FLAC__byte                 buffer[],
+    size_t*                    bytes,
+    void*                      client_data
+    )
+{
+    decode_t* decode = (decode_t*)client_data;
+
+    (void)flac;
+
+    *bytes = _read_input(decode, buffer, *bytes);
+
+    return (*bytes > 0) ? FLAC__STREAM_DECODER_READ_STATUS_CONTINUE : FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+
+} /* _flac_read() */
+
+/******************************************************************
+ *
+ *    _FLAC_WRITE
+ *
+ *    Interleave a decoded frame into 16 bit samples, or 32 bit ones
+ *    for streams deeper than 16 bits, left justified either way.
+ *
+ *****************************************************************/
+static FLAC__StreamDecoderWriteStatus
+_flac_write(
+    const FLAC__StreamDecoder* flac,
+    const FLAC__Frame*         frame,
+    const FLAC__int32* const   buffer[],
+    void*                      client_data
+    )
+{
+    decode_t* decode   = (decode_t*)client_data;
+    uint32_t  channels = decode->format.channels;
+    uint32_t  frames   = frame->header.blocksize;
+    uint32_t  shift    = decode->format.bits_per_sample - frame->header.bits_per_sample;
+    int16_t*  out16    = NULL;
+    int32_t*  out32    = NULL;
+    uint32_t  channel  = 0;
+    uint32_t  i        = 0;
+
+    (void)flac;
+
+    if (frame->header.channels != channels
+        || frame->header.bits_per_sample > decode->format.bits_per_sample
+        || 0 != _reserve_pcm(decode, (size_t)frames * AUDIO_FRAME_SIZE(&decode->format)))
+    {
+        decode->b_flac_failed = 1;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+
+    if (16 == decode->format.bits_per_sample)
+    {
+        out16 = (int16_t*)decode->pcm;
+        for (channel = 0; channel < channels; channel++)
+        {
+            for (i = 0; i < frames; i++)
+            {
+                out16[i * channels + channel] = (int16_t)(buffer[channel][i] * (1 << shift));
+            }
+        }
+    }
+    else
+    {
+        out32 = (int32_t*)decode->pcm;
+        for (channel = 0; channel < channels; channel++)
+        {
+            for (i = 0; i < frames; i++)
+            {
+                out32[i * channels + channel] = (int32_t)((uint32_t)buffer[channel][i] << shift);
+            }
+        }
+    }
+    decode->pcm_size = (size_t)frames * AUDIO_FRAME_SIZE(&decode->format);
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+
+} /* _flac_write() */
+
+static void
+_flac_metadata(
+    const FLAC__StreamDecoder*  flac,
+    const FLAC__StreamMetadata* metadata,
+    void*                       client_data
+    )
+{
+    decode_t* decode = (decode_t*)client_data;
+
+    (void)flac;
+
+    if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO)
+    {
+        decode->format.sample_rate     = metadata->data.stream_info.sample_rate;
+        decode->format.channels        = metadata->data.stream_info.channels;
+        decode->format.bits_per_sample = (metadata->data.stream_info.bits_per_sample <= 16) ? 16 : 32;
+        decode->b_flac_info            = 1;
+    }
+
+} /* _flac_metadata() */
+
+static void
+_flac_error(
+    const FLAC__StreamDecoder*     flac,
+    FLAC__StreamDecoderErrorStatus status,
+    void*                          client_data
+    )
+{
+    /* libFLAC resynchronises on the next frame by itself */
+    (void)flac;
+    (void)status;
+    (void)client_data;
+
+} /* _flac_error() */
+
+static const char*
+_flac_open(
+    decode_t* decode
+    )
+{
+    decode->flac = FLAC__stream_decoder_new();
+    if (decode->flac == NULL)
+    {
+        return "Out of memory";
+    }
+
+    if (FLAC__STREAM_DECODER_INIT_STATUS_OK != FLAC__stream_decoder_init_stream(
+            decode->flac,
+            _flac_read,
+            NULL,
+            NULL,
+            NULL,
+            NULL,
+            _flac_write,
+            _flac_metadata,
+            _flac_error,
+            decode
+            ))
+    {
+        return "Failed to start the FLAC decoder";
+    }
+
+    if (!FLAC__stream_decoder_process_until_end_of_metadata(decode->flac) || !decode->b_flac_info)
+    {
+        return "Invalid FLAC stream";
+    }
+
+    return NULL;
+
+} /* _flac_open() */
+
+static size_t
+_flac_read_block(
+    decode_t* decode
+    )
+{
+    FLAC__StreamDecoderState state;
+
+    decode->pcm_size = 0;
+
+    while (0 == decode->pcm_size && !decode->b_flac_failed)
+    {
+        state = FLAC__stream_decoder_get_state(decode->flac);
+        if (state == FLAC__STREAM_DECODER_END_OF_STREAM || state == FLAC__STREAM_DECODER_ABORTED)
+        {
+            break;
+        }
+        if (!FLAC__stream_decoder_process_single(decode->flac))
+        {
+            break;
+        }
+    }
+
+    return decode->b_flac_failed ? 0 : decode->pcm_size;
+
+} /* _flac_read_block() */
+
+#endif /* SAMPLE_WITH_FLAC */
+
+#if defined(SAMPLE_WITH_MP3)
+
+static pthread_once_t s_mp3_once = PTHREAD_ONCE_INIT;
+
+static void
+_mp3_init(void)
+{
+    mpg123_init();
+}
+
+/******************************************************************
+ *
+ *    _MP3_DECODE
+ *
+ *    Run the decoder until it has output, feeding it more of the
+ *    stream whenever it needs it. On the first call it stops at the
+ *    format instead, which is all decode_open() needs.
+ *
+ *****************************************************************/
+static size_t
+_mp3_decode(
+    decode_t* decode
+    )
+{
+    size_t got      = 0;
+    size_t done     = 0;
+    long   rate     = 0;
+    int    channels = 0;
+    int    encoding = 0;
+    int    rc       = 0;
+
+    for (;;)
+    {
+        rc = mpg123_decode(decode->mp3, NULL, 0, decode->pcm, decode->pcm_capacity, &done);
+
+        if (rc == MPG123_NEW_FORMAT)
+        {
+            mpg123_getformat(decode->mp3, &rate, &channels, &encoding);
+
+            if (0 == decode->format.sample_rate)
+            {
+                decode->format.sample_rate     = (uint32_t)rate;
+                decode->format.channels        = (uint32_t)channels;
+                decode->format.bits_per_sample = 16;
+                return 0;
+            }
+
+            /* the channel can't follow a change of format mid-stream */
+            if ((uint32_t)rate != decode->format.sample_rate || (uint32_t)channels != decode->format.channels)
+            {
+                return 0;
+            }
+        }
+
+        if (done > 0)
+        {
+            return done;
+        }
+
+        if (rc == MPG123_NEED_MORE)
+        {
+            got = _read_input(decode, decode->mp3_input, DECODE_INPUT_SIZE);
+            if (0 == got || MPG123_OK != mpg123_feed(decode->mp3, decode->mp3_input, got))
+            {
+                return 0;
+            }
+        }
+        else if (rc != MPG123_OK && rc != MPG123_NEW_FORMAT)
+        {
+            /* MPG123_DONE or an error */
+            return 0;
+        }
+    }
+
+} /* _mp3_decode() */
+
+static const char*
+_mp3_open(
+    decode_t* decode
+    )
+{
+    const long* rates      = NULL;
+    size_t      rate_count = 0;
+    size_t      i          = 0;
+    int         error      = MPG123_OK;
+
+    pthread_once(&s_mp3_once, _mp3_init);
+
+    decode->mp3_input = malloc(DECODE_INPUT_SIZE);
+    if (decode->mp3_input == NULL || 0 != _reserve_pcm(decode, DECODE_BLOCK_SIZE))
+    {
+        return "Out of memory";
+    }
+
+    decode->mp3 = mpg123_new(NULL, &error);
+    if (decode->mp3 == NULL)
+    {
+        return mpg123_plain_strerror(error);
+    }
+
+    /* always 16 bit, at whatever rate and channel count the file has */
+    mpg123_format_none(decode->mp3);
+    mpg123_rates(&rates, &rate_count);
+    for (i = 0; i < rate_count; i++)
+    {
+        mpg123_format(decode->mp3, rates[i], MPG123_MONO | MPG123_STEREO, MPG123_ENC_SIGNED_16);
+    }
+
+    if (MPG123_OK != mpg123_open_feed(decode->mp3))
+    {
+        return mpg123_strerror(decode->mp3);
+    }
+
+    _mp3_decode(decode);
+    if (0 == decode->format.sample_rate)
+    {
+        return "Invalid MP3 stream";
+    }
+
+    return NULL;
+
+} /* _mp3_open() */
+
+#endif /* SAMPLE_WITH_MP3 */
+
+#if defined(SAMPLE_WITH_VORBIS)
+
+static size_t
+_vorbis_read(
+    void*  ptr,
+    size_t size,
+    size_t nmemb,
+    void*  datasource
+    )
+{
+    if (0 == size)
+    {
+        return 0;
+    }
+
+    return _read_input((decode_t*)datasource, ptr, size * nmemb) / size;
+
+} /* _vorbis_read() */
+
+static const char*
+_vorbis_open(
+    decode_t* decode
+    )
+{
+    ov_callbacks callbacks = { _vorbis_read, NULL, NULL, NULL };
+    vorbis_info* info      = NULL;
+
+    if (0 != _reserve_pcm(decode, DECODE_BLOCK_SIZE))
+    {
+        return "Out of memory";
+    }
+
+    /* the bytes already read are given back through _read_input() */
+    if (0 != ov_open_callbacks(decode, &decode->vorbis, NULL, 0, callbacks))
+    {
+        return "Invalid Ogg Vorbis stream";
+    }
+    decode->b_vorbis_open = 1;
+
+    info = ov_info(&decode->vorbis, -1);
+    if (info == NULL)
+    {
+        return "Invalid Ogg Vorbis stream";
+    }
+    decode->format.sample_rate     = (uint32_t)info->rate;
+    decode->format.channels        = (uint32_t)info->channels;
+    decode->format.bits_per_sample = 16;
+
+    return NULL;
+
+} /* _vorbis_open() */
+
+/******************************************************************
+ *
+ *    _VORBIS_READ_BLOCK
+ *
+ *    5.1 Vorbis is ordered FL C FR RL RR LFE; it is put in WAV order
+ *    (FL FR C LFE RL RR) for the downmix.
+ *
+ *****************************************************************/
+static size_t
+_vorbis_read_block(
+    decode_t* decode
+    )
+{
+    size_t       frame_size = AUDIO_FRAME_SIZE(&decode->format);
+    int          length     = (int)(decode->pcm_capacity - (decode->pcm_capacity % frame_size));
+    int          bitstream  = 0;
+    long         got        = 0;
+    vorbis_info* info       = NULL;
+    int16_t*     frame      = NULL;
+    int16_t      vorbis[6];
+    size_t       i          = 0;
+
+    do
+    {
+        got = ov_read(&decode->vorbis, (char*)decode->pcm, length, 0, 2, 1, &bitstream);
+    }
+    while (got == OV_HOLE);
+
+    if (got <= 0)
+    {
+        return 0;
+    }
+
+    /* chained streams can change format */
+    info = ov_info(&decode->vorbis, bitstream);
+    if (info == NULL
+        || (uint32_t)info->rate != decode->format.sample_rate
+        || (uint32_t)info->channels != decode->format.channels)
+    {
+        return 0;
+    }
+
+    if (6 == decode->format.channels)
+    {
+        for (i = 0; i + frame_size <= (size_t)got; i += frame_size)
+        {
+            frame = (int16_t*)(decode->pcm + i);
+            memcpy(vorbis, frame, sizeof(vorbis));
+            frame[0] = vorbis[0];
+            frame[1] = vorbis[2];
+            frame[2] = vorbis[1];
+            frame[3] = vorbis[5];
+            frame[4] = vorbis[3];
+            frame[5] = vorbis[4];
+        }
+    }
+
+    return (size_t)got;
+
+} /* _vorbis_read_block() */
+
+#endif /* SAMPLE_WITH_VORBIS */
+
+/******************************************************************
+ *
+ *    DECODE_DETECT
+ *
+ *****************************************************************/
+decode_container_t
+decode_detect(
+    const unsigned char* magic,
+    size_t               magic_size
+    )
+{
+    if (magic_size >= 4 && 0 == memcmp(magic, "fLaC", 4))
+    {
+        return DECODE_FLAC;
+    }
+    if (magic_size >= 4 && 0 == memcmp(magic, "OggS", 4))
+    {
+        return DECODE_VORBIS;
+    }
+
+    /* an ID3v2 tag, or an MPEG audio frame sync with a valid layer */
+    if (magic_size >= 3 && 0 == memcmp(magic, "ID3", 3))
+    {
+        return DECODE_MP3;
+    }
+    if (magic_size >= 2 && 0xFF == magic[0] && 0xE0 == (magic[1] & 0xE0) && 0 != (magic[1] & 0x06))
+    {
+        return DECODE_MP3;
+    }
+
+    return DECODE_NONE;
+
+} /* decode_detect() */
+
+/******************************************************************
+ *
+ *    DECODE_OPEN
+ *
+ *****************************************************************/
+decode_t*
+decode_open(
+    int                  fd,
+    decode_container_t   container,
+    const unsigned char* magic,
+    size_t               magic_size,
+    audio_format_t*      p_format,
+    const char**         p_error
+    )
+{
+    decode_t*   decode = NULL;
+    const char* error  = NULL;
+
+    decode = calloc(1, sizeof(*decode));
+    if (decode == NULL)
+    {
+        *p_error = "Out of memory";
+        return NULL;
+    }
+
+    decode->fd         = fd;
+    decode->container  = container;
+    decode->magic      = malloc(magic_size ? magic_size : 1);
+    decode->magic_size = magic_size;
+    if (decode->magic == NULL)
+    {
+        *p_error = "Out of memory";
+        free(decode);
+        return NULL;
+    }
+    memcpy(decode->magic, magic, magic_size);
+
+    switch (container)
+    {
+    case DECODE_FLAC:
+#if defined(SAMPLE_WITH_FLAC)
+        error = _flac_open(decode);
+#else
+        error = "FLAC input is not supported by this build";
+#endif
+        break;
+    case DECODE_MP3:
+#if defined(SAMPLE_WITH_MP3)
+        error = _mp3_open(decode);
+#else
+        error = "MP3 input is not supported by this build";
+#endif
+        break;
+    case DECODE_VORBIS:
+#if defined(SAMPLE_WITH_VORBIS)
+        error = _vorbis_open(decode);
+#else
+        error = "Ogg Vorbis input is not supported by this build";
+#endif
+        break;
+    default:
+        error = "Unrecognised audio format";
+        break;
+    }
+
+    if (error == NULL
+        && (0 == decode->format.sample_rate || 0 == decode->format.channels))
+    {
+        error = "Invalid audio format";
+    }
+    if (error)
+    {
+        *p_error = error;
+        decode_close(decode);
+        return NULL;
+    }
+
+    *p_format = decode->format;
+
+    return decode;
+
+} /* decode_open() */
+
+/******************************************************************
+ *
+ *    DECODE_CLOSE
+ *
+ *****************************************************************/
+void
+decode_close(
+    decode_t* decode
+    )
+{
+    if (decode == NULL)
+    {
+        return;
+    }
+
+#if defined(SAMPLE_WITH_FLAC)
+    if (decode->flac)
+    {
+        FLAC__stream_decoder_delete(decode->flac);
+    }
+#endif
+#if defined(SAMPLE_WITH_MP3)
+    if (decode->mp3)
+    {
+        mpg123_delete(decode->mp3);
+    }
+    free(decode->mp3_input);
+#endif
+#if defined(SAMPLE_WITH_VORBIS)
+    if (decode->b_vorbis_open)
+    {
+        ov_clear(&decode->vorbis);
+    }
+#endif
+
+    free(decode->magic);
+    free(decode->pcm);
+    free(decode);
+
+} /* decode_close() */
+
+/******************************************************************
+ *
+ *    DECODE_READ
+ *
+ *****************************************************************/
+size_t
+decode_read(
+    decode_t*    decode,
+    const void** p_pcm
+    )
+{
+    size_t size = 0;
+
+    switch (decode->container)
+    {
+#if defined(SAMPLE_WITH_FLAC)
+    case DECODE_FLAC:
+        size = _flac_read_block(decode);
+        break;
+#endif
+#if defined(SAMPLE_WITH_MP3)
+    case DECODE_MP3:
+        size = _mp3_decode(decode);
+        break;
+#endif
+#if defined(SAMPLE_WITH_VORBIS)
+    case DECODE_VORBIS:
+        size = _vorbis_read_block(decode);
+        break;
+#endif
+    default:
+        break;
+    }
+
+    *p_pcm = decode->pcm;
+
+    return size;
+
+} /* decode_read() */
@@ -0,0 +1,72 @@
+/*
+ *  Name: decode.h
+ *  Description:
+ *  Streaming decoders for compressed inputs (FLAC, MP3 and Ogg Vorbis),
+ *  producing interleaved PCM a block at a time so a file can be fed to
+ *  MusicID-Stream without decoding it to a WAV first.
+ *
+ *  Each decoder is only built in when its library is: define
+ *  SAMPLE_WITH_FLAC (libFLAC), SAMPLE_WITH_MP3 (libmpg123) and/or
+ *  SAMPLE_WITH_VORBIS (libvorbisfile) and link the library.
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stddef.h>
+
+#include "audio.h"
+
+typedef enum
+{
+    DECODE_NONE,     /* not a compressed format we know (WAV or raw PCM) */
+    DECODE_FLAC,
+    DECODE_MP3,
+    DECODE_VORBIS
+
+} decode_container_t;
+
+typedef struct decode_s decode_t;
+
+/* Recognise a container from the first few (at least 4) bytes of a file */
+decode_container_t
+decode_detect(
+    const unsigned char* magic,
+    size_t               magic_size
+    );
+
+/*
+ * Start decoding the stream on fd, whose first magic_size bytes have
+ * already been read into magic. Reads as far as the audio format, which
+ * is returned in p_format: 16 bit samples, or 32 bit for FLAC deeper
+ * than 16 bits. Returns NULL with a description of the problem in
+ * *p_error if the stream can't be decoded. fd is not closed.
+ */
+decode_t*
+decode_open(
+    int                  fd,
+    decode_container_t   container,
+    const unsigned char* magic,
+    size_t               magic_size,
+    audio_format_t*      p_format,
+    const char**         p_error
+    );
+
+void
+decode_close(
+    decode_t* decode
+    );
+
+/*
+ * Decode the next block. Its PCM (whole frames) is returned in *p_pcm
+ * and stays valid until the next call; the number of bytes is returned.
+ * Returns 0 at the end of the stream, or if the rest of it can't be
+ * decoded.
+ */
+size_t
+decode_read(
+    decode_t*    decode,
+    const void** p_pcm
+    );
+
+#endif /* DECODE_H */
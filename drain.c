@@ -0,0 +1,679 @@
+/*
+ *  Name: drain.c
+ *  Description:
+ *  --fingerprint and --drain. A fingerprint is made with a MusicID query
+ *  fed only as much audio as it needs, converted and conditioned as a
+ *  channel would have it. A drain works on a copy of the spool moved
+ *  aside, so that the live spool keeps filling meanwhile, and puts what
+ *  it couldn't look up back on the live one.
+ */
+
+#include "drain.h"
+#include "batch.h"
+#include "spool.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* the fingerprints --fingerprint spools, those MusicID-Stream makes */
+#define SPOOL_FP_TYPE GNSDK_MUSICID_FP_DATA_TYPE_STREAM3
+
+/* --drain: where a spool is moved while it is drained */
+#define DRAIN_SUFFIX ".draining"
+
+/* --drain: failed lookups of a fingerprint before it is dropped rather
+ * than put back on the spool */
+#define DRAIN_MAX_ATTEMPTS 5
+
+/**********************************************
+ *    Local Function Declarations
+ **********************************************/
+static void
+_spool_file(
+    batch_t* batch,
+    query_t* query
+    );
+
+/* --fingerprint: each input's fingerprint is spooled, not looked up */
+static const batch_hooks_t s_spool_hooks =
+{
+    GNSDK_NULL,
+    GNSDK_NULL,
+    _spool_file
+};
+
+/***************************************************************************
+ *
+ *    _SPOOL_WRITE
+ *
+ * Add a block of whole frames to the fingerprint a MusicID query is
+ * making, through the converter and the conditioner when the query has
+ * them, as query_write_audio() does for a channel. *pb_complete is set once
+ * the fingerprint needs no more.
+ *
+ ***************************************************************************/
+static gnsdk_error_t
+_spool_write(
+    gnsdk_musicid_query_handle_t musicid_handle,
+    query_t*                     query,
+    const gnsdk_byte_t*          p_audio,
+    gnsdk_size_t                 size,
+    gnsdk_bool_t*                pb_complete
+    )
+{
+    const gnsdk_byte_t* p_ready = p_audio;
+    const int16_t*      p_stage = GNSDK_NULL;
+    size_t              ready   = size;
+
+    if (query->convert)
+    {
+        ready   = convert_process(query->convert, p_ready, ready, &p_stage);
+        p_ready = (const gnsdk_byte_t*)p_stage;
+    }
+    if (query->condition && ready > 0)
+    {
+        ready   = condition_process(query->condition, (const int16_t*)p_ready, ready, &p_stage);
+        p_ready = (const gnsdk_byte_t*)p_stage;
+    }
+
+    if (0 == ready)
+    {
+        return GNSDK_SUCCESS;
+    }
+
+    return gnsdk_musicid_query_fingerprint_write(musicid_handle, p_ready, ready, pb_complete);
+
+}   /* _spool_write() */
+
+/***************************************************************************
+ *
+ *    _SPOOL_FILE
+ *
+ * --fingerprint: fingerprint the query's input from its start until the
+ * fingerprint is complete or the audio runs out, and append it to the
+ * spool with a record saying how much audio it took. Errors are
+ * reported.
+ *
+ ***************************************************************************/
+static void
+_spool_file(
+    batch_t* batch,
+    query_t* query
+    )
+{
+    gnsdk_musicid_query_handle_t musicid_handle = GNSDK_NULL;
+    gnsdk_error_t                error          = GNSDK_SUCCESS;
+    gnsdk_bool_t                 b_complete     = GNSDK_FALSE;
+    gnsdk_cstr_t                 fp_data        = GNSDK_NULL;
+    audio_input_t                input;
+    audio_format_t               out_format;
+    spool_entry_t                entry          = {0};
+    record_t*                    record         = GNSDK_NULL;
+    const void*                  p_pcm          = GNSDK_NULL;
+    const int16_t*               p_ready        = GNSDK_NULL;
+    unsigned char*               buffer         = GNSDK_NULL;
+    gnsdk_size_t                 frame_size     = 0;
+    gnsdk_size_t                 slice_size     = 0;
+    uint64_t                     taken          = 0;
+    size_t                       size           = 0;
+    size_t                       held           = 0;
+    ssize_t                      got            = 0;
+    int                          rc             = 0;
+    struct stat                  st;
+    struct timespec              captured;
+
+    if (0 != query_open_input(query, &input))
+    {
+        return;
+    }
+
+    if (0 != batch_start_sdk(batch))
+    {
+        record_string(query_begin_record(query), "error", "The Gracenote SDK failed to start");
+        query_end_record(query);
+        query_close_input(&input);
+        return;
+    }
+
+    /* a clip is taken to have been captured when it was last written */
+    if (0 == fstat(input.fd, &st) && S_ISREG(st.st_mode))
+    {
+        captured = st.st_mtim;
+    }
+    else
+    {
+        clock_gettime(CLOCK_REALTIME, &captured);
+    }
+
+    if (0 != query_open_stages(query, &input.info.format, input.info.format_tag == WAV_FORMAT_IEEE_FLOAT, &out_format))
+    {
+        query_close_input(&input);
+        return;
+    }
+
+    error = gnsdk_musicid_query_create(batch->user_handle, GNSDK_NULL, GNSDK_NULL, &musicid_handle);
+    if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_musicid_query_fingerprint_begin(
+            musicid_handle,
+            SPOOL_FP_TYPE,
+            out_format.sample_rate,
+            out_format.bits_per_sample,
+            out_format.channels
+            );
+    }
+
+    frame_size = input.info.block_align;
+    slice_size = query->context->feed_size - (query->context->feed_size % frame_size);
+    if (0 == slice_size)
+    {
+        slice_size = frame_size;
+    }
+
+    if (GNSDK_SUCCESS != error)
+    {
+        /* reported below */
+    }
+    else if (input.p_map)
+    {
+        while (GNSDK_SUCCESS == error && !b_complete && taken < input.audio_size)
+        {
+            size   = (input.audio_size - taken < slice_size) ? (size_t)(input.audio_size - taken) : slice_size;
+            error  = _spool_write(musicid_handle, query, input.p_audio + taken, size, &b_complete);
+            taken += size;
+        }
+    }
+    else if (input.decode)
+    {
+        while (GNSDK_SUCCESS == error && !b_complete && 0 < (size = decode_read(input.decode, &p_pcm)))
+        {
+            error  = _spool_write(musicid_handle, query, p_pcm, size, &b_complete);
+            taken += size;
+        }
+    }
+    else
+    {
+        /* read, keeping any part of a frame for the next read */
+        buffer = malloc(slice_size + frame_size);
+        rc     = buffer ? 0 : -1;
+        while (0 == rc && GNSDK_SUCCESS == error && !b_complete)
+        {
+            got = read(input.fd, buffer + held, slice_size);
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                break;
+            }
+            held  += (size_t)got;
+            taken += (uint64_t)got;
+            size   = held - (held % frame_size);
+            error  = _spool_write(musicid_handle, query, buffer, size, &b_complete);
+            memmove(buffer, buffer + size, held - size);
+            held  -= size;
+        }
+    }
+
+    /* whatever the conditioner still holds */
+    if (0 == rc && GNSDK_SUCCESS == error && !b_complete && query->condition)
+    {
+        size = condition_flush(query->condition, &p_ready);
+        if (size > 0)
+        {
+            error = gnsdk_musicid_query_fingerprint_write(musicid_handle, p_ready, size, &b_complete);
+        }
+    }
+
+    if (0 == rc && GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_musicid_query_fingerprint_end(musicid_handle);
+    }
+    if (0 == rc && GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_musicid_query_get_fp_data(musicid_handle, &fp_data);
+    }
+
+    if (0 != rc)
+    {
+        record_string(query_begin_record(query), "error", "Out of memory");
+        query_end_record(query);
+    }
+    else if (GNSDK_SUCCESS != error)
+    {
+        query_display_last_error(query);
+    }
+    else
+    {
+        entry.id          = query->audio_file;
+        entry.captured_ms = (uint64_t)captured.tv_sec * 1000 + (uint64_t)(captured.tv_nsec / 1000000);
+        entry.fp_type     = SPOOL_FP_TYPE;
+        entry.fp_data     = fp_data;
+        if (0 != spool_append((spool_t*)batch->owner, &entry))
+        {
+            record_stringf(query_begin_record(query), "error", "Failed to spool the fingerprint: %s", strerror(errno));
+            query_end_record(query);
+        }
+        else
+        {
+            record = query_begin_record(query);
+            record_begin_object(record, "spooled");
+            record_number(record, "seconds", (double)taken / ((double)input.info.format.sample_rate * frame_size), 3);
+            record_int(record, "fp_bytes", (int64_t)strlen(fp_data));
+            record_end_object(record);
+            query_end_record(query);
+        }
+    }
+
+    if (musicid_handle)
+    {
+        gnsdk_musicid_query_release(musicid_handle);
+    }
+    free(buffer);
+    query_close_stages(query);
+    query_close_input(&input);
+
+}   /* _spool_file() */
+
+/***************************************************************************
+ *
+ *    DRAIN_FINGERPRINT
+ *
+ ***************************************************************************/
+int
+drain_fingerprint(
+    query_context_t* context,
+    const char*      spool_path,
+    long             jobs,
+    int              input_count,
+    char**           inputs
+    )
+{
+    batch_t  batch = {0};
+    spool_t* spool = spool_open(spool_path);
+    int      rc    = 0;
+
+    if (spool == GNSDK_NULL)
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to open spool %s: %s", spool_path, strerror(errno));
+        query_context_end_record(context);
+        return -1;
+    }
+
+    batch_init(&batch, context, &s_spool_hooks, spool);
+
+    rc = batch_add_inputs(&batch, input_count, inputs);
+
+    if (jobs <= 0)
+    {
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs > (long)batch.file_count)
+    {
+        jobs = (long)batch.file_count;
+    }
+
+    if (0 == rc && jobs > 0)
+    {
+        rc = batch_run_workers(&batch, jobs);
+    }
+
+    batch_close(&batch);
+    spool_close(spool);
+
+    return rc;
+
+}   /* drain_fingerprint() */
+
+/* Shared by the --drain workers */
+typedef struct
+{
+    query_context_t*    context;
+    gnsdk_user_handle_t user_handle;
+    spool_contents_t    contents;     /* of the spool being drained */
+    size_t              next_entry;   /* first entry not yet claimed by a worker */
+    spool_t*            spool;        /* the live spool, where fingerprints go back */
+    unsigned long       answered;
+    unsigned long       requeued;
+    unsigned long       dropped;      /* failed too often, or not a fingerprint */
+    unsigned long       lost;         /* couldn't be put back */
+    pthread_mutex_t     lock;         /* guards next_entry and the counts */
+
+} drain_t;
+
+/***************************************************************************
+ *
+ *    _DRAIN_COUNT
+ *
+ ***************************************************************************/
+static void
+_drain_count(
+    drain_t*       drain,
+    unsigned long* p_counter
+    )
+{
+    pthread_mutex_lock(&drain->lock);
+    (*p_counter)++;
+    pthread_mutex_unlock(&drain->lock);
+
+}   /* _drain_count() */
+
+/***************************************************************************
+ *
+ *    _DRAIN_REQUEUE
+ *
+ * Put an entry back on the live spool with attempts failed lookups, for
+ * the next drain. Returns -1 (counted in lost, not reported) if it
+ * couldn't be written.
+ *
+ ***************************************************************************/
+static int
+_drain_requeue(
+    drain_t*             drain,
+    const spool_entry_t* p_entry,
+    uint32_t             attempts
+    )
+{
+    spool_entry_t entry = *p_entry;
+
+    entry.attempts = attempts;
+    if (0 != spool_append(drain->spool, &entry))
+    {
+        _drain_count(drain, &drain->lost);
+        return -1;
+    }
+    _drain_count(drain, &drain->requeued);
+
+    return 0;
+
+}   /* _drain_requeue() */
+
+/***************************************************************************
+ *
+ *    _DRAIN_ENTRY
+ *
+ * Look up one spooled fingerprint and write its result, tagged with the
+ * clip's ID and capture time. A lookup that fails is put back on the
+ * spool unless it has failed DRAIN_MAX_ATTEMPTS times, and the error
+ * record says which.
+ *
+ ***************************************************************************/
+static void
+_drain_entry(
+    drain_t*             drain,
+    query_t*             query,
+    const spool_entry_t* entry
+    )
+{
+    gnsdk_musicid_query_handle_t musicid_handle = GNSDK_NULL;
+    gnsdk_gdo_handle_t           response_gdo   = GNSDK_NULL;
+    gnsdk_error_t                error          = GNSDK_SUCCESS;
+    gnsdk_uint32_t               count          = 0;
+    gnsdk_bool_t                 b_retry        = GNSDK_FALSE;
+    record_t*                    record         = GNSDK_NULL;
+
+    error = gnsdk_musicid_query_create(drain->user_handle, GNSDK_NULL, GNSDK_NULL, &musicid_handle);
+    if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_musicid_query_set_fp_data(musicid_handle, entry->fp_data, entry->fp_type);
+    }
+    if (GNSDK_SUCCESS != error)
+    {
+        /* asking again won't make it a fingerprint */
+        query_display_last_error(query);
+        _drain_count(drain, &drain->dropped);
+    }
+    else if (0 != query_wait_for_quota(query))
+    {
+        /* stopped: it was never asked */
+        _drain_requeue(drain, entry, entry->attempts);
+    }
+    else
+    {
+        error = gnsdk_musicid_query_find_albums(musicid_handle, &response_gdo);
+        if (GNSDK_SUCCESS == error)
+        {
+            record = query_begin_record(query);
+            record_int(record, "captured", (int64_t)entry->captured_ms);
+            error = query_add_response(query->context, record, response_gdo, &count);
+            if (GNSDK_SUCCESS == error)
+            {
+                query_end_record(query);
+            }
+            else
+            {
+                query_display_last_error(query);
+            }
+            gnsdk_manager_gdo_release(response_gdo);
+            _drain_count(drain, &drain->answered);
+        }
+        else
+        {
+            record = query_begin_record(query);
+            record_string(record, "error", gnsdk_manager_error_info()->error_description);
+            record_int(record, "captured", (int64_t)entry->captured_ms);
+            record_int(record, "attempts", (int64_t)entry->attempts + 1);
+
+            b_retry = (entry->attempts + 1 < DRAIN_MAX_ATTEMPTS);
+            if (!b_retry)
+            {
+                _drain_count(drain, &drain->dropped);
+            }
+            else if (0 != _drain_requeue(drain, entry, entry->attempts + 1))
+            {
+                b_retry = GNSDK_FALSE;
+            }
+            record_string(record, "spooled", b_retry ? "again" : "no");
+            query_end_record(query);
+        }
+    }
+
+    if (musicid_handle)
+    {
+        gnsdk_musicid_query_release(musicid_handle);
+    }
+
+}   /* _drain_entry() */
+
+/***************************************************************************
+ *
+ *    _DRAIN_WORKER
+ *
+ * Look up entries of the spool being drained until there are none left
+ * or we are asked to stop.
+ *
+ ***************************************************************************/
+static void*
+_drain_worker(
+    void* arg
+    )
+{
+    drain_t* drain = (drain_t*)arg;
+    query_t  query = {0};
+    size_t   index = 0;
+
+    query.context    = drain->context;
+    query.b_tag_file = GNSDK_TRUE;
+    query.priority   = drain->context->priority;
+    query.out        = drain->context->output;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&drain->lock);
+        index = drain->context->b_stop ? drain->contents.count : drain->next_entry++;
+        pthread_mutex_unlock(&drain->lock);
+
+        if (index >= drain->contents.count)
+        {
+            break;
+        }
+
+        /* the clip's ID goes where a batch puts the path */
+        query.audio_file = drain->contents.entries[index].id;
+        query.records    = 0;
+        query_trace_start(&query);
+        _drain_entry(drain, &query, &drain->contents.entries[index]);
+        query_trace_finish(&query);
+    }
+
+    return GNSDK_NULL;
+
+}   /* _drain_worker() */
+
+/***************************************************************************
+ *
+ *    DRAIN_RUN
+ *
+ * Whatever isn't answered or dropped goes back on the live spool, and
+ * the spool drained is removed once all of it has.
+ *
+ ***************************************************************************/
+int
+drain_run(
+    query_context_t* context,
+    const char*      spool_path,
+    long             jobs
+    )
+{
+    drain_t      drain     = {0};
+    pthread_t*   workers   = GNSDK_NULL;
+    char*        draining  = GNSDK_NULL;
+    long         started   = 0;
+    gnsdk_bool_t b_resumed = GNSDK_FALSE;
+    gnsdk_bool_t b_sdk     = GNSDK_FALSE;
+    size_t       index     = 0;
+    int          rc        = 0;
+
+    if (jobs <= 0)
+    {
+        jobs = DRAIN_JOBS;
+    }
+
+    draining = malloc(strlen(spool_path) + sizeof(DRAIN_SUFFIX));
+    if (draining == GNSDK_NULL)
+    {
+        record_string(query_context_begin_record(context), "error", "Out of memory");
+        query_context_end_record(context);
+        return -1;
+    }
+    sprintf(draining, "%s%s", spool_path, DRAIN_SUFFIX);
+    drain.context = context;
+    pthread_mutex_init(&drain.lock, GNSDK_NULL);
+
+    /* a spool left by a drain that didn't finish goes first; the live
+     * spool keeps filling meanwhile */
+    if (0 == access(draining, F_OK))
+    {
+        b_resumed = GNSDK_TRUE;
+    }
+    else if (0 != rename(spool_path, draining) && errno != ENOENT)
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to move spool %s aside: %s", spool_path, strerror(errno));
+        query_context_end_record(context);
+        rc = -1;
+    }
+
+    if (0 == rc && 0 != spool_read(draining, &drain.contents) && errno != ENOENT)
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to read spool %s: %s", draining, strerror(errno));
+        query_context_end_record(context);
+        rc = -1;
+    }
+
+    if (0 == rc)
+    {
+        drain.spool = spool_open(spool_path);
+        if (drain.spool == GNSDK_NULL)
+        {
+            record_stringf(query_context_begin_record(context), "error", "Failed to open spool %s: %s", spool_path, strerror(errno));
+            query_context_end_record(context);
+            rc = -1;
+        }
+    }
+
+    if (0 == rc && drain.contents.count > 0)
+    {
+        rc = query_start_sdk(context, &drain.user_handle);
+        b_sdk = (0 == rc);
+    }
+
+    if (b_sdk)
+    {
+        /* stop handing out entries; those in flight are finished */
+        query_stop_on_signals(context);
+
+        if (jobs > (long)drain.contents.count)
+        {
+            jobs = (long)drain.contents.count;
+        }
+
+        workers = calloc((size_t)jobs, sizeof(pthread_t));
+        for (started = 0; workers && started < jobs; started++)
+        {
+            if (0 != pthread_create(&workers[started], GNSDK_NULL, _drain_worker, &drain))
+            {
+                break;
+            }
+        }
+        if (0 == started)
+        {
+            record_string(query_context_begin_record(context), "error", "Failed to start drain workers");
+            query_context_end_record(context);
+            rc = -1;
+        }
+        while (started > 0)
+        {
+            pthread_join(workers[--started], GNSDK_NULL);
+        }
+        free(workers);
+    }
+
+    /* what wasn't looked up waits for the next drain, as it was */
+    if (drain.spool)
+    {
+        for (index = drain.next_entry; index < drain.contents.count; index++)
+        {
+            _drain_requeue(&drain, &drain.contents.entries[index], drain.contents.entries[index].attempts);
+        }
+
+        if (0 == drain.lost)
+        {
+            unlink(draining);
+        }
+        else
+        {
+            record_stringf(query_context_begin_record(context), "error", "Kept %s: %lu fingerprints couldn't be put back on the spool", draining, drain.lost);
+            query_context_end_record(context);
+            rc = -1;
+        }
+
+        fprintf(stderr,
+            "{\"drain\": {\"entries\": %lu, \"answered\": %lu, \"spooled_again\": %lu, \"dropped\": %lu, \"damaged_bytes\": %lu, \"resumed\": %s}}\n",
+            (unsigned long)drain.contents.count,
+            drain.answered,
+            drain.requeued,
+            drain.dropped,
+            (unsigned long)drain.contents.damaged,
+            b_resumed ? "true" : "false"
+            );
+    }
+
+    if (b_sdk)
+    {
+        query_stop_sdk(context, drain.user_handle);
+    }
+
+    spool_close(drain.spool);
+    spool_contents_free(&drain.contents);
+    pthread_mutex_destroy(&drain.lock);
+    free(draining);
+
+    return rc;
+
+}   /* drain_run() */
+
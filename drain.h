@@ -0,0 +1,52 @@
+/*
+ *  Name: drain.h
+ *  Description:
+ *  Deferred lookups for capture boxes with a poor link. --fingerprint
+ *  fingerprints every input on a batch pool (batch.h) with MusicID
+ *  queries, without a channel or a lookup, and appends the fingerprints
+ *  to a spool file (spool.h). --drain later looks every spooled
+ *  fingerprint up and writes a record per clip, putting back on the
+ *  spool what couldn't be looked up.
+ */
+
+#ifndef DRAIN_H
+#define DRAIN_H
+
+#include "query.h"
+
+/* --drain: lookups in flight at once unless --jobs says otherwise; they
+ * wait on the service rather than on a core */
+#define DRAIN_JOBS 32
+
+/*
+ * Fingerprint every input on a pool of jobs workers (one per core if
+ * jobs is 0) and append the fingerprints to the spool at spool_path,
+ * with the input's path as the clip's ID and its mtime as when it was
+ * captured. One record is written per input, tagged with its path.
+ * The SDK is started by the first input and stopped here.
+ */
+int
+drain_fingerprint(
+    query_context_t* context,
+    const char*      spool_path,
+    long             jobs,
+    int              input_count,
+    char**           inputs
+    );
+
+/*
+ * Move the spool at spool_path aside (or carry on with one an earlier
+ * drain left) and look up every fingerprint in it with jobs lookups in
+ * flight (DRAIN_JOBS if jobs is 0), writing a record per clip tagged
+ * with its ID and capture time. Whatever isn't answered goes back on
+ * the live spool. On SIGINT or SIGTERM the lookups in flight are
+ * finished and the rest put back. How it went is reported on stderr.
+ */
+int
+drain_run(
+    query_context_t* context,
+    const char*      spool_path,
+    long             jobs
+    );
+
+#endif /* DRAIN_H */
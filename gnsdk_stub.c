@@ -0,0 +1,2046 @@
+/*
+ *  Name: gnsdk_stub.c
+ *  Description:
+ *  An offline stand-in for the parts of the Gracenote SDK that sample
+ *  uses (manager, user, locale, GDO, MusicID-Stream channel and MusicID
+ *  fingerprint query entry points), so that sample, bench and libidentify can be built and
+ *  load-tested without the SDK libraries or the service. Link it in
+ *  place of the gnsdk_* libraries; the SDK headers are still needed.
+ *
+ *  Answers come from a fixture file (GNSDK_STUB_FIXTURES) of canned
+ *  albums, one per line, tab separated:
+ *
+ *    hash  album  track  artist  [track number  [position ms  [duration ms]]]
+ *
+ *  where hash is the 64-bit FNV-1a hash, as 16 hex digits, of the first
+ *  GNSDK_STUB_MATCH_BYTES (529200, three seconds of 16 bit stereo at
+ *  44100 Hz) written to a channel after channel_identify(), or of all
+ *  of it if less is written before audio_end(). A hash of "*" matches
+ *  audio no other line does. Lines with the same hash are the albums of
+ *  one response, in order. Lines starting with # are ignored. With
+ *  GNSDK_STUB_TRACE set, the hash of every identification is written to
+ *  stderr, so fixtures can be made from the audio they are for.
+ *
+ *  A MusicID query hashes the audio written to its fingerprint the same
+ *  way, and the fingerprint data it gives is that hash ("stub:" and the
+ *  16 hex digits), so a fingerprint kept and looked up later finds the
+ *  albums its audio would have. find_albums() answers on the calling
+ *  thread, with the latencies and errors set below.
+ *
+ *  How the service behaves is set in the environment:
+ *
+ *    GNSDK_STUB_LATENCY_MS  min[-max]: each answer comes that long after
+ *                           the audio is in (uniformly between the two)
+ *    GNSDK_STUB_TAIL        fraction:ms: that fraction of answers take ms
+ *                           instead
+ *    GNSDK_STUB_ERROR_RATE  fraction of identifications that end in an
+ *                           error instead
+ *    GNSDK_STUB_MAX_IN_FLIGHT  identifications answered at once before
+ *                           more are refused with an error
+ *    GNSDK_STUB_CALLBACKS   thread (a thread per identification, as the
+ *                           SDK does), serial (one thread for every
+ *                           channel, in the order answers fall due) or
+ *                           inline (on the thread that wrote the audio,
+ *                           inside audio_write() or audio_end())
+ *    GNSDK_STUB_STARTUP_MS  added to user registration and locale loads
+ *    GNSDK_STUB_SEED        seed for the latencies and errors
+ *
+ *  What was asked of it is written to stderr as JSON at
+ *  gnsdk_manager_shutdown().
+ */
+
+#include "gnsdk.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* failures are composed as the SDK's are, with the high bit set */
+#define STUB_ERROR(code)       ((gnsdk_error_t)(0x90000000u | (code)))
+#define STUB_ERR_INVALID_ARG   STUB_ERROR(0x0001)
+#define STUB_ERR_NO_MEMORY     STUB_ERROR(0x0002)
+#define STUB_ERR_NOT_FOUND     STUB_ERROR(0x0003)
+#define STUB_ERR_TIMEOUT       STUB_ERROR(0x0004)
+#define STUB_ERR_BUSY          STUB_ERROR(0x0005)
+#define STUB_ERR_SERVICE       STUB_ERROR(0x0006)
+
+#define STUB_MATCH_BYTES       (44100 * 2 * 2 * 3)
+
+/* a fingerprint is the hash of the audio it was made from, after this */
+#define STUB_FP_PREFIX         "stub:"
+
+#define FNV_OFFSET             0xcbf29ce484222325ULL
+#define FNV_PRIME              0x100000001b3ULL
+
+
+/* One line of the fixture file */
+typedef struct
+{
+    uint64_t hash;
+    int      b_any;           /* "*": for audio no other line matches */
+    char*    album;
+    char*    track;
+    char*    artist;
+    char*    track_number;
+    char*    position_ms;     /* NULL if not given */
+    char*    duration_ms;     /* NULL if not given */
+
+} stub_album_t;
+
+typedef enum
+{
+    STUB_GDO_RESPONSE,
+    STUB_GDO_ALBUM,
+    STUB_GDO_TRACK,
+    STUB_GDO_ARTIST,
+    STUB_GDO_TITLE            /* TITLE_OFFICIAL or NAME_OFFICIAL: just a display value */
+
+} stub_gdo_kind_t;
+
+typedef struct
+{
+    stub_gdo_kind_t      kind;
+    const stub_album_t** albums;   /* STUB_GDO_RESPONSE */
+    gnsdk_uint32_t       count;
+    const stub_album_t*  album;    /* the rest */
+    stub_album_t*        owned;    /* an album made by gdo_create_from_xml() */
+    const char*          display;  /* STUB_GDO_TITLE */
+    int                  b_owned;  /* a response from find_albums(), which the caller releases */
+
+} stub_gdo_t;
+
+typedef enum
+{
+    STUB_IDLE,                /* no identification asked for */
+    STUB_LISTENING,           /* asked for, hashing the audio */
+    STUB_PENDING,             /* the audio is in, the answer on its way */
+    STUB_ANSWERING,           /* the callbacks are being called */
+    STUB_DONE                 /* answered */
+
+} stub_state_t;
+
+/* What an identification will be answered with */
+typedef struct
+{
+    gnsdk_error_t        error;    /* GNSDK_SUCCESS for a response */
+    const char*          description;
+    const stub_album_t** albums;
+    gnsdk_uint32_t       count;
+    int                  b_in_flight;  /* counted in stub_stats_t.in_flight */
+
+} stub_answer_t;
+
+typedef struct stub_channel_s
+{
+    gnsdk_musicidstream_callbacks_t callbacks;
+    const gnsdk_void_t*             callback_data;
+    stub_state_t                    state;
+    unsigned long                   generation;  /* changed by identify and cancel, so a stale answer is dropped */
+    uint64_t                        hash;
+    size_t                          hashed;
+    stub_answer_t                   answer;
+    double                          due;
+    pthread_t                       thread;       /* GNSDK_STUB_CALLBACKS=thread */
+    int                             b_thread;
+    pthread_mutex_t                 lock;
+    pthread_cond_t                  changed;
+
+} stub_channel_t;
+
+/* A MusicID query, fingerprinting audio written to it or holding a
+ * fingerprint made earlier */
+typedef struct
+{
+    uint64_t hash;
+    size_t   hashed;
+    int      b_fingerprinting;  /* between fingerprint_begin() and fingerprint_end() */
+    int      b_fp;              /* fp is a fingerprint */
+    char     fp[32];
+
+} stub_query_t;
+
+/* An answer waiting for the serial callback thread */
+typedef struct stub_due_s
+{
+    struct stub_due_s* next;
+    stub_channel_t*    channel;
+    unsigned long      generation;
+    double             due;
+
+} stub_due_t;
+
+typedef enum
+{
+    STUB_CALLBACKS_THREAD,
+    STUB_CALLBACKS_SERIAL,
+    STUB_CALLBACKS_INLINE
+
+} stub_callbacks_t;
+
+typedef struct
+{
+    unsigned long identifications;
+    unsigned long matches;
+    unsigned long no_matches;
+    unsigned long errors;        /* injected by GNSDK_STUB_ERROR_RATE */
+    unsigned long refused;       /* over GNSDK_STUB_MAX_IN_FLIGHT */
+    unsigned long cancelled;
+    unsigned long in_flight;
+    unsigned long peak_in_flight;
+    unsigned long channels;
+    unsigned long peak_channels;
+
+} stub_stats_t;
+
+/* settings, read by gnsdk_manager_initialize() */
+static stub_album_t*    s_albums;
+static size_t           s_album_count;
+static size_t           s_match_bytes   = STUB_MATCH_BYTES;
+static double           s_latency_min;
+static double           s_latency_max;
+static double           s_tail_fraction;
+static double           s_tail_seconds;
+static double           s_error_rate;
+static unsigned long    s_max_in_flight;
+static stub_callbacks_t s_callbacks     = STUB_CALLBACKS_THREAD;
+static double           s_startup_seconds;
+static int              s_b_trace;
+
+static stub_stats_t     s_stats;
+static unsigned short   s_random[3];
+static pthread_mutex_t  s_lock = PTHREAD_MUTEX_INITIALIZER;   /* guards s_stats and s_random */
+
+/* GNSDK_STUB_CALLBACKS=serial */
+static stub_due_t*      s_due;
+static stub_channel_t*  s_delivering;
+static pthread_t        s_serial_thread;
+static int              s_b_serial_thread;
+static int              s_b_serial_stop;
+static pthread_mutex_t  s_serial_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   s_serial_changed = PTHREAD_COND_INITIALIZER;
+
+static pthread_key_t    s_error_key;
+static pthread_once_t   s_error_key_once = PTHREAD_ONCE_INIT;
+static const gnsdk_error_info_t s_no_error = { GNSDK_SUCCESS, GNSDK_SUCCESS, "", "", "", "" };
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+/******************************************************************
+ *
+ *    _NOW
+ *
+ *****************************************************************/
+static double
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+
+} /* _now() */
+
+/******************************************************************
+ *
+ *    _DEADLINE
+ *
+ *    when as a timespec for pthread_cond_timedwait().
+ *
+ *****************************************************************/
+static struct timespec
+_deadline(
+    double when
+    )
+{
+    struct timespec ts;
+
+    ts.tv_sec  = (time_t)when;
+    ts.tv_nsec = (long)((when - (double)ts.tv_sec) * 1e9);
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    return ts;
+
+} /* _deadline() */
+
+/******************************************************************
+ *
+ *    _SLEEP
+ *
+ *****************************************************************/
+static void
+_sleep(
+    double seconds
+    )
+{
+    struct timespec ts;
+
+    if (seconds > 0)
+    {
+        ts.tv_sec  = (time_t)seconds;
+        ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+        while (0 != nanosleep(&ts, &ts) && errno == EINTR)
+        {
+        }
+    }
+
+} /* _sleep() */
+
+/******************************************************************
+ *
+ *    _RANDOM
+ *
+ *    Uniform in [0, 1), from the GNSDK_STUB_SEED sequence.
+ *
+ *****************************************************************/
+static double
+_random(void)
+{
+    double value = 0;
+
+    pthread_mutex_lock(&s_lock);
+    value = erand48(s_random);
+    pthread_mutex_unlock(&s_lock);
+
+    return value;
+
+} /* _random() */
+
+/******************************************************************
+ *
+ *    _SET_ERROR
+ *
+ *    Keep error as the calling thread's last, for
+ *    gnsdk_manager_error_info(), and return it.
+ *
+ *****************************************************************/
+static void
+_make_error_key(void)
+{
+    pthread_key_create(&s_error_key, free);
+}
+
+static gnsdk_error_t
+_set_error(
+    gnsdk_error_t error,
+    const char*   description,
+    const char*   api
+    )
+{
+    gnsdk_error_info_t* info = GNSDK_NULL;
+
+    pthread_once(&s_error_key_once, _make_error_key);
+    info = pthread_getspecific(s_error_key);
+    if (info == GNSDK_NULL)
+    {
+        info = calloc(1, sizeof(*info));
+        if (info == GNSDK_NULL)
+        {
+            return error;
+        }
+        pthread_setspecific(s_error_key, info);
+    }
+
+    info->error_code          = error;
+    info->source_error_code   = error;
+    info->error_description   = description;
+    info->error_api           = api;
+    info->error_module        = "gnsdk_stub";
+    info->source_error_module = "gnsdk_stub";
+
+    return error;
+
+} /* _set_error() */
+
+/******************************************************************
+ *
+ *    _ENV_DOUBLE
+ *
+ *****************************************************************/
+static double
+_env_double(
+    const char* name,
+    double      fallback
+    )
+{
+    const char* value = getenv(name);
+
+    return (value && *value) ? strtod(value, GNSDK_NULL) : fallback;
+
+} /* _env_double() */
+
+/******************************************************************
+ *
+ *    _READ_SETTINGS
+ *
+ *****************************************************************/
+static void
+_read_settings(void)
+{
+    const char* value = GNSDK_NULL;
+    char*       end   = GNSDK_NULL;
+    long        seed  = 0;
+
+    s_match_bytes = (size_t)_env_double("GNSDK_STUB_MATCH_BYTES", STUB_MATCH_BYTES);
+    if (0 == s_match_bytes)
+    {
+        s_match_bytes = STUB_MATCH_BYTES;
+    }
+
+    s_latency_min = s_latency_max = 0;
+    value = getenv("GNSDK_STUB_LATENCY_MS");
+    if (value && *value)
+    {
+        s_latency_min = s_latency_max = strtod(value, &end) / 1e3;
+        if (*end == '-')
+        {
+            s_latency_max = strtod(end + 1, GNSDK_NULL) / 1e3;
+        }
+        if (s_latency_max < s_latency_min)
+        {
+            s_latency_max = s_latency_min;
+        }
+    }
+
+    s_tail_fraction = s_tail_seconds = 0;
+    value = getenv("GNSDK_STUB_TAIL");
+    if (value && *value)
+    {
+        s_tail_fraction = strtod(value, &end);
+        if (*end == ':')
+        {
+            s_tail_seconds = strtod(end + 1, GNSDK_NULL) / 1e3;
+        }
+    }
+
+    s_error_rate      = _env_double("GNSDK_STUB_ERROR_RATE", 0);
+    s_max_in_flight   = (unsigned long)_env_double("GNSDK_STUB_MAX_IN_FLIGHT", 0);
+    s_startup_seconds = _env_double("GNSDK_STUB_STARTUP_MS", 0) / 1e3;
+    s_b_trace         = getenv("GNSDK_STUB_TRACE") != GNSDK_NULL;
+
+    value = getenv("GNSDK_STUB_CALLBACKS");
+    s_callbacks = STUB_CALLBACKS_THREAD;
+    if (value && 0 == strcmp(value, "serial"))
+    {
+        s_callbacks = STUB_CALLBACKS_SERIAL;
+    }
+    else if (value && 0 == strcmp(value, "inline"))
+    {
+        s_callbacks = STUB_CALLBACKS_INLINE;
+    }
+
+    seed = (long)_env_double("GNSDK_STUB_SEED", (double)getpid());
+    s_random[0] = 0x330e;
+    s_random[1] = (unsigned short)seed;
+    s_random[2] = (unsigned short)(seed >> 16);
+
+} /* _read_settings() */
+
+/******************************************************************
+ *
+ *    _FREE_ALBUM
+ *
+ *****************************************************************/
+static void
+_free_album(
+    stub_album_t* album
+    )
+{
+    free(album->album);
+    free(album->track);
+    free(album->artist);
+    free(album->track_number);
+    free(album->position_ms);
+    free(album->duration_ms);
+
+} /* _free_album() */
+
+/******************************************************************
+ *
+ *    _FREE_FIXTURES
+ *
+ *****************************************************************/
+static void
+_free_fixtures(void)
+{
+    size_t i = 0;
+
+    for (i = 0; i < s_album_count; i++)
+    {
+        _free_album(&s_albums[i]);
+    }
+    free(s_albums);
+    s_albums      = GNSDK_NULL;
+    s_album_count = 0;
+
+} /* _free_fixtures() */
+
+/******************************************************************
+ *
+ *    _LOAD_FIXTURES
+ *
+ *    Read the albums of GNSDK_STUB_FIXTURES, if it is set. Returns -1
+ *    if it can't be read or a line can't be used.
+ *
+ *****************************************************************/
+static int
+_load_fixtures(void)
+{
+    const char*   path     = getenv("GNSDK_STUB_FIXTURES");
+    FILE*         file     = GNSDK_NULL;
+    char*         line     = GNSDK_NULL;
+    size_t        line_cap = 0;
+    ssize_t       length   = 0;
+    char*         fields[7];
+    size_t        count    = 0;
+    size_t        capacity = 0;
+    stub_album_t* albums   = GNSDK_NULL;
+    stub_album_t* album    = GNSDK_NULL;
+    char*         end      = GNSDK_NULL;
+    int           rc       = 0;
+
+    if (path == GNSDK_NULL || *path == '\0')
+    {
+        return 0;
+    }
+
+    file = fopen(path, "r");
+    if (file == GNSDK_NULL)
+    {
+        fprintf(stderr, "gnsdk_stub: can't read %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (0 == rc && (length = getline(&line, &line_cap, file)) >= 0)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            line[--length] = '\0';
+        }
+        if (length == 0 || line[0] == '#')
+        {
+            continue;
+        }
+
+        memset(fields, 0, sizeof(fields));
+        fields[0] = line;
+        for (count = 1, end = line; count < 7 && (end = strchr(end, '\t')) != GNSDK_NULL; count++)
+        {
+            *end++          = '\0';
+            fields[count] = end;
+        }
+        if (count < 4)
+        {
+            fprintf(stderr, "gnsdk_stub: %s: want hash, album, track and artist: %s\n", path, line);
+            rc = -1;
+            break;
+        }
+
+        if (s_album_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            albums   = realloc(s_albums, capacity * sizeof(*albums));
+            if (albums == GNSDK_NULL)
+            {
+                rc = -1;
+                break;
+            }
+            s_albums = albums;
+        }
+
+        album = &s_albums[s_album_count];
+        memset(album, 0, sizeof(*album));
+        album->b_any = (0 == strcmp(fields[0], "*"));
+        if (!album->b_any)
+        {
+            album->hash = strtoull(fields[0], &end, 16);
+            if (*end != '\0' || end == fields[0])
+            {
+                fprintf(stderr, "gnsdk_stub: %s: bad hash %s\n", path, fields[0]);
+                rc = -1;
+                break;
+            }
+        }
+        album->album        = strdup(fields[1]);
+        album->track        = strdup(fields[2]);
+        album->artist       = strdup(fields[3]);
+        album->track_number = strdup(fields[4] ? fields[4] : "1");
+        album->position_ms  = fields[5] ? strdup(fields[5]) : GNSDK_NULL;
+        album->duration_ms  = fields[6] ? strdup(fields[6]) : GNSDK_NULL;
+        s_album_count++;
+    }
+
+    free(line);
+    fclose(file);
+    if (0 != rc)
+    {
+        _free_fixtures();
+    }
+
+    return rc;
+
+} /* _load_fixtures() */
+
+/******************************************************************
+ *
+ *    _MATCH
+ *
+ *    The albums of hash (or of "*"), as an array in *p_albums the
+ *    caller frees. Returns how many; 0 with *p_albums NULL for none.
+ *
+ *****************************************************************/
+static gnsdk_uint32_t
+_match(
+    uint64_t              hash,
+    const stub_album_t*** p_albums
+    )
+{
+    const stub_album_t** albums = GNSDK_NULL;
+    gnsdk_uint32_t       count  = 0;
+    size_t               i      = 0;
+    int                  pass   = 0;
+
+    *p_albums = GNSDK_NULL;
+
+    /* the albums of the hash itself, or else those of "*" */
+    for (pass = 0; pass < 2 && 0 == count; pass++)
+    {
+        for (i = 0; i < s_album_count; i++)
+        {
+            if (pass ? s_albums[i].b_any : (!s_albums[i].b_any && s_albums[i].hash == hash))
+            {
+                if (albums == GNSDK_NULL)
+                {
+                    albums = calloc(s_album_count, sizeof(*albums));
+                    if (albums == GNSDK_NULL)
+                    {
+                        return 0;
+                    }
+                }
+                albums[count++] = &s_albums[i];
+            }
+        }
+    }
+
+    *p_albums = albums;
+
+    return count;
+
+} /* _match() */
+
+/******************************************************************
+ *
+ *    _NEW_GDO
+ *
+ *****************************************************************/
+static gnsdk_gdo_handle_t
+_new_gdo(
+    stub_gdo_kind_t     kind,
+    const stub_album_t* album,
+    const char*         display
+    )
+{
+    stub_gdo_t* gdo = calloc(1, sizeof(*gdo));
+
+    if (gdo)
+    {
+        gdo->kind    = kind;
+        gdo->album   = album;
+        gdo->display = display;
+    }
+
+    return (gnsdk_gdo_handle_t)gdo;
+
+} /* _new_gdo() */
+
+/******************************************************************
+ *
+ *    _XML_TEXT
+ *
+ *    The text of the first element named by the tags, each looked
+ *    for after the one before (so "<ARTIST>", "<DISPLAY>" is the
+ *    first display value within the artist), as a new string.
+ *
+ *****************************************************************/
+static char*
+_xml_text(
+    const char* xml,
+    const char* first,
+    const char* second,
+    const char* third
+    )
+{
+    const char* tags[3] = { first, second, third };
+    const char* at      = xml;
+    const char* end     = GNSDK_NULL;
+    size_t      i       = 0;
+
+    for (i = 0; i < 3 && tags[i] && at; i++)
+    {
+        at = strstr(at, tags[i]);
+        if (at)
+        {
+            at += strlen(tags[i]);
+        }
+    }
+
+    end = at ? strchr(at, '<') : GNSDK_NULL;
+
+    return end ? strndup(at, (size_t)(end - at)) : GNSDK_NULL;
+
+} /* _xml_text() */
+
+/******************************************************************
+ *
+ *    _STATS_ADD
+ *
+ *****************************************************************/
+static void
+_stats_add(
+    unsigned long* p_counter,
+    long           delta
+    )
+{
+    pthread_mutex_lock(&s_lock);
+    *p_counter += (unsigned long)delta;
+    if (s_stats.in_flight > s_stats.peak_in_flight)
+    {
+        s_stats.peak_in_flight = s_stats.in_flight;
+    }
+    if (s_stats.channels > s_stats.peak_channels)
+    {
+        s_stats.peak_channels = s_stats.channels;
+    }
+    pthread_mutex_unlock(&s_lock);
+
+} /* _stats_add() */
+
+/******************************************************************
+ *
+ *    _DELIVER
+ *
+ *    Give the answer of generation to the channel's callbacks, in
+ *    the order the SDK does, unless it was cancelled meanwhile.
+ *
+ *****************************************************************/
+static void
+_deliver(
+    stub_channel_t* channel,
+    unsigned long   generation
+    )
+{
+    gnsdk_musicidstream_callbacks_t* callbacks = &channel->callbacks;
+    gnsdk_void_t*                    data      = (gnsdk_void_t*)channel->callback_data;
+    gnsdk_musicidstream_channel_handle_t handle = (gnsdk_musicidstream_channel_handle_t)channel;
+    stub_answer_t                    answer;
+    stub_gdo_t                       response  = { STUB_GDO_RESPONSE, GNSDK_NULL, 0, GNSDK_NULL, GNSDK_NULL, GNSDK_NULL, 0 };
+    gnsdk_error_info_t               info      = s_no_error;
+    gnsdk_bool_t                     b_abort   = GNSDK_FALSE;
+
+    pthread_mutex_lock(&channel->lock);
+    if (channel->generation != generation || channel->state != STUB_PENDING)
+    {
+        pthread_mutex_unlock(&channel->lock);
+        return;
+    }
+    answer = channel->answer;
+    memset(&channel->answer, 0, sizeof(channel->answer));
+    channel->state = STUB_ANSWERING;
+    if (answer.b_in_flight)
+    {
+        _stats_add(&s_stats.in_flight, -1);
+    }
+    pthread_mutex_unlock(&channel->lock);
+
+    if (callbacks->callback_identifying_status)
+    {
+        callbacks->callback_identifying_status(data, gnsdk_musicidstream_identifying_started, &b_abort);
+        callbacks->callback_identifying_status(data, gnsdk_musicidstream_identifying_fp_generated, &b_abort);
+        callbacks->callback_identifying_status(data, gnsdk_musicidstream_identifying_online_query_started, &b_abort);
+        callbacks->callback_identifying_status(data, gnsdk_musicidstream_identifying_online_query_ended, &b_abort);
+    }
+
+    if (GNSDK_SUCCESS != answer.error)
+    {
+        info.error_code          = answer.error;
+        info.source_error_code   = answer.error;
+        info.error_description   = answer.description;
+        info.error_api           = "gnsdk_musicidstream_channel_identify";
+        info.error_module        = "gnsdk_stub";
+        info.source_error_module = "gnsdk_stub";
+        if (callbacks->callback_error)
+        {
+            callbacks->callback_error(data, handle, &info);
+        }
+    }
+    else if (callbacks->callback_result_available)
+    {
+        response.albums = answer.albums;
+        response.count  = answer.count;
+        callbacks->callback_result_available(data, handle, (gnsdk_gdo_handle_t)&response, &b_abort);
+    }
+    free(answer.albums);
+
+    if (callbacks->callback_identifying_status)
+    {
+        callbacks->callback_identifying_status(data, gnsdk_musicidstream_identifying_ended, &b_abort);
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    if (channel->generation == generation)
+    {
+        channel->state = STUB_DONE;
+    }
+    pthread_cond_broadcast(&channel->changed);
+    pthread_mutex_unlock(&channel->lock);
+
+} /* _deliver() */
+
+/******************************************************************
+ *
+ *    _ANSWER_THREAD
+ *
+ *    GNSDK_STUB_CALLBACKS=thread: wait until the answer is due, or
+ *    cancelled, then deliver it.
+ *
+ *****************************************************************/
+typedef struct
+{
+    stub_channel_t* channel;
+    unsigned long   generation;
+
+} stub_answer_job_t;
+
+static void*
+_answer_thread(
+    void* p_job
+    )
+{
+    stub_answer_job_t job = *(stub_answer_job_t*)p_job;
+    struct timespec   ts  = _deadline(job.channel->due);
+
+    free(p_job);
+
+    pthread_mutex_lock(&job.channel->lock);
+    while (job.channel->generation == job.generation
+           && 0 == pthread_cond_timedwait(&job.channel->changed, &job.channel->lock, &ts))
+    {
+    }
+    pthread_mutex_unlock(&job.channel->lock);
+
+    _deliver(job.channel, job.generation);
+
+    return GNSDK_NULL;
+
+} /* _answer_thread() */
+
+/******************************************************************
+ *
+ *    _SERIAL_THREAD
+ *
+ *    GNSDK_STUB_CALLBACKS=serial: deliver every channel's answers
+ *    one at a time, in the order they fall due.
+ *
+ *****************************************************************/
+static void*
+_serial_thread(
+    void* unused
+    )
+{
+    stub_due_t*     due = GNSDK_NULL;
+    struct timespec ts;
+
+    pthread_mutex_lock(&s_serial_lock);
+    while (!s_b_serial_stop)
+    {
+        due = s_due;
+        if (due == GNSDK_NULL)
+        {
+            pthread_cond_wait(&s_serial_changed, &s_serial_lock);
+            continue;
+        }
+        if (due->due > _now())
+        {
+            ts = _deadline(due->due);
+            pthread_cond_timedwait(&s_serial_changed, &s_serial_lock, &ts);
+            continue;
+        }
+
+        s_due        = due->next;
+        s_delivering = due->channel;
+        pthread_mutex_unlock(&s_serial_lock);
+
+        _deliver(due->channel, due->generation);
+        free(due);
+
+        pthread_mutex_lock(&s_serial_lock);
+        s_delivering = GNSDK_NULL;
+        pthread_cond_broadcast(&s_serial_changed);
+    }
+    pthread_mutex_unlock(&s_serial_lock);
+
+    (void)unused;
+    return GNSDK_NULL;
+
+} /* _serial_thread() */
+
+/******************************************************************
+ *
+ *    _SERIAL_FORGET
+ *
+ *    Drop the channel's answers still waiting for the serial thread,
+ *    and wait out one being delivered, so it can be freed.
+ *
+ *****************************************************************/
+static void
+_serial_forget(
+    stub_channel_t* channel
+    )
+{
+    stub_due_t** p_due = GNSDK_NULL;
+    stub_due_t*  due   = GNSDK_NULL;
+
+    pthread_mutex_lock(&s_serial_lock);
+    for (p_due = &s_due; *p_due; )
+    {
+        due = *p_due;
+        if (due->channel == channel)
+        {
+            *p_due = due->next;
+            free(due);
+        }
+        else
+        {
+            p_due = &due->next;
+        }
+    }
+    while (s_delivering == channel)
+    {
+        pthread_cond_wait(&s_serial_changed, &s_serial_lock);
+    }
+    pthread_mutex_unlock(&s_serial_lock);
+
+} /* _serial_forget() */
+
+/******************************************************************
+ *
+ *    _DECIDE
+ *
+ *    What an identification of the audio with hash (of hashed bytes)
+ *    is answered with: refused if too many are in flight, an injected
+ *    error, or the albums it matches. Returns the seconds the answer
+ *    takes to arrive.
+ *
+ *****************************************************************/
+static double
+_decide(
+    stub_answer_t* answer,
+    uint64_t       hash,
+    size_t         hashed
+    )
+{
+    double latency   = 0;
+    int    b_refused = 0;
+
+    memset(answer, 0, sizeof(*answer));
+
+    pthread_mutex_lock(&s_lock);
+    s_stats.identifications++;
+    b_refused = (s_max_in_flight > 0 && s_stats.in_flight >= s_max_in_flight);
+    if (!b_refused)
+    {
+        answer->b_in_flight = 1;
+        s_stats.in_flight++;
+        if (s_stats.in_flight > s_stats.peak_in_flight)
+        {
+            s_stats.peak_in_flight = s_stats.in_flight;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    if (b_refused)
+    {
+        answer->error       = STUB_ERR_BUSY;
+        answer->description = "Too many identifications in flight";
+        _stats_add(&s_stats.refused, 1);
+    }
+    else if (s_error_rate > 0 && _random() < s_error_rate)
+    {
+        answer->error       = STUB_ERR_SERVICE;
+        answer->description = "Injected service error";
+        _stats_add(&s_stats.errors, 1);
+    }
+    else
+    {
+        answer->count = _match(hash, &answer->albums);
+        _stats_add(answer->count ? &s_stats.matches : &s_stats.no_matches, 1);
+    }
+
+    if (s_b_trace)
+    {
+        fprintf(stderr,
+            "{\"gnsdk_stub\": {\"hash\": \"%016llx\", \"bytes\": %lu, \"albums\": %u}}\n",
+            (unsigned long long)hash,
+            (unsigned long)hashed,
+            answer->count
+            );
+    }
+
+    latency = s_latency_min + (s_latency_max - s_latency_min) * _random();
+    if (s_tail_fraction > 0 && _random() < s_tail_fraction)
+    {
+        latency = s_tail_seconds;
+    }
+
+    return latency;
+
+} /* _decide() */
+
+/******************************************************************
+ *
+ *    _ANSWER
+ *
+ *    The audio for the identification is in: decide what it is
+ *    answered with and when, and send the answer on its way. Called
+ *    with the channel locked, which it unlocks.
+ *
+ *****************************************************************/
+static gnsdk_error_t
+_answer(
+    stub_channel_t* channel
+    )
+{
+    stub_answer_job_t* job        = GNSDK_NULL;
+    stub_due_t*        due        = GNSDK_NULL;
+    stub_due_t**       p_due      = GNSDK_NULL;
+    unsigned long      generation = channel->generation;
+    double             latency    = 0;
+
+    channel->state = STUB_PENDING;
+    latency        = _decide(&channel->answer, channel->hash, channel->hashed);
+    channel->due   = _now() + latency;
+
+    switch (s_callbacks)
+    {
+    case STUB_CALLBACKS_INLINE:
+        pthread_mutex_unlock(&channel->lock);
+        _sleep(latency);
+        _deliver(channel, generation);
+        return GNSDK_SUCCESS;
+
+    case STUB_CALLBACKS_SERIAL:
+        pthread_mutex_unlock(&channel->lock);
+        due = calloc(1, sizeof(*due));
+        if (due == GNSDK_NULL)
+        {
+            break;
+        }
+        due->channel    = channel;
+        due->generation = generation;
+        due->due        = channel->due;
+
+        pthread_mutex_lock(&s_serial_lock);
+        if (!s_b_serial_thread)
+        {
+            s_b_serial_stop   = 0;
+            s_b_serial_thread = (0 == pthread_create(&s_serial_thread, GNSDK_NULL, _serial_thread, GNSDK_NULL));
+        }
+        for (p_due = &s_due; *p_due && (*p_due)->due <= due->due; p_due = &(*p_due)->next)
+        {
+        }
+        due->next = *p_due;
+        *p_due    = due;
+        pthread_cond_broadcast(&s_serial_changed);
+        pthread_mutex_unlock(&s_serial_lock);
+        return GNSDK_SUCCESS;
+
+    case STUB_CALLBACKS_THREAD:
+    default:
+        /* the last answer's thread has delivered or been cancelled */
+        if (channel->b_thread)
+        {
+            pthread_mutex_unlock(&channel->lock);
+            pthread_join(channel->thread, GNSDK_NULL);
+            pthread_mutex_lock(&channel->lock);
+            channel->b_thread = 0;
+        }
+        job = malloc(sizeof(*job));
+        if (job)
+        {
+            job->channel    = channel;
+            job->generation = generation;
+            channel->b_thread = (0 == pthread_create(&channel->thread, GNSDK_NULL, _answer_thread, job));
+            if (!channel->b_thread)
+            {
+                free(job);
+                job = GNSDK_NULL;
+            }
+        }
+        pthread_mutex_unlock(&channel->lock);
+        if (job)
+        {
+            return GNSDK_SUCCESS;
+        }
+        break;
+    }
+
+    /* couldn't hand it on, so answer here */
+    _deliver(channel, generation);
+    return GNSDK_SUCCESS;
+
+} /* _answer() */
+
+/******************************************************************
+ *
+ *    _CANCEL
+ *
+ *    Forget any identification in progress. Called with the channel
+ *    locked.
+ *
+ *****************************************************************/
+static void
+_cancel(
+    stub_channel_t* channel
+    )
+{
+    channel->generation++;
+    if (channel->state == STUB_PENDING)
+    {
+        if (channel->answer.b_in_flight)
+        {
+            _stats_add(&s_stats.in_flight, -1);
+        }
+        free(channel->answer.albums);
+        memset(&channel->answer, 0, sizeof(channel->answer));
+    }
+    if (channel->state == STUB_PENDING || channel->state == STUB_LISTENING || channel->state == STUB_ANSWERING)
+    {
+        _stats_add(&s_stats.cancelled, 1);
+    }
+    channel->state = STUB_IDLE;
+    pthread_cond_broadcast(&channel->changed);
+
+} /* _cancel() */
+
+/**********************************************
+ *    Manager
+ **********************************************/
+
+const gnsdk_error_info_t*
+gnsdk_manager_error_info(void)
+{
+    const gnsdk_error_info_t* info = GNSDK_NULL;
+
+    pthread_once(&s_error_key_once, _make_error_key);
+    info = pthread_getspecific(s_error_key);
+
+    return info ? info : &s_no_error;
+}
+
+gnsdk_error_t
+gnsdk_manager_initialize(
+    gnsdk_manager_handle_t* p_sdkmgr_handle,
+    gnsdk_cstr_t            license_data,
+    gnsdk_size_t            license_data_len
+    )
+{
+    static int s_manager;
+
+    _read_settings();
+    _free_fixtures();
+    memset(&s_stats, 0, sizeof(s_stats));
+    if (0 != _load_fixtures())
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "GNSDK_STUB_FIXTURES can't be used", "gnsdk_manager_initialize");
+    }
+
+    *p_sdkmgr_handle = (gnsdk_manager_handle_t)&s_manager;
+
+    GNSDK_UNUSED(license_data);
+    GNSDK_UNUSED(license_data_len);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_shutdown(void)
+{
+    pthread_mutex_lock(&s_serial_lock);
+    s_b_serial_stop = 1;
+    pthread_cond_broadcast(&s_serial_changed);
+    pthread_mutex_unlock(&s_serial_lock);
+    if (s_b_serial_thread)
+    {
+        pthread_join(s_serial_thread, GNSDK_NULL);
+        s_b_serial_thread = 0;
+    }
+
+    fprintf(stderr,
+        "{\"gnsdk_stub\": {\"identifications\": %lu, \"matches\": %lu, \"no_matches\": %lu, \"errors\": %lu, \"refused\": %lu, \"cancelled\": %lu, \"peak_in_flight\": %lu, \"peak_channels\": %lu}}\n",
+        s_stats.identifications,
+        s_stats.matches,
+        s_stats.no_matches,
+        s_stats.errors,
+        s_stats.refused,
+        s_stats.cancelled,
+        s_stats.peak_in_flight,
+        s_stats.peak_channels
+        );
+
+    _free_fixtures();
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_logging_enable(
+    gnsdk_cstr_t   log_file_path,
+    gnsdk_uint32_t package_id,
+    gnsdk_uint32_t filter_mask,
+    gnsdk_uint32_t options_mask,
+    gnsdk_size_t   max_size,
+    gnsdk_bool_t   b_archive
+    )
+{
+    GNSDK_UNUSED(log_file_path);
+    GNSDK_UNUSED(package_id);
+    GNSDK_UNUSED(filter_mask);
+    GNSDK_UNUSED(options_mask);
+    GNSDK_UNUSED(max_size);
+    GNSDK_UNUSED(b_archive);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_string_free(
+    gnsdk_cstr_t string
+    )
+{
+    free((void*)string);
+    return GNSDK_SUCCESS;
+}
+
+/**********************************************
+ *    Users and locales
+ **********************************************/
+
+gnsdk_error_t
+gnsdk_manager_user_register(
+    gnsdk_cstr_t register_mode,
+    gnsdk_cstr_t client_id,
+    gnsdk_cstr_t client_id_tag,
+    gnsdk_cstr_t client_app_version,
+    gnsdk_str_t* p_serialized_user
+    )
+{
+    _sleep(s_startup_seconds);
+
+    *p_serialized_user = strdup("gnsdk_stub_user");
+    if (*p_serialized_user == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_NO_MEMORY, "Out of memory", "gnsdk_manager_user_register");
+    }
+
+    GNSDK_UNUSED(register_mode);
+    GNSDK_UNUSED(client_id);
+    GNSDK_UNUSED(client_id_tag);
+    GNSDK_UNUSED(client_app_version);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_user_create(
+    gnsdk_cstr_t         serialized_user,
+    gnsdk_cstr_t         client_id,
+    gnsdk_user_handle_t* p_user_handle
+    )
+{
+    static int s_user;
+
+    if (serialized_user == GNSDK_NULL || *serialized_user == '\0')
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "No serialized user", "gnsdk_manager_user_create");
+    }
+
+    *p_user_handle = (gnsdk_user_handle_t)&s_user;
+
+    GNSDK_UNUSED(client_id);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_user_is_localonly(
+    gnsdk_user_handle_t user_handle,
+    gnsdk_bool_t*       pb_localonly
+    )
+{
+    *pb_localonly = GNSDK_FALSE;
+
+    GNSDK_UNUSED(user_handle);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_user_release(
+    gnsdk_user_handle_t user_handle
+    )
+{
+    GNSDK_UNUSED(user_handle);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_locale_load(
+    gnsdk_cstr_t             locale_group,
+    gnsdk_cstr_t             language,
+    gnsdk_cstr_t             region,
+    gnsdk_cstr_t             descriptor,
+    gnsdk_user_handle_t      user_handle,
+    gnsdk_status_callback_fn callback_fn,
+    const gnsdk_void_t*      callback_data,
+    gnsdk_locale_handle_t*   p_locale_handle
+    )
+{
+    static int s_locale;
+
+    _sleep(s_startup_seconds);
+
+    *p_locale_handle = (gnsdk_locale_handle_t)&s_locale;
+
+    GNSDK_UNUSED(locale_group);
+    GNSDK_UNUSED(language);
+    GNSDK_UNUSED(region);
+    GNSDK_UNUSED(descriptor);
+    GNSDK_UNUSED(user_handle);
+    GNSDK_UNUSED(callback_fn);
+    GNSDK_UNUSED(callback_data);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_locale_serialize(
+    gnsdk_locale_handle_t locale_handle,
+    gnsdk_str_t*          p_serialized_locale
+    )
+{
+    *p_serialized_locale = strdup("gnsdk_stub_locale");
+    if (*p_serialized_locale == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_NO_MEMORY, "Out of memory", "gnsdk_manager_locale_serialize");
+    }
+
+    GNSDK_UNUSED(locale_handle);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_locale_deserialize(
+    gnsdk_cstr_t           serialized_locale,
+    gnsdk_locale_handle_t* p_locale_handle
+    )
+{
+    static int s_locale;
+
+    if (serialized_locale == GNSDK_NULL || 0 != strcmp(serialized_locale, "gnsdk_stub_locale"))
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Not a locale serialized by the stub", "gnsdk_manager_locale_deserialize");
+    }
+
+    *p_locale_handle = (gnsdk_locale_handle_t)&s_locale;
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_locale_set_group_default(
+    gnsdk_locale_handle_t locale_handle
+    )
+{
+    GNSDK_UNUSED(locale_handle);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_locale_release(
+    gnsdk_locale_handle_t locale_handle
+    )
+{
+    GNSDK_UNUSED(locale_handle);
+    return GNSDK_SUCCESS;
+}
+
+/**********************************************
+ *    GDOs
+ **********************************************/
+
+gnsdk_error_t
+gnsdk_manager_gdo_child_count(
+    gnsdk_gdo_handle_t gdo_handle,
+    gnsdk_cstr_t       child_key,
+    gnsdk_uint32_t*    p_count
+    )
+{
+    stub_gdo_t* gdo = (stub_gdo_t*)gdo_handle;
+
+    if (gdo == GNSDK_NULL || p_count == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_manager_gdo_child_count");
+    }
+
+    *p_count = (gdo->kind == STUB_GDO_RESPONSE && 0 == strcmp(child_key, GNSDK_GDO_CHILD_ALBUM)) ? gdo->count : 0;
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_gdo_child_get(
+    gnsdk_gdo_handle_t  gdo_handle,
+    gnsdk_cstr_t        child_key,
+    gnsdk_uint32_t      ordinal,
+    gnsdk_gdo_handle_t* p_child_gdo
+    )
+{
+    stub_gdo_t*        gdo   = (stub_gdo_t*)gdo_handle;
+    gnsdk_gdo_handle_t child = GNSDK_NULL;
+
+    if (gdo == GNSDK_NULL || p_child_gdo == GNSDK_NULL || ordinal == 0)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_manager_gdo_child_get");
+    }
+
+    *p_child_gdo = GNSDK_NULL;
+    if (gdo->kind == STUB_GDO_RESPONSE)
+    {
+        if (0 != strcmp(child_key, GNSDK_GDO_CHILD_ALBUM) || ordinal > gdo->count)
+        {
+            return _set_error(STUB_ERR_NOT_FOUND, "No such child", "gnsdk_manager_gdo_child_get");
+        }
+        child = _new_gdo(STUB_GDO_ALBUM, gdo->albums[ordinal - 1], GNSDK_NULL);
+    }
+    else if (ordinal != 1)
+    {
+        return _set_error(STUB_ERR_NOT_FOUND, "No such child", "gnsdk_manager_gdo_child_get");
+    }
+    else if (gdo->kind == STUB_GDO_ALBUM && 0 == strcmp(child_key, GNSDK_GDO_CHILD_TITLE_OFFICIAL))
+    {
+        child = _new_gdo(STUB_GDO_TITLE, gdo->album, gdo->album->album);
+    }
+    else if (gdo->kind == STUB_GDO_ALBUM && 0 == strcmp(child_key, GNSDK_GDO_CHILD_ARTIST))
+    {
+        child = _new_gdo(STUB_GDO_ARTIST, gdo->album, GNSDK_NULL);
+    }
+    else if (gdo->kind == STUB_GDO_ALBUM && 0 == strcmp(child_key, GNSDK_GDO_CHILD_TRACK_MATCHED))
+    {
+        child = _new_gdo(STUB_GDO_TRACK, gdo->album, GNSDK_NULL);
+    }
+    else if (gdo->kind == STUB_GDO_TRACK && 0 == strcmp(child_key, GNSDK_GDO_CHILD_TITLE_OFFICIAL))
+    {
+        child = _new_gdo(STUB_GDO_TITLE, gdo->album, gdo->album->track);
+    }
+    else if (gdo->kind == STUB_GDO_ARTIST && 0 == strcmp(child_key, GNSDK_GDO_CHILD_NAME_OFFICIAL))
+    {
+        child = _new_gdo(STUB_GDO_TITLE, gdo->album, gdo->album->artist);
+    }
+    else
+    {
+        return _set_error(STUB_ERR_NOT_FOUND, "No such child", "gnsdk_manager_gdo_child_get");
+    }
+
+    if (child == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_NO_MEMORY, "Out of memory", "gnsdk_manager_gdo_child_get");
+    }
+
+    *p_child_gdo = child;
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_gdo_value_get(
+    gnsdk_gdo_handle_t gdo_handle,
+    gnsdk_cstr_t       value_key,
+    gnsdk_uint32_t     ordinal,
+    gnsdk_cstr_t*      p_value
+    )
+{
+    stub_gdo_t*  gdo   = (stub_gdo_t*)gdo_handle;
+    gnsdk_cstr_t value = GNSDK_NULL;
+
+    if (gdo == GNSDK_NULL || p_value == GNSDK_NULL || ordinal != 1)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_manager_gdo_value_get");
+    }
+
+    if (gdo->kind == STUB_GDO_TITLE && 0 == strcmp(value_key, GNSDK_GDO_VALUE_DISPLAY))
+    {
+        value = gdo->display;
+    }
+    else if (gdo->kind == STUB_GDO_ALBUM && 0 == strcmp(value_key, GNSDK_GDO_VALUE_TRACK_MATCHED_NUM))
+    {
+        value = gdo->album->track_number;
+    }
+    /* where the match was and how long the track is, for --monitor,
+     * only under the names the SDK headers give them */
+#ifdef GNSDK_GDO_VALUE_TRACK_MATCHED_POSITION
+    else if (gdo->kind == STUB_GDO_TRACK && 0 == strcmp(value_key, GNSDK_GDO_VALUE_TRACK_MATCHED_POSITION))
+    {
+        value = gdo->album->position_ms;
+    }
+#endif
+#ifdef GNSDK_GDO_VALUE_DURATION
+    else if (gdo->kind == STUB_GDO_TRACK && 0 == strcmp(value_key, GNSDK_GDO_VALUE_DURATION))
+    {
+        value = gdo->album->duration_ms;
+    }
+#endif
+#ifdef GNSDK_GDO_VALUE_DURATION_UNITS
+    else if (gdo->kind == STUB_GDO_TRACK && 0 == strcmp(value_key, GNSDK_GDO_VALUE_DURATION_UNITS) && gdo->album->duration_ms)
+    {
+        value = "ms";
+    }
+#endif
+
+    *p_value = value;
+    if (value == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_NOT_FOUND, "No such value", "gnsdk_manager_gdo_value_get");
+    }
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_gdo_release(
+    gnsdk_gdo_handle_t gdo_handle
+    )
+{
+    stub_gdo_t* gdo = (stub_gdo_t*)gdo_handle;
+
+    /* the responses given to callbacks are the stub's to free */
+    if (gdo && gdo->kind == STUB_GDO_RESPONSE && gdo->b_owned)
+    {
+        free(gdo->albums);
+        free(gdo);
+    }
+    else if (gdo && gdo->kind != STUB_GDO_RESPONSE)
+    {
+        if (gdo->owned)
+        {
+            _free_album(gdo->owned);
+            free(gdo->owned);
+        }
+        free(gdo);
+    }
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_manager_gdo_create_from_xml(
+    gnsdk_cstr_t        xml,
+    gnsdk_gdo_handle_t* p_gdo_handle
+    )
+{
+    stub_album_t* album = GNSDK_NULL;
+    stub_gdo_t*   gdo   = GNSDK_NULL;
+
+    /* only the album of a response, as bench renders it */
+    album = calloc(1, sizeof(*album));
+    gdo   = (stub_gdo_t*)_new_gdo(STUB_GDO_ALBUM, album, GNSDK_NULL);
+    if (album == GNSDK_NULL || gdo == GNSDK_NULL)
+    {
+        free(album);
+        free(gdo);
+        return _set_error(STUB_ERR_NO_MEMORY, "Out of memory", "gnsdk_manager_gdo_create_from_xml");
+    }
+    gdo->owned = album;
+
+    album->album        = _xml_text(xml, "<TITLE_OFFICIAL>", "<DISPLAY>", GNSDK_NULL);
+    album->track        = _xml_text(xml, "<TRACK_MATCHED>", "<TITLE_OFFICIAL>", "<DISPLAY>");
+    album->artist       = _xml_text(xml, "<ARTIST>", "<NAME_OFFICIAL>", "<DISPLAY>");
+    album->track_number = _xml_text(xml, "<TRACK_MATCHED_NUM>", GNSDK_NULL, GNSDK_NULL);
+    album->position_ms  = _xml_text(xml, "<TRACK_MATCHED_POS_MS>", GNSDK_NULL, GNSDK_NULL);
+    album->duration_ms  = _xml_text(xml, "<TRACK_MATCHED>", "<DURATION>", GNSDK_NULL);
+    if (album->album == GNSDK_NULL || album->track == GNSDK_NULL || album->artist == GNSDK_NULL || album->track_number == GNSDK_NULL)
+    {
+        gnsdk_manager_gdo_release((gnsdk_gdo_handle_t)gdo);
+        return _set_error(STUB_ERR_INVALID_ARG, "Not an album the stub can read", "gnsdk_manager_gdo_create_from_xml");
+    }
+
+    *p_gdo_handle = (gnsdk_gdo_handle_t)gdo;
+    return GNSDK_SUCCESS;
+}
+
+/**********************************************
+ *    MusicID-Stream
+ **********************************************/
+
+gnsdk_error_t
+gnsdk_dsp_initialize(
+    gnsdk_manager_handle_t sdkmgr_handle
+    )
+{
+    GNSDK_UNUSED(sdkmgr_handle);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicid_initialize(
+    gnsdk_manager_handle_t sdkmgr_handle
+    )
+{
+    GNSDK_UNUSED(sdkmgr_handle);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_initialize(
+    gnsdk_manager_handle_t sdkmgr_handle
+    )
+{
+    GNSDK_UNUSED(sdkmgr_handle);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_channel_create(
+    gnsdk_user_handle_t                   user_handle,
+    gnsdk_musicidstream_presets_t         preset,
+    gnsdk_musicidstream_callbacks_t*      p_callbacks,
+    const gnsdk_void_t*                   callback_data,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle
+    )
+{
+    stub_channel_t* channel = GNSDK_NULL;
+
+    if (p_callbacks == GNSDK_NULL || p_channel_handle == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicidstream_channel_create");
+    }
+
+    channel = calloc(1, sizeof(*channel));
+    if (channel == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_NO_MEMORY, "Out of memory", "gnsdk_musicidstream_channel_create");
+    }
+
+    channel->callbacks     = *p_callbacks;
+    channel->callback_data = callback_data;
+    channel->state         = STUB_IDLE;
+    pthread_mutex_init(&channel->lock, GNSDK_NULL);
+    pthread_cond_init(&channel->changed, GNSDK_NULL);
+    _stats_add(&s_stats.channels, 1);
+
+    *p_channel_handle = (gnsdk_musicidstream_channel_handle_t)channel;
+
+    GNSDK_UNUSED(user_handle);
+    GNSDK_UNUSED(preset);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_channel_release(
+    gnsdk_musicidstream_channel_handle_t channel_handle
+    )
+{
+    stub_channel_t* channel = (stub_channel_t*)channel_handle;
+
+    if (channel == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicidstream_channel_release");
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    _cancel(channel);
+    pthread_mutex_unlock(&channel->lock);
+
+    _serial_forget(channel);
+    if (channel->b_thread)
+    {
+        pthread_join(channel->thread, GNSDK_NULL);
+    }
+
+    pthread_cond_destroy(&channel->changed);
+    pthread_mutex_destroy(&channel->lock);
+    free(channel);
+    _stats_add(&s_stats.channels, -1);
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_channel_audio_begin(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    gnsdk_uint32_t                       sample_rate,
+    gnsdk_uint32_t                       sample_size,
+    gnsdk_uint32_t                       channels
+    )
+{
+    if (channel_handle == GNSDK_NULL || sample_rate == 0 || (sample_size != 8 && sample_size != 16) || channels == 0 || channels > 2)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Unsupported audio format", "gnsdk_musicidstream_channel_audio_begin");
+    }
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_channel_audio_write(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    const gnsdk_void_t*                  p_audio,
+    gnsdk_size_t                         audio_size
+    )
+{
+    stub_channel_t*      channel = (stub_channel_t*)channel_handle;
+    const unsigned char* p_byte  = (const unsigned char*)p_audio;
+    gnsdk_size_t         i       = 0;
+
+    if (channel == GNSDK_NULL || (p_audio == GNSDK_NULL && audio_size > 0))
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicidstream_channel_audio_write");
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    if (channel->state != STUB_LISTENING)
+    {
+        pthread_mutex_unlock(&channel->lock);
+        return GNSDK_SUCCESS;
+    }
+
+    for (i = 0; i < audio_size && channel->hashed < s_match_bytes; i++, channel->hashed++)
+    {
+        channel->hash = (channel->hash ^ p_byte[i]) * FNV_PRIME;
+    }
+
+    if (channel->hashed < s_match_bytes)
+    {
+        pthread_mutex_unlock(&channel->lock);
+        return GNSDK_SUCCESS;
+    }
+
+    return _answer(channel);
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_channel_audio_end(
+    gnsdk_musicidstream_channel_handle_t channel_handle
+    )
+{
+    stub_channel_t* channel = (stub_channel_t*)channel_handle;
+
+    if (channel == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicidstream_channel_audio_end");
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    if (channel->state != STUB_LISTENING)
+    {
+        pthread_mutex_unlock(&channel->lock);
+        return GNSDK_SUCCESS;
+    }
+
+    return _answer(channel);
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_channel_identify(
+    gnsdk_musicidstream_channel_handle_t channel_handle
+    )
+{
+    stub_channel_t* channel = (stub_channel_t*)channel_handle;
+
+    if (channel == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicidstream_channel_identify");
+    }
+
+    /* one still in its callbacks has said it ended, so the next may begin */
+    pthread_mutex_lock(&channel->lock);
+    if (channel->state == STUB_LISTENING || channel->state == STUB_PENDING)
+    {
+        pthread_mutex_unlock(&channel->lock);
+        return _set_error(STUB_ERR_BUSY, "An identification is already in progress", "gnsdk_musicidstream_channel_identify");
+    }
+    channel->generation++;
+    channel->state  = STUB_LISTENING;
+    channel->hash   = FNV_OFFSET;
+    channel->hashed = 0;
+    pthread_mutex_unlock(&channel->lock);
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_channel_identify_cancel(
+    gnsdk_musicidstream_channel_handle_t channel_handle
+    )
+{
+    stub_channel_t* channel = (stub_channel_t*)channel_handle;
+
+    if (channel == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicidstream_channel_identify_cancel");
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    _cancel(channel);
+    pthread_mutex_unlock(&channel->lock);
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicidstream_channel_wait_for_identify(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    gnsdk_uint32_t                       timeout_ms
+    )
+{
+    stub_channel_t* channel = (stub_channel_t*)channel_handle;
+    gnsdk_error_t   error   = GNSDK_SUCCESS;
+    struct timespec ts      = _deadline(_now() + timeout_ms / 1e3);
+
+    if (channel == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicidstream_channel_wait_for_identify");
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    while (GNSDK_SUCCESS == error && (channel->state == STUB_LISTENING || channel->state == STUB_PENDING || channel->state == STUB_ANSWERING))
+    {
+        if (timeout_ms == GNSDK_MUSICIDSTREAM_TIMEOUT_INFINITE)
+        {
+            pthread_cond_wait(&channel->changed, &channel->lock);
+        }
+        else if (0 != pthread_cond_timedwait(&channel->changed, &channel->lock, &ts))
+        {
+            error = _set_error(STUB_ERR_TIMEOUT, "Timed out waiting for the identification", "gnsdk_musicidstream_channel_wait_for_identify");
+        }
+    }
+    pthread_mutex_unlock(&channel->lock);
+
+    return error;
+}
+
+/**********************************************
+ *    MusicID
+ **********************************************/
+
+gnsdk_error_t
+gnsdk_musicid_query_create(
+    gnsdk_user_handle_t           user_handle,
+    gnsdk_status_callback_fn      callback_fn,
+    const gnsdk_void_t*           callback_data,
+    gnsdk_musicid_query_handle_t* p_query_handle
+    )
+{
+    stub_query_t* query = GNSDK_NULL;
+
+    if (p_query_handle == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicid_query_create");
+    }
+
+    query = calloc(1, sizeof(*query));
+    if (query == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_NO_MEMORY, "Out of memory", "gnsdk_musicid_query_create");
+    }
+
+    *p_query_handle = (gnsdk_musicid_query_handle_t)query;
+
+    GNSDK_UNUSED(user_handle);
+    GNSDK_UNUSED(callback_fn);
+    GNSDK_UNUSED(callback_data);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicid_query_release(
+    gnsdk_musicid_query_handle_t query_handle
+    )
+{
+    free((stub_query_t*)query_handle);
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicid_query_fingerprint_begin(
+    gnsdk_musicid_query_handle_t query_handle,
+    gnsdk_cstr_t                 fp_data_type,
+    gnsdk_uint32_t               audio_sample_rate,
+    gnsdk_uint32_t               audio_sample_size,
+    gnsdk_uint32_t               audio_channels
+    )
+{
+    stub_query_t* query = (stub_query_t*)query_handle;
+
+    if (query == GNSDK_NULL || fp_data_type == GNSDK_NULL || audio_sample_rate == 0
+        || (audio_sample_size != 8 && audio_sample_size != 16) || audio_channels == 0 || audio_channels > 2)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Unsupported audio format", "gnsdk_musicid_query_fingerprint_begin");
+    }
+
+    query->hash             = FNV_OFFSET;
+    query->hashed           = 0;
+    query->b_fingerprinting = 1;
+    query->b_fp             = 0;
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicid_query_fingerprint_write(
+    gnsdk_musicid_query_handle_t query_handle,
+    const gnsdk_void_t*          audio_data,
+    gnsdk_size_t                 audio_data_size,
+    gnsdk_bool_t*                pb_complete
+    )
+{
+    stub_query_t*        query  = (stub_query_t*)query_handle;
+    const unsigned char* p_byte = (const unsigned char*)audio_data;
+    gnsdk_size_t         i      = 0;
+
+    if (query == GNSDK_NULL || pb_complete == GNSDK_NULL || (audio_data == GNSDK_NULL && audio_data_size > 0))
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicid_query_fingerprint_write");
+    }
+    if (!query->b_fingerprinting)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "No fingerprint was begun", "gnsdk_musicid_query_fingerprint_write");
+    }
+
+    /* the same audio hashes as it does on a channel */
+    for (i = 0; i < audio_data_size && query->hashed < s_match_bytes; i++, query->hashed++)
+    {
+        query->hash = (query->hash ^ p_byte[i]) * FNV_PRIME;
+    }
+
+    *pb_complete = (query->hashed >= s_match_bytes) ? GNSDK_TRUE : GNSDK_FALSE;
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicid_query_fingerprint_end(
+    gnsdk_musicid_query_handle_t query_handle
+    )
+{
+    stub_query_t* query = (stub_query_t*)query_handle;
+
+    if (query == GNSDK_NULL || !query->b_fingerprinting)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "No fingerprint was begun", "gnsdk_musicid_query_fingerprint_end");
+    }
+
+    query->b_fingerprinting = 0;
+    query->b_fp             = 1;
+    snprintf(query->fp, sizeof(query->fp), STUB_FP_PREFIX "%016llx", (unsigned long long)query->hash);
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicid_query_get_fp_data(
+    gnsdk_musicid_query_handle_t query_handle,
+    gnsdk_cstr_t*                p_fp_data
+    )
+{
+    stub_query_t* query = (stub_query_t*)query_handle;
+
+    if (query == GNSDK_NULL || p_fp_data == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicid_query_get_fp_data");
+    }
+    if (!query->b_fp)
+    {
+        return _set_error(STUB_ERR_NOT_FOUND, "No fingerprint has been made", "gnsdk_musicid_query_get_fp_data");
+    }
+
+    *p_fp_data = query->fp;
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicid_query_set_fp_data(
+    gnsdk_musicid_query_handle_t query_handle,
+    gnsdk_cstr_t                 fp_data,
+    gnsdk_cstr_t                 fp_data_type
+    )
+{
+    stub_query_t*      query  = (stub_query_t*)query_handle;
+    unsigned long long hash   = 0;
+    int                length = 0;
+
+    if (query == GNSDK_NULL || fp_data == GNSDK_NULL || fp_data_type == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicid_query_set_fp_data");
+    }
+
+    /* only what fingerprint_end() made */
+    if (1 != sscanf(fp_data, STUB_FP_PREFIX "%16llx%n", &hash, &length) || fp_data[length] != '\0')
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Not a fingerprint the stub made", "gnsdk_musicid_query_set_fp_data");
+    }
+
+    query->hash             = (uint64_t)hash;
+    query->hashed           = 0;
+    query->b_fingerprinting = 0;
+    query->b_fp             = 1;
+    snprintf(query->fp, sizeof(query->fp), "%s", fp_data);
+
+    return GNSDK_SUCCESS;
+}
+
+gnsdk_error_t
+gnsdk_musicid_query_find_albums(
+    gnsdk_musicid_query_handle_t query_handle,
+    gnsdk_gdo_handle_t*          p_response_gdo
+    )
+{
+    stub_query_t* query    = (stub_query_t*)query_handle;
+    stub_gdo_t*   response = GNSDK_NULL;
+    stub_answer_t answer;
+
+    if (query == GNSDK_NULL || p_response_gdo == GNSDK_NULL)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "Invalid argument", "gnsdk_musicid_query_find_albums");
+    }
+    if (!query->b_fp)
+    {
+        return _set_error(STUB_ERR_INVALID_ARG, "The query has no fingerprint", "gnsdk_musicid_query_find_albums");
+    }
+
+    /* answered on the calling thread, as the SDK does */
+    _sleep(_decide(&answer, query->hash, query->hashed));
+    if (answer.b_in_flight)
+    {
+        _stats_add(&s_stats.in_flight, -1);
+    }
+
+    if (GNSDK_SUCCESS != answer.error)
+    {
+        free(answer.albums);
+        return _set_error(answer.error, answer.description, "gnsdk_musicid_query_find_albums");
+    }
+
+    response = (stub_gdo_t*)_new_gdo(STUB_GDO_RESPONSE, GNSDK_NULL, GNSDK_NULL);
+    if (response == GNSDK_NULL)
+    {
+        free(answer.albums);
+        return _set_error(STUB_ERR_NO_MEMORY, "Out of memory", "gnsdk_musicid_query_find_albums");
+    }
+    response->albums  = answer.albums;
+    response->count   = answer.count;
+    response->b_owned = 1;
+
+    *p_response_gdo = (gnsdk_gdo_handle_t)response;
+    return GNSDK_SUCCESS;
+}
@@ -0,0 +1,387 @@
+/*
+ *  Name: hedge.c
+ *  Description:
+ *  Deadlines and hedged retries for the queries of query.c. The answer
+ *  times of a context are kept in a ring of HEDGE_SAMPLES, from which
+ *  the --hedge percentile is worked out when a query starts waiting.
+ */
+
+#include "hedge.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* --hedge: answer times the percentile needs to be trusted, and the
+ * threshold until then */
+#define HEDGE_MIN_SAMPLES     20
+#define HEDGE_INITIAL_SECONDS 3.0
+
+/* how often a query and its hedge are checked while both are in flight */
+#define HEDGE_POLL_MS 10
+
+/***************************************************************************
+ *
+ *    _COMPARE_SECONDS
+ *
+ ***************************************************************************/
+static int
+_compare_seconds(
+    const void* a,
+    const void* b
+    )
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+
+} /* _compare_seconds() */
+
+/***************************************************************************
+ *
+ *    _ANSWER_PERCENTILE
+ *
+ * The percentile of the recent answer times, in seconds, or -1 if
+ * fewer than min_count have been seen.
+ *
+ ***************************************************************************/
+static double
+_answer_percentile(
+    query_context_t* context,
+    double           percentile,
+    size_t           min_count
+    )
+{
+    double sorted[HEDGE_SAMPLES];
+    size_t count = 0;
+    size_t rank  = 0;
+
+    pthread_mutex_lock(&context->stats_lock);
+    count = (context->answer_count < HEDGE_SAMPLES) ? (size_t)context->answer_count : HEDGE_SAMPLES;
+    memcpy(sorted, context->answer_seconds, count * sizeof(double));
+    pthread_mutex_unlock(&context->stats_lock);
+
+    if (count == 0 || count < min_count)
+    {
+        return -1;
+    }
+
+    qsort(sorted, count, sizeof(double), _compare_seconds);
+    rank = (size_t)ceil(percentile / 100.0 * (double)count);
+
+    return sorted[(rank > 0) ? rank - 1 : 0];
+
+} /* _answer_percentile() */
+
+/***************************************************************************
+ *
+ *    HEDGE_CLAIM_ANSWER
+ *
+ * Called from the callbacks before a result or error is reported: only
+ * the first answer to a query, from its own channel or its --hedge, is
+ * kept, and none once it has timed out. Returns GNSDK_TRUE if this one
+ * is it, noting how long it took.
+ *
+ ***************************************************************************/
+gnsdk_bool_t
+hedge_claim_answer(
+    query_t* query
+    )
+{
+    query_context_t* context   = query->context;
+    query_t*         owner     = query->primary ? query->primary : query;
+    int              unclaimed = ANSWER_NONE;
+
+    if (!atomic_compare_exchange_strong(&owner->answered, &unclaimed, query->primary ? ANSWER_HEDGE : ANSWER_PRIMARY))
+    {
+        return GNSDK_FALSE;
+    }
+
+    if (query->asked > 0)
+    {
+        pthread_mutex_lock(&context->stats_lock);
+        context->answer_seconds[context->answer_count % HEDGE_SAMPLES] = query_now() - query->asked;
+        context->answer_count++;
+        context->hedge_wins += query->primary ? 1 : 0;
+        pthread_mutex_unlock(&context->stats_lock);
+    }
+
+    return GNSDK_TRUE;
+
+} /* hedge_claim_answer() */
+
+/***************************************************************************
+ *
+ *    HEDGE_PAST_DEADLINE
+ *
+ ***************************************************************************/
+gnsdk_bool_t
+hedge_past_deadline(
+    query_t* query
+    )
+{
+    return query->deadline > 0 && query_now() >= query->deadline;
+
+} /* hedge_past_deadline() */
+
+/***************************************************************************
+ *
+ *    _CANCEL_IDENTIFY
+ *
+ * Stop an identification that is no longer wanted and release its
+ * channel, so that nothing it still has to say can reach a later query
+ * on it; the next query creates a fresh one.
+ *
+ ***************************************************************************/
+static void
+_cancel_identify(
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle
+    )
+{
+    if (*p_channel_handle)
+    {
+        gnsdk_musicidstream_channel_identify_cancel(*p_channel_handle);
+        gnsdk_musicidstream_channel_release(*p_channel_handle);
+        *p_channel_handle = GNSDK_NULL;
+    }
+
+} /* _cancel_identify() */
+
+/***************************************************************************
+ *
+ *    _START_HEDGE
+ *
+ * Identify the input again on a channel of its own, as a second try at
+ * query. Its records are held in a buffer of its own until it is known
+ * whether it answered first. Returns -1 if it couldn't be started.
+ *
+ ***************************************************************************/
+static int
+_start_hedge(
+    gnsdk_user_handle_t                   user_handle,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle,
+    query_t*                              query,
+    query_t*                              hedge,
+    char**                                p_held,
+    size_t*                               p_held_size,
+    audio_input_t*                        input
+    )
+{
+    gnsdk_error_t error = GNSDK_SUCCESS;
+
+    hedge->audio_file    = query->audio_file;
+    hedge->b_tag_file    = query->b_tag_file;
+    hedge->b_cache_store = query->b_cache_store;
+    hedge->priority      = query->priority;
+    hedge->context       = query->context;
+    hedge->hooks         = query->hooks;
+    hedge->owner         = query->owner;
+    hedge->deadline      = query->deadline;
+    hedge->primary       = query;
+    memcpy(hedge->cache_key, query->cache_key, sizeof(hedge->cache_key));
+
+    /* held the same way as the query's own records, if they are */
+    hedge->trace.out = query->trace.out;
+    hedge->out       = open_memstream(p_held, p_held_size);
+    if (hedge->out == GNSDK_NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&query->context->stats_lock);
+    query->context->hedges++;
+    pthread_mutex_unlock(&query->context->stats_lock);
+
+    error = query_create_channel(user_handle, hedge, p_channel_handle);
+    if (GNSDK_SUCCESS != error)
+    {
+        *p_channel_handle = GNSDK_NULL;
+        return -1;
+    }
+
+    return query_process_audio(*p_channel_handle, hedge, input);
+
+} /* _start_hedge() */
+
+/***************************************************************************
+ *
+ *    HEDGE_WAIT_FOR_ANSWER
+ *
+ * Wait for the identification of query to finish, or with --deadline
+ * until its deadline, when it is cancelled and reported as timed out.
+ * With --hedge, an input that can be fed again (mapped, or a buffer in
+ * memory) is identified a second time on a fresh channel once the query
+ * has taken longer than the --hedge percentile of recent answers;
+ * whichever answers first is kept and the other is cancelled. A query
+ * that is cancelled loses its channel.
+ *
+ ***************************************************************************/
+void
+hedge_wait_for_answer(
+    gnsdk_user_handle_t                   user_handle,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle,
+    query_t*                              query,
+    audio_input_t*                        input
+    )
+{
+    query_context_t*                     context       = query->context;
+    gnsdk_musicidstream_channel_handle_t hedge_channel = GNSDK_NULL;
+    query_t                              hedge         = {0};
+    char*                                held          = GNSDK_NULL;
+    size_t                               held_size     = 0;
+    record_t*                            record        = GNSDK_NULL;
+    gnsdk_bool_t                         b_hedged      = GNSDK_FALSE;
+    gnsdk_bool_t                         b_over        = GNSDK_FALSE;
+    gnsdk_bool_t                         b_hedge_over  = GNSDK_FALSE;
+    gnsdk_uint32_t                       wait_ms       = 0;
+    double                               hedge_at      = 0;
+    double                               until         = 0;
+    double                               now           = 0;
+    int                                  unclaimed     = ANSWER_NONE;
+    int                                  answered      = ANSWER_NONE;
+
+    if (query->asked == 0 || (query->deadline == 0 && context->hedge_percentile == 0) || *p_channel_handle == GNSDK_NULL)
+    {
+        /* wait for the identification to finish so we actually get results */
+        if (*p_channel_handle)
+        {
+            gnsdk_musicidstream_channel_wait_for_identify(*p_channel_handle, GNSDK_MUSICIDSTREAM_TIMEOUT_INFINITE);
+        }
+        return;
+    }
+
+    if (context->hedge_percentile > 0 && input && input->p_map)
+    {
+        hedge_at = _answer_percentile(context, context->hedge_percentile, HEDGE_MIN_SAMPLES);
+        hedge_at = query->asked + ((hedge_at < 0) ? HEDGE_INITIAL_SECONDS : hedge_at);
+    }
+
+    for (;;)
+    {
+        b_over = b_over || atomic_load(&query->b_identify_ended);
+        if (ANSWER_NONE != atomic_load(&query->answered) || (b_over && (!b_hedged || b_hedge_over)))
+        {
+            break;
+        }
+
+        now = query_now();
+        if (query->deadline > 0 && now >= query->deadline)
+        {
+            break;
+        }
+
+        if (!b_hedged && hedge_at > 0 && now >= hedge_at && !b_over)
+        {
+            b_hedged     = GNSDK_TRUE;
+            b_hedge_over = (0 != _start_hedge(user_handle, &hedge_channel, query, &hedge, &held, &held_size, input));
+            continue;
+        }
+
+        /* sleep on what is in flight until the next thing to do */
+        if (b_hedged)
+        {
+            b_hedge_over = b_hedge_over || atomic_load(&hedge.b_identify_ended);
+            if (!b_hedge_over)
+            {
+                b_hedge_over = (GNSDK_SUCCESS == gnsdk_musicidstream_channel_wait_for_identify(hedge_channel, HEDGE_POLL_MS));
+            }
+            if (!b_over)
+            {
+                b_over = (GNSDK_SUCCESS == gnsdk_musicidstream_channel_wait_for_identify(*p_channel_handle, HEDGE_POLL_MS));
+            }
+            continue;
+        }
+
+        until = query->deadline;
+        if (hedge_at > 0 && (until == 0 || hedge_at < until))
+        {
+            until = hedge_at;
+        }
+        wait_ms = (until > 0) ? (gnsdk_uint32_t)((until - now) * 1e3) + 1 : GNSDK_MUSICIDSTREAM_TIMEOUT_INFINITE;
+        b_over  = (GNSDK_SUCCESS == gnsdk_musicidstream_channel_wait_for_identify(*p_channel_handle, wait_ms));
+    }
+
+    /* claimed for the timeout, nothing that turns up later is kept */
+    if (hedge_past_deadline(query) && atomic_compare_exchange_strong(&query->answered, &unclaimed, ANSWER_TIMEOUT))
+    {
+        pthread_mutex_lock(&context->stats_lock);
+        context->timeouts++;
+        pthread_mutex_unlock(&context->stats_lock);
+
+        /* hooks (a --tracklist window) count it themselves */
+        if (query->hooks && query->hooks->on_error)
+        {
+            query->hooks->on_error(query, "No answer before the deadline");
+        }
+        else
+        {
+            record = query_begin_record(query);
+            record_string(record, "error", "No answer before the deadline");
+            record_number(record, "deadline_s", context->deadline_seconds, 3);
+            query_end_record(query);
+        }
+    }
+
+    /* whichever side answered may still be in its callbacks, writing its
+     * record: it is waited for. The query's own channel is kept for the
+     * next query unless it was given up on. */
+    answered = atomic_load(&query->answered);
+    if (ANSWER_PRIMARY == answered || (ANSWER_NONE == answered && b_over))
+    {
+        gnsdk_musicidstream_channel_wait_for_identify(*p_channel_handle, GNSDK_MUSICIDSTREAM_TIMEOUT_INFINITE);
+    }
+    else
+    {
+        _cancel_identify(p_channel_handle);
+    }
+
+    if (b_hedged)
+    {
+        if (hedge_channel && ANSWER_HEDGE == answered)
+        {
+            gnsdk_musicidstream_channel_wait_for_identify(hedge_channel, GNSDK_MUSICIDSTREAM_TIMEOUT_INFINITE);
+        }
+        _cancel_identify(&hedge_channel);
+
+        if (hedge.out)
+        {
+            fclose(hedge.out);
+            if (ANSWER_HEDGE == answered)
+            {
+                fwrite(held, 1, held_size, query->out);
+                fflush(query->out);
+                query->records += hedge.records;
+            }
+        }
+        free(held);
+    }
+
+} /* hedge_wait_for_answer() */
+
+/***************************************************************************
+ *
+ *    HEDGE_DISPLAY_STATS
+ *
+ ***************************************************************************/
+void
+hedge_display_stats(
+    query_context_t* context
+    )
+{
+    double p50 = _answer_percentile(context, 50, 1);
+    double p99 = _answer_percentile(context, 99, 1);
+
+    pthread_mutex_lock(&context->stats_lock);
+    fprintf(stderr,
+        "{\"deadline\": {\"timeouts\": %lu, \"hedges\": %lu, \"hedge_wins\": %lu, \"answer_ms\": {\"p50\": %.3f, \"p99\": %.3f}}}\n",
+        context->timeouts,
+        context->hedges,
+        context->hedge_wins,
+        (p50 < 0) ? 0.0 : p50 * 1e3,
+        (p99 < 0) ? 0.0 : p99 * 1e3
+        );
+    pthread_mutex_unlock(&context->stats_lock);
+
+} /* hedge_display_stats() */
+
@@ -0,0 +1,61 @@
+/*
+ *  Name: hedge.h
+ *  Description:
+ *  Waiting for the answer to a query: with --deadline a query that
+ *  takes too long is cancelled and reported as timed out, and with
+ *  --hedge one that takes longer than most recent answers did is asked
+ *  a second time on a channel of its own, keeping whichever answers
+ *  first. Without either, it is just a wait for the identification.
+ */
+
+#ifndef HEDGE_H
+#define HEDGE_H
+
+#include "query.h"
+
+/* query_t.answered: the first answer to a query is the only one kept */
+#define ANSWER_NONE    0
+#define ANSWER_PRIMARY 1
+#define ANSWER_HEDGE   2
+#define ANSWER_TIMEOUT 3
+
+/*
+ * Wait for the identification of query on *p_channel_handle to finish,
+ * or until its deadline. input is fed again to a hedge if it can be (it
+ * is mapped, or a buffer in memory); pass NULL if it can't. A query
+ * that is cancelled loses its channel, which is left NULL.
+ */
+void
+hedge_wait_for_answer(
+    gnsdk_user_handle_t                   user_handle,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle,
+    query_t*                              query,
+    audio_input_t*                        input
+    );
+
+/*
+ * Called from the channel callbacks before a result or error is
+ * reported. Returns GNSDK_TRUE if this is the first answer to query
+ * or to the query it is a hedge of, and it hasn't timed out.
+ */
+gnsdk_bool_t
+hedge_claim_answer(
+    query_t* query
+    );
+
+/* Whether query has a deadline and it has gone by */
+gnsdk_bool_t
+hedge_past_deadline(
+    query_t* query
+    );
+
+/*
+ * Report on stderr, as a JSON line, how many queries of context ran out
+ * of time or were hedged, and the spread of their answer times.
+ */
+void
+hedge_display_stats(
+    query_context_t* context
+    );
+
+#endif /* HEDGE_H */
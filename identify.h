@@ -0,0 +1,104 @@
+/*
+ *  Name: identify.h
+ *  Description:
+ *  libidentify: what sample does for one input, as a library, so that a
+ *  long-running process can keep the Gracenote SDK started and identify
+ *  PCM it already holds in memory, without writing it to a file or
+ *  running sample for it. Bindings (ctypes, cffi, C++) only need this
+ *  header.
+ *
+ *  Every identification ends in one or more records, each handed to the
+ *  caller's callback as the JSON object sample would have written:
+ *
+ *    {"result": {"album": "...", "track": "...", "artist": "..."}}
+ *    {"result": null}
+ *    {"error": "..."}
+ *
+ *  Any number of identify_t may be open in a process, each with its own
+ *  settings, cache and local index; the SDK is started with the first
+ *  and shared. Any number of threads may identify on one at once, each
+ *  on a channel of its own that is kept for later calls.
+ */
+
+#ifndef IDENTIFY_H
+#define IDENTIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct identify_s identify_t;
+
+/* Settings for identify_init(); all zero (or a NULL pointer) for none */
+typedef struct
+{
+    const char* cache_dir;         /* keep answers here, as --cache does */
+    const char* local_index_path;  /* match against this index first, as --local-index does */
+    uint32_t    candidates;        /* list this many albums, as --candidates does */
+    int         b_condition;       /* trim silence and raise quiet audio, as --condition does */
+    double      deadline_seconds;  /* give up on an identification after this long, as --deadline does */
+    double      hedge_percentile;  /* identify again alongside a slow one, as --hedge does */
+
+} identify_config_t;
+
+/* Interleaved PCM in host byte order */
+typedef struct
+{
+    uint32_t sample_rate;
+    uint32_t bits_per_sample;      /* 8, 16, 24 or 32 */
+    uint32_t channels;
+    int      b_float;              /* 32 bit float samples */
+
+} identify_format_t;
+
+/*
+ * Called with each record of an identification, on the thread that
+ * called identify_pcm(): size bytes of JSON, NUL-terminated, valid until
+ * the callback returns.
+ */
+typedef void (*identify_callback_t)(
+    void*       user_data,
+    const char* json,
+    size_t      size
+    );
+
+/*
+ * Start the SDK (registering or reading back the user and locale as
+ * sample does) and open the cache and local index asked for. Errors are
+ * written to stderr as records. Returns NULL with errno set on failure.
+ */
+identify_t*
+identify_init(
+    const identify_config_t* p_config
+    );
+
+/*
+ * Identify size bytes of PCM in p_format, which is read in place and
+ * must stay unchanged until this returns. Returns 0 once every record
+ * has been given to callback, -1 with errno set (and no records) if
+ * the format or size can't be used or memory runs out.
+ */
+int
+identify_pcm(
+    identify_t*              identify,
+    const void*              pcm,
+    size_t                   size,
+    const identify_format_t* p_format,
+    identify_callback_t      callback,
+    void*                    user_data
+    );
+
+/* Release the channels and shut the SDK down; no call may be in progress */
+void
+identify_shutdown(
+    identify_t* identify
+    );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IDENTIFY_H */
@@ -8,6 +8,12 @@ import json
 import argparse
 import webbrowser
 import sys
+import socket
+import ctypes
+import collections
+import sqlite3
+import threading
+import Queue
 import requests
 import keyring
 import pyaudio
@@ -20,6 +26,7 @@ FORMAT = pyaudio.paInt16
 CHANNELS = 2
 RATE = 44100
 RECORD_SECONDS = 6
+PREROLL_SECONDS = 12
 SAVE_PATH = os.path.expanduser("~") + "/Music/recordings/"
 WAVE_OUTPUT_FILENAME = "temp_{}.wav".format(int(time.time()))
 COMPLETE_NAME = os.path.join(SAVE_PATH, WAVE_OUTPUT_FILENAME)
@@ -38,6 +45,22 @@ def load_user_config(path):
 
 config = load_user_config(CONFIG_PATH)
 
+# sample converts whatever it is given, so the capture format can follow the device
+RECORD_FORMATS = {"int16": pyaudio.paInt16, "int24": pyaudio.paInt24,
+                  "int32": pyaudio.paInt32, "float32": pyaudio.paFloat32}
+FORMAT = RECORD_FORMATS[config.get("RECORD_FORMAT", "int16")]
+CHANNELS = int(config.get("RECORD_CHANNELS", CHANNELS))
+RATE = int(config.get("RECORD_RATE", RATE))
+
+# trim silence and bring up quiet recordings before they are fingerprinted
+CONDITION_ARGS = ["--condition"] if config.get("CONDITION") == "on" else []
+
+# give up on a lookup that is taking too long, or ask again alongside it
+DEADLINE = float(config.get("DEADLINE", 0))
+HEDGE = float(config.get("HEDGE", 0))
+DEADLINE_ARGS = (["--deadline", str(DEADLINE)] if DEADLINE else []) + \
+                (["--hedge", str(HEDGE)] if HEDGE else [])
+
 # ---------------- Setup ------------------
 
 class GracenoteError(Exception):
@@ -59,7 +82,106 @@ discogs = OAuth1Service(
     authorize_url=config["DISCOGS_AUTHORIZE_URL"],
     base_url=config["DISCOGS_BASE_URL"])
 
-def discogs_get_master(artist_name, album_name):
+# every API call goes to DISCOGS_BASE_URL, so a local mock can stand in for Discogs
+DISCOGS_URL = config["DISCOGS_BASE_URL"].rstrip("/")
+DISCOGS_USER_AGENT = "identify-audio-v0.2"
+DISCOGS_TIMEOUT = 30
+DISCOGS_RETRIES = 4
+DISCOGS_JOBS = int(config.get("DISCOGS_JOBS", 8))
+DISCOGS_RATE = float(config.get("DISCOGS_RATE", 1))
+DISCOGS_CACHE = os.path.expanduser(config.get("DISCOGS_CACHE", "~/.identify-discogs.db"))
+DISCOGS_CACHE_DAYS = float(config.get("DISCOGS_CACHE_DAYS", 30))
+DISCOGS_MISS_DAYS = 1
+
+class RateLimit(object):
+    # A token bucket shared by every thread, holding a second's worth of
+    # calls. Each caller takes its token at once and sleeps off any debt
+    # outside the lock, so callers go in the order they asked.
+    def __init__(self, rate):
+        self.rate = rate
+        self.burst = max(rate, 1.0)
+        self.tokens = self.burst
+        self.stamp = time.time()
+        self.lock = threading.Lock()
+
+    def wait(self):
+        if self.rate <= 0:
+            return
+        with self.lock:
+            now = time.time()
+            self.tokens = min(self.burst, self.tokens + (now - self.stamp) * self.rate)
+            self.stamp = now
+            self.tokens -= 1
+            delay = -self.tokens / self.rate
+        if delay > 0:
+            time.sleep(delay)
+
+rate_limit = RateLimit(DISCOGS_RATE)
+
+# each thread keeps its own keep-alive session and cache connection
+local = threading.local()
+
+def discogs_session():
+    if not hasattr(local, "session"):
+        local.session = requests.Session()
+        local.session.headers["user-agent"] = DISCOGS_USER_AGENT
+    return local.session
+
+def discogs_request(session, method, path, **kwargs):
+    # a call turned away for going too fast waits as long as it is told to
+    for attempt in range(DISCOGS_RETRIES):
+        rate_limit.wait()
+        r = session.request(method, DISCOGS_URL + path, timeout=DISCOGS_TIMEOUT, **kwargs)
+        if r.status_code != 429:
+            break
+        time.sleep(float(r.headers.get("retry-after", 1 << attempt)))
+    return r
+
+def discogs_get(path, params):
+    r = discogs_request(discogs_session(), "GET", path, params=params)
+    r.raise_for_status()
+    return r.json()
+
+def cache_connection():
+    if not hasattr(local, "cache"):
+        db = sqlite3.connect(DISCOGS_CACHE, timeout=DISCOGS_TIMEOUT, isolation_level=None)
+        db.execute("PRAGMA journal_mode=WAL")
+        db.execute("CREATE TABLE IF NOT EXISTS lookups (kind TEXT, key TEXT, value TEXT, expires REAL, "
+                   "PRIMARY KEY (kind, key))")
+        local.cache = db
+    return local.cache
+
+inflight = {}
+inflight_lock = threading.Lock()
+
+def cached(kind, key, fetch):
+    # Answer from the cache file, or fetch and keep the answer. Finding
+    # nothing is kept too, for less time. Threads after the same key
+    # wait for the first one's answer rather than asking again.
+    db = cache_connection()
+    while True:
+        row = db.execute("SELECT value FROM lookups WHERE kind = ? AND key = ? AND expires > ?",
+                         (kind, key, time.time())).fetchone()
+        if row:
+            return json.loads(row[0])
+        with inflight_lock:
+            event = inflight.get((kind, key))
+            if event is None:
+                inflight[(kind, key)] = threading.Event()
+        if event is None:
+            break
+        event.wait()
+    try:
+        value = fetch()
+        days = DISCOGS_CACHE_DAYS if value is not None else DISCOGS_MISS_DAYS
+        db.execute("INSERT OR REPLACE INTO lookups VALUES (?, ?, ?, ?)",
+                   (kind, key, json.dumps(value), time.time() + days * 86400))
+    finally:
+        with inflight_lock:
+            inflight.pop((kind, key)).set()
+    return value
+
+def discogs_search_master(artist_name, album_name):
     # TODO: sometimes comes up with nothing when it should find something
     payload = {
         "key": config["DISCOGS_KEY"],
@@ -68,25 +190,49 @@ def discogs_get_master(artist_name, album_name):
         "release_title": album_name,
         "type": "master"
     }
-    r = requests.get("https://api.discogs.com/database/search", params=payload)
-    result = r.json()["results"]
+    result = discogs_get("/database/search", payload)["results"]
     if len(result):
-        return r.json()["results"][0]
-    else:
+        return dict((k, result[0].get(k)) for k in ("id", "uri", "title", "year"))
+    return None
+
+def discogs_get_master(artist_name, album_name):
+    key = u"\t".join((artist_name, album_name)).lower()
+    master = cached("master", key, lambda: discogs_search_master(artist_name, album_name))
+    if master is None:
         raise RuntimeError("No Discogs master found")
+    return master
 
-def discogs_get_release(master_id):
-    release = requests.get("https://api.discogs.com/masters/"+str(master_id)+"/versions",
-                           params={"per_page": 1}
-                          )
-    return release.json()["versions"][0]
+def discogs_search_release(master_id):
+    versions = discogs_get("/masters/"+str(master_id)+"/versions", {"per_page": 1})["versions"]
+    if len(versions):
+        return dict((k, versions[0].get(k)) for k in ("id", "title"))
+    return None
 
-def discogs_get_oauth_session():
+def discogs_get_release(master_id):
+    release = cached("release", str(master_id), lambda: discogs_search_release(master_id))
+    if release is None:
+        raise RuntimeError("No Discogs release found")
+    return release
+
+oauth_session = None
+oauth_lock = threading.Lock()
+
+def discogs_get_oauth_session(authorise=True):
+    # the keyring is read, or the app authorised, once per run
+    global oauth_session
+    with oauth_lock:
+        if oauth_session is None:
+            oauth_session = discogs_open_oauth_session(authorise)
+    return oauth_session
+
+def discogs_open_oauth_session(authorise):
     access_token = keyring.get_password("system", "access_token")
     access_token_secret = keyring.get_password("system", "access_token_secret")
 
     if access_token and access_token_secret:
         session = discogs.get_session((access_token, access_token_secret))
+    elif not authorise:
+        raise RuntimeError("Run identify.py --want once to authorise Discogs access.")
     else:
         request_token, request_token_secret = discogs.get_request_token()
         authorize_url = discogs.get_authorize_url(request_token)
@@ -97,17 +243,125 @@ def discogs_get_oauth_session():
                                            method="POST",
                                            data={"oauth_verifier": oauth_verifier})
         keyring.set_password("system", "access_token", session.access_token)
-        keyring.set_password("system", "access_token_secret", session.access_token_secret)        
+        keyring.set_password("system", "access_token_secret", session.access_token_secret)
+    # shared by every thread, so it keeps a connection for each
+    session.mount("https://", requests.adapters.HTTPAdapter(pool_maxsize=DISCOGS_JOBS))
+    session.mount("http://", requests.adapters.HTTPAdapter(pool_maxsize=DISCOGS_JOBS))
     return session
 
 def discogs_add_wantlist(session, username, release_id):
-    r = session.put("https://api.discogs.com/users/"+username+"/wants/"+str(release_id),
-                    header_auth=True,
-                    headers={
-                        "content-type": "application/json",
-                        "user-agent": "identify-audio-v0.2"})
+    r = discogs_request(session, "PUT", "/users/"+username+"/wants/"+str(release_id),
+                        header_auth=True,
+                        headers={
+                            "content-type": "application/json",
+                            "user-agent": DISCOGS_USER_AGENT})
     return r.status_code
 
+def discogs_want(release_id):
+    # a release already added isn't added again
+    def add():
+        status = discogs_add_wantlist(discogs_get_oauth_session(), config["DISCOGS_USERNAME"], release_id)
+        if status != 201:
+            raise RuntimeError("Error code {} adding the release to your Discogs wantlist".format(status))
+        return True
+    return cached("want", config["DISCOGS_USERNAME"] + "/" + str(release_id), add)
+
+# ----------- Enrichment ------------------
+
+def enrich_result(item):
+    result = item.get("result")
+    if not isinstance(result, dict) or not result.get("artist") or not result.get("album"):
+        return
+    try:
+        master = discogs_get_master(result["artist"], result["album"])
+        discogs_result = collections.OrderedDict([("master_id", master["id"]),
+                                                  ("title", master["title"]),
+                                                  ("year", master["year"]),
+                                                  ("url", "https://discogs.com" + master["uri"])])
+        if args["want"]:
+            release = discogs_get_release(master["id"])
+            discogs_want(release["id"])
+            discogs_result["release_id"] = release["id"]
+            discogs_result["wanted"] = True
+    except (RuntimeError, requests.RequestException, ValueError) as e:
+        discogs_result = {"error": str(e)}
+    item["discogs"] = discogs_result
+
+def enrich_line(line):
+    # lines that aren't records pass through untouched
+    try:
+        record = json.loads(line, object_pairs_hook=collections.OrderedDict)
+    except ValueError:
+        return line.rstrip("\n")
+    if not isinstance(record, dict):
+        return line.rstrip("\n")
+    enrich_result(record)
+    for track in record.get("tracklist") or []:
+        enrich_result(track)
+    return json.dumps(record)
+
+def enrich_stream(lines, out):
+    # Lines are enriched on DISCOGS_JOBS threads and written in the order
+    # they were read, as soon as each is done, so a --monitor log can be
+    # followed live. The read never gets more than a few lines per thread
+    # ahead of the write.
+    work = Queue.Queue()
+    pending = Queue.Queue(maxsize=4 * DISCOGS_JOBS)
+    closed = threading.Event()
+
+    def enrich_worker():
+        while True:
+            job = work.get()
+            try:
+                job[2] = enrich_line(job[0])
+            except Exception as e:
+                sys.stderr.write("Unable to enrich a record: {}\n".format(e))
+                job[2] = job[0].rstrip("\n")
+            finally:
+                job[1].set()
+
+    def write_worker():
+        while True:
+            job = pending.get()
+            if job is None:
+                return
+            job[1].wait()
+            if closed.is_set():
+                continue
+            try:
+                out.write(job[2] + "\n")
+                out.flush()
+            except IOError:
+                # the reader has gone; keep taking lines so the read can stop
+                closed.set()
+
+    threads = [threading.Thread(target=enrich_worker) for i in range(max(DISCOGS_JOBS, 1))]
+    writer = threading.Thread(target=write_worker)
+    for thread in threads + [writer]:
+        thread.daemon = True
+        thread.start()
+    for line in lines:
+        if closed.is_set():
+            break
+        job = [line, threading.Event(), None]
+        pending.put(job)
+        work.put(job)
+    pending.put(None)
+    while writer.is_alive():
+        writer.join(1)
+
+def enrich(paths):
+    if args["want"]:
+        # asked for now, and not from stdin if that is where the records are
+        reads_stdin = not paths or "-" in paths
+        discogs_get_oauth_session(authorise=not reads_stdin or sys.stdin.isatty())
+    for path in paths or ["-"]:
+        if path == "-":
+            enrich_stream(iter(sys.stdin.readline, ""), sys.stdout)
+        else:
+            with open(path, "r") as f:
+                enrich_stream(iter(f.readline, ""), sys.stdout)
+
 # ----------- Audio devices ---------------
 
 def find_device(device_sought, device_list):
@@ -174,9 +428,153 @@ def write_file(frames, path, format, channels, rate):
 
 # ----------- Gracenote -------------------
 
+def raw_format_args(format, channels, rate):
+    args = ["--rate", str(rate), "--channels", str(channels)]
+    if format == pyaudio.paFloat32:
+        return args + ["--float"]
+    return args + ["--bits", str(8 * p.get_sample_size(format))]
+
+def query_gracenote_server(socket_path, sound_path):
+    # one request per connection, answered with a single line of JSON
+    client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        client.connect(socket_path)
+        client.sendall(sound_path + "\n")
+        out = client.makefile("r").readline()
+    finally:
+        client.close()
+    if not out:
+        raise GracenoteError("No response from server at " + socket_path)
+    return out
+
+def query_gracenote_stream(device_index, format, channels, rate, chunk, record_seconds):
+    # Feed the recording straight into sample's stdin as it is captured,
+    # so identification starts before recording has finished and nothing
+    # is written to disk.
+    app = subprocess.Popen([config["APP_PATH"], "--raw"] + CONDITION_ARGS + DEADLINE_ARGS +
+                           raw_format_args(format, channels, rate) + ["-"],
+                           stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    stream = p.open(format=format,
+                    channels=channels,
+                    rate=rate,
+                    input=True,
+                    input_device_index=device_index,
+                    frames_per_buffer=chunk)
+
+    log("Recording for up to {} seconds...".format(record_seconds))
+
+    try:
+        for i in range(0, int(rate / chunk * record_seconds)):
+            app.stdin.write(stream.read(chunk))
+            app.stdin.flush()
+    except IOError:
+        # sample closes its end once it has an answer
+        pass
+    finally:
+        stream.stop_stream()
+        stream.close()
+
+    try:
+        app.stdin.close()
+    except IOError:
+        pass
+    out = app.stdout.read()
+    app.wait()
+    return parse_gracenote(out)
+
+def run_capture(device_index, format, channels, rate, chunk, socket_path, preroll):
+    # Keep sample listening to the device so that a request to the socket
+    # is answered from the last few seconds of audio, plus whatever plays
+    # next if that isn't enough, without waiting for a recording.
+    app = subprocess.Popen([config["APP_PATH"], "--server", socket_path,
+                            "--capture", "--preroll", str(preroll)] + CONDITION_ARGS + DEADLINE_ARGS +
+                           raw_format_args(format, channels, rate) + ["-"],
+                           stdin=subprocess.PIPE)
+    stream = p.open(format=format,
+                    channels=channels,
+                    rate=rate,
+                    input=True,
+                    input_device_index=device_index,
+                    frames_per_buffer=chunk)
+
+    log("Capturing to {}, Ctrl-C to stop...".format(socket_path))
+
+    try:
+        while app.poll() is None:
+            app.stdin.write(stream.read(chunk))
+    except (IOError, KeyboardInterrupt):
+        pass
+    finally:
+        stream.stop_stream()
+        stream.close()
+        if app.poll() is None:
+            app.terminate()
+        app.wait()
+
+# ------------- libidentify --------------
+
+class IdentifyConfig(ctypes.Structure):
+    _fields_ = [("cache_dir", ctypes.c_char_p),
+                ("local_index_path", ctypes.c_char_p),
+                ("candidates", ctypes.c_uint32),
+                ("b_condition", ctypes.c_int),
+                ("deadline_seconds", ctypes.c_double),
+                ("hedge_percentile", ctypes.c_double)]
+
+class IdentifyFormat(ctypes.Structure):
+    _fields_ = [("sample_rate", ctypes.c_uint32),
+                ("bits_per_sample", ctypes.c_uint32),
+                ("channels", ctypes.c_uint32),
+                ("b_float", ctypes.c_int)]
+
+IDENTIFY_CALLBACK = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t)
+
+library = None
+
+def load_library(path):
+    # the SDK is started once and kept for every attempt
+    global library
+    if library is None:
+        lib = ctypes.CDLL(path)
+        lib.identify_init.restype = ctypes.c_void_p
+        lib.identify_init.argtypes = [ctypes.POINTER(IdentifyConfig)]
+        lib.identify_pcm.restype = ctypes.c_int
+        lib.identify_pcm.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t,
+                                     ctypes.POINTER(IdentifyFormat), IDENTIFY_CALLBACK, ctypes.c_void_p]
+        lib.identify_shutdown.argtypes = [ctypes.c_void_p]
+        identify_config = IdentifyConfig(None, None, 0, 1 if CONDITION_ARGS else 0,
+                                         DEADLINE, HEDGE)
+        handle = lib.identify_init(ctypes.byref(identify_config))
+        if not handle:
+            raise GracenoteError("Unable to start " + path)
+        library = (lib, handle)
+    return library
+
+def unload_library():
+    global library
+    if library is not None:
+        library[0].identify_shutdown(library[1])
+        library = None
+
+def query_gracenote_library(pcm, format, channels, rate):
+    # the recording is identified where it is, without a file or a process
+    lib, handle = load_library(config["LIB_PATH"])
+    pcm_format = IdentifyFormat(rate, 8 * p.get_sample_size(format), channels,
+                                1 if format == pyaudio.paFloat32 else 0)
+    records = []
+    callback = IDENTIFY_CALLBACK(lambda user_data, record, size: records.append(record))
+    if lib.identify_pcm(handle, pcm, len(pcm), ctypes.byref(pcm_format), callback, None) != 0:
+        raise GracenoteError("Unable to identify the recording")
+    return parse_gracenote(records[-1])
+
 def query_gracenote(sound_path):
-    # TODO - handle double quotes in the output
-    out = subprocess.check_output([config["APP_PATH"], sound_path])
+    if "SERVER_SOCKET" in config:
+        out = query_gracenote_server(config["SERVER_SOCKET"], sound_path)
+    else:
+        out = subprocess.check_output([config["APP_PATH"]] + CONDITION_ARGS + DEADLINE_ARGS + [sound_path])
+    return parse_gracenote(out)
+
+def parse_gracenote(out):
     result = json.loads(out)
     try:
         error = result["error"]
@@ -190,62 +588,101 @@ def log(statement):
 
 # ----------- Main ------------------------
 
-def main():
-
-    output = get_current_output()
-    multi_out = get_multi_device(output)
-    FNULL = open(os.devnull, "w")
-
-    if subprocess.call(["SwitchAudioSource", "-s", multi_out], stdout=FNULL, stderr=FNULL) == 0:
-        length = RECORD_SECONDS
-        match = False
-        attempts = 0
-        while not match and attempts <= 2:
+def identify_recording():
+    length = RECORD_SECONDS
+    attempts = 0
+    while True:
+        if "LIB_PATH" in config:
+            input_audio = record_audio(get_soundflower_index(), FORMAT, CHANNELS, RATE, CHUNK, length)
+            resp = query_gracenote_library(b"".join(input_audio), FORMAT, CHANNELS, RATE)
+        elif "SERVER_SOCKET" in config:
             input_audio = record_audio(get_soundflower_index(), FORMAT, CHANNELS, RATE, CHUNK, length)
             try:
                 write_file(input_audio, COMPLETE_NAME, FORMAT, CHANNELS, RATE)
             except IOError:
                 log("Error writing the sound file.")
             resp = query_gracenote(COMPLETE_NAME)
-            if resp["result"] is None:
-                log("The track was not identified.")
-                length += 3
-                attempts += 1
-                if attempts <= 2:
-                    log("Retrying...")
-            else:
-                match = True
-        if match:
-            print json.dumps(resp["result"], indent=4, separators=("", " - "), ensure_ascii=False).encode("utf8")
-            if args["discogs"] or args["want"]:
-                try:
-                    master = discogs_get_master(resp["result"]["artist"], resp["result"]["album"])
-                except RuntimeError as e:
-                    log(e)
+        else:
+            resp = query_gracenote_stream(get_soundflower_index(), FORMAT, CHANNELS, RATE, CHUNK, length)
+        if resp["result"] is not None:
+            return resp
+        log("The track was not identified.")
+        length += 3
+        attempts += 1
+        if attempts > 2:
+            return resp
+        log("Retrying...")
+
+def identify_captured():
+    # the capture process has been listening all along, so one request
+    # covers what has just played and as much as it needs of what follows
+    resp = parse_gracenote(query_gracenote_server(config["CAPTURE_SOCKET"], "identify"))
+    if resp["result"] is None:
+        log("The track was not identified.")
+    return resp
+
+def show_match(resp):
+    print json.dumps(resp["result"], indent=4, separators=("", " - "), ensure_ascii=False).encode("utf8")
+    if args["discogs"] or args["want"]:
+        try:
+            master = discogs_get_master(resp["result"]["artist"], resp["result"]["album"])
+        except RuntimeError as e:
+            log(e)
+        else:
+            url = "https://discogs.com" + master["uri"]
+            log("Find online: " + url)
+
+            if args["open"]:
+                webbrowser.open(url, new=2, autoraise=True)
+            want_add = None
+            if not args["want"] and not args["open"]:
+                want_add = raw_input("Add this to your Discogs wantlist? y/n/o (to open in browser): ")
+            if want_add == "o" or args["open"]:
+                webbrowser.open(url, new=2, autoraise=True)
+                want_add = raw_input("Add this to your Discogs wantlist? y/n: ")
+            if want_add == "y" or args["want"]:
+                release = discogs_get_release(master["id"])
+                session = discogs_get_oauth_session()
+                status = discogs_add_wantlist(session, config["DISCOGS_USERNAME"], release["id"])
+                if status == 201:
+                    log("Added '{}' to your Discogs wantlist".format(release["title"]))
                 else:
-                    url = "https://discogs.com" + master["uri"]
-                    log("Find online: " + url)
-
-                    if args["open"]:
-                        webbrowser.open(url, new=2, autoraise=True)
-                    want_add = None
-                    if not args["want"] and not args["open"]:
-                        want_add = raw_input("Add this to your Discogs wantlist? y/n/o (to open in browser): ")
-                    if want_add == "o" or args["open"]:
-                        webbrowser.open(url, new=2, autoraise=True)
-                        want_add = raw_input("Add this to your Discogs wantlist? y/n: ")
-                    if want_add == "y" or args["want"]:
-                        release = discogs_get_release(master["id"])
-                        session = discogs_get_oauth_session()
-                        status = discogs_add_wantlist(session, config["DISCOGS_USERNAME"], release["id"])
-                        if status == 201:
-                            log("Added '{}' to your Discogs wantlist".format(release["title"]))
-                        else:
-                            log("Error code {} adding the release to your Discogs wantlist".format(status))
+                    log("Error code {} adding the release to your Discogs wantlist".format(status))
+
+def main():
+
+    if args["enrich"] is not None:
+        p.terminate()
+        enrich(args["enrich"])
+        return
+
+    if "CAPTURE_SOCKET" in config and not args["capture"]:
+        resp = identify_captured()
+        p.terminate()
+        if resp["result"] is not None:
+            show_match(resp)
+        return
+
+    output = get_current_output()
+    multi_out = get_multi_device(output)
+    FNULL = open(os.devnull, "w")
+
+    if subprocess.call(["SwitchAudioSource", "-s", multi_out], stdout=FNULL, stderr=FNULL) == 0:
+        if args["capture"]:
+            if "CAPTURE_SOCKET" not in config:
+                raise RuntimeError("Set CAPTURE_SOCKET in your config file to use --capture.")
+            run_capture(get_soundflower_index(), FORMAT, CHANNELS, RATE, CHUNK,
+                        config["CAPTURE_SOCKET"], int(config.get("CAPTURE_PREROLL", PREROLL_SECONDS)))
+        else:
+            resp = identify_recording()
+            if resp["result"] is not None:
+                show_match(resp)
     else:
         raise RuntimeError("Couldn't switch to multi-output device.")
+    unload_library()
     p.terminate()
-    os.remove(COMPLETE_NAME)
+    if os.path.exists(COMPLETE_NAME):
+        os.remove(COMPLETE_NAME)
     if subprocess.call(["SwitchAudioSource", "-s", output], stdout=FNULL, stderr=FNULL) == 0:
         return
     else:
@@ -258,6 +695,8 @@ if __name__ == "__main__":
     parser.add_argument("--open", "-o", action="store_true")
     parser.add_argument("--quiet", "-q", action="store_true")
     parser.add_argument("--verbose", "-v", action="store_true")
+    parser.add_argument("--capture", "-c", action="store_true")
+    parser.add_argument("--enrich", "-e", nargs="*", metavar="FILE")
     args = vars(parser.parse_args())
 
     if args["verbose"]:
@@ -0,0 +1,417 @@
+/*
+ *  Name: ingest.c
+ *  Description:
+ *  Reader thread and single producer, single consumer ring for one live
+ *  input. The reader only ever moves head and the consumer only ever
+ *  moves tail, so neither takes a lock: a consumer stuck in a slow SDK
+ *  call costs the reader nothing until the ring is full, and then only
+ *  the audio that doesn't fit is lost.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  /* pthread_setaffinity_np() */
+#endif
+
+#include "ingest.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* how long the reader waits for input before checking it should stop */
+#define INGEST_POLL_MS 200
+
+/* how long the consumer sleeps between looks at an empty ring */
+#define INGEST_IDLE_NS (2 * 1000000L)
+
+/* keeps the reader's and the consumer's fields on separate cache lines */
+#define INGEST_CACHE_LINE 64
+
+struct ingest_s
+{
+    /* set up by ingest_open() and then only read */
+    int             fd;
+    uint64_t        limit;
+    size_t          frame_size;
+    size_t          read_size;
+    unsigned char*  ring;
+    size_t          capacity;      /* bytes, a whole number of frames */
+    pthread_t       thread;
+
+    /* written by the reader */
+    _Alignas(INGEST_CACHE_LINE)
+    _Atomic uint64_t      head;    /* bytes ever put in the ring */
+    _Atomic int           b_eof;
+    _Atomic uint64_t      bytes_read;
+    _Atomic uint64_t      bytes_dropped;
+    _Atomic unsigned long overruns;
+    _Atomic size_t        peak_fill;
+
+    /* written by the consumer */
+    _Alignas(INGEST_CACHE_LINE)
+    _Atomic uint64_t      tail;    /* bytes ever taken out */
+    _Atomic unsigned long underruns;
+    int                   b_dry;   /* last peek found nothing; only the consumer looks */
+    _Atomic int           b_stop;  /* set by ingest_close() */
+};
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+/******************************************************************
+ *
+ *    _INGEST_PUSH
+ *
+ *    Put size bytes (whole frames) in the ring if there is room for
+ *    all of them, otherwise count an overrun and drop them. Only the
+ *    reader calls this.
+ *
+ *****************************************************************/
+static void
+_ingest_push(
+    ingest_t*            ingest,
+    const unsigned char* data,
+    size_t               size
+    )
+{
+    uint64_t head   = atomic_load_explicit(&ingest->head, memory_order_relaxed);
+    uint64_t tail   = atomic_load_explicit(&ingest->tail, memory_order_acquire);
+    size_t   fill   = (size_t)(head - tail);
+    size_t   offset = 0;
+    size_t   part   = 0;
+
+    if (size > ingest->capacity - fill)
+    {
+        atomic_fetch_add_explicit(&ingest->overruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ingest->bytes_dropped, size, memory_order_relaxed);
+        return;
+    }
+
+    offset = (size_t)(head % ingest->capacity);
+    part   = ingest->capacity - offset;
+    if (part > size)
+    {
+        part = size;
+    }
+    memcpy(ingest->ring + offset, data, part);
+    memcpy(ingest->ring, data + part, size - part);
+
+    /* publish the audio only once it is in place */
+    atomic_store_explicit(&ingest->head, head + size, memory_order_release);
+
+    fill += size;
+    if (fill > atomic_load_explicit(&ingest->peak_fill, memory_order_relaxed))
+    {
+        atomic_store_explicit(&ingest->peak_fill, fill, memory_order_relaxed);
+    }
+
+} /* _ingest_push() */
+
+/******************************************************************
+ *
+ *    _INGEST_READER
+ *
+ *    Thread reading the input into the ring. Only whole frames go in;
+ *    a partial frame from a short read waits for the rest.
+ *
+ *****************************************************************/
+static void*
+_ingest_reader(
+    void* arg
+    )
+{
+    ingest_t*      ingest    = (ingest_t*)arg;
+    unsigned char* buf       = NULL;
+    struct pollfd  pfd       = {0};
+    uint64_t       remaining = ingest->limit;
+    size_t         buffered  = 0;
+    size_t         whole     = 0;
+    size_t         want      = 0;
+    ssize_t        got       = 0;
+    int            ready     = 0;
+
+    buf = malloc(ingest->read_size);
+
+    pfd.fd     = ingest->fd;
+    pfd.events = POLLIN;
+
+    while (buf && remaining > 0 && !atomic_load_explicit(&ingest->b_stop, memory_order_relaxed))
+    {
+        /* wait in poll() rather than read() so that a quiet input can be stopped */
+        ready = poll(&pfd, 1, INGEST_POLL_MS);
+        if (ready < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (ready <= 0)
+        {
+            continue;
+        }
+
+        want = ingest->read_size - buffered;
+        if (remaining != UINT64_MAX && remaining < want)
+        {
+            want = (size_t)remaining;
+        }
+
+        got = read(ingest->fd, buf + buffered, want);
+        if (got < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+        if (remaining != UINT64_MAX)
+        {
+            remaining -= (uint64_t)got;
+        }
+        atomic_fetch_add_explicit(&ingest->bytes_read, (uint64_t)got, memory_order_relaxed);
+
+        buffered += (size_t)got;
+        whole     = buffered - (buffered % ingest->frame_size);
+        if (0 == whole)
+        {
+            continue;
+        }
+
+        _ingest_push(ingest, buf, whole);
+
+        buffered -= whole;
+        memmove(buf, buf + whole, buffered);
+    }
+
+    free(buf);
+
+    atomic_store_explicit(&ingest->b_eof, 1, memory_order_release);
+
+    return NULL;
+
+} /* _ingest_reader() */
+
+/******************************************************************
+ *
+ *    INGEST_OPEN
+ *
+ *****************************************************************/
+ingest_t*
+ingest_open(
+    int      fd,
+    uint64_t limit,
+    size_t   frame_size,
+    size_t   capacity,
+    size_t   read_size,
+    int      cpu
+    )
+{
+    ingest_t* ingest = NULL;
+    int       rc     = 0;
+
+    if (0 == frame_size || capacity < frame_size)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+#if !defined(__linux__)
+    if (cpu >= 0)
+    {
+        errno = ENOTSUP;
+        return NULL;
+    }
+#endif
+
+    ingest = aligned_alloc(INGEST_CACHE_LINE, (sizeof(*ingest) + INGEST_CACHE_LINE - 1) / INGEST_CACHE_LINE * INGEST_CACHE_LINE);
+    if (ingest == NULL)
+    {
+        return NULL;
+    }
+    memset(ingest, 0, sizeof(*ingest));
+
+    ingest->fd         = fd;
+    ingest->limit      = limit;
+    ingest->frame_size = frame_size;
+    ingest->read_size  = (read_size > frame_size) ? read_size - (read_size % frame_size) : frame_size;
+    ingest->capacity   = capacity - (capacity % frame_size);
+    ingest->ring       = malloc(ingest->capacity);
+    if (ingest->ring == NULL)
+    {
+        free(ingest);
+        return NULL;
+    }
+
+    atomic_init(&ingest->head, 0);
+    atomic_init(&ingest->tail, 0);
+    atomic_init(&ingest->b_eof, 0);
+    atomic_init(&ingest->b_stop, 0);
+    atomic_init(&ingest->bytes_read, 0);
+    atomic_init(&ingest->bytes_dropped, 0);
+    atomic_init(&ingest->overruns, 0);
+    atomic_init(&ingest->underruns, 0);
+    atomic_init(&ingest->peak_fill, 0);
+
+    rc = pthread_create(&ingest->thread, NULL, _ingest_reader, ingest);
+    if (0 != rc)
+    {
+        free(ingest->ring);
+        free(ingest);
+        errno = rc;
+        return NULL;
+    }
+
+#if defined(__linux__)
+    if (cpu >= CPU_SETSIZE)
+    {
+        ingest_close(ingest);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        rc = pthread_setaffinity_np(ingest->thread, sizeof(cpus), &cpus);
+        if (0 != rc)
+        {
+            ingest_close(ingest);
+            errno = rc;
+            return NULL;
+        }
+    }
+#endif
+
+    return ingest;
+
+} /* ingest_open() */
+
+/******************************************************************
+ *
+ *    INGEST_CLOSE
+ *
+ *****************************************************************/
+void
+ingest_close(
+    ingest_t* ingest
+    )
+{
+    if (ingest == NULL)
+    {
+        return;
+    }
+
+    /* the reader never blocks for longer than INGEST_POLL_MS */
+    atomic_store_explicit(&ingest->b_stop, 1, memory_order_relaxed);
+    pthread_join(ingest->thread, NULL);
+
+    free(ingest->ring);
+    free(ingest);
+
+} /* ingest_close() */
+
+/******************************************************************
+ *
+ *    INGEST_PEEK
+ *
+ *****************************************************************/
+long
+ingest_peek(
+    ingest_t*    ingest,
+    const void** p_data,
+    long         timeout_ms
+    )
+{
+    struct timespec idle    = { 0, INGEST_IDLE_NS };
+    uint64_t        tail    = atomic_load_explicit(&ingest->tail, memory_order_relaxed);
+    uint64_t        head    = 0;
+    long long       waited  = 0;
+    size_t          offset  = 0;
+    size_t          size    = 0;
+    int             b_eof   = 0;
+
+    for (;;)
+    {
+        /* b_eof before head, so audio pushed just before the end is seen */
+        b_eof = atomic_load_explicit(&ingest->b_eof, memory_order_acquire);
+        head  = atomic_load_explicit(&ingest->head, memory_order_acquire);
+        if (head != tail || b_eof || waited >= timeout_ms * 1000000LL)
+        {
+            break;
+        }
+
+        /* count running dry once, not for every look at an empty ring */
+        if (!ingest->b_dry && tail > 0)
+        {
+            ingest->b_dry = 1;
+            atomic_fetch_add_explicit(&ingest->underruns, 1, memory_order_relaxed);
+        }
+
+        nanosleep(&idle, NULL);
+        waited += INGEST_IDLE_NS;
+    }
+
+    if (head == tail)
+    {
+        return b_eof ? -1 : 0;
+    }
+    ingest->b_dry = 0;
+
+    offset = (size_t)(tail % ingest->capacity);
+    size   = (size_t)(head - tail);
+    if (size > ingest->capacity - offset)
+    {
+        size = ingest->capacity - offset;
+    }
+
+    *p_data = ingest->ring + offset;
+
+    return (long)size;
+
+} /* ingest_peek() */
+
+/******************************************************************
+ *
+ *    INGEST_CONSUME
+ *
+ *****************************************************************/
+void
+ingest_consume(
+    ingest_t* ingest,
+    size_t    size
+    )
+{
+    uint64_t tail = atomic_load_explicit(&ingest->tail, memory_order_relaxed);
+
+    /* hand the space back only once we are done with the audio in it */
+    atomic_store_explicit(&ingest->tail, tail + size, memory_order_release);
+
+} /* ingest_consume() */
+
+/******************************************************************
+ *
+ *    INGEST_GET_STATS
+ *
+ *****************************************************************/
+void
+ingest_get_stats(
+    ingest_t*       ingest,
+    ingest_stats_t* p_stats
+    )
+{
+    p_stats->bytes_read    = atomic_load_explicit(&ingest->bytes_read, memory_order_relaxed);
+    p_stats->bytes_dropped = atomic_load_explicit(&ingest->bytes_dropped, memory_order_relaxed);
+    p_stats->overruns      = atomic_load_explicit(&ingest->overruns, memory_order_relaxed);
+    p_stats->underruns     = atomic_load_explicit(&ingest->underruns, memory_order_relaxed);
+    p_stats->peak_fill     = atomic_load_explicit(&ingest->peak_fill, memory_order_relaxed);
+    p_stats->capacity      = ingest->capacity;
+
+} /* ingest_get_stats() */
@@ -0,0 +1,80 @@
+/*
+ *  Name: ingest.h
+ *  Description:
+ *  Live input read on a thread of its own into a lock-free single
+ *  producer, single consumer ring, so that a slow write to the channel
+ *  never holds up reading (and a stalled input never holds up anything
+ *  else).
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ingest_s ingest_t;
+
+typedef struct
+{
+    uint64_t      bytes_read;     /* from the input, including any dropped */
+    uint64_t      bytes_dropped;  /* read while the ring was full and thrown away */
+    unsigned long overruns;       /* reads that found the ring full */
+    unsigned long underruns;      /* times the consumer caught up and found it empty */
+    size_t        peak_fill;      /* most bytes ever waiting in the ring */
+    size_t        capacity;
+
+} ingest_stats_t;
+
+/*
+ * Start a thread reading interleaved PCM from fd, read_size bytes at a
+ * time, into a ring of capacity bytes (rounded down to whole frames).
+ * It stops after limit bytes (UINT64_MAX for none) or at the end of the
+ * input. Audio that arrives while the ring is full is dropped, a read at
+ * a time, rather than held. With cpu >= 0 the thread is pinned to that
+ * CPU. Returns NULL with errno set if the ring or thread can't be set up.
+ */
+ingest_t*
+ingest_open(
+    int      fd,
+    uint64_t limit,
+    size_t   frame_size,
+    size_t   capacity,
+    size_t   read_size,
+    int      cpu
+    );
+
+/* Stop the reader thread and free the ring. fd is not closed. */
+void
+ingest_close(
+    ingest_t* ingest
+    );
+
+/*
+ * Consumer side: point *p_data at the oldest audio waiting, waiting up
+ * to timeout_ms for some, and return how many bytes of it are
+ * contiguous (whole frames). They stay put until ingest_consume().
+ * Returns 0 on timeout, or -1 once the input has ended and everything
+ * has been consumed.
+ */
+long
+ingest_peek(
+    ingest_t*    ingest,
+    const void** p_data,
+    long         timeout_ms
+    );
+
+/* Release size bytes returned by ingest_peek() back to the reader */
+void
+ingest_consume(
+    ingest_t* ingest,
+    size_t    size
+    );
+
+void
+ingest_get_stats(
+    ingest_t*       ingest,
+    ingest_stats_t* p_stats
+    );
+
+#endif /* INGEST_H */
@@ -0,0 +1,1082 @@
+/*
+ *  Name: landmark.c
+ *  Description:
+ *  Spectral peak pair fingerprints and the memory mapped index they are
+ *  matched against.
+ *
+ *  Each frame of LANDMARK_FRAME samples (Hann windowed, LANDMARK_HOP
+ *  apart) is turned into a log power spectrum. A bin is a peak if it is
+ *  the largest within PEAK_FREQ_SPAN bins and PEAK_TIME_SPAN frames
+ *  either side and stands PEAK_ABOVE_MEAN_DB over the frame's average;
+ *  only the PEAKS_PER_FRAME strongest are kept. Every peak is then paired
+ *  with the first PAIR_FANOUT peaks that follow it within PAIR_MAX_DT
+ *  frames and PAIR_MAX_DF bins, and each pair becomes a hash of the two
+ *  frequencies and the time between them.
+ */
+
+#include "landmark.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* samples per analysis frame, a power of two */
+#define LANDMARK_FRAME 1024
+#define LANDMARK_BINS  (LANDMARK_FRAME / 2)
+
+/* bins searched for peaks: about 50 Hz to 4 kHz */
+#define PEAK_MIN_BIN 5
+#define PEAK_MAX_BIN 380
+
+#define PEAK_FREQ_SPAN      8
+#define PEAK_TIME_SPAN      3
+#define PEAK_ABOVE_MEAN_DB  6.0
+#define PEAK_FLOOR_DB       -60.0
+#define PEAKS_PER_FRAME     5
+
+#define PAIR_MAX_DT  63
+#define PAIR_MAX_DF  64
+#define PAIR_FANOUT  6
+
+/* frames of spectrum kept while their peaks are worked out */
+#define SPECTRUM_FRAMES (2 * PEAK_TIME_SPAN + 1)
+
+/* peaks kept while later ones may still pair with them */
+#define RECENT_PEAKS ((PAIR_MAX_DT + 1) * PEAKS_PER_FRAME)
+
+/* index entries looked at for any one query hash, so a very common
+ * hash can't swamp the vote */
+#define MATCH_MAX_HITS 256
+
+#define INDEX_MAGIC      "LANDMRK1"
+#define INDEX_BYTE_ORDER 0x01020304u
+
+typedef struct
+{
+    uint32_t frame;
+    uint16_t bin;
+    uint16_t pairs;    /* made with it as the first peak */
+    float    db;
+
+} landmark_peak_t;
+
+struct landmark_fp_s
+{
+    uint32_t         channels;
+    float            samples[LANDMARK_FRAME];   /* mono, waiting to be analysed */
+    size_t           sample_count;
+    float            window[LANDMARK_FRAME];
+    float            cos_table[LANDMARK_BINS];
+    float            sin_table[LANDMARK_BINS];
+    uint16_t         bit_reverse[LANDMARK_FRAME];
+    float            spectrum[SPECTRUM_FRAMES][LANDMARK_BINS];  /* dB, by frame % SPECTRUM_FRAMES */
+    float            mean_db[SPECTRUM_FRAMES];
+    uint32_t         frames;                    /* analysed so far */
+    landmark_peak_t  recent[RECENT_PEAKS];
+    size_t           recent_count;
+    landmark_hash_t* hashes;
+    size_t           hash_count;
+    size_t           hash_capacity;
+};
+
+typedef struct
+{
+    uint32_t name_offset;
+    uint32_t duration_ms;
+
+} landmark_track_t;
+
+typedef struct
+{
+    uint32_t hash;
+    uint32_t track;
+    uint32_t frame;
+
+} landmark_entry_t;
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t byte_order;
+    uint32_t track_count;
+    uint32_t bucket_bits;
+    uint32_t reserved;
+    uint64_t entry_count;
+    uint64_t tracks_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t buckets_offset;
+    uint64_t entries_offset;
+    uint64_t file_size;
+
+} landmark_file_header_t;
+
+struct landmark_builder_s
+{
+    landmark_track_t* tracks;
+    uint32_t          track_count;
+    size_t            track_capacity;
+    char*             names;
+    size_t            names_size;
+    size_t            names_capacity;
+    landmark_entry_t* entries;
+    size_t            entry_count;
+    size_t            entry_capacity;
+};
+
+struct landmark_index_s
+{
+    void*                         map;
+    size_t                        map_size;
+    const landmark_file_header_t* header;
+    const landmark_track_t*       tracks;
+    const char*                   names;
+    const uint32_t*               buckets;
+    const landmark_entry_t*       entries;
+};
+
+typedef struct
+{
+    uint32_t track;
+    int32_t  delta;    /* index frame less query frame */
+
+} landmark_vote_t;
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+/******************************************************************
+ *
+ *    _GROW
+ *
+ *    Make room for one more item in a growing array.
+ *
+ *****************************************************************/
+static int
+_grow(
+    void**  p_items,
+    size_t* p_capacity,
+    size_t  count,
+    size_t  item_size
+    )
+{
+    size_t capacity = *p_capacity;
+    void*  items    = NULL;
+
+    if (count < capacity)
+    {
+        return 0;
+    }
+
+    capacity = capacity ? capacity * 2 : 256;
+    items    = realloc(*p_items, capacity * item_size);
+    if (items == NULL)
+    {
+        return -1;
+    }
+    *p_items    = items;
+    *p_capacity = capacity;
+
+    return 0;
+
+} /* _grow() */
+
+/******************************************************************
+ *
+ *    _BUCKET
+ *
+ *    The index bucket of a hash, spread over bucket_bits bits.
+ *
+ *****************************************************************/
+static uint32_t
+_bucket(
+    uint32_t hash,
+    uint32_t bucket_bits
+    )
+{
+    return (uint32_t)((hash * 2654435761u) >> (32 - bucket_bits));
+
+} /* _bucket() */
+
+/******************************************************************
+ *
+ *    _SPECTRUM
+ *
+ *    Window the waiting samples and put their power spectrum, in dB,
+ *    in the slot for the next frame.
+ *
+ *****************************************************************/
+static void
+_spectrum(
+    landmark_fp_t* fp
+    )
+{
+    float  re[LANDMARK_FRAME];
+    float  im[LANDMARK_FRAME];
+    float* out   = fp->spectrum[fp->frames % SPECTRUM_FRAMES];
+    double total = 0;
+    size_t i     = 0;
+    size_t half  = 0;
+    size_t step  = 0;
+    size_t start = 0;
+    size_t k     = 0;
+    float  t_re  = 0;
+    float  t_im  = 0;
+    float  power = 0;
+
+    for (i = 0; i < LANDMARK_FRAME; i++)
+    {
+        re[fp->bit_reverse[i]] = fp->samples[i] * fp->window[i];
+        im[fp->bit_reverse[i]] = 0;
+    }
+
+    /* radix-2 decimation in time */
+    for (half = 1; half < LANDMARK_FRAME; half *= 2)
+    {
+        step = LANDMARK_BINS / half;
+        for (start = 0; start < LANDMARK_FRAME; start += 2 * half)
+        {
+            for (k = 0; k < half; k++)
+            {
+                i    = start + k;
+                t_re = fp->cos_table[k * step] * re[i + half] + fp->sin_table[k * step] * im[i + half];
+                t_im = fp->cos_table[k * step] * im[i + half] - fp->sin_table[k * step] * re[i + half];
+                re[i + half] = re[i] - t_re;
+                im[i + half] = im[i] - t_im;
+                re[i]       += t_re;
+                im[i]       += t_im;
+            }
+        }
+    }
+
+    for (k = 0; k < LANDMARK_BINS; k++)
+    {
+        power  = (re[k] * re[k] + im[k] * im[k]) / (float)LANDMARK_FRAME;
+        out[k] = 10.0f * log10f(power + 1e-12f);
+        if (k >= PEAK_MIN_BIN && k < PEAK_MAX_BIN)
+        {
+            total += out[k];
+        }
+    }
+    fp->mean_db[fp->frames % SPECTRUM_FRAMES] = (float)(total / (PEAK_MAX_BIN - PEAK_MIN_BIN));
+
+} /* _spectrum() */
+
+/******************************************************************
+ *
+ *    _ADD_HASH
+ *
+ *****************************************************************/
+static int
+_add_hash(
+    landmark_fp_t*         fp,
+    const landmark_peak_t* anchor,
+    const landmark_peak_t* target
+    )
+{
+    landmark_hash_t* hash = NULL;
+
+    if (0 != _grow((void**)&fp->hashes, &fp->hash_capacity, fp->hash_count, sizeof(*fp->hashes)))
+    {
+        return -1;
+    }
+
+    hash        = &fp->hashes[fp->hash_count++];
+    hash->hash  = ((uint32_t)anchor->bin << 15) | ((uint32_t)target->bin << 6) | (target->frame - anchor->frame);
+    hash->frame = anchor->frame;
+
+    return 0;
+
+} /* _add_hash() */
+
+/******************************************************************
+ *
+ *    _PICK_PEAKS
+ *
+ *    Find the peaks of frame, whose neighbours PEAK_TIME_SPAN frames
+ *    either side are all in the spectrum slots, and pair them with the
+ *    recent peaks before them.
+ *
+ *****************************************************************/
+static int
+_pick_peaks(
+    landmark_fp_t* fp,
+    uint32_t       frame
+    )
+{
+    landmark_peak_t found[PEAKS_PER_FRAME];
+    size_t          found_count = 0;
+    const float*    row         = fp->spectrum[frame % SPECTRUM_FRAMES];
+    float           threshold   = fp->mean_db[frame % SPECTRUM_FRAMES] + (float)PEAK_ABOVE_MEAN_DB;
+    float           value       = 0;
+    uint32_t        other       = 0;
+    size_t          weakest     = 0;
+    size_t          i           = 0;
+    size_t          kept        = 0;
+    int             bin         = 0;
+    int             b           = 0;
+    int             dt          = 0;
+    int             b_peak      = 0;
+
+    if (threshold < (float)PEAK_FLOOR_DB)
+    {
+        threshold = (float)PEAK_FLOOR_DB;
+    }
+
+    for (bin = PEAK_MIN_BIN; bin < PEAK_MAX_BIN; bin++)
+    {
+        value = row[bin];
+        if (value < threshold || value <= row[bin - 1])
+        {
+            continue;
+        }
+
+        b_peak = 1;
+        for (dt = -PEAK_TIME_SPAN; b_peak && dt <= PEAK_TIME_SPAN; dt++)
+        {
+            /* frames before the first don't exist */
+            if ((int64_t)frame + dt < 0)
+            {
+                continue;
+            }
+            other = (uint32_t)((int64_t)frame + dt);
+            for (b = bin - PEAK_FREQ_SPAN; b <= bin + PEAK_FREQ_SPAN; b++)
+            {
+                if (b >= 0 && b < LANDMARK_BINS && !(other == frame && b == bin)
+                    && fp->spectrum[other % SPECTRUM_FRAMES][b] > value)
+                {
+                    b_peak = 0;
+                    break;
+                }
+            }
+        }
+        if (!b_peak)
+        {
+            continue;
+        }
+
+        /* keep the strongest few */
+        if (found_count < PEAKS_PER_FRAME)
+        {
+            weakest = found_count++;
+        }
+        else
+        {
+            weakest = 0;
+            for (i = 1; i < PEAKS_PER_FRAME; i++)
+            {
+                if (found[i].db < found[weakest].db)
+                {
+                    weakest = i;
+                }
+            }
+            if (found[weakest].db >= value)
+            {
+                continue;
+            }
+        }
+        found[weakest].frame = frame;
+        found[weakest].bin   = (uint16_t)bin;
+        found[weakest].pairs = 0;
+        found[weakest].db    = value;
+    }
+
+    /* pair with the peaks before; they come in time order, so each gets
+     * the nearest PAIR_FANOUT that follow it */
+    for (i = 0; i < fp->recent_count; i++)
+    {
+        landmark_peak_t* anchor = &fp->recent[i];
+
+        if (frame - anchor->frame > PAIR_MAX_DT || anchor->frame == frame)
+        {
+            continue;
+        }
+        for (b = 0; b < (int)found_count && anchor->pairs < PAIR_FANOUT; b++)
+        {
+            if (abs((int)found[b].bin - (int)anchor->bin) <= PAIR_MAX_DF)
+            {
+                if (0 != _add_hash(fp, anchor, &found[b]))
+                {
+                    return -1;
+                }
+                anchor->pairs++;
+            }
+        }
+    }
+
+    /* forget peaks too old to pair with anything to come */
+    for (i = 0; i < fp->recent_count; i++)
+    {
+        if (frame - fp->recent[i].frame < PAIR_MAX_DT)
+        {
+            fp->recent[kept++] = fp->recent[i];
+        }
+    }
+    fp->recent_count = kept;
+
+    for (i = 0; i < found_count && fp->recent_count < RECENT_PEAKS; i++)
+    {
+        fp->recent[fp->recent_count++] = found[i];
+    }
+
+    return 0;
+
+} /* _pick_peaks() */
+
+/******************************************************************
+ *
+ *    _COMPARE_VOTES
+ *
+ *****************************************************************/
+static int
+_compare_votes(
+    const void* a,
+    const void* b
+    )
+{
+    const landmark_vote_t* va = (const landmark_vote_t*)a;
+    const landmark_vote_t* vb = (const landmark_vote_t*)b;
+
+    if (va->track != vb->track)
+    {
+        return (va->track < vb->track) ? -1 : 1;
+    }
+    if (va->delta != vb->delta)
+    {
+        return (va->delta < vb->delta) ? -1 : 1;
+    }
+
+    return 0;
+
+} /* _compare_votes() */
+
+/**********************************************
+ *    Fingerprints
+ **********************************************/
+
+/******************************************************************
+ *
+ *    LANDMARK_FP_OPEN
+ *
+ *****************************************************************/
+landmark_fp_t*
+landmark_fp_open(
+    uint32_t channels
+    )
+{
+    landmark_fp_t* fp   = NULL;
+    size_t         i    = 0;
+    size_t         bits = 0;
+    size_t         j    = 0;
+
+    if (channels < 1 || channels > 2)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fp = calloc(1, sizeof(*fp));
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    fp->channels = channels;
+
+    for (i = 0; i < LANDMARK_FRAME; i++)
+    {
+        fp->window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * (double)i / LANDMARK_FRAME));
+
+        /* index with its bits reversed */
+        for (bits = 1, j = 0; bits < LANDMARK_FRAME; bits *= 2)
+        {
+            j = (j << 1) | ((i & bits) ? 1 : 0);
+        }
+        fp->bit_reverse[i] = (uint16_t)j;
+    }
+    for (i = 0; i < LANDMARK_BINS; i++)
+    {
+        fp->cos_table[i] = (float)cos(2 * M_PI * (double)i / LANDMARK_FRAME);
+        fp->sin_table[i] = (float)sin(2 * M_PI * (double)i / LANDMARK_FRAME);
+    }
+
+    return fp;
+
+} /* landmark_fp_open() */
+
+/******************************************************************
+ *
+ *    LANDMARK_FP_CLOSE
+ *
+ *****************************************************************/
+void
+landmark_fp_close(
+    landmark_fp_t* fp
+    )
+{
+    if (fp)
+    {
+        free(fp->hashes);
+        free(fp);
+    }
+
+} /* landmark_fp_close() */
+
+/******************************************************************
+ *
+ *    LANDMARK_FP_PROCESS
+ *
+ *****************************************************************/
+int
+landmark_fp_process(
+    landmark_fp_t* fp,
+    const int16_t* pcm,
+    size_t         size
+    )
+{
+    size_t frames = size / (sizeof(int16_t) * fp->channels);
+    size_t i      = 0;
+
+    for (i = 0; i < frames; i++)
+    {
+        if (2 == fp->channels)
+        {
+            fp->samples[fp->sample_count++] = ((float)pcm[2 * i] + (float)pcm[2 * i + 1]) / 65536.0f;
+        }
+        else
+        {
+            fp->samples[fp->sample_count++] = (float)pcm[i] / 32768.0f;
+        }
+
+        if (fp->sample_count < LANDMARK_FRAME)
+        {
+            continue;
+        }
+
+        _spectrum(fp);
+        fp->frames++;
+
+        /* a frame's peaks are known once PEAK_TIME_SPAN more have been seen */
+        if (fp->frames > PEAK_TIME_SPAN)
+        {
+            if (0 != _pick_peaks(fp, fp->frames - 1 - PEAK_TIME_SPAN))
+            {
+                return -1;
+            }
+        }
+
+        memmove(fp->samples, fp->samples + LANDMARK_HOP, (LANDMARK_FRAME - LANDMARK_HOP) * sizeof(float));
+        fp->sample_count = LANDMARK_FRAME - LANDMARK_HOP;
+    }
+
+    return 0;
+
+} /* landmark_fp_process() */
+
+/******************************************************************
+ *
+ *    LANDMARK_FP_HASHES
+ *
+ *****************************************************************/
+size_t
+landmark_fp_hashes(
+    landmark_fp_t*          fp,
+    const landmark_hash_t** p_hashes
+    )
+{
+    *p_hashes = fp->hashes;
+
+    return fp->hash_count;
+
+} /* landmark_fp_hashes() */
+
+/******************************************************************
+ *
+ *    LANDMARK_FP_FRAMES
+ *
+ *****************************************************************/
+uint32_t
+landmark_fp_frames(
+    landmark_fp_t* fp
+    )
+{
+    return fp->frames;
+
+} /* landmark_fp_frames() */
+
+/******************************************************************
+ *
+ *    LANDMARK_FP_FORGET
+ *
+ *****************************************************************/
+void
+landmark_fp_forget(
+    landmark_fp_t* fp,
+    uint32_t       frame
+    )
+{
+    size_t kept = 0;
+    size_t i    = 0;
+
+    /* hashes are added as their second peak is found, so one starting
+     * before frame can follow others that start after it */
+    for (i = 0; i < fp->hash_count; i++)
+    {
+        if (fp->hashes[i].frame >= frame)
+        {
+            fp->hashes[kept++] = fp->hashes[i];
+        }
+    }
+    fp->hash_count = kept;
+
+} /* landmark_fp_forget() */
+
+/**********************************************
+ *    Building an index
+ **********************************************/
+
+/******************************************************************
+ *
+ *    LANDMARK_BUILDER_OPEN
+ *
+ *****************************************************************/
+landmark_builder_t*
+landmark_builder_open(void)
+{
+    return calloc(1, sizeof(landmark_builder_t));
+
+} /* landmark_builder_open() */
+
+/******************************************************************
+ *
+ *    LANDMARK_BUILDER_CLOSE
+ *
+ *****************************************************************/
+void
+landmark_builder_close(
+    landmark_builder_t* builder
+    )
+{
+    if (builder)
+    {
+        free(builder->tracks);
+        free(builder->names);
+        free(builder->entries);
+        free(builder);
+    }
+
+} /* landmark_builder_close() */
+
+/******************************************************************
+ *
+ *    LANDMARK_BUILDER_ADD
+ *
+ *****************************************************************/
+int
+landmark_builder_add(
+    landmark_builder_t*    builder,
+    const char*            id,
+    double                 seconds,
+    const landmark_hash_t* hashes,
+    size_t                 count
+    )
+{
+    size_t            id_size = strlen(id) + 1;
+    landmark_track_t* track   = NULL;
+    char*             names   = NULL;
+    size_t            i       = 0;
+
+    if (builder->track_count == UINT32_MAX || builder->names_size + id_size > UINT32_MAX)
+    {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    if (0 != _grow((void**)&builder->tracks, &builder->track_capacity, builder->track_count, sizeof(*builder->tracks)))
+    {
+        return -1;
+    }
+    if (builder->names_size + id_size > builder->names_capacity)
+    {
+        names = realloc(builder->names, builder->names_size + id_size + 4096);
+        if (names == NULL)
+        {
+            return -1;
+        }
+        builder->names          = names;
+        builder->names_capacity = builder->names_size + id_size + 4096;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (0 != _grow((void**)&builder->entries, &builder->entry_capacity, builder->entry_count, sizeof(*builder->entries)))
+        {
+            return -1;
+        }
+        builder->entries[builder->entry_count].hash  = hashes[i].hash;
+        builder->entries[builder->entry_count].track = builder->track_count;
+        builder->entries[builder->entry_count].frame = hashes[i].frame;
+        builder->entry_count++;
+    }
+
+    track              = &builder->tracks[builder->track_count++];
+    track->name_offset = (uint32_t)builder->names_size;
+    track->duration_ms = (seconds > 0 && seconds < UINT32_MAX / 1000.0) ? (uint32_t)(seconds * 1000) : 0;
+    memcpy(builder->names + builder->names_size, id, id_size);
+    builder->names_size += id_size;
+
+    return 0;
+
+} /* landmark_builder_add() */
+
+/******************************************************************
+ *
+ *    LANDMARK_BUILDER_WRITE
+ *
+ *****************************************************************/
+int
+landmark_builder_write(
+    landmark_builder_t* builder,
+    const char*         path
+    )
+{
+    landmark_file_header_t header;
+    landmark_entry_t*      sorted      = NULL;
+    uint32_t*              buckets     = NULL;
+    uint32_t               bucket_bits = 10;
+    size_t                 bucket_count = 0;
+    size_t                 i           = 0;
+    uint32_t               b           = 0;
+    char*                  tmp_path    = NULL;
+    size_t                 tmp_len     = 0;
+    FILE*                  out         = NULL;
+    static const char      padding[4]  = {0};
+    int                    rc          = -1;
+    int                    saved_errno = 0;
+
+    if (builder->entry_count > UINT32_MAX)
+    {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    /* about two entries a bucket */
+    while (bucket_bits < 24 && ((size_t)1 << bucket_bits) < builder->entry_count / 2)
+    {
+        bucket_bits++;
+    }
+    bucket_count = (size_t)1 << bucket_bits;
+
+    buckets = calloc(bucket_count + 1, sizeof(*buckets));
+    sorted  = malloc((builder->entry_count ? builder->entry_count : 1) * sizeof(*sorted));
+    tmp_len  = strlen(path) + 32;
+    tmp_path = malloc(tmp_len);
+    if (buckets == NULL || sorted == NULL || tmp_path == NULL)
+    {
+        free(buckets);
+        free(sorted);
+        free(tmp_path);
+        return -1;
+    }
+
+    /* counting sort of the entries into their buckets */
+    for (i = 0; i < builder->entry_count; i++)
+    {
+        buckets[_bucket(builder->entries[i].hash, bucket_bits) + 1]++;
+    }
+    for (i = 0; i < bucket_count; i++)
+    {
+        buckets[i + 1] += buckets[i];
+    }
+    for (i = 0; i < builder->entry_count; i++)
+    {
+        b = _bucket(builder->entries[i].hash, bucket_bits);
+        sorted[buckets[b]++] = builder->entries[i];
+    }
+    /* each bucket's count was added to its start; take it back off */
+    for (i = bucket_count; i > 0; i--)
+    {
+        buckets[i] = buckets[i - 1];
+    }
+    buckets[0] = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.byte_order     = INDEX_BYTE_ORDER;
+    header.track_count    = builder->track_count;
+    header.bucket_bits    = bucket_bits;
+    header.entry_count    = builder->entry_count;
+    header.tracks_offset  = sizeof(header);
+    header.names_offset   = header.tracks_offset + (uint64_t)builder->track_count * sizeof(landmark_track_t);
+    header.names_size     = builder->names_size;
+    header.buckets_offset = (header.names_offset + header.names_size + 3) & ~(uint64_t)3;
+    header.entries_offset = header.buckets_offset + (uint64_t)(bucket_count + 1) * sizeof(*buckets);
+    header.file_size      = header.entries_offset + (uint64_t)builder->entry_count * sizeof(*sorted);
+
+    /* written aside and renamed into place, so a running matcher never
+     * sees half an index */
+    snprintf(tmp_path, tmp_len, "%s.%ld.tmp", path, (long)getpid());
+    out = fopen(tmp_path, "wb");
+    if (out)
+    {
+        if (1 == fwrite(&header, sizeof(header), 1, out)
+            && builder->track_count == fwrite(builder->tracks, sizeof(landmark_track_t), builder->track_count, out)
+            && builder->names_size == fwrite(builder->names, 1, builder->names_size, out)
+            && (header.buckets_offset - header.names_offset - header.names_size)
+               == fwrite(padding, 1, (size_t)(header.buckets_offset - header.names_offset - header.names_size), out)
+            && bucket_count + 1 == fwrite(buckets, sizeof(*buckets), bucket_count + 1, out)
+            && builder->entry_count == fwrite(sorted, sizeof(*sorted), builder->entry_count, out))
+        {
+            rc = 0;
+        }
+        if (0 != fclose(out))
+        {
+            rc = -1;
+        }
+        if (0 == rc && 0 != rename(tmp_path, path))
+        {
+            rc = -1;
+        }
+        if (0 != rc)
+        {
+            saved_errno = errno;
+            unlink(tmp_path);
+            errno = saved_errno;
+        }
+    }
+
+    free(buckets);
+    free(sorted);
+    free(tmp_path);
+
+    return rc;
+
+} /* landmark_builder_write() */
+
+/**********************************************
+ *    Matching
+ **********************************************/
+
+/******************************************************************
+ *
+ *    LANDMARK_INDEX_OPEN
+ *
+ *****************************************************************/
+landmark_index_t*
+landmark_index_open(
+    const char* path
+    )
+{
+    landmark_index_t*             index  = NULL;
+    const landmark_file_header_t* header = NULL;
+    struct stat                   st;
+    void*                         map    = MAP_FAILED;
+    uint64_t                      bucket_count = 0;
+    uint32_t                      i      = 0;
+    int                           fd     = -1;
+    int                           b_ok   = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (0 == fstat(fd, &st) && (size_t)st.st_size >= sizeof(*header))
+    {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* check everything that will be trusted later */
+    header       = (const landmark_file_header_t*)map;
+    bucket_count = (uint64_t)1 << (header->bucket_bits & 31);
+    b_ok = 0 == memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic))
+        && header->byte_order == INDEX_BYTE_ORDER
+        && header->bucket_bits >= 1 && header->bucket_bits <= 24
+        && header->file_size == (uint64_t)st.st_size
+        && header->tracks_offset == sizeof(*header)
+        && header->names_offset == header->tracks_offset + (uint64_t)header->track_count * sizeof(landmark_track_t)
+        && header->buckets_offset >= header->names_offset + header->names_size
+        && header->buckets_offset % 4 == 0
+        && header->entries_offset == header->buckets_offset + (bucket_count + 1) * sizeof(uint32_t)
+        && header->file_size == header->entries_offset + header->entry_count * sizeof(landmark_entry_t)
+        && (header->names_size == 0 || ((const char*)map)[header->names_offset + header->names_size - 1] == '\0');
+
+    index = b_ok ? calloc(1, sizeof(*index)) : NULL;
+    if (index)
+    {
+        index->map      = map;
+        index->map_size = (size_t)st.st_size;
+        index->header   = header;
+        index->tracks   = (const landmark_track_t*)((const char*)map + header->tracks_offset);
+        index->names    = (const char*)map + header->names_offset;
+        index->buckets  = (const uint32_t*)((const char*)map + header->buckets_offset);
+        index->entries  = (const landmark_entry_t*)((const char*)map + header->entries_offset);
+
+        b_ok = index->buckets[bucket_count] == header->entry_count;
+        for (i = 0; b_ok && i < header->track_count; i++)
+        {
+            b_ok = index->tracks[i].name_offset < header->names_size;
+        }
+        for (i = 0; b_ok && i < bucket_count; i++)
+        {
+            b_ok = index->buckets[i] <= index->buckets[i + 1];
+        }
+    }
+
+    if (!b_ok)
+    {
+        free(index);
+        munmap(map, (size_t)st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    madvise(map, index->map_size, MADV_RANDOM);
+
+    return index;
+
+} /* landmark_index_open() */
+
+/******************************************************************
+ *
+ *    LANDMARK_INDEX_CLOSE
+ *
+ *****************************************************************/
+void
+landmark_index_close(
+    landmark_index_t* index
+    )
+{
+    if (index)
+    {
+        munmap(index->map, index->map_size);
+        free(index);
+    }
+
+} /* landmark_index_close() */
+
+/******************************************************************
+ *
+ *    LANDMARK_INDEX_TRACKS
+ *
+ *****************************************************************/
+uint32_t
+landmark_index_tracks(
+    landmark_index_t* index
+    )
+{
+    return index->header->track_count;
+
+} /* landmark_index_tracks() */
+
+/******************************************************************
+ *
+ *    LANDMARK_INDEX_MATCH
+ *
+ *    Every index entry with a query hash votes for its track and the
+ *    difference between its frame and the query's. The true match
+ *    piles its votes on one difference (or two neighbouring ones, as
+ *    the query's frames needn't line up with the track's).
+ *
+ *****************************************************************/
+int
+landmark_index_match(
+    landmark_index_t*      index,
+    const landmark_hash_t* hashes,
+    size_t                 count,
+    uint32_t               min_score,
+    landmark_match_t*      p_match
+    )
+{
+    landmark_vote_t*        votes      = NULL;
+    size_t                  vote_count = 0;
+    size_t                  capacity   = 0;
+    const landmark_entry_t* entry      = NULL;
+    const landmark_entry_t* end        = NULL;
+    uint32_t                bucket     = 0;
+    size_t                  hits       = 0;
+    size_t                  i          = 0;
+    size_t                  run        = 0;
+    size_t                  next       = 0;
+    size_t                  score      = 0;
+    size_t                  best_score = 0;
+    size_t                  best       = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        bucket = _bucket(hashes[i].hash, index->header->bucket_bits);
+        entry  = index->entries + index->buckets[bucket];
+        end    = index->entries + index->buckets[bucket + 1];
+        for (hits = 0; entry < end && hits < MATCH_MAX_HITS; entry++)
+        {
+            if (entry->hash != hashes[i].hash || entry->track >= index->header->track_count)
+            {
+                continue;
+            }
+            if (0 != _grow((void**)&votes, &capacity, vote_count, sizeof(*votes)))
+            {
+                free(votes);
+                return -1;
+            }
+            votes[vote_count].track = entry->track;
+            votes[vote_count].delta = (int32_t)(entry->frame - hashes[i].frame);
+            vote_count++;
+            hits++;
+        }
+    }
+
+    if (vote_count > 0)
+    {
+        qsort(votes, vote_count, sizeof(*votes), _compare_votes);
+    }
+
+    /* the biggest run of equal votes, with the run one frame later */
+    for (i = 0; i < vote_count; i = next)
+    {
+        for (next = i; next < vote_count && 0 == _compare_votes(&votes[next], &votes[i]); next++)
+        {
+        }
+        score = next - i;
+        for (run = next; run < vote_count && votes[run].track == votes[i].track && votes[run].delta == votes[i].delta + 1; run++)
+        {
+            score++;
+        }
+        if (score > best_score)
+        {
+            best_score = score;
+            best       = i;
+        }
+    }
+
+    if (best_score < min_score || best_score == 0)
+    {
+        free(votes);
+        return -1;
+    }
+
+    p_match->id             = index->names + index->tracks[votes[best].track].name_offset;
+    p_match->offset_seconds = (double)votes[best].delta * LANDMARK_HOP / LANDMARK_SAMPLE_RATE;
+    p_match->track_seconds  = index->tracks[votes[best].track].duration_ms / 1000.0;
+    p_match->score          = (uint32_t)best_score;
+
+    free(votes);
+
+    return 0;
+
+} /* landmark_index_match() */
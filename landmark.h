@@ -0,0 +1,158 @@
+/*
+ *  Name: landmark.h
+ *  Description:
+ *  Local audio fingerprints for matching against a catalog of our own,
+ *  without a round trip to the Gracenote service. Audio is analysed in
+ *  short overlapping frames; the strongest spectral peaks are picked and
+ *  pairs of nearby peaks are hashed (both frequencies and the time
+ *  between them), which survives noise, level changes and lossy coding.
+ *
+ *  An index of the hashes of every catalog track is written to a file
+ *  laid out to be used straight from a read-only memory mapping, so
+ *  opening it costs nothing however big it is:
+ *
+ *    header      magic, byte order mark, counts and section offsets
+ *    tracks      u32 name offset, u32 duration in ms, per track
+ *    names       the track IDs, NUL-terminated
+ *    buckets     u32 first entry of each hash bucket, plus one past the end
+ *    entries     u32 hash, u32 track, u32 frame, per hash, grouped by bucket
+ *
+ *  All integers are in host byte order; the header says which.
+ */
+
+#ifndef LANDMARK_H
+#define LANDMARK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* audio is fingerprinted as 16 bit mono or stereo at this rate */
+#define LANDMARK_SAMPLE_RATE 11025
+
+/* samples between the starts of successive frames */
+#define LANDMARK_HOP 512
+
+typedef struct landmark_fp_s      landmark_fp_t;
+typedef struct landmark_builder_s landmark_builder_t;
+typedef struct landmark_index_s   landmark_index_t;
+
+typedef struct
+{
+    uint32_t hash;
+    uint32_t frame;   /* of the first peak of the pair */
+
+} landmark_hash_t;
+
+typedef struct
+{
+    const char* id;             /* valid until the index is closed */
+    double      offset_seconds; /* where in the track the query audio starts */
+    double      track_seconds;
+    uint32_t    score;          /* hashes that agree on the track and offset */
+
+} landmark_match_t;
+
+/*
+ * Start fingerprinting 16 bit PCM of channels (1 or 2) at
+ * LANDMARK_SAMPLE_RATE. Returns NULL if channels is out of range or on
+ * failure.
+ */
+landmark_fp_t*
+landmark_fp_open(
+    uint32_t channels
+    );
+
+void
+landmark_fp_close(
+    landmark_fp_t* fp
+    );
+
+/* Add size bytes of whole frames. Returns -1 if out of memory. */
+int
+landmark_fp_process(
+    landmark_fp_t* fp,
+    const int16_t* pcm,
+    size_t         size
+    );
+
+/*
+ * The hashes found so far, in the order their second peaks were found,
+ * in *p_hashes (valid until the next call on fp). Returns how many.
+ */
+size_t
+landmark_fp_hashes(
+    landmark_fp_t*          fp,
+    const landmark_hash_t** p_hashes
+    );
+
+/* Frames analysed so far */
+uint32_t
+landmark_fp_frames(
+    landmark_fp_t* fp
+    );
+
+/* Drop the hashes of pairs starting before frame */
+void
+landmark_fp_forget(
+    landmark_fp_t* fp,
+    uint32_t       frame
+    );
+
+landmark_builder_t*
+landmark_builder_open(void);
+
+void
+landmark_builder_close(
+    landmark_builder_t* builder
+    );
+
+/* Add a catalog track. Returns -1 if out of memory. */
+int
+landmark_builder_add(
+    landmark_builder_t*    builder,
+    const char*            id,
+    double                 seconds,
+    const landmark_hash_t* hashes,
+    size_t                 count
+    );
+
+/*
+ * Write the index to path (through a temporary file renamed into
+ * place). Returns -1 with errno set on failure.
+ */
+int
+landmark_builder_write(
+    landmark_builder_t* builder,
+    const char*         path
+    );
+
+/* Map an index. Returns NULL with errno set if it can't be used. */
+landmark_index_t*
+landmark_index_open(
+    const char* path
+    );
+
+void
+landmark_index_close(
+    landmark_index_t* index
+    );
+
+uint32_t
+landmark_index_tracks(
+    landmark_index_t* index
+    );
+
+/*
+ * Find the track and offset most of the query hashes agree on. Returns 0
+ * with it in *p_match if at least min_score of them do, -1 otherwise.
+ */
+int
+landmark_index_match(
+    landmark_index_t*      index,
+    const landmark_hash_t* hashes,
+    size_t                 count,
+    uint32_t               min_score,
+    landmark_match_t*      p_match
+    );
+
+#endif /* LANDMARK_H */
@@ -0,0 +1,313 @@
+
+/*
+ *  Name: libidentify
+ *  Description:
+ *  The API of identify.h, built from sample's own identification: a
+ *  buffer is handed to the channel as if it were a mapped WAV file, so it
+ *  goes through the same conversion, conditioning, cache and local index,
+ *  and the records it gives are rendered as sample renders them, into
+ *  memory rather than to stdout, then passed to the caller's callback.
+ *
+ *  Each identify_t has a query context of its own (query.h), so any
+ *  number can be open at once; they share the SDK, which query.c starts
+ *  for the first and shuts down after the last.
+ *
+ *  Build as a shared library, e.g.:
+ *
+ *  cc -shared -fPIC -o build/libidentify.so libidentify.c query.c hedge.c wav.c cache.c ...
+ */
+
+#include "identify.h"
+#include "query.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A channel between identifications and the query its callbacks render
+ * into, which has to stay where it is for as long as the channel does */
+typedef struct identify_channel_s
+{
+    struct identify_channel_s*           next;
+    query_t                              query;
+    gnsdk_musicidstream_channel_handle_t channel_handle;
+
+} identify_channel_t;
+
+struct identify_s
+{
+    query_context_t     context;  /* settings, cache and local index */
+    gnsdk_user_handle_t user_handle;
+    identify_channel_t* idle;     /* channels free for the next identification */
+    pthread_mutex_t     lock;     /* guards idle */
+};
+
+/******************************************************************
+ *
+ *    _TAKE_CHANNEL
+ *
+ *    An idle channel, or a new one (created by its first
+ *    identification). Returns GNSDK_NULL if out of memory.
+ *
+ *****************************************************************/
+static identify_channel_t*
+_take_channel(
+    identify_t* identify
+    )
+{
+    identify_channel_t* channel = GNSDK_NULL;
+
+    pthread_mutex_lock(&identify->lock);
+    channel = identify->idle;
+    if (channel)
+    {
+        identify->idle = channel->next;
+    }
+    pthread_mutex_unlock(&identify->lock);
+
+    if (channel == GNSDK_NULL)
+    {
+        channel = calloc(1, sizeof(*channel));
+    }
+
+    return channel;
+
+} /* _take_channel() */
+
+/******************************************************************
+ *
+ *    _GIVE_CHANNEL
+ *
+ *****************************************************************/
+static void
+_give_channel(
+    identify_t*         identify,
+    identify_channel_t* channel
+    )
+{
+    pthread_mutex_lock(&identify->lock);
+    channel->next  = identify->idle;
+    identify->idle = channel;
+    pthread_mutex_unlock(&identify->lock);
+
+} /* _give_channel() */
+
+/******************************************************************
+ *
+ *    IDENTIFY_INIT
+ *
+ *****************************************************************/
+identify_t*
+identify_init(
+    const identify_config_t* p_config
+    )
+{
+    identify_config_t config   = {0};
+    identify_t*       identify = GNSDK_NULL;
+    query_context_t*  context  = GNSDK_NULL;
+    int               rc       = 0;
+
+    if (p_config)
+    {
+        config = *p_config;
+    }
+
+    identify = calloc(1, sizeof(*identify));
+    if (identify == GNSDK_NULL)
+    {
+        return GNSDK_NULL;
+    }
+    context = &identify->context;
+
+    /* the records that don't belong to an identification */
+    query_context_init(context);
+    context->output           = stderr;
+    context->candidates       = (config.candidates > 1) ? (long)config.candidates : 1;
+    context->b_condition      = config.b_condition ? GNSDK_TRUE : GNSDK_FALSE;
+    context->deadline_seconds = (config.deadline_seconds > 0) ? config.deadline_seconds : 0;
+    context->hedge_percentile = (config.hedge_percentile > 0 && config.hedge_percentile < 100) ? config.hedge_percentile : 0;
+
+    if (config.local_index_path)
+    {
+        context->local_index = landmark_index_open(config.local_index_path);
+        if (context->local_index == GNSDK_NULL)
+        {
+            record_stringf(query_context_begin_record(context), "error", "Failed to open local index %s: %s", config.local_index_path, strerror(errno));
+            query_context_end_record(context);
+            rc = -1;
+        }
+    }
+
+    if (0 == rc && config.cache_dir)
+    {
+        context->cache = cache_open(config.cache_dir, CACHE_TTL, CACHE_NEGATIVE_TTL, (uint64_t)CACHE_MAX_MB * 1024 * 1024);
+        if (context->cache == GNSDK_NULL)
+        {
+            record_stringf(query_context_begin_record(context), "error", "Failed to open cache %s: %s", config.cache_dir, strerror(errno));
+            query_context_end_record(context);
+            rc = -1;
+        }
+    }
+
+    if (0 == rc)
+    {
+        rc = query_start_sdk(context, &identify->user_handle);
+        if (0 != rc)
+        {
+            errno = EIO;
+        }
+    }
+
+    if (0 != rc)
+    {
+        rc = errno;
+        query_context_close(context);
+        free(identify);
+        errno = rc;
+        return GNSDK_NULL;
+    }
+
+    pthread_mutex_init(&identify->lock, GNSDK_NULL);
+
+    return identify;
+
+} /* identify_init() */
+
+/******************************************************************
+ *
+ *    IDENTIFY_PCM
+ *
+ *****************************************************************/
+int
+identify_pcm(
+    identify_t*              identify,
+    const void*              pcm,
+    size_t                   size,
+    const identify_format_t* p_format,
+    identify_callback_t      callback,
+    void*                    user_data
+    )
+{
+    identify_channel_t* channel    = GNSDK_NULL;
+    query_t*            query      = GNSDK_NULL;
+    audio_input_t       input;
+    char*               record_buf = GNSDK_NULL;
+    size_t              record_len = 0;
+    char*               line       = GNSDK_NULL;
+    char*               end        = GNSDK_NULL;
+    size_t              frame_size = 0;
+
+    if (identify == GNSDK_NULL || pcm == GNSDK_NULL || p_format == GNSDK_NULL || callback == GNSDK_NULL
+        || 0 == p_format->sample_rate
+        || 0 == p_format->channels
+        || 0 == p_format->bits_per_sample
+        || 0 != p_format->bits_per_sample % 8
+        || (p_format->b_float && 32 != p_format->bits_per_sample))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    frame_size = (p_format->bits_per_sample / 8) * p_format->channels;
+    if (size < frame_size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    channel = _take_channel(identify);
+    if (channel == GNSDK_NULL)
+    {
+        return -1;
+    }
+
+    /* the channel's callbacks still point at this query */
+    query                = &channel->query;
+    query->context       = &identify->context;
+    query->audio_file    = "buffer";
+    query->records       = 0;
+    query->b_tag_file    = GNSDK_FALSE;
+    query->priority      = identify->context.priority;
+    query->out           = open_memstream(&record_buf, &record_len);
+    if (query->out == GNSDK_NULL)
+    {
+        _give_channel(identify, channel);
+        return -1;
+    }
+
+    /* the buffer passes for a mapped file, which is never unmapped as
+     * it isn't closed */
+    memset(&input, 0, sizeof(input));
+    input.fd                          = -1;
+    input.info.format.sample_rate     = p_format->sample_rate;
+    input.info.format.bits_per_sample = p_format->bits_per_sample;
+    input.info.format.channels        = p_format->channels;
+    input.info.format_tag             = p_format->b_float ? WAV_FORMAT_IEEE_FLOAT : WAV_FORMAT_PCM;
+    input.info.block_align            = (uint16_t)frame_size;
+    input.info.data_size              = size;
+    input.p_map                       = (gnsdk_byte_t*)pcm;
+    input.map_size                    = size;
+    input.p_audio                     = (const gnsdk_byte_t*)pcm;
+    input.audio_size                  = (gnsdk_size_t)(size - size % frame_size);
+
+    if (0 == query_lookup_input(query, &input))
+    {
+        query_identify_input(identify->user_handle, &channel->channel_handle, query, &input);
+    }
+
+    if (0 == query->records)
+    {
+        record_null(query_begin_record(query), "result");
+        query_end_record(query);
+    }
+
+    fclose(query->out);
+    query->out = GNSDK_NULL;
+    _give_channel(identify, channel);
+
+    /* every record was rendered as a line of JSON */
+    for (line = record_buf; line && (end = strchr(line, '\n')) != GNSDK_NULL; line = end + 1)
+    {
+        *end = '\0';
+        callback(user_data, line, (size_t)(end - line));
+    }
+    free(record_buf);
+
+    return 0;
+
+} /* identify_pcm() */
+
+/******************************************************************
+ *
+ *    IDENTIFY_SHUTDOWN
+ *
+ *****************************************************************/
+void
+identify_shutdown(
+    identify_t* identify
+    )
+{
+    identify_channel_t* channel = GNSDK_NULL;
+
+    if (identify == GNSDK_NULL)
+    {
+        return;
+    }
+
+    while ((channel = identify->idle) != GNSDK_NULL)
+    {
+        identify->idle = channel->next;
+        if (channel->channel_handle)
+        {
+            gnsdk_musicidstream_channel_release(channel->channel_handle);
+        }
+        free(channel);
+    }
+
+    query_stop_sdk(&identify->context, identify->user_handle);
+    query_context_close(&identify->context);
+
+    pthread_mutex_destroy(&identify->lock);
+    free(identify);
+
+} /* identify_shutdown() */
@@ -13,69 +13,268 @@
  *  of an audio stream
  *
  *  Command-line Syntax:
- *  sample <sound_file>
- */
-
-/* GNSDK headers
+ *  sample [--feed-size <bytes>] <sound_file|->
+ *  sample --raw [--rate <hz>] [--bits <n> | --float] [--channels <n>] <pcm_file|->
+ *  sample --server <socket_path>
+ *  sample --server <socket_path> --capture [--preroll <s>] [--rate <hz>] [--bits <n> | --float] [--channels <n>] <pcm_file|->
+ *  sample --batch [--jobs <n>] <file|directory|->...
+ *  sample --monitor [--requery <s>] [--ring-seconds <s>] [--pin-cpus <list>] <stream|->...
+ *  sample --tracklist [--window <s>] [--hop <s>] [--jobs <n>] <file|directory|->...
+ *  sample --build-index <index_file> <file|directory|->...
+ *  sample --fingerprint <spool_file> [--jobs <n>] <file|directory|->...
+ *  sample --drain <spool_file> [--jobs <n>]
+ *  sample --split <queue_dir> [--unit-size <n>] <file|directory|->...
+ *  sample --work <queue_dir> [--jobs <n>] [--lease <s>]
+ *  sample --merge <queue_dir>
+ *  (each also takes [--cache <dir>] [--cache-ttl <s>] [--cache-negative-ttl <s>] [--cache-max-mb <n>]
+ *  [--timing], [--condition [--silence-db <dB>] [--max-gain-db <dB>]], [--candidates <n>],
+ *  [--rate-limit <n> [--rate-burst <n>]] [--priority interactive|bulk], [--local-index <index_file>],
+ *  [--deadline <s>] [--hedge <percentile>] and [--format ndjson|binary])
+ *
+ *  In server mode GNSDK is initialized once and identify requests are read
+ *  from a Unix domain socket, one audio file path per line, optionally
+ *  followed by a tab and the priority of the request. Each request is
+ *  answered with a single line of JSON. Every connection is served on a
+ *  thread of its own.
+ *
+ *  With --capture the server reads live raw PCM continuously and keeps the
+ *  last --preroll seconds (12 by default) in a ring buffer. Every request
+ *  line identifies what is playing: the buffered audio is written to the
+ *  channel at once, followed by live audio until there is an answer.
+ *
+ *  With --raw the input is headerless interleaved PCM, read from stdin
+ *  ("-") or a named pipe and fed to MusicID-Stream as it arrives. The
+ *  format defaults to 44100 Hz, 16 bit, 2 channels; --float means 32 bit
+ *  float samples.
+ *
+ *  Audio that isn't 16 bit mono or stereo at 44100 Hz (8, 24 and 32 bit
+ *  integer or 32 bit float samples, more than two channels, any other
+ *  rate) is converted in-process before it reaches the channel.
+ *
+ *  WAV files are parsed chunk by chunk and their data chunk is memory
+ *  mapped and written to the channel in --feed-size slices (64KB by
+ *  default) without an intermediate copy. FLAC, MP3 and Ogg Vorbis files
+ *  (when built with SAMPLE_WITH_FLAC, SAMPLE_WITH_MP3, SAMPLE_WITH_VORBIS)
+ *  are decoded a block at a time as they are written, until the
+ *  identification ends.
+ *
+ *  Batch mode identifies every file given, every file under a directory,
+ *  or every path listed on stdin ("-"), with one MusicID-Stream channel
+ *  per worker thread (one per core unless --jobs says otherwise). Each
+ *  result is a JSON line tagged with the path of its input.
+ *
+ *  Tracklist mode lists the tracks of long recordings such as DJ mixes.
+ *  Each WAV or raw file (it must be mapped) is cut into --window second
+ *  windows (20) starting every --hop seconds (10), which are identified
+ *  at once on --jobs channels like a batch. Runs of windows with the
+ *  same result are merged into one JSON line per mix listing each
+ *  track with its start and end in seconds. --timing and --candidates
+ *  don't apply to it.
+ *
+ *  Monitor mode watches broadcast streams around the clock: each input
+ *  (raw PCM with --raw, or a WAV or compressed stream) is fed to its own
+ *  long-lived channel and identified again and again as it plays. A JSON
+ *  line is written whenever the track changes (or the stream ends), with
+ *  the wall-clock time and the seconds of stream heard so far. While a
+ *  recognised track is still playing it isn't looked up again: the next
+ *  query waits until its expected end when the match says where in the
+ *  track it was (in builds whose SDK headers name the matched position,
+ *  see monitor.c), or --requery seconds (30) otherwise. --cache and --timing don't apply to it.
+ *
+ *  Monitored streams that are read (pipes, sockets, devices) get a reader
+ *  thread each, which keeps reading into a lock-free ring of
+ *  --ring-seconds (10) however long the channel takes over a write; what
+ *  arrives while the ring is full is dropped and counted. --pin-cpus
+ *  pins the readers to the CPUs listed, in turn. Ring statistics are
+ *  written as a "stats" event every five minutes and on the "end" event.
+ *
+ *  The registered user and the downloaded locale are kept serialized in
+ *  ~/.gracenote.txt and ~/.gracenote-locale.txt, so only the first run
+ *  (and the first after the locale is LOCALE_MAX_AGE_SECONDS old) has to
+ *  fetch them. --batch only starts the SDK once an input misses the
+ *  cache and the local index. How long start-up took, where the locale
+ *  came from and the time from entering main() to the first audio_begin
+ *  are reported on stderr at exit.
+ *
+ *  Any mode can keep answers in a --cache directory, keyed by a hash of
+ *  the audio itself (its first CACHE_KEY_SECONDS after any leading
+ *  silence, and its length), so identifying the same clip again needs no
+ *  lookup. Matches are kept for --cache-ttl seconds
+ *  (30 days), "no match" answers for --cache-negative-ttl seconds (1 day)
+ *  and the oldest entries go once it outgrows --cache-max-mb (64MB).
+ *  Cache statistics are reported on stderr at exit.
+ *
+ *  --timing adds a "timing" object to every record: how long each step of
+ *  SDK start-up took, and when each phase of the query (channel creation,
+ *  audio_begin, the first audio_write, each identifying status, the result
+ *  and the channel release) was reached, in milliseconds. Without it the
+ *  only cost is a flag test at each phase.
+ *
+ *  --condition drops silence before the first and after the last sound
+ *  (blocks at or below --silence-db, -50 dBFS by default) and raises
+ *  quiet audio towards -20 dBFS by at most --max-gain-db (18 dB) before
+ *  it is fingerprinted. Records get a "conditioning" object saying how
+ *  much was skipped and how much gain was applied.
+ *
+ *  Every record is built in a buffer and written with a single call, so
+ *  records from different threads never interleave. --format ndjson (the
+ *  default) writes each as a line of JSON; --format binary writes each as
+ *  a little-endian u32 length followed by the fields encoded as described
+ *  in record.h.
+ *
+ *  --candidates n adds a "candidates" array to every result, listing up
+ *  to n of the albums the response matched (the first is the "result"),
+ *  each with its matched track and track number, so that a wrong first
+ *  pick can be put right without asking again.
+ *
+ *  --rate-limit n keeps identify requests to the service under n a
+ *  second (--rate-burst at once, 1 by default) across every channel in
+ *  the process. Requests that have to wait queue by priority: with
+ *  --priority interactive (the default for single files and the server)
+ *  they go ahead of any --priority bulk ones (the default for --batch,
+ *  --tracklist and --monitor). Monitored streams never queue; a query that can't have a
+ *  token straight away is put off until it can. Queue depths and waits
+ *  are reported on stderr at exit, and --timing shows when each query
+ *  was let through.
+ *
+ *  --deadline s gives every query s seconds from when it starts: once
+ *  they are up its identification is cancelled, its channel released
+ *  and an "error" record written in place of whatever it would have
+ *  answered. --hedge p asks again, on a second channel, for a mapped
+ *  input whose answer has taken longer than the p-th percentile of the
+ *  last HEDGE_SAMPLES answers (HEDGE_INITIAL_SECONDS until there have
+ *  been HEDGE_MIN_SAMPLES); the first answer is kept and the other
+ *  identification cancelled. Timeouts, hedges and answer times are
+ *  reported on stderr at exit. Neither applies to --monitor.
+ *
+ *  --build-index fingerprints every input given (as --batch lists them)
+ *  with the landmark fingerprints of landmark.h and writes an index of
+ *  them, without the SDK; each track is known by its path as given.
+ *  With --local-index that catalog is tried before the service: the
+ *  first LOCAL_MATCH_SECONDS of a file that can be mapped are matched
+ *  against it, and a monitored stream's last LOCAL_MATCH_SECONDS are
+ *  matched whenever an identification is due. A match is answered with
+ *  a "result" of its local ID, where in the track the audio started
+ *  ("offset_s") and how many hashes agreed; only a miss goes to
+ *  Gracenote.
+ *
+ *  --fingerprint is for capture boxes with a poor link: every input (as
+ *  --batch lists them) is fingerprinted on --jobs threads with MusicID
+ *  queries, without a channel or a lookup, and the fingerprint appended
+ *  to a spool file (spool.h) with the input's path as the clip's ID and
+ *  its mtime as when it was captured. No locale is loaded for it.
+ *  --drain renames a spool to <spool_file>.draining (or carries on with
+ *  one left by an earlier drain), looks every fingerprint up with
+ *  --jobs queries in flight (DRAIN_JOBS by default) and writes a JSON
+ *  line per clip tagged with its ID and capture time. Fingerprints
+ *  whose lookup fails, and any not looked up when SIGINT or SIGTERM
+ *  arrives, are put back on the spool for the next drain, up to
+ *  DRAIN_MAX_ATTEMPTS failures each. --rate-limit, --priority and
+ *  --candidates apply to it.
  *
- * Define the modules your application needs.
- * These constants enable inclusion of headers and symbols in gnsdk.h.
+ *  --split, --work and --merge share a batch out between any number of
+ *  processes and hosts through a work queue directory (workq.h), on
+ *  NFS or a local disk. --split lists the inputs as --batch does and
+ *  writes them to the queue in units of --unit-size (WORK_UNIT_FILES, work.h).
+ *  Each --work process leases units by renaming them, identifies their
+ *  inputs with --jobs channels as a batch would, keeping its channels
+ *  from one unit to the next, and stores each unit's records in input
+ *  order once they are all in. Its leases are renewed while it works;
+ *  one not renewed for --lease seconds (WORK_LEASE_SECONDS) is taken
+ *  back by another worker. A worker stops once every unit is done, and
+ *  on SIGINT or SIGTERM puts back the units it hasn't finished. --merge
+ *  writes the records of every unit, in the order the inputs were
+ *  listed, once they are all done.
  */
-#define GNSDK_MUSICID_STREAM        1
-#define GNSDK_DSP                   1
-#include "gnsdk.h"
+
+/* Identification itself (query.h) and the stores the runners write */
+#include "query.h"
+#include "batch.h"
+#include "monitor.h"
+#include "drain.h"
+#include "server.h"
+#include "tracklist.h"
+#include "work.h"
 
 /* Standard C headers - used by the sample app, but not required for GNSDK */
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /**********************************************
  *    Local Function Declarations
  **********************************************/
 static int
-_init_gnsdk(
-    const char*          client_id,
-    const char*          client_id_tag,
-    const char*          client_app_version,
-    const char*          license_data,
-    gnsdk_user_handle_t* p_user_handle
+_run_build_index(
+    const char* index_path,
+    int         input_count,
+    char**      inputs
     );
 
-static void
-_shutdown_gnsdk(
-    gnsdk_user_handle_t user_handle
-    );
+/* --batch and --tracklist: identifications in flight at once, one channel each */
+static long           s_batch_jobs;
 
-static void
-_do_sample_musicid_stream(
-    gnsdk_user_handle_t user_handle
-    );
+/* --split: inputs in each unit of a work queue */
+static long           s_unit_files = WORK_UNIT_FILES;
 
-/* callbacks */
-gnsdk_void_t GNSDK_CALLBACK_API
-_musicidstream_identifying_status_callback(
-    gnsdk_void_t* callback_data,
-    gnsdk_musicidstream_identifying_status_t status,
-    gnsdk_bool_t* pb_abort
-    );
+/* --work: seconds a lease lasts without being renewed */
+static double         s_lease_seconds = WORK_LEASE_SECONDS;
 
-gnsdk_void_t GNSDK_CALLBACK_API
-_musicidstream_result_available_callback(
-    gnsdk_void_t* callback_data,
-    gnsdk_musicidstream_channel_handle_t channel_handle,
-    gnsdk_gdo_handle_t response_gdo,
-    gnsdk_bool_t* pb_abort
-    );
+/* --tracklist: seconds of a mix in each window and between the starts
+ * of windows, so that they overlap */
+static double         s_window_seconds = 20.0;
+static double         s_hop_seconds    = 10.0;
 
-gnsdk_void_t GNSDK_CALLBACK_API
-_musicidstream_completed_with_error_callback(
-    gnsdk_void_t* callback_data,
-    gnsdk_musicidstream_channel_handle_t channel_handle,
-    const gnsdk_error_info_t* p_error_info
-    );
+/* --monitor, --requery, --ring-seconds and --pin-cpus */
+static monitor_options_t s_monitor_options = { MONITOR_REQUERY_SECONDS, MONITOR_RING_SECONDS, {0}, 0 };
 
-static gnsdk_cstr_t s_audio_file;
+/* long options without a short form */
+enum
+{
+    OPT_CACHE = 256,
+    OPT_CACHE_TTL,
+    OPT_CACHE_NEGATIVE_TTL,
+    OPT_CACHE_MAX_MB,
+    OPT_TIMING,
+    OPT_CAPTURE,
+    OPT_PREROLL,
+    OPT_FLOAT,
+    OPT_CONDITION,
+    OPT_SILENCE_DB,
+    OPT_MAX_GAIN_DB,
+    OPT_MONITOR,
+    OPT_REQUERY,
+    OPT_RING_SECONDS,
+    OPT_PIN_CPUS,
+    OPT_FORMAT,
+    OPT_CANDIDATES,
+    OPT_RATE_LIMIT,
+    OPT_RATE_BURST,
+    OPT_PRIORITY,
+    OPT_BUILD_INDEX,
+    OPT_LOCAL_INDEX,
+    OPT_TRACKLIST,
+    OPT_WINDOW,
+    OPT_HOP,
+    OPT_DEADLINE,
+    OPT_HEDGE,
+    OPT_FINGERPRINT,
+    OPT_DRAIN,
+    OPT_SPLIT,
+    OPT_WORK,
+    OPT_MERGE,
+    OPT_UNIT_SIZE,
+    OPT_LEASE
+};
+
+/* what every query of this run shares: the options that apply to them,
+ * the stores they use and their statistics */
+static query_context_t s_context;
 
 /******************************************************************
  *
@@ -86,763 +285,587 @@ int
 main(int argc, char* argv[])
 {
     gnsdk_user_handle_t user_handle        = GNSDK_NULL;
-    const char*         client_id          = "client_id";
-    const char*         client_id_tag      = "client_id_tag";
-    const char*         client_app_version = "0.1.0.0";
-    const char*         license_data       = "license";
+    const char*         socket_path        = GNSDK_NULL;
+    const char*         cache_dir          = GNSDK_NULL;
+    const char*         build_index_path   = GNSDK_NULL;
+    const char*         local_index_path   = GNSDK_NULL;
+    const char*         fingerprint_path   = GNSDK_NULL;
+    const char*         drain_path         = GNSDK_NULL;
+    const char*         split_path         = GNSDK_NULL;
+    const char*         work_path          = GNSDK_NULL;
+    const char*         merge_path         = GNSDK_NULL;
+    long                cache_ttl          = CACHE_TTL;
+    long                cache_negative_ttl = CACHE_NEGATIVE_TTL;
+    long                cache_max_mb       = CACHE_MAX_MB;
+    gnsdk_bool_t        b_batch            = GNSDK_FALSE;
+    gnsdk_bool_t        b_monitor          = GNSDK_FALSE;
+    gnsdk_bool_t        b_tracklist        = GNSDK_FALSE;
+    gnsdk_bool_t        b_single           = GNSDK_FALSE;
+    gnsdk_bool_t        b_need_sdk         = GNSDK_TRUE;
+    gnsdk_bool_t        b_capture          = GNSDK_FALSE;
+    gnsdk_bool_t        b_priority         = GNSDK_FALSE;
+    double              rate_limit         = 0;
+    double              rate_burst         = 1;
+    int                 capture_fd         = -1;
+    query_t             query              = {0};
+    audio_input_t       input;
+    gnsdk_musicidstream_channel_handle_t channel_handle = GNSDK_NULL;
     int                 rc                 = 0;
-
-    if (argc == 2)
-    {
-        s_audio_file = argv[1];
-
-        /* GNSDK initialization */
-        rc = _init_gnsdk(
-            client_id,
-            client_id_tag,
-            client_app_version,
-            license_data,
-            &user_handle
-            );
-        if (0 == rc)
-        {
-            /* Sample the audio */
-            _do_sample_musicid_stream(user_handle);
-
-            /* Clean up and shutdown */
-            _shutdown_gnsdk(user_handle);
-        }
-    } else
-    {
-        printf("\nUsage:\n%s soundfile\n", argv[0]);
-        rc = -1;
-    }
-
-    return rc;
-
-}  /* main() */
-
-/******************************************************************
- *
- *    _DISPLAY_LAST_ERROR
- *
- *    Echo the error and information.
- *
- *****************************************************************/
-static void
-_display_last_error()
-{
-    /* Get the last error information from the SDK */
-    const gnsdk_error_info_t* error_info = gnsdk_manager_error_info();
-
-    printf("{\"error\": \"%s\"}",
-        error_info->error_description
-        );
-
-} /* _display_last_error() */
-
-/******************************************************************
- *
- *    _GET_USER_HANDLE
- *
- *    Load existing user handle, or register new one.
- *
- *****************************************************************/
-static int
-_get_user_handle(
-    const char*          client_id,
-    const char*          client_id_tag,
-    const char*          client_app_version,
-    gnsdk_user_handle_t* p_user_handle
-    )
-{
-    gnsdk_user_handle_t user_handle               = GNSDK_NULL;
-    gnsdk_cstr_t        user_reg_mode             = GNSDK_NULL;
-    gnsdk_str_t         serialized_user           = GNSDK_NULL;
-    gnsdk_char_t        serialized_user_buf[1024] = {0};
-    gnsdk_bool_t        b_localonly               = GNSDK_FALSE;
-    gnsdk_error_t       error                     = GNSDK_SUCCESS;
-    const char*         user_home_path            = getenv("HOME");
-    FILE*               file                      = NULL;
-    int                 rc                        = 0;
-    char*               user_file_path            = NULL;
-    
-    user_reg_mode = GNSDK_USER_REGISTER_MODE_ONLINE;
-
-    if (user_home_path)
-    {
-        user_file_path = malloc(strlen(user_home_path) + strlen("/.gracenote.txt") + 1);
-        strcpy(user_file_path, user_home_path);
-        strcat(user_file_path, "/.gracenote.txt");
-    } else
-    {
-        user_file_path = "gracenote.txt";
-    }
-    /* Do we have a user saved locally? */
-    file = fopen(user_file_path, "r");
-    if (file)
-    {
-        fgets(serialized_user_buf, sizeof(serialized_user_buf), file);
-        fclose(file);
-        
-        /* Create the user handle from the saved user */
-        error = gnsdk_manager_user_create(serialized_user_buf, client_id, &user_handle);
-        if (GNSDK_SUCCESS == error)
+    int                 opt                = 0;
+    int                 b_usage            = 0;
+    static const struct option long_options[] =
+    {
+        { "server",   required_argument, GNSDK_NULL, 's' },
+        { "raw",      no_argument,       GNSDK_NULL, 'r' },
+        { "rate",     required_argument, GNSDK_NULL, 'R' },
+        { "bits",     required_argument, GNSDK_NULL, 'B' },
+        { "channels", required_argument, GNSDK_NULL, 'C' },
+        { "feed-size", required_argument, GNSDK_NULL, 'F' },
+        { "batch",    no_argument,       GNSDK_NULL, 'b' },
+        { "jobs",     required_argument, GNSDK_NULL, 'j' },
+        { "cache",    required_argument, GNSDK_NULL, OPT_CACHE },
+        { "cache-ttl", required_argument, GNSDK_NULL, OPT_CACHE_TTL },
+        { "cache-negative-ttl", required_argument, GNSDK_NULL, OPT_CACHE_NEGATIVE_TTL },
+        { "cache-max-mb", required_argument, GNSDK_NULL, OPT_CACHE_MAX_MB },
+        { "timing",   no_argument,       GNSDK_NULL, OPT_TIMING },
+        { "capture",  no_argument,       GNSDK_NULL, OPT_CAPTURE },
+        { "preroll",  required_argument, GNSDK_NULL, OPT_PREROLL },
+        { "float",    no_argument,       GNSDK_NULL, OPT_FLOAT },
+        { "condition", no_argument,      GNSDK_NULL, OPT_CONDITION },
+        { "silence-db", required_argument, GNSDK_NULL, OPT_SILENCE_DB },
+        { "max-gain-db", required_argument, GNSDK_NULL, OPT_MAX_GAIN_DB },
+        { "monitor",  no_argument,       GNSDK_NULL, OPT_MONITOR },
+        { "requery",  required_argument, GNSDK_NULL, OPT_REQUERY },
+        { "ring-seconds", required_argument, GNSDK_NULL, OPT_RING_SECONDS },
+        { "pin-cpus", required_argument, GNSDK_NULL, OPT_PIN_CPUS },
+        { "format",   required_argument, GNSDK_NULL, OPT_FORMAT },
+        { "candidates", required_argument, GNSDK_NULL, OPT_CANDIDATES },
+        { "rate-limit", required_argument, GNSDK_NULL, OPT_RATE_LIMIT },
+        { "rate-burst", required_argument, GNSDK_NULL, OPT_RATE_BURST },
+        { "priority", required_argument, GNSDK_NULL, OPT_PRIORITY },
+        { "build-index", required_argument, GNSDK_NULL, OPT_BUILD_INDEX },
+        { "local-index", required_argument, GNSDK_NULL, OPT_LOCAL_INDEX },
+        { "tracklist", no_argument,      GNSDK_NULL, OPT_TRACKLIST },
+        { "window",   required_argument, GNSDK_NULL, OPT_WINDOW },
+        { "hop",      required_argument, GNSDK_NULL, OPT_HOP },
+        { "deadline", required_argument, GNSDK_NULL, OPT_DEADLINE },
+        { "hedge",    required_argument, GNSDK_NULL, OPT_HEDGE },
+        { "fingerprint", required_argument, GNSDK_NULL, OPT_FINGERPRINT },
+        { "drain",    required_argument, GNSDK_NULL, OPT_DRAIN },
+        { "split",    required_argument, GNSDK_NULL, OPT_SPLIT },
+        { "work",     required_argument, GNSDK_NULL, OPT_WORK },
+        { "merge",    required_argument, GNSDK_NULL, OPT_MERGE },
+        { "unit-size", required_argument, GNSDK_NULL, OPT_UNIT_SIZE },
+        { "lease",    required_argument, GNSDK_NULL, OPT_LEASE },
+        { GNSDK_NULL, 0, GNSDK_NULL, 0 }
+    };
+
+    query_context_init(&s_context);
+
+    while (-1 != (opt = getopt_long(argc, argv, "s:rbj:", long_options, GNSDK_NULL)))
+    {
+        switch (opt)
         {
-            error = gnsdk_manager_user_is_localonly(user_handle, &b_localonly);
-            if (!b_localonly || (strcmp(user_reg_mode, GNSDK_USER_REGISTER_MODE_LOCALONLY) == 0))
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'r':
+            s_context.b_raw_input = GNSDK_TRUE;
+            break;
+        case 'R':
+            s_context.raw_format.sample_rate = (gnsdk_uint32_t)strtoul(optarg, GNSDK_NULL, 10);
+            break;
+        case 'B':
+            s_context.raw_format.bits_per_sample = (gnsdk_uint32_t)strtoul(optarg, GNSDK_NULL, 10);
+            break;
+        case 'C':
+            s_context.raw_format.channels = (gnsdk_uint32_t)strtoul(optarg, GNSDK_NULL, 10);
+            break;
+        case 'F':
+            s_context.feed_size = (gnsdk_size_t)strtoul(optarg, GNSDK_NULL, 10);
+            break;
+        case 'b':
+            b_batch = GNSDK_TRUE;
+            break;
+        case 'j':
+            s_batch_jobs = strtol(optarg, GNSDK_NULL, 10);
+            if (s_batch_jobs <= 0)
             {
-                *p_user_handle = user_handle;
-                return 0;
+                b_usage = 1;
             }
-            
-            /* else desired regmode is online, but user is localonly - discard and register new online user */
-            gnsdk_manager_user_release(user_handle);
-        }
-        
-        if (GNSDK_SUCCESS != error)
-        {
-            _display_last_error();
-        }
-    }
-
-    /*
-     * Register new user
-     */
-    error = gnsdk_manager_user_register(
-        user_reg_mode,
-        client_id,
-        client_id_tag,
-        client_app_version,
-        &serialized_user
-    );
-    if (GNSDK_SUCCESS == error)
-    {
-        /* Create the user handle from the newly registered user */
-        error = gnsdk_manager_user_create(serialized_user, client_id, &user_handle);
-        if (GNSDK_SUCCESS == error)
-        {
-            /* save newly registered user for use next time */
-            file = fopen(user_file_path, "w");
-            if (file)
+            break;
+        case OPT_CACHE:
+            cache_dir = optarg;
+            break;
+        case OPT_CACHE_TTL:
+            cache_ttl = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case OPT_CACHE_NEGATIVE_TTL:
+            cache_negative_ttl = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case OPT_CACHE_MAX_MB:
+            cache_max_mb = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case OPT_TIMING:
+            s_context.b_timing = GNSDK_TRUE;
+            break;
+        case OPT_CAPTURE:
+            b_capture     = GNSDK_TRUE;
+            s_context.b_raw_input = GNSDK_TRUE;
+            break;
+        case OPT_PREROLL:
+            s_context.preroll_seconds = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case OPT_FLOAT:
+            s_context.b_raw_float                = GNSDK_TRUE;
+            s_context.raw_format.bits_per_sample = 32;
+            break;
+        case OPT_CONDITION:
+            s_context.b_condition = GNSDK_TRUE;
+            break;
+        case OPT_SILENCE_DB:
+            s_context.silence_db = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_MAX_GAIN_DB:
+            s_context.max_gain_db = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_MONITOR:
+            b_monitor = GNSDK_TRUE;
+            break;
+        case OPT_REQUERY:
+            s_monitor_options.requery_seconds = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_RING_SECONDS:
+            s_monitor_options.ring_seconds = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case OPT_PIN_CPUS:
+            if (0 != monitor_parse_cpus(&s_monitor_options, optarg))
             {
-                fputs(serialized_user, file);
-                fclose(file);
+                b_usage = 1;
             }
+            break;
+        case OPT_FORMAT:
+            if (0 == strcmp(optarg, "ndjson"))
+            {
+                s_context.record_format = RECORD_FORMAT_JSON;
+            }
+            else if (0 == strcmp(optarg, "binary"))
+            {
+                s_context.record_format = RECORD_FORMAT_BINARY;
+            }
+            else
+            {
+                b_usage = 1;
+            }
+            break;
+        case OPT_CANDIDATES:
+            s_context.candidates = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case OPT_RATE_LIMIT:
+            rate_limit = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_RATE_BURST:
+            rate_burst = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_PRIORITY:
+            if (0 != quota_class_parse(optarg, &s_context.priority))
+            {
+                b_usage = 1;
+            }
+            b_priority = GNSDK_TRUE;
+            break;
+        case OPT_BUILD_INDEX:
+            build_index_path = optarg;
+            break;
+        case OPT_LOCAL_INDEX:
+            local_index_path = optarg;
+            break;
+        case OPT_TRACKLIST:
+            b_tracklist = GNSDK_TRUE;
+            break;
+        case OPT_WINDOW:
+            s_window_seconds = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_HOP:
+            s_hop_seconds = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_DEADLINE:
+            s_context.deadline_seconds = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_HEDGE:
+            s_context.hedge_percentile = strtod(optarg, GNSDK_NULL);
+            break;
+        case OPT_FINGERPRINT:
+            fingerprint_path = optarg;
+            break;
+        case OPT_DRAIN:
+            drain_path = optarg;
+            break;
+        case OPT_SPLIT:
+            split_path = optarg;
+            break;
+        case OPT_WORK:
+            work_path = optarg;
+            break;
+        case OPT_MERGE:
+            merge_path = optarg;
+            break;
+        case OPT_UNIT_SIZE:
+            s_unit_files = strtol(optarg, GNSDK_NULL, 10);
+            break;
+        case OPT_LEASE:
+            s_lease_seconds = strtod(optarg, GNSDK_NULL);
+            break;
+        default:
+            b_usage = 1;
+            break;
         }
-        
-        gnsdk_manager_string_free(serialized_user);
-    }
-    
-    if (GNSDK_SUCCESS == error)
-    {
-        *p_user_handle = user_handle;
-        rc = 0;
     }
-    else
-    {
-        _display_last_error();
-        rc = -1;
-    }
-
-    return rc;
-
-} /* _get_user_handle() */
-
-/******************************************************************
- *
- *    _ENABLE_LOGGING
- *
- *  Enable logging for the SDK.
- *
- ******************************************************************/
-static int
-_enable_logging(void)
-{
-    gnsdk_error_t error = GNSDK_SUCCESS;
-    int           rc    = 0;
-
-    error = gnsdk_manager_logging_enable(
-        "sample.log",                                           /* Log file path */
-        GNSDK_LOG_PKG_ALL,                                      /* Include entries for all packages and subsystems */
-        GNSDK_LOG_LEVEL_ERROR,                                  /* Include only error entries */
-        GNSDK_LOG_OPTION_ALL,                                   /* All logging options: timestamps, thread IDs, etc */
-        0,                                                      /* Max size of log: 0 means a new log file will be created each run */
-        GNSDK_FALSE                                             /* GNSDK_TRUE = old logs will be renamed and saved */
-        );
-    if (GNSDK_SUCCESS != error)
-    {
-        _display_last_error();
-        rc = -1;
-    }
-
-    return rc;
-
-}  /* _enable_logging() */
 
-
-/*****************************************************************************
- *
- *    _SET_LOCALE
- *
- *  Set application locale
- *
- ****************************************************************************/
-static int
-_set_locale(
-    gnsdk_user_handle_t user_handle
-    )
-{
-    gnsdk_locale_handle_t locale_handle = GNSDK_NULL;
-    gnsdk_error_t         error         = GNSDK_SUCCESS;
-    int                   rc            = 0;
-
-    error = gnsdk_manager_locale_load(
-        GNSDK_LOCALE_GROUP_MUSIC,               /* Locale group */
-        GNSDK_LANG_ENGLISH,                     /* Language */
-        GNSDK_REGION_DEFAULT,                   /* Region */
-        GNSDK_DESCRIPTOR_SIMPLIFIED,            /* Descriptor */
-        user_handle,                            /* User handle */
-        GNSDK_NULL,                             /* User callback function */
-        0,                                      /* Optional data for user callback function */
-        &locale_handle                          /* Return handle */
-        );
-    if (GNSDK_SUCCESS == error)
-    {
-        /* Setting the 'locale' as default
-         * If default not set, no locale-specific results would be available
-         */
-        error = gnsdk_manager_locale_set_group_default(locale_handle);
-        if (GNSDK_SUCCESS != error)
+    /* One sound file, a server socket, a batch of inputs, streams to
+     * monitor, mixes to list the tracks of, the inputs of an index to
+     * build, inputs to fingerprint, a spool to drain, or inputs to split
+     * into a work queue, a queue to work on or one to merge */
+    if ((split_path || work_path || merge_path)
+        ? ((split_path != GNSDK_NULL) + (work_path != GNSDK_NULL) + (merge_path != GNSDK_NULL) > 1
+           || socket_path || b_batch || b_monitor || b_tracklist || b_capture || build_index_path || fingerprint_path || drain_path
+           || (split_path ? (optind == argc) : (optind != argc)))
+        : fingerprint_path ? (socket_path || b_batch || b_monitor || b_tracklist || b_capture || build_index_path || drain_path || optind == argc)
+        : drain_path ? (socket_path || b_batch || b_monitor || b_tracklist || b_capture || build_index_path || optind != argc)
+        : build_index_path ? (socket_path || b_batch || b_monitor || b_tracklist || b_capture || local_index_path || optind == argc)
+        : socket_path ? (optind != argc - (b_capture ? 1 : 0) || b_batch || b_monitor || b_tracklist)
+                      : (b_capture || (b_batch + b_monitor + b_tracklist > 1)
+                         || ((b_batch || b_monitor || b_tracklist) ? (optind == argc) : (optind != argc - 1))))
+    {
+        b_usage = 1;
+    }
+    b_single = !socket_path && !b_batch && !b_monitor && !b_tracklist && !build_index_path && !fingerprint_path && !drain_path
+               && !split_path && !work_path && !merge_path;
+    s_context.b_fingerprint_only = (fingerprint_path != GNSDK_NULL);
+
+    /* archive work waits behind anything interactive unless told otherwise */
+    if (!b_priority && (b_batch || b_monitor || b_tracklist || drain_path || work_path))
+    {
+        s_context.priority = QUOTA_BULK;
+    }
+
+    /* whole bytes per sample, so frames can be kept intact */
+    if (0 == s_context.raw_format.sample_rate
+        || 0 == s_context.raw_format.channels
+        || 0 == s_context.raw_format.bits_per_sample
+        || 0 != s_context.raw_format.bits_per_sample % 8
+        || 0 == s_context.feed_size
+        || cache_ttl < 0
+        || cache_negative_ttl < 0
+        || cache_max_mb <= 0
+        || s_context.preroll_seconds <= 0
+        || s_context.silence_db > 0
+        || s_context.max_gain_db < 0
+        || s_monitor_options.requery_seconds <= 0
+        || s_monitor_options.ring_seconds <= 0
+        || s_context.candidates <= 0
+        || s_window_seconds <= 0
+        || s_hop_seconds <= 0
+        || s_context.deadline_seconds < 0
+        || s_context.hedge_percentile < 0
+        || s_context.hedge_percentile >= 100
+        || rate_limit < 0
+        || rate_burst < 1
+        || s_unit_files <= 0
+        || s_lease_seconds <= 0)
+    {
+        b_usage = 1;
+    }
+
+    /* start capturing straight away so the pre-roll fills during start-up */
+    if (!b_usage && b_capture)
+    {
+        capture_fd = (0 == strcmp(argv[optind], "-")) ? STDIN_FILENO : open(argv[optind], O_RDONLY);
+        if (capture_fd >= 0)
+        {
+            s_context.capture = capture_open(capture_fd, &s_context.raw_format, (uint32_t)s_context.preroll_seconds, s_context.feed_size);
+        }
+        if (s_context.capture == GNSDK_NULL)
         {
-            _display_last_error();
+            record_stringf(query_context_begin_record(&s_context), "error", "Failed to capture %s: %s", argv[optind], strerror(errno));
+            query_context_end_record(&s_context);
             rc = -1;
         }
-
-        /* The manager will hold onto the locale when set as default
-         * so it's ok to release our reference to it here
-         */
-        gnsdk_manager_locale_release(locale_handle);
     }
-    else
-    {
-        _display_last_error();
-        rc = -1;
-    }
-
-    return rc;
-
-}  /* _set_locale() */
 
-/****************************************************************************************
- *
- *    _INIT_GNSDK
- *
- ****************************************************************************************/
-static int
-_init_gnsdk(
-    const char*          client_id,
-    const char*          client_id_tag,
-    const char*          client_app_version,
-    const char*          license_data,
-    gnsdk_user_handle_t* p_user_handle
-    )
-{
-    gnsdk_manager_handle_t sdkmgr_handle = GNSDK_NULL;
-    gnsdk_error_t          error         = GNSDK_SUCCESS;
-    gnsdk_user_handle_t    user_handle   = GNSDK_NULL;
-    int                    rc            = 0;
-
-    /* Initialize the GNSDK Manager */
-    error = gnsdk_manager_initialize(
-        &sdkmgr_handle,
-        license_data,
-        GNSDK_MANAGER_LICENSEDATA_NULLTERMSTRING
-        );
-    if (GNSDK_SUCCESS != error)
+    if (!b_usage && rate_limit > 0)
     {
-        _display_last_error();
-        return -1;
-    }
-
-    /* Enable logging */
-    if (0 == rc)
-    {
-        rc = _enable_logging();
+        s_context.quota = quota_open(rate_limit, rate_burst);
+        if (s_context.quota == GNSDK_NULL)
+        {
+            record_stringf(query_context_begin_record(&s_context), "error", "Failed to set up the rate limit: %s", strerror(errno));
+            query_context_end_record(&s_context);
+            rc = -1;
+        }
     }
 
-    /* Initialize the DSP Library - used for generating fingerprints */
-    if (0 == rc)
+    if (!b_usage && local_index_path)
     {
-        error = gnsdk_dsp_initialize(sdkmgr_handle);
-        if (GNSDK_SUCCESS != error)
+        s_context.local_index = landmark_index_open(local_index_path);
+        if (s_context.local_index == GNSDK_NULL)
         {
-            _display_last_error();
+            record_stringf(query_context_begin_record(&s_context), "error", "Failed to open local index %s: %s", local_index_path, strerror(errno));
+            query_context_end_record(&s_context);
             rc = -1;
         }
     }
 
-    /* Initialize the MusicID-Stream Library */
-    if (0 == rc)
+    if (!b_usage && cache_dir)
     {
-        error = gnsdk_musicidstream_initialize(sdkmgr_handle);
-        if (GNSDK_SUCCESS != error)
+        s_context.cache = cache_open(cache_dir, cache_ttl, cache_negative_ttl, (uint64_t)cache_max_mb * 1024 * 1024);
+        if (s_context.cache == GNSDK_NULL)
         {
-            _display_last_error();
+            record_stringf(query_context_begin_record(&s_context), "error", "Failed to open cache %s: %s", cache_dir, strerror(errno));
+            query_context_end_record(&s_context);
             rc = -1;
         }
     }
-    
-    /* Get a user handle for our client ID.  This will be passed in for all queries */
-    if (0 == rc)
-    {
-        rc = _get_user_handle(
-            client_id,
-            client_id_tag,
-            client_app_version,
-            &user_handle
-            );
-    }
 
-    /* Set the 'locale' to return locale-specifc results values. This examples loads an English locale. */
-    if (0 == rc)
+    if (!b_usage && 0 == rc && build_index_path)
     {
-        rc = _set_locale(user_handle);
+        /* fingerprinting our own catalog needs nothing from the service */
+        rc = _run_build_index(build_index_path, argc - optind, argv + optind);
     }
 
-    if (0 != rc)
+    if (!b_usage && 0 == rc && (split_path || merge_path))
     {
-        /* Clean up on failure. */
-        _shutdown_gnsdk(user_handle);
+        /* a work queue is split up and put back together without the service */
+        rc = split_path ? work_split(&s_context, split_path, s_unit_files, argc - optind, argv + optind) : work_merge(&s_context, merge_path);
     }
-    else
-    {
-        /* return the User handle for use at query time */
-        *p_user_handle = user_handle;
-    }
-
-    return rc;
-
-}  /* _init_gnsdk() */
 
-
-/***************************************************************************
- *
- *    _SHUTDOWN_GNSDK
- *
- ***************************************************************************/
-static void
-_shutdown_gnsdk(
-    gnsdk_user_handle_t user_handle
-    )
-{
-    gnsdk_error_t error = GNSDK_SUCCESS;
-
-    error = gnsdk_manager_user_release(user_handle);
-    if (GNSDK_SUCCESS != error)
+    if (!b_usage && 0 == rc && !build_index_path && !split_path && !merge_path)
     {
-        _display_last_error();
-    }
-
-    /* Shutdown the Manager to shutdown all libraries */
-    gnsdk_manager_shutdown();
-
-}  /* _shutdown_gnsdk() */
-
-/***************************************************************************
- *
- *    _DISPLAY_TRACK_GDO
- *
- ***************************************************************************/
-
-static void
-_display_track_gdo(
-    gnsdk_gdo_handle_t track_gdo
-    )
-{
-    gnsdk_error_t      error     = GNSDK_SUCCESS;
-    gnsdk_gdo_handle_t title_gdo = GNSDK_NULL;
-    gnsdk_cstr_t       value     = GNSDK_NULL;
+        if (b_single)
+        {
+            /* a single file answered from the cache never needs the SDK */
+            query.context    = &s_context;
+            query.audio_file = argv[optind];
+            query.out        = s_context.output;
+            query.priority   = s_context.priority;
+            query_trace_start(&query);
+            b_need_sdk       = (0 == query_prepare_input(&query, &input));
+        }
 
-    /* Track Title */
-    error = gnsdk_manager_gdo_child_get( track_gdo, GNSDK_GDO_CHILD_TITLE_OFFICIAL, 1, &title_gdo );
-    if (GNSDK_SUCCESS == error)
-    {
-        error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
-        if (GNSDK_SUCCESS == error)
+        if (fingerprint_path)
         {
-            printf("\"%s\": \"%s\",\n", "track", value );
+            /* Fingerprint every input on a pool of queries and spool
+             * the fingerprints for --drain */
+            rc = drain_fingerprint(&s_context, fingerprint_path, s_batch_jobs, argc - optind, argv + optind);
         }
-        else
+        else if (drain_path)
         {
-            _display_last_error();
+            /* Look up every spooled fingerprint on a pool of queries */
+            rc = drain_run(&s_context, drain_path, s_batch_jobs);
         }
-        gnsdk_manager_gdo_release(title_gdo);
-    }
-    else
-    {
-        _display_last_error();
-    }
-
-}  /* _display_track_gdo() */
-
-/***************************************************************************
- *
- *    _DISPLAY_ARTIST_GDO
- *
- ***************************************************************************/
-static void
-_display_artist_gdo(
-    gnsdk_gdo_handle_t album_gdo
-    )
-{
-    gnsdk_error_t      error           = GNSDK_SUCCESS;
-    gnsdk_gdo_handle_t artist_gdo      = GNSDK_NULL;
-    gnsdk_gdo_handle_t artist_name_gdo = GNSDK_NULL;
-    gnsdk_cstr_t       value           = GNSDK_NULL;
-
-
-    /* Artist Title */
-    error = gnsdk_manager_gdo_child_get( album_gdo, GNSDK_GDO_CHILD_ARTIST, 1, &artist_gdo );
-    if (GNSDK_SUCCESS == error)
-    {
-        error = gnsdk_manager_gdo_child_get( artist_gdo, GNSDK_GDO_CHILD_NAME_OFFICIAL, 1, &artist_name_gdo );
-        if (GNSDK_SUCCESS == error)
+        else if (work_path)
         {
-            error = gnsdk_manager_gdo_value_get( artist_name_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
-            if (GNSDK_SUCCESS == error)
-            {
-                printf( "\"%s\": \"%s\"\n}\n}", "artist", value ); /* close json */
-            }
-            else
-            {
-                _display_last_error();
-            }
+            /* Identify the units of a work queue on a pool of channels
+             * until every unit is done */
+            rc = work_run(&s_context, work_path, s_batch_jobs, s_lease_seconds);
         }
-        else
+        else if (b_batch)
         {
-            _display_last_error();
+            /* Identify every input on a pool of channels, starting the
+             * SDK only once one of them needs it */
+            rc = batch_run(&s_context, s_batch_jobs, argc - optind, argv + optind);
         }
-        gnsdk_manager_gdo_release(artist_gdo);
-        gnsdk_manager_gdo_release(artist_name_gdo);
-    }
-    else
-    {
-        _display_last_error();
-    }
-
-}  /* _display_artist_gdo() */
-
-/***************************************************************************
- *
- *    _DISPLAY_ALBUM_GDO
- *
- ***************************************************************************/
-static void
-_display_album_gdo(
-    gnsdk_gdo_handle_t album_gdo
-    )
-{
-    gnsdk_error_t      error           = GNSDK_SUCCESS;
-    gnsdk_gdo_handle_t title_gdo       = GNSDK_NULL;
-    gnsdk_gdo_handle_t track_gdo       = GNSDK_NULL;
-    gnsdk_cstr_t       value           = GNSDK_NULL;
-    
-
-    /* Begin json structure */
-    printf("{\"result\": {\n");
-    
-    /* Album Title */
-    error = gnsdk_manager_gdo_child_get( album_gdo, GNSDK_GDO_CHILD_TITLE_OFFICIAL, 1, &title_gdo );
-    if (GNSDK_SUCCESS == error)
-    {
-        error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
-        if (GNSDK_SUCCESS == error)
+        else if (b_tracklist)
         {
-            printf( "\"%s\": \"%s\",\n", "album", value );
-
-            /* Matched track number. */
-            error = gnsdk_manager_gdo_value_get( album_gdo, GNSDK_GDO_VALUE_TRACK_MATCHED_NUM, 1, &value );
-            if (GNSDK_SUCCESS == error)
+            /* Identify the windows of each mix on a pool of channels,
+             * starting the SDK only once one of them needs it */
+            rc = tracklist_run(&s_context, s_batch_jobs, s_window_seconds, s_hop_seconds, argc - optind, argv + optind);
+        }
+        else if (b_need_sdk)
+        {
+            /* GNSDK initialization */
+            rc = query_start_sdk(&s_context, &user_handle);
+            if (0 == rc)
             {
-                error = gnsdk_manager_gdo_child_get( album_gdo, GNSDK_GDO_CHILD_TRACK_MATCHED, 1, &track_gdo );
-                if (GNSDK_SUCCESS == error)
+                if (socket_path)
+                {
+                    /* Serve identify requests until signalled */
+                    rc = server_run(&s_context, user_handle, socket_path);
+                }
+                else if (b_monitor)
                 {
-                    _display_track_gdo(track_gdo);
-                    gnsdk_manager_gdo_release(track_gdo);
+                    /* Follow every stream until it ends or we are signalled */
+                    rc = monitor_run(&s_context, user_handle, &s_monitor_options, argc - optind, argv + optind);
                 }
                 else
                 {
-                    _display_last_error();
+                    /* Sample the audio */
+                    query_identify_input(user_handle, &channel_handle, &query, &input);
+                    if (channel_handle)
+                    {
+                        gnsdk_musicidstream_channel_release(channel_handle);
+                        TRACE_MARK(&query, TRACE_RELEASE);
+                    }
                 }
+
+                /* Clean up and shutdown */
+                query_stop_sdk(&s_context, user_handle);
             }
-            else
+
+            if (b_single)
             {
-                _display_last_error();
+                query_close_input(&input);
             }
         }
-        else
+
+        if (b_single)
         {
-            _display_last_error();
+            query_trace_finish(&query);
         }
-        gnsdk_manager_gdo_release(title_gdo);
+
+        query_display_stats(&s_context);
     }
-    else
+
+    query_context_close(&s_context);
+
+    if (capture_fd > STDIN_FILENO)
     {
-        _display_last_error();
+        close(capture_fd);
+    }
+    else if (b_usage)
+    {
+        printf("\nUsage:\n");
+        printf("%s [--feed-size bytes] soundfile|-\n", argv[0]);
+        printf("%s --raw [--rate hz] [--bits n | --float] [--channels n] pcmfile|-\n", argv[0]);
+        printf("%s --server socket_path\n", argv[0]);
+        printf("%s --server socket_path --capture [--preroll s] [--rate hz] [--bits n | --float] [--channels n] pcmfile|-\n", argv[0]);
+        printf("%s --batch [--jobs n] file|directory|- ...\n", argv[0]);
+        printf("%s --monitor [--requery s] [--ring-seconds s] [--pin-cpus n,n,...]\n", argv[0]);
+        printf("    [--raw [--rate hz] [--bits n | --float] [--channels n]] stream|- ...\n");
+        printf("%s --tracklist [--window s] [--hop s] [--jobs n] file|directory|- ...\n", argv[0]);
+        printf("%s --build-index index_file file|directory|- ...\n", argv[0]);
+        printf("%s --fingerprint spool_file [--jobs n] file|directory|- ...\n", argv[0]);
+        printf("%s --drain spool_file [--jobs n]\n", argv[0]);
+        printf("%s --split queue_dir [--unit-size n] file|directory|- ...\n", argv[0]);
+        printf("%s --work queue_dir [--jobs n] [--lease s]\n", argv[0]);
+        printf("%s --merge queue_dir\n", argv[0]);
+        printf("\nAny mode can add --cache dir [--cache-ttl s] [--cache-negative-ttl s] [--cache-max-mb n]\n");
+        printf("and --timing, --condition [--silence-db dB] [--max-gain-db dB], --candidates n,\n");
+        printf("--rate-limit n [--rate-burst n], --priority interactive|bulk, --local-index index_file,\n");
+        printf("--deadline s, --hedge percentile, --format ndjson|binary\n");
+        rc = -1;
     }
-    
-}  /* _display_album_gdo() */
 
+    return rc;
+
+}  /* main() */
 
 /***************************************************************************
  *
- *    _PROCESS_AUDIO
+ *    _RUN_BUILD_INDEX
  *
- * This function simulates streaming audio into the Channel handle to give
- * MusicId-Stream audio to identify
+ * Fingerprint every input (listed as --batch lists them) and write the
+ * index of them to index_path for --local-index, with a record for each
+ * input and one for the index.
  *
  ***************************************************************************/
 static int
-_process_audio(
-    gnsdk_musicidstream_channel_handle_t channel_handle
+_run_build_index(
+    const char* index_path,
+    int         input_count,
+    char**      inputs
     )
 {
-    gnsdk_error_t error           = GNSDK_SUCCESS;
-    gnsdk_size_t  read_size       = 0;
-    gnsdk_byte_t  pcm_audio[2048] = {0};
-    FILE*         p_file          = NULL;
-    int           rc              = 0;
-
-    /* check file for existence */
-    p_file = fopen(s_audio_file, "rb");
-    if (p_file == NULL)
-    {
-        printf("{\"error\": \"Failed to open input file: %s\"}", s_audio_file);
+    batch_t                batch   = {0};
+    landmark_builder_t*    builder = GNSDK_NULL;
+    landmark_fp_t*         fp      = GNSDK_NULL;
+    const landmark_hash_t* hashes  = GNSDK_NULL;
+    query_t                query   = {0};
+    audio_input_t          input;
+    record_t*              record  = GNSDK_NULL;
+    double                 seconds = 0;
+    size_t                 count   = 0;
+    uint64_t               total   = 0;
+    uint32_t               tracks  = 0;
+    size_t                 index   = 0;
+    int                    rc      = 0;
+
+    builder = landmark_builder_open();
+    if (builder == GNSDK_NULL)
+    {
+        record_string(query_context_begin_record(&s_context), "error", "Out of memory");
+        query_context_end_record(&s_context);
         return -1;
     }
 
-    /* skip the wave header (first 44 bytes). we know the format of our sample files */
-    if (0 != fseek(p_file, 44, SEEK_SET))
-    {
-        fclose(p_file);
-        return -1;
-    }
+    batch_init(&batch, &s_context, GNSDK_NULL, GNSDK_NULL);
+    rc = batch_add_inputs(&batch, input_count, inputs);
 
-    /* initialize the fingerprinter */
-    error = gnsdk_musicidstream_channel_audio_begin(
-        channel_handle,
-        44100, 16, 2
-        );
-    if (GNSDK_SUCCESS != error)
-    {
-        _display_last_error();
-        fclose(p_file);
-        return -1;
-    }
+    query.context    = &s_context;
+    query.b_tag_file = GNSDK_TRUE;
+    query.out        = s_context.output;
 
-    /* To keep this sample single-threaded, we launch the identification request
-     ** immediately then do the audio processing. Generally we expect this
-     ** call to occur on a separate thread from audio processing thread.
-     **
-     ** MusicId-Stream will actually perform the identification when it
-     ** receives enough audio.
-     **
-     ** With the asynchronous nature of MusicID-Stream this call is non-blocking so it is ok to
-     ** call on the UI thread.
-     */
-    error = gnsdk_musicidstream_channel_identify(channel_handle);
-    if (GNSDK_SUCCESS != error)
+    for (index = 0; 0 == rc && index < batch.file_count; index++)
     {
-        _display_last_error();
-        fclose(p_file);
-        return -1;
-    }
-
-    read_size = fread(pcm_audio, sizeof(char), 2048, p_file);
-    while (read_size > 0)
-    {
-        /* write audio to the fingerprinter */
-        error = gnsdk_musicidstream_channel_audio_write(
-            channel_handle,
-            pcm_audio,
-            read_size
-            );
-        if (GNSDK_SUCCESS != error)
+        query.audio_file = batch.files[index];
+        if (0 != query_open_input(&query, &input))
         {
-            if (GNSDKERR_SEVERE(error)) /* 'aborted' warnings could come back from write which should be expected */
-            {
-                _display_last_error();
-            }
-            rc = -1;
-            break;
+            continue;
         }
 
-        read_size = fread(pcm_audio, sizeof(char), 2048, p_file);
-    }
-
-    fclose(p_file);
-
-    /*signal that we are done*/
-    if (GNSDK_SUCCESS == error)
-    {
-        error = gnsdk_musicidstream_channel_audio_end(channel_handle);
-        if (GNSDK_SUCCESS != error)
+        if (0 != query_fingerprint_input(&s_context, &input, 0, &fp, &seconds))
         {
-            _display_last_error();
+            record_stringf(query_begin_record(&query), "error", "Failed to fingerprint input file: %s", query.audio_file);
+            query_end_record(&query);
         }
-    }
-
-    return rc;
-
-}  /* _process_audio() */
-
-/***************************************************************************
- *
- *    _DO_SAMPLE_MUSICID_STREAM
- *
- ***************************************************************************/
-static void
-_do_sample_musicid_stream(
-    gnsdk_user_handle_t user_handle
-    )
-{
-    gnsdk_musicidstream_channel_handle_t channel_handle = GNSDK_NULL;
-    gnsdk_musicidstream_callbacks_t      callbacks      = {0};
-    gnsdk_error_t                        error          = GNSDK_SUCCESS;
-    int                                  rc             = 0;
-
-    /* MusicId-Stream requires callbacks to receive identification results.
-    ** He we set the various callbacks for results ands status.
-    */
-    callbacks.callback_status             = GNSDK_NULL;
-    callbacks.callback_processing_status  = GNSDK_NULL;
-    callbacks.callback_identifying_status = _musicidstream_identifying_status_callback;
-    callbacks.callback_result_available   = _musicidstream_result_available_callback;
-    callbacks.callback_error              = _musicidstream_completed_with_error_callback;
-
-    /* Create the channel handle */
-    error = gnsdk_musicidstream_channel_create(
-        user_handle,
-        gnsdk_musicidstream_preset_radio,
-        &callbacks,          /* User callback functions */
-        GNSDK_NULL,          /* Optional data to be passed to the callbacks */
-        &channel_handle
-    );
-    if (GNSDK_SUCCESS == error)
-    {
-        rc = _process_audio(channel_handle);
-        if (0 == rc)
+        else
         {
-            /* result will be sent to _musicidstream_result_available_callback */
+            count = landmark_fp_hashes(fp, &hashes);
+            if (0 != landmark_builder_add(builder, query.audio_file, seconds, hashes, count))
+            {
+                record_string(query_begin_record(&query), "error", "Out of memory");
+                query_end_record(&query);
+                rc = -1;
+            }
+            else
+            {
+                record = query_begin_record(&query);
+                record_begin_object(record, "indexed");
+                record_number(record, "seconds", seconds, 3);
+                record_int(record, "hashes", (int64_t)count);
+                record_end_object(record);
+                query_end_record(&query);
+
+                tracks++;
+                total += count;
+            }
+            landmark_fp_close(fp);
         }
 
-        /* wait for the identification to finish so we actually get results */
-        gnsdk_musicidstream_channel_wait_for_identify(channel_handle, GNSDK_MUSICIDSTREAM_TIMEOUT_INFINITE);
-    }
-
-    /* Clean up */
-    gnsdk_musicidstream_channel_release(channel_handle);
-
-}   /* _do_sample_musicid_stream() */
-
-
-/*-----------------------------------------------------------------------------
- *  _musicidstream_identifying_status_callback
- */
-gnsdk_void_t GNSDK_CALLBACK_API
-_musicidstream_identifying_status_callback(
-    gnsdk_void_t*                            callback_data,
-    gnsdk_musicidstream_identifying_status_t status,
-    gnsdk_bool_t*                            pb_abort
-    )
-{
-    /* This sample chooses to stop the audio processing when the identification
-    ** is complete so it stops feeding in audio */
-    if (status == gnsdk_musicidstream_identifying_ended)
-    {
-        *pb_abort = GNSDK_TRUE;
+        query_close_input(&input);
     }
 
-    GNSDK_UNUSED(callback_data);
-}
-
-
-/*-----------------------------------------------------------------------------
- *  _musicidstream_result_available_callback
- */
-gnsdk_void_t GNSDK_CALLBACK_API
-_musicidstream_result_available_callback(
-    gnsdk_void_t*                        callback_data,
-    gnsdk_musicidstream_channel_handle_t channel_handle,
-    gnsdk_gdo_handle_t                   response_gdo,
-    gnsdk_bool_t*                        pb_abort
-    )
-{
-    gnsdk_gdo_handle_t album_gdo = GNSDK_NULL;
-    gnsdk_uint32_t     count     = 0;
-    gnsdk_error_t      error     = GNSDK_SUCCESS;
-
-    /* See how many albums were found. */
-    error = gnsdk_manager_gdo_child_count(
-        response_gdo,
-        GNSDK_GDO_CHILD_ALBUM,
-        &count
-        );
-    if (GNSDK_SUCCESS != error)
-    {
-        _display_last_error();
-    }
-    else
+    if (0 == rc)
     {
-        if (count == 0)
+        if (0 != landmark_builder_write(builder, index_path))
         {
-            printf("\n{\"result\": null}\n");
+            record_stringf(query_context_begin_record(&s_context), "error", "Failed to write index %s: %s", index_path, strerror(errno));
+            query_context_end_record(&s_context);
+            rc = -1;
         }
         else
         {
-            /* we display first album result */
-            error = gnsdk_manager_gdo_child_get(
-                response_gdo,
-                GNSDK_GDO_CHILD_ALBUM,
-                1,
-                &album_gdo
-                );
-            if (GNSDK_SUCCESS != error)
-            {
-                _display_last_error();
-            }
-            else
-            {
-                _display_album_gdo(album_gdo);
-                _display_artist_gdo(album_gdo);
-                gnsdk_manager_gdo_release(album_gdo);
-            }
+            record = query_context_begin_record(&s_context);
+            record_string(record, "index", index_path);
+            record_int(record, "tracks", tracks);
+            record_int(record, "hashes", (int64_t)total);
+            query_context_end_record(&s_context);
         }
     }
 
-    GNSDK_UNUSED(pb_abort);
-    GNSDK_UNUSED(callback_data);
-    GNSDK_UNUSED(channel_handle);
-}
+    batch_close(&batch);
+    landmark_builder_close(builder);
 
-/*-----------------------------------------------------------------------------
- *  _musicidstream_completed_with_error_callback
- */
-gnsdk_void_t GNSDK_CALLBACK_API
-_musicidstream_completed_with_error_callback(
-    gnsdk_void_t*                        callback_data,
-    gnsdk_musicidstream_channel_handle_t channel_handle,
-    const gnsdk_error_info_t*            p_error_info
-    )
-{
-    /* an error occurred during identification */
-    printf(
-        "{\"error\": \"%s\"}",
-        p_error_info->error_description
-        );
-
-    GNSDK_UNUSED(channel_handle);
-    GNSDK_UNUSED(callback_data);
-}
+    return rc;
+
+}   /* _run_build_index() */
 
@@ -0,0 +1,943 @@
+/*
+ *  Name: monitor.c
+ *  Description:
+ *  --monitor. Every stream is followed on a thread and channel of its
+ *  own, identified again and again as it plays (see s_monitor_hooks),
+ *  and each change of track is written as an event. Streams that have
+ *  to be read get a reader thread and ring (ingest.h) so that a slow
+ *  channel doesn't hold up reading them.
+ */
+
+#include "monitor.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/* --monitor tells when a track should end from where in the matched
+ * track the match was and how long that track is. SDK headers that
+ * don't name those GDO values build without it: every recognised track
+ * is then checked again each --requery seconds, which --monitor says on
+ * stderr when it starts. */
+#if defined(GNSDK_GDO_VALUE_TRACK_MATCHED_POSITION) && defined(GNSDK_GDO_VALUE_DURATION)
+#define SAMPLE_TRACK_END 1
+#endif
+
+/* ask again this soon after "no match" or an error */
+#define MONITOR_RETRY_SECONDS 10
+
+/* "no match" answers in a row before the track counts as over,
+ * so one bad fingerprint doesn't end it */
+#define MONITOR_MISSES 2
+
+/* give up on an identification with no answer after this long */
+#define MONITOR_STUCK_SECONDS 60
+
+/* how often monitor_run() checks whether its streams are done or it was asked to stop */
+#define MONITOR_WAIT_MS 200
+
+/* seconds between "stats" events for streams with a reader thread */
+#define MONITOR_STATS_SECONDS 300
+
+/* One --monitor run: what its streams share */
+typedef struct
+{
+    query_context_t*         context;
+    const monitor_options_t* options;
+    pthread_mutex_t          lock;      /* one event line at a time on the output, and b_done */
+
+} monitor_set_t;
+
+/* --monitor state of one stream, the owner of its query. Stream time is
+ * measured in seconds of input audio written, so it runs at the pace the
+ * audio arrives. Guarded by lock, as the callbacks update it from SDK
+ * threads. */
+typedef struct
+{
+    monitor_set_t*  set;                /* the run it is part of */
+    pthread_mutex_t lock;
+    double          bytes_per_second;   /* of the input audio */
+    uint64_t        bytes_written;
+    double          stream_seconds;
+    gnsdk_bool_t    b_identifying;      /* an identification is in flight */
+    double          identify_started;   /* stream time it was asked for */
+    double          next_identify;      /* stream time to ask again */
+    unsigned char*  track;              /* current answer's encoded fields, GNSDK_NULL until there is one */
+    size_t          track_size;
+    unsigned        misses;             /* "no match" answers in a row */
+    convert_t*      local_convert;      /* --local-index: the stream at LANDMARK_SAMPLE_RATE, */
+    landmark_fp_t*  local_fp;           /* its recent fingerprints (both only used by the */
+    double          local_missed;       /* writing thread) and the next_identify it last missed */
+    double          next_stats;         /* when its reader thread is next reported on */
+
+} monitor_t;
+
+/* One --monitor input and the thread following it */
+typedef struct
+{
+    monitor_set_t*      set;
+    gnsdk_user_handle_t user_handle;
+    const char*         path;
+    int                 index;    /* picks the CPU from --pin-cpus */
+    pthread_t           thread;
+    gnsdk_bool_t        b_done;   /* guarded by set->lock */
+
+} monitor_stream_t;
+
+/**********************************************
+ *    Local Function Declarations
+ **********************************************/
+static void
+_monitor_answer(
+    query_t*       query,
+    record_t*      record,
+    gnsdk_uint32_t count,
+    double         asked,
+    double         left
+    );
+
+static record_t*
+_monitor_begin_event(
+    query_t*    query,
+    const char* event,
+    double      stream_seconds
+    );
+
+static void
+_monitor_end_event(
+    query_t* query
+    );
+
+static void
+_monitor_audio(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    const gnsdk_byte_t*                  p_audio,
+    gnsdk_size_t                         size
+    );
+
+static void
+_monitor_ingest(
+    query_t*  query,
+    ingest_t* ingest
+    );
+
+static void
+_monitor_identified(
+    query_t* query
+    );
+
+static void
+_monitor_result(
+    query_t*           query,
+    gnsdk_gdo_handle_t response_gdo
+    );
+
+static void
+_monitor_error(
+    query_t*    query,
+    const char* description
+    );
+
+/* a stream is identified as it goes by, its answers written as events */
+static const query_hooks_t s_monitor_hooks =
+{
+    GNSDK_TRUE,
+    _monitor_audio,
+    _monitor_ingest,
+    _monitor_identified,
+    _monitor_result,
+    _monitor_error
+};
+
+/******************************************************************
+ *
+ *    MONITOR_PARSE_CPUS
+ *
+ *    Read the --pin-cpus list of CPU numbers, e.g. "2,3,6".
+ *    Returns -1 if it isn't one.
+ *
+ *****************************************************************/
+int
+monitor_parse_cpus(
+    monitor_options_t* options,
+    const char*        list
+    )
+{
+    char* end = GNSDK_NULL;
+    long  cpu = 0;
+
+    options->pin_cpu_count = 0;
+    while (*list)
+    {
+        cpu = strtol(list, &end, 10);
+        if (end == list || cpu < 0 || cpu > INT32_MAX || (*end != ',' && *end != '\0')
+            || options->pin_cpu_count == MONITOR_MAX_PIN_CPUS)
+        {
+            return -1;
+        }
+        options->pin_cpus[options->pin_cpu_count++] = (int)cpu;
+        list = (*end == ',') ? end + 1 : end;
+    }
+
+    return (options->pin_cpu_count > 0) ? 0 : -1;
+
+} /* monitor_parse_cpus() */
+
+/******************************************************************
+ *
+ *    _ADD_INGEST_STATS
+ *
+ *    The "ingest" object for a --monitor event on a stream with a
+ *    reader thread: bytes read and dropped, how often the ring ran
+ *    over or dry, and how full it has been, in seconds of audio.
+ *
+ *****************************************************************/
+static void
+_add_ingest_stats(
+    record_t*             record,
+    const ingest_stats_t* p_stats,
+    double                bytes_per_second
+    )
+{
+    record_begin_object(record, "ingest");
+    record_int(record, "bytes", (int64_t)p_stats->bytes_read);
+    record_int(record, "dropped_bytes", (int64_t)p_stats->bytes_dropped);
+    record_int(record, "overruns", (int64_t)p_stats->overruns);
+    record_int(record, "underruns", (int64_t)p_stats->underruns);
+    record_number(record, "ring_s", (double)p_stats->capacity / bytes_per_second, 1);
+    record_number(record, "peak_fill_s", (double)p_stats->peak_fill / bytes_per_second, 3);
+    record_end_object(record);
+
+} /* _add_ingest_stats() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_BEGIN_EVENT
+ *
+ * Start a --monitor event record for query's stream, stamped with the
+ * wall-clock time (UTC) and the stream time it refers to. The caller
+ * adds any more fields and calls _monitor_end_event().
+ *
+ ***************************************************************************/
+static record_t*
+_monitor_begin_event(
+    query_t*    query,
+    const char* event,
+    double      stream_seconds
+    )
+{
+    record_t*       record        = query_thread_record();
+    char            time_text[32] = {0};
+    struct timespec ts;
+    struct tm       utc;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &utc);
+    strftime(time_text, sizeof(time_text), "%Y-%m-%dT%H:%M:%S", &utc);
+
+    record_clear(record);
+    record_string(record, "file", query->audio_file);
+    record_string(record, "event", event);
+    record_stringf(record, "time", "%s.%03ldZ", time_text, ts.tv_nsec / 1000000);
+    record_number(record, "stream_s", stream_seconds, 3);
+
+    return record;
+
+}   /* _monitor_begin_event() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_END_EVENT
+ *
+ * Write the event started by _monitor_begin_event() on this thread.
+ *
+ ***************************************************************************/
+static void
+_monitor_end_event(
+    query_t* query
+    )
+{
+    monitor_t* monitor = query->owner;
+
+    pthread_mutex_lock(&monitor->set->lock);
+    query_write_record(query->context, query_thread_record(), query->context->output);
+    pthread_mutex_unlock(&monitor->set->lock);
+
+}   /* _monitor_end_event() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_ERROR
+ *
+ * Report a failed identification of a monitored stream and ask again in
+ * MONITOR_RETRY_SECONDS.
+ *
+ ***************************************************************************/
+static void
+_monitor_error(
+    query_t*    query,
+    const char* description
+    )
+{
+    monitor_t* monitor = query->owner;
+
+    pthread_mutex_lock(&monitor->lock);
+    monitor->b_identifying = GNSDK_FALSE;
+    monitor->next_identify = monitor->stream_seconds + MONITOR_RETRY_SECONDS;
+    record_string(_monitor_begin_event(query, "error", monitor->stream_seconds), "error", description);
+    _monitor_end_event(query);
+    pthread_mutex_unlock(&monitor->lock);
+
+}   /* _monitor_error() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_FINGERPRINT
+ *
+ * With --local-index, fingerprint a slice of a monitored stream as it
+ * is written, keeping only the last LOCAL_MATCH_SECONDS.
+ *
+ ***************************************************************************/
+static void
+_monitor_fingerprint(
+    query_t*            query,
+    const gnsdk_byte_t* p_audio,
+    gnsdk_size_t        size
+    )
+{
+    monitor_t* monitor = query->owner;
+    uint32_t   frames  = 0;
+    uint32_t   window  = (uint32_t)(LOCAL_MATCH_SECONDS * LANDMARK_SAMPLE_RATE / LANDMARK_HOP);
+
+    if (monitor->local_fp == GNSDK_NULL)
+    {
+        return;
+    }
+
+    /* out of memory only costs the local match; the service still answers */
+    query_fingerprint(monitor->local_fp, monitor->local_convert, p_audio, size);
+
+    frames = landmark_fp_frames(monitor->local_fp);
+    if (frames > window)
+    {
+        landmark_fp_forget(monitor->local_fp, frames - window);
+    }
+
+}   /* _monitor_fingerprint() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_MATCH_LOCAL
+ *
+ * Match the last LOCAL_MATCH_SECONDS of a monitored stream against
+ * --local-index when an identification is due, and answer it if the
+ * catalog has the track. Returns 0 if it was answered, 1 if it is too
+ * early in the stream to tell (nothing is asked yet), -1 to ask the
+ * service.
+ *
+ ***************************************************************************/
+static int
+_monitor_match_local(
+    query_t* query
+    )
+{
+    monitor_t*             monitor = query->owner;
+    record_t*              record  = query_thread_record();
+    const landmark_hash_t* hashes  = GNSDK_NULL;
+    landmark_match_t       match;
+    size_t                 count   = 0;
+    double                 heard   = 0;
+    double                 now     = 0;
+    double                 left    = -1;
+
+    heard = (double)landmark_fp_frames(monitor->local_fp) * LANDMARK_HOP / LANDMARK_SAMPLE_RATE;
+    if (heard < LOCAL_MATCH_SECONDS)
+    {
+        return 1;
+    }
+
+    count = landmark_fp_hashes(monitor->local_fp, &hashes);
+    if (0 != landmark_index_match(query->context->local_index, hashes, count, LOCAL_MIN_SCORE, &match))
+    {
+        return -1;
+    }
+
+    /* the offset is where stream time 0 would be in the track; ask
+     * again once most of what is matched is past its end */
+    if (match.track_seconds > 0)
+    {
+        left = match.track_seconds - (match.offset_seconds + heard);
+        if (left < 0)
+        {
+            left = 0;
+        }
+        left += LOCAL_MATCH_SECONDS / 2.0;
+    }
+
+    pthread_mutex_lock(&monitor->lock);
+    now = monitor->stream_seconds;
+    pthread_mutex_unlock(&monitor->lock);
+
+    record_clear(record);
+    query_add_local_match(record, &match, GNSDK_FALSE);
+    _monitor_answer(query, record, 1, now, left);
+
+    return 0;
+
+}   /* _monitor_match_local() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_POLL
+ *
+ * Called as each slice of a monitored stream is written: move the stream
+ * clock on and, when the next identification is due, ask for it. One
+ * that has had no answer for MONITOR_STUCK_SECONDS is cancelled. With
+ * --rate-limit an identification is only asked for when a token is free,
+ * and otherwise stays due until the next slice. With --local-index
+ * the catalog is tried first, once for each identification due, and the
+ * service is only asked if it has no match.
+ *
+ ***************************************************************************/
+static void
+_monitor_poll(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    gnsdk_size_t                         written
+    )
+{
+    monitor_t*   monitor = query->owner;
+    gnsdk_bool_t b_due   = GNSDK_FALSE;
+    gnsdk_bool_t b_stuck = GNSDK_FALSE;
+    gnsdk_bool_t b_local = GNSDK_FALSE;
+    int          local   = 0;
+
+    pthread_mutex_lock(&monitor->lock);
+    monitor->bytes_written += written;
+    monitor->stream_seconds = (double)monitor->bytes_written / monitor->bytes_per_second;
+    b_local = monitor->local_fp && !monitor->b_identifying
+              && monitor->stream_seconds >= monitor->next_identify
+              && monitor->local_missed != monitor->next_identify;
+    pthread_mutex_unlock(&monitor->lock);
+
+    /* only this thread asks for identifications, so nothing can start
+     * one while the lock is let go */
+    if (b_local)
+    {
+        local = _monitor_match_local(query);
+        if (local >= 0)
+        {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&monitor->lock);
+    if (b_local)
+    {
+        monitor->local_missed = monitor->next_identify;
+    }
+    if (monitor->b_identifying)
+    {
+        b_stuck = (monitor->stream_seconds - monitor->identify_started >= MONITOR_STUCK_SECONDS);
+    }
+    else if (monitor->stream_seconds >= monitor->next_identify
+             && (query->context->quota == GNSDK_NULL || 0 == quota_try_acquire(query->context->quota, query->priority)))
+    {
+        b_due                     = GNSDK_TRUE;
+        monitor->b_identifying    = GNSDK_TRUE;
+        monitor->identify_started = monitor->stream_seconds;
+
+        /* in case it ends with neither a result nor an error */
+        monitor->next_identify    = monitor->stream_seconds + MONITOR_RETRY_SECONDS;
+    }
+    pthread_mutex_unlock(&monitor->lock);
+
+    if (b_stuck)
+    {
+        gnsdk_musicidstream_channel_identify_cancel(channel_handle);
+        _monitor_error(query, "Identification timed out");
+    }
+    else if (b_due && GNSDK_SUCCESS != gnsdk_musicidstream_channel_identify(channel_handle))
+    {
+        _monitor_error(query, gnsdk_manager_error_info()->error_description);
+    }
+
+}   /* _monitor_poll() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_AUDIO
+ *
+ * The on_audio hook of a monitored stream: fingerprint the slice for
+ * --local-index and move the stream on (see _monitor_poll()).
+ *
+ ***************************************************************************/
+static void
+_monitor_audio(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    const gnsdk_byte_t*                  p_audio,
+    gnsdk_size_t                         size
+    )
+{
+    _monitor_fingerprint(query, p_audio, size);
+    _monitor_poll(channel_handle, query, size);
+
+}   /* _monitor_audio() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_INGEST
+ *
+ * The on_ingest hook of a monitored stream with a reader thread: a
+ * "stats" event every MONITOR_STATS_SECONDS.
+ *
+ ***************************************************************************/
+static void
+_monitor_ingest(
+    query_t*  query,
+    ingest_t* ingest
+    )
+{
+    monitor_t*     monitor = query->owner;
+    ingest_stats_t stats;
+
+    if (query_now() < monitor->next_stats)
+    {
+        return;
+    }
+
+    ingest_get_stats(ingest, &stats);
+    _add_ingest_stats(
+        _monitor_begin_event(query, "stats", monitor->stream_seconds),
+        &stats,
+        monitor->bytes_per_second
+        );
+    _monitor_end_event(query);
+    monitor->next_stats += MONITOR_STATS_SECONDS;
+
+}   /* _monitor_ingest() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_IDENTIFIED
+ *
+ * The stream keeps going; the next identification can be asked for once
+ * this one is over.
+ *
+ ***************************************************************************/
+static void
+_monitor_identified(
+    query_t* query
+    )
+{
+    monitor_t* monitor = query->owner;
+
+    pthread_mutex_lock(&monitor->lock);
+    monitor->b_identifying = GNSDK_FALSE;
+    pthread_mutex_unlock(&monitor->lock);
+
+}   /* _monitor_identified() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_TRACK_LEFT
+ *
+ * Seconds of the matched track still to play after the audio that was
+ * matched, from where in the track the match was and how long the track
+ * is. Returns -1 if the response doesn't say.
+ *
+ ***************************************************************************/
+static double
+_monitor_track_left(
+    gnsdk_gdo_handle_t response_gdo
+    )
+{
+    double             left      = -1;
+#ifdef SAMPLE_TRACK_END
+    gnsdk_gdo_handle_t album_gdo = GNSDK_NULL;
+    gnsdk_gdo_handle_t track_gdo = GNSDK_NULL;
+    gnsdk_cstr_t       value     = GNSDK_NULL;
+    double             position  = 0;
+    double             duration  = 0;
+
+    if (GNSDK_SUCCESS != gnsdk_manager_gdo_child_get(response_gdo, GNSDK_GDO_CHILD_ALBUM, 1, &album_gdo))
+    {
+        return left;
+    }
+
+    /* both are values of the matched track; the position is in
+     * milliseconds, the duration in seconds unless its units say "ms" */
+    if (GNSDK_SUCCESS == gnsdk_manager_gdo_child_get(album_gdo, GNSDK_GDO_CHILD_TRACK_MATCHED, 1, &track_gdo))
+    {
+        if (GNSDK_SUCCESS == gnsdk_manager_gdo_value_get(track_gdo, GNSDK_GDO_VALUE_TRACK_MATCHED_POSITION, 1, &value))
+        {
+            position = strtod(value, GNSDK_NULL) / 1e3;
+
+            if (GNSDK_SUCCESS == gnsdk_manager_gdo_value_get(track_gdo, GNSDK_GDO_VALUE_DURATION, 1, &value))
+            {
+                duration = strtod(value, GNSDK_NULL);
+#ifdef GNSDK_GDO_VALUE_DURATION_UNITS
+                if (GNSDK_SUCCESS == gnsdk_manager_gdo_value_get(track_gdo, GNSDK_GDO_VALUE_DURATION_UNITS, 1, &value)
+                    && 0 == strcasecmp(value, "ms"))
+                {
+                    duration /= 1e3;
+                }
+#endif
+                if (duration > 0)
+                {
+                    left = (duration > position) ? duration - position : 0;
+                }
+            }
+        }
+        gnsdk_manager_gdo_release(track_gdo);
+    }
+    gnsdk_manager_gdo_release(album_gdo);
+#else
+    GNSDK_UNUSED(response_gdo);
+#endif
+
+    return left;
+
+}   /* _monitor_track_left() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_ANSWER
+ *
+ * Handle an answer for a monitored stream, built alone in record from
+ * count matches: write a "track" event if it differs from the track
+ * playing, and decide when to ask again. A track whose end can be
+ * worked out (left seconds after the audio at stream time asked) isn't
+ * looked up again until then; others are checked every --requery
+ * seconds. "No match" only replaces a track after MONITOR_MISSES
+ * answers in a row. Only the current answer is kept, so memory stays
+ * the same however long the stream runs.
+ *
+ ***************************************************************************/
+static void
+_monitor_answer(
+    query_t*       query,
+    record_t*      record,
+    gnsdk_uint32_t count,
+    double         asked,
+    double         left
+    )
+{
+    monitor_t*     monitor = query->owner;
+    unsigned char* track   = GNSDK_NULL;
+    double         now     = 0;
+
+    pthread_mutex_lock(&monitor->lock);
+    now = monitor->stream_seconds;
+    monitor->misses = (count > 0) ? 0 : monitor->misses + 1;
+
+    if ((count > 0 || monitor->misses >= MONITOR_MISSES)
+        && (monitor->track == GNSDK_NULL || monitor->track_size != record->size
+            || 0 != memcmp(monitor->track, record->data, record->size)))
+    {
+        track = realloc(monitor->track, record->size);
+        if (track)
+        {
+            memcpy(track, record->data, record->size);
+            monitor->track      = track;
+            monitor->track_size = record->size;
+
+            /* the event record replaces the result in the thread's record */
+            record_append(_monitor_begin_event(query, "track", now), track, monitor->track_size);
+            _monitor_end_event(query);
+        }
+    }
+
+    if (count == 0)
+    {
+        monitor->next_identify = now + MONITOR_RETRY_SECONDS;
+    }
+    else if (left >= 0)
+    {
+        monitor->next_identify = asked + left;
+        if (monitor->next_identify < now + MONITOR_RETRY_SECONDS)
+        {
+            monitor->next_identify = now + MONITOR_RETRY_SECONDS;
+        }
+    }
+    else
+    {
+        monitor->next_identify = now + monitor->set->options->requery_seconds;
+    }
+    pthread_mutex_unlock(&monitor->lock);
+
+}   /* _monitor_answer() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_RESULT
+ *
+ * Handle a response from the service for a monitored stream.
+ *
+ ***************************************************************************/
+static void
+_monitor_result(
+    query_t*           query,
+    gnsdk_gdo_handle_t response_gdo
+    )
+{
+    monitor_t*     monitor = query->owner;
+    record_t*      record  = query_thread_record();
+    gnsdk_uint32_t count   = 0;
+    double         left    = -1;
+    double         asked   = 0;
+
+    /* build the result alone, to compare with the track playing */
+    record_clear(record);
+    if (GNSDK_SUCCESS != query_add_response(query->context, record, response_gdo, &count)
+        || record->b_failed || record->depth != 0)
+    {
+        _monitor_error(query, gnsdk_manager_error_info()->error_description);
+        return;
+    }
+
+    if (count > 0)
+    {
+        left = _monitor_track_left(response_gdo);
+    }
+
+    /* the match was made on audio from about when it was asked for */
+    pthread_mutex_lock(&monitor->lock);
+    asked = monitor->identify_started;
+    pthread_mutex_unlock(&monitor->lock);
+
+    _monitor_answer(query, record, count, asked, left);
+
+}   /* _monitor_result() */
+
+/***************************************************************************
+ *
+ *    _MONITOR_WORKER
+ *
+ * Follow one stream on its own channel until it ends or we are asked to
+ * stop, then write an "end" event. A stream that has to be read gets a
+ * reader thread and ring of its own, so that a slow channel doesn't
+ * hold up reading it. Records for errors outside the identifications are
+ * written when the stream is done.
+ *
+ ***************************************************************************/
+static void*
+_monitor_worker(
+    void* arg
+    )
+{
+    monitor_stream_t*                    stream         = (monitor_stream_t*)arg;
+    monitor_set_t*                       set            = stream->set;
+    gnsdk_musicidstream_channel_handle_t channel_handle = GNSDK_NULL;
+    query_t                              query          = {0};
+    monitor_t                            monitor;
+    audio_input_t                        input;
+    record_t*                            record         = GNSDK_NULL;
+    char*                                record_buf     = GNSDK_NULL;
+    size_t                               record_size    = 0;
+    gnsdk_bool_t                         b_ingest       = GNSDK_FALSE;
+    ingest_stats_t                       stats;
+    int                                  cpu            = -1;
+
+    memset(&monitor, 0, sizeof(monitor));
+    pthread_mutex_init(&monitor.lock, GNSDK_NULL);
+    monitor.set = set;
+
+    query.context    = set->context;
+    query.hooks      = &s_monitor_hooks;
+    query.owner      = &monitor;
+    query.audio_file = stream->path;
+    query.b_tag_file = GNSDK_TRUE;
+    query.priority   = set->context->priority;
+    query.out        = open_memstream(&record_buf, &record_size);
+
+    if (query.out != GNSDK_NULL)
+    {
+        if (0 == query_open_input(&query, &input))
+        {
+            monitor.bytes_per_second = (double)input.info.format.sample_rate * input.info.block_align;
+            monitor.local_missed     = -1;
+            monitor.next_stats       = query_now() + MONITOR_STATS_SECONDS;
+
+            if (set->context->local_index)
+            {
+                monitor.local_fp = query_open_fingerprint(
+                    &input.info.format,
+                    input.info.format_tag == WAV_FORMAT_IEEE_FLOAT,
+                    &monitor.local_convert
+                    );
+                if (monitor.local_fp == GNSDK_NULL)
+                {
+                    record_stringf(query_begin_record(&query), "error", "Failed to fingerprint %s locally; only the service will be asked", query.audio_file);
+                    query_end_record(&query);
+                }
+            }
+
+            if (input.p_map == GNSDK_NULL && input.decode == GNSDK_NULL)
+            {
+                if (set->options->pin_cpu_count > 0)
+                {
+                    cpu = set->options->pin_cpus[stream->index % set->options->pin_cpu_count];
+                }
+                input.ingest = ingest_open(
+                    input.fd,
+                    input.info.data_size,
+                    input.info.block_align,
+                    (size_t)(set->options->ring_seconds * monitor.bytes_per_second),
+                    set->context->feed_size,
+                    cpu
+                    );
+                if (input.ingest == GNSDK_NULL)
+                {
+                    record_stringf(query_begin_record(&query), "error", "Failed to start reading %s: %s", query.audio_file, strerror(errno));
+                    query_end_record(&query);
+                }
+            }
+
+            if (input.p_map || input.decode || input.ingest)
+            {
+                query_identify_input(stream->user_handle, &channel_handle, &query, &input);
+            }
+            if (input.ingest)
+            {
+                b_ingest = GNSDK_TRUE;
+                ingest_get_stats(input.ingest, &stats);
+            }
+            query_close_input(&input);
+        }
+
+        fclose(query.out);
+        if (record_size > 0)
+        {
+            pthread_mutex_lock(&set->lock);
+            fwrite(record_buf, 1, record_size, set->context->output);
+            fflush(set->context->output);
+            pthread_mutex_unlock(&set->lock);
+        }
+    }
+
+    if (channel_handle)
+    {
+        gnsdk_musicidstream_channel_release(channel_handle);
+        record = _monitor_begin_event(&query, "end", monitor.stream_seconds);
+        if (b_ingest)
+        {
+            _add_ingest_stats(record, &stats, monitor.bytes_per_second);
+        }
+        _monitor_end_event(&query);
+    }
+
+    free(record_buf);
+    free(monitor.track);
+    landmark_fp_close(monitor.local_fp);
+    convert_close(monitor.local_convert);
+    pthread_mutex_destroy(&monitor.lock);
+
+    pthread_mutex_lock(&set->lock);
+    stream->b_done = GNSDK_TRUE;
+    pthread_mutex_unlock(&set->lock);
+
+    return GNSDK_NULL;
+
+}   /* _monitor_worker() */
+
+/***************************************************************************
+ *
+ *    MONITOR_RUN
+ *
+ * Follow every input on a thread and channel of its own, writing
+ * track-change events as JSON lines, until they have all ended or
+ * SIGINT or SIGTERM arrives.
+ *
+ ***************************************************************************/
+int
+monitor_run(
+    query_context_t*         context,
+    gnsdk_user_handle_t      user_handle,
+    const monitor_options_t* options,
+    int                      input_count,
+    char**                   inputs
+    )
+{
+    monitor_set_t     set     = { context, options, PTHREAD_MUTEX_INITIALIZER };
+    monitor_stream_t* streams = GNSDK_NULL;
+    struct timespec   wait    = { 0, MONITOR_WAIT_MS * 1000000L };
+    int               started = 0;
+    int               done    = 0;
+    int               i       = 0;
+    int               rc      = 0;
+
+    streams = calloc((size_t)input_count, sizeof(monitor_stream_t));
+    if (streams == GNSDK_NULL)
+    {
+        record_string(query_context_begin_record(context), "error", "Out of memory");
+        query_context_end_record(context);
+        return -1;
+    }
+
+#ifndef SAMPLE_TRACK_END
+    fprintf(stderr,
+        "{\"warning\": \"built without the SDK's matched track position and duration: "
+        "recognised tracks are checked again every %g seconds\"}\n",
+        options->requery_seconds
+        );
+#endif
+
+    /* no SA_RESTART, so a stream waiting for audio is woken to stop */
+    query_stop_on_signals(context);
+
+    for (started = 0; started < input_count; started++)
+    {
+        streams[started].set         = &set;
+        streams[started].user_handle = user_handle;
+        streams[started].path        = inputs[started];
+        streams[started].index       = started;
+        if (0 != pthread_create(&streams[started].thread, GNSDK_NULL, _monitor_worker, &streams[started]))
+        {
+            record_stringf(query_context_begin_record(context), "error", "Failed to start monitoring %s", inputs[started]);
+            query_context_end_record(context);
+            rc = -1;
+            break;
+        }
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&set.lock);
+        for (i = 0, done = 0; i < started; i++)
+        {
+            done += streams[i].b_done ? 1 : 0;
+        }
+        pthread_mutex_unlock(&set.lock);
+
+        if (done == started)
+        {
+            break;
+        }
+
+        /* the signal only interrupts the thread it lands on; keep waking
+         * the rest until they have all noticed */
+        if (context->b_stop)
+        {
+            for (i = 0; i < started; i++)
+            {
+                pthread_kill(streams[i].thread, SIGINT);
+            }
+        }
+        nanosleep(&wait, GNSDK_NULL);
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(streams[i].thread, GNSDK_NULL);
+    }
+    free(streams);
+
+    return rc;
+
+}   /* monitor_run() */
+
@@ -0,0 +1,60 @@
+/*
+ *  Name: monitor.h
+ *  Description:
+ *  --monitor: broadcast streams watched around the clock. Each stream is
+ *  fed to a long-lived channel of its own and identified again and
+ *  again as it plays, and a JSON event line is written whenever the
+ *  track changes or the stream ends. A recognised track isn't looked up
+ *  again until it should have ended, or every requery seconds when that
+ *  can't be worked out.
+ */
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include "query.h"
+
+/* --requery: seconds between queries while a track of unknown length plays */
+#define MONITOR_REQUERY_SECONDS 30
+
+/* --ring-seconds: audio a reader thread can get ahead of its channel */
+#define MONITOR_RING_SECONDS 10
+
+/* --pin-cpus: CPUs that can be listed */
+#define MONITOR_MAX_PIN_CPUS 256
+
+/* How the streams of a --monitor run are followed */
+typedef struct
+{
+    double requery_seconds;                   /* --requery */
+    long   ring_seconds;                      /* --ring-seconds */
+    int    pin_cpus[MONITOR_MAX_PIN_CPUS];    /* --pin-cpus, for the reader threads in turn */
+    int    pin_cpu_count;
+
+} monitor_options_t;
+
+/*
+ * Read a --pin-cpus list of CPU numbers, e.g. "2,3,6", into options.
+ * Returns -1 if it isn't one.
+ */
+int
+monitor_parse_cpus(
+    monitor_options_t* options,
+    const char*        list
+    );
+
+/*
+ * Follow every input on a thread and channel of its own with
+ * user_handle, writing its events to the context's output, until they
+ * have all ended or SIGINT or SIGTERM arrives.
+ */
+int
+monitor_run(
+    query_context_t*         context,
+    gnsdk_user_handle_t      user_handle,
+    const monitor_options_t* options,
+    int                      input_count,
+    char**                   inputs
+    );
+
+#endif /* MONITOR_H */
@@ -0,0 +1,3057 @@
+/*
+ *  Name: query.c
+ *  Description:
+ *  Identification of one input on a MusicID-Stream channel, shared by
+ *  every mode of sample and by bench and libidentify (see query.h).
+ *
+ *  The SDK itself is global to the process: query_start_sdk() starts
+ *  the manager and its libraries for the first caller and hands every
+ *  caller a user handle of its own, and query_stop_sdk() shuts it down
+ *  after the last. Everything else belongs to a query_context_t.
+ */
+
+#include "query.h"
+#include "hedge.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Gracenote client credentials */
+#define SAMPLE_CLIENT_ID          "client_id"
+#define SAMPLE_CLIENT_ID_TAG      "client_id_tag"
+#define SAMPLE_CLIENT_APP_VERSION "0.1.0.0"
+#define SAMPLE_LICENSE_DATA       "license"
+
+/* SDK state kept between runs, as ~/.<name> */
+#define USER_STATE_FILE        "gracenote.txt"
+#define LOCALE_STATE_FILE      "gracenote-locale.txt"
+
+/* a kept locale older than this is downloaded again */
+#define LOCALE_MAX_AGE_SECONDS (7 * 24 * 60 * 60)
+
+/* live audio fed to one request after the pre-roll before giving up */
+#define CAPTURE_LIVE_SECONDS 30
+
+/* how long to wait for live audio before checking the request is still going */
+#define CAPTURE_POLL_MS 200
+
+/* the record each thread is building; see query_thread_record() */
+static _Thread_local record_t s_thread_record;
+static pthread_key_t          s_record_key;
+static pthread_once_t         s_record_key_once = PTHREAD_ONCE_INIT;
+
+/* callers of query_start_sdk() not yet stopped, whether the locale has
+ * been loaded since the SDK was started and where it came from */
+static pthread_mutex_t s_sdk_lock      = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long   s_sdk_users;
+static gnsdk_bool_t    s_b_locale_set;
+static const char*     s_locale_source = "none";
+
+/* the context SIGINT and SIGTERM stop; see query_stop_on_signals() */
+static query_context_t* volatile s_stop_context;
+
+/**********************************************
+ *    Local Function Declarations
+ **********************************************/
+/* callbacks */
+static gnsdk_void_t GNSDK_CALLBACK_API
+_musicidstream_identifying_status_callback(
+    gnsdk_void_t* callback_data,
+    gnsdk_musicidstream_identifying_status_t status,
+    gnsdk_bool_t* pb_abort
+    );
+
+static gnsdk_void_t GNSDK_CALLBACK_API
+_musicidstream_result_available_callback(
+    gnsdk_void_t* callback_data,
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    gnsdk_gdo_handle_t response_gdo,
+    gnsdk_bool_t* pb_abort
+    );
+
+static gnsdk_void_t GNSDK_CALLBACK_API
+_musicidstream_completed_with_error_callback(
+    gnsdk_void_t* callback_data,
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    const gnsdk_error_info_t* p_error_info
+    );
+
+/******************************************************************
+ *
+ *    QUERY_CONTEXT_INIT
+ *
+ *****************************************************************/
+void
+query_context_init(
+    query_context_t* context
+    )
+{
+    memset(context, 0, sizeof(*context));
+
+    context->output                     = stdout;
+    context->record_format              = RECORD_FORMAT_JSON;
+    context->raw_format.sample_rate     = 44100;
+    context->raw_format.bits_per_sample = 16;
+    context->raw_format.channels        = 2;
+    context->feed_size                  = 64 * 1024;
+    context->silence_db                 = -50.0;
+    context->max_gain_db                = 18.0;
+    context->candidates                 = 1;
+    context->priority                   = QUOTA_INTERACTIVE;
+    context->preroll_seconds            = 12;
+    context->locale_source              = "none";
+    context->process_start              = query_now();
+
+    pthread_mutex_init(&context->stats_lock, GNSDK_NULL);
+
+} /* query_context_init() */
+
+/******************************************************************
+ *
+ *    QUERY_CONTEXT_CLOSE
+ *
+ *****************************************************************/
+void
+query_context_close(
+    query_context_t* context
+    )
+{
+    if (s_stop_context == context)
+    {
+        s_stop_context = GNSDK_NULL;
+    }
+
+    cache_close(context->cache);
+    context->cache = GNSDK_NULL;
+
+    landmark_index_close(context->local_index);
+    context->local_index = GNSDK_NULL;
+
+    quota_close(context->quota);
+    context->quota = GNSDK_NULL;
+
+    capture_close(context->capture);
+    context->capture = GNSDK_NULL;
+
+    pthread_mutex_destroy(&context->stats_lock);
+
+} /* query_context_close() */
+
+/******************************************************************
+ *
+ *    _ON_STOP_SIGNAL
+ *
+ *****************************************************************/
+static void
+_on_stop_signal(
+    int signum
+    )
+{
+    query_context_t* context = s_stop_context;
+
+    if (context)
+    {
+        context->b_stop = 1;
+    }
+
+    GNSDK_UNUSED(signum);
+
+} /* _on_stop_signal() */
+
+/******************************************************************
+ *
+ *    QUERY_STOP_ON_SIGNALS
+ *
+ *    Without SA_RESTART, so that a read, accept() or wait in progress
+ *    returns and its caller sees b_stop. One context at a time is
+ *    stopped this way, the last one given.
+ *
+ *****************************************************************/
+void
+query_stop_on_signals(
+    query_context_t* context
+    )
+{
+    struct sigaction action = {0};
+
+    s_stop_context = context;
+
+    action.sa_handler = _on_stop_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, GNSDK_NULL);
+    sigaction(SIGTERM, &action, GNSDK_NULL);
+
+} /* query_stop_on_signals() */
+
+/******************************************************************
+ *
+ *    QUERY_THREAD_RECORD
+ *
+ *    The record being built on this thread. Each thread (including
+ *    the SDK's callback threads) has one of its own, reused from one
+ *    record to the next and freed when the thread exits.
+ *
+ *****************************************************************/
+static void
+_free_thread_record(
+    void* p_record
+    )
+{
+    record_free((record_t*)p_record);
+
+} /* _free_thread_record() */
+
+static void
+_make_record_key(void)
+{
+    pthread_key_create(&s_record_key, _free_thread_record);
+
+} /* _make_record_key() */
+
+record_t*
+query_thread_record(void)
+{
+    pthread_once(&s_record_key_once, _make_record_key);
+    if (pthread_getspecific(s_record_key) == GNSDK_NULL)
+    {
+        record_init(&s_thread_record);
+        pthread_setspecific(s_record_key, &s_thread_record);
+    }
+
+    return &s_thread_record;
+
+} /* query_thread_record() */
+
+/******************************************************************
+ *
+ *    QUERY_WRITE_RECORD
+ *
+ *    Render the record in the --format chosen and write it to out
+ *    in one piece.
+ *
+ *****************************************************************/
+void
+query_write_record(
+    query_context_t* context,
+    record_t*        record,
+    FILE*            out
+    )
+{
+    const void* p_rendered = GNSDK_NULL;
+    size_t      size       = 0;
+
+    p_rendered = record_render(record, context->record_format, &size);
+    if (p_rendered)
+    {
+        fwrite(p_rendered, 1, size, out);
+        fflush(out);
+    }
+
+} /* query_write_record() */
+
+/******************************************************************
+ *
+ *    QUERY_BEGIN_RECORD
+ *
+ *    Start a record for query, tagged with the input path if the
+ *    query wants it. The caller adds the fields and then calls
+ *    query_end_record().
+ *
+ *****************************************************************/
+record_t*
+query_begin_record(
+    query_t* query
+    )
+{
+    record_t* record = query_thread_record();
+
+    record_clear(record);
+    if (query->b_tag_file)
+    {
+        record_string(record, "file", query->audio_file);
+    }
+
+    return record;
+
+} /* query_begin_record() */
+
+/******************************************************************
+ *
+ *    QUERY_END_RECORD
+ *
+ *    Write the record. As JSON every record is a single line so
+ *    that clients can frame responses by newline. Records held for
+ *    query_trace_finish() are kept encoded, each after its length,
+ *    so that fields can still be added to them.
+ *
+ *****************************************************************/
+void
+query_end_record(
+    query_t* query
+    )
+{
+    record_t* record = query_thread_record();
+    uint32_t  size   = (uint32_t)record->size;
+
+    if (query->trace.out)
+    {
+        if (!record->b_failed && record->depth == 0)
+        {
+            fwrite(&size, sizeof(size), 1, query->out);
+            fwrite(record->data, 1, record->size, query->out);
+        }
+    }
+    else
+    {
+        query_write_record(query->context, record, query->out);
+    }
+
+    query->records++;
+
+} /* query_end_record() */
+
+/******************************************************************
+ *
+ *    QUERY_CONTEXT_BEGIN_RECORD
+ *
+ *    Start a record for the run as a whole rather than a query.
+ *
+ *****************************************************************/
+record_t*
+query_context_begin_record(
+    query_context_t* context
+    )
+{
+    record_t* record = query_thread_record();
+
+    record_clear(record);
+    GNSDK_UNUSED(context);
+
+    return record;
+
+} /* query_context_begin_record() */
+
+/******************************************************************
+ *
+ *    QUERY_CONTEXT_END_RECORD
+ *
+ *****************************************************************/
+void
+query_context_end_record(
+    query_context_t* context
+    )
+{
+    query_write_record(context, query_thread_record(), context->output);
+
+} /* query_context_end_record() */
+
+/******************************************************************
+ *
+ *    QUERY_DISPLAY_LAST_ERROR
+ *
+ *    Echo the error and information.
+ *
+ *****************************************************************/
+void
+query_display_last_error(
+    query_t* query
+    )
+{
+    /* Get the last error information from the SDK */
+    const gnsdk_error_info_t* error_info = gnsdk_manager_error_info();
+
+    record_string(query_begin_record(query), "error", error_info->error_description);
+    query_end_record(query);
+
+} /* query_display_last_error() */
+
+/******************************************************************
+ *
+ *    _DISPLAY_SDK_ERROR
+ *
+ *    The same for an error outside any query, such as in starting
+ *    the SDK.
+ *
+ *****************************************************************/
+static void
+_display_sdk_error(
+    query_context_t* context
+    )
+{
+    const gnsdk_error_info_t* error_info = gnsdk_manager_error_info();
+
+    record_string(query_context_begin_record(context), "error", error_info->error_description);
+    query_context_end_record(context);
+
+} /* _display_sdk_error() */
+
+/******************************************************************
+ *
+ *    _DISPLAY_CACHE_STATS
+ *
+ *    Report cache effectiveness on stderr, away from the results.
+ *
+ *****************************************************************/
+static void
+_display_cache_stats(
+    query_context_t* context
+    )
+{
+    cache_stats_t stats;
+
+    cache_get_stats(context->cache, &stats);
+
+    fprintf(stderr,
+        "{\"cache\": {\"hits\": %lu, \"negative_hits\": %lu, \"misses\": %lu, \"stores\": %lu, \"evictions\": %lu}}\n",
+        stats.hits,
+        stats.negative_hits,
+        stats.misses,
+        stats.stores,
+        stats.evictions
+        );
+
+} /* _display_cache_stats() */
+
+/******************************************************************
+ *
+ *    _DISPLAY_CAPTURE_STATS
+ *
+ *****************************************************************/
+static void
+_display_capture_stats(
+    query_context_t* context
+    )
+{
+    capture_stats_t stats;
+
+    capture_get_stats(context->capture, &stats);
+
+    fprintf(stderr,
+        "{\"capture\": {\"bytes\": %llu, \"overruns\": %lu}}\n",
+        (unsigned long long)stats.bytes_captured,
+        stats.overruns
+        );
+
+} /* _display_capture_stats() */
+
+/******************************************************************
+ *
+ *    _DISPLAY_QUOTA_STATS
+ *
+ *    Report, for each priority class, how many requests went through
+ *    the --rate-limit queue and how long they waited.
+ *
+ *****************************************************************/
+static void
+_display_quota_stats(
+    query_context_t* context
+    )
+{
+    quota_stats_t              stats;
+    const quota_class_stats_t* p_class = GNSDK_NULL;
+    int                        cls     = 0;
+
+    quota_get_stats(context->quota, &stats);
+
+    fprintf(stderr, "{\"quota\": {");
+    for (cls = 0; cls < QUOTA_CLASS_COUNT; cls++)
+    {
+        p_class = &stats.classes[cls];
+        fprintf(stderr,
+            "%s\"%s\": {\"granted\": %lu, \"cancelled\": %lu, \"deferred\": %lu, \"peak_queued\": %lu, \"wait_ms\": {\"mean\": %.3f, \"max\": %.3f}}",
+            cls ? ", " : "",
+            quota_class_name((quota_class_t)cls),
+            p_class->granted,
+            p_class->cancelled,
+            p_class->deferred,
+            (unsigned long)p_class->peak_depth,
+            p_class->granted ? p_class->total_wait * 1e3 / (double)p_class->granted : 0.0,
+            p_class->max_wait * 1e3
+            );
+    }
+    fprintf(stderr, "}}\n");
+
+} /* _display_quota_stats() */
+
+/******************************************************************
+ *
+ *    _DISPLAY_COLD_START
+ *
+ *    Report on stderr how long the SDK took to start and how long it
+ *    was from setting up the context to the first audio_begin, with
+ *    where the locale came from.
+ *
+ *****************************************************************/
+static void
+_display_cold_start(
+    query_context_t* context
+    )
+{
+    pthread_mutex_lock(&context->stats_lock);
+    if (context->b_init_timed)
+    {
+        fprintf(stderr,
+            "{\"cold_start_ms\": {\"manager_init\": %.3f, \"user_handle\": %.3f, \"locale\": %.3f, \"locale_source\": \"%s\"",
+            context->init_manager_seconds * 1e3,
+            context->init_user_seconds * 1e3,
+            context->init_locale_seconds * 1e3,
+            context->locale_source
+            );
+        if (context->first_audio_begin != 0)
+        {
+            fprintf(stderr, ", \"first_audio_begin\": %.3f", (context->first_audio_begin - context->process_start) * 1e3);
+        }
+        fprintf(stderr, "}}\n");
+    }
+    pthread_mutex_unlock(&context->stats_lock);
+
+} /* _display_cold_start() */
+
+/******************************************************************
+ *
+ *    QUERY_DISPLAY_STATS
+ *
+ *****************************************************************/
+void
+query_display_stats(
+    query_context_t* context
+    )
+{
+    if (context->cache)
+    {
+        _display_cache_stats(context);
+    }
+
+    _display_cold_start(context);
+
+    if (context->quota)
+    {
+        _display_quota_stats(context);
+    }
+
+    if (context->deadline_seconds > 0 || context->hedge_percentile > 0)
+    {
+        hedge_display_stats(context);
+    }
+
+    if (context->capture)
+    {
+        _display_capture_stats(context);
+    }
+
+} /* query_display_stats() */
+
+/******************************************************************
+ *
+ *    QUERY_NOW
+ *
+ *    Monotonic time in seconds.
+ *
+ *****************************************************************/
+double
+query_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+
+} /* query_now() */
+
+/******************************************************************
+ *
+ *    QUERY_TRACE_START
+ *
+ *    With --timing or --condition, start the clock on a query and
+ *    hold its records back until query_trace_finish(), when the timing and
+ *    conditioning statistics are known.
+ *
+ *****************************************************************/
+void
+query_trace_start(
+    query_t* query
+    )
+{
+    query_context_t* context  = query->context;
+    FILE*            held_out = GNSDK_NULL;
+
+    query->b_conditioned = GNSDK_FALSE;
+    if (!context->b_timing && !context->b_condition)
+    {
+        return;
+    }
+
+    memset(&query->trace, 0, sizeof(query->trace));
+    held_out = open_memstream(&query->trace.held, &query->trace.held_size);
+    if (held_out != GNSDK_NULL)
+    {
+        query->trace.out = query->out;
+        query->out       = held_out;
+    }
+    query->trace.start = query_now();
+
+} /* query_trace_start() */
+
+/******************************************************************
+ *
+ *    _ADD_CONDITIONING
+ *
+ *    The "conditioning" object for a record: seconds of silence
+ *    skipped at each end, the level of the sound kept (null if there
+ *    was none) and the gain applied to it, in dB.
+ *
+ *****************************************************************/
+static void
+_add_conditioning(
+    record_t* record,
+    query_t*  query
+    )
+{
+    const condition_stats_t* stats = &query->condition_stats;
+
+    record_begin_object(record, "conditioning");
+    record_number(record, "seconds", stats->seconds_in, 3);
+    record_number(record, "leading_silence_s", stats->leading_silence_seconds, 3);
+    record_number(record, "trailing_silence_s", stats->trailing_silence_seconds, 3);
+    if (isinf(stats->level_db))
+    {
+        record_null(record, "level_db");
+    }
+    else
+    {
+        record_number(record, "level_db", stats->level_db, 1);
+    }
+    record_begin_object(record, "gain_db");
+    record_number(record, "mean", stats->mean_gain_db, 1);
+    record_number(record, "max", stats->max_gain_db, 1);
+    record_end_object(record);
+    record_end_object(record);
+
+} /* _add_conditioning() */
+
+/******************************************************************
+ *
+ *    _ADD_TIMING
+ *
+ *    The "timing" object for a record: "init_ms" is how long each
+ *    step of SDK start-up took (absent if the SDK wasn't needed) and
+ *    "query_ms" when each phase of the query was first reached, in
+ *    milliseconds from its start.
+ *
+ *****************************************************************/
+static void
+_add_timing(
+    record_t* record,
+    query_t*  query,
+    double    end
+    )
+{
+    static const char* phase_names[TRACE_PHASE_COUNT] =
+    {
+        "channel_create",
+        "audio_begin",
+        "quota_granted",
+        "first_audio_write",
+        "identifying_started",
+        "fp_generated",
+        "local_query_started",
+        "local_query_ended",
+        "online_query_started",
+        "online_query_ended",
+        "identifying_ended",
+        "result",
+        "error",
+        "release"
+    };
+    query_context_t* context = query->context;
+    int              phase   = 0;
+
+    record_begin_object(record, "timing");
+    pthread_mutex_lock(&context->stats_lock);
+    if (context->b_init_timed)
+    {
+        record_begin_object(record, "init_ms");
+        record_number(record, "manager_init", context->init_manager_seconds * 1e3, 3);
+        record_number(record, "user_handle", context->init_user_seconds * 1e3, 3);
+        record_number(record, "locale", context->init_locale_seconds * 1e3, 3);
+        record_end_object(record);
+    }
+    pthread_mutex_unlock(&context->stats_lock);
+    record_begin_object(record, "query_ms");
+    for (phase = 0; phase < TRACE_PHASE_COUNT; phase++)
+    {
+        if (query->trace.at[phase] != 0)
+        {
+            record_number(record, phase_names[phase], (query->trace.at[phase] - query->trace.start) * 1e3, 3);
+        }
+    }
+    record_number(record, "total", (end - query->trace.start) * 1e3, 3);
+    record_end_object(record);
+    record_end_object(record);
+
+} /* _add_timing() */
+
+/******************************************************************
+ *
+ *    QUERY_TRACE_FINISH
+ *
+ *    Write the held records out, each with a "timing" object (see
+ *    _add_timing()) if --timing is on, and a "conditioning" object
+ *    if the audio went through --condition.
+ *
+ *****************************************************************/
+void
+query_trace_finish(
+    query_t* query
+    )
+{
+    query_context_t*     context = query->context;
+    record_t*            record  = GNSDK_NULL;
+    const unsigned char* held    = GNSDK_NULL;
+    size_t               left    = 0;
+    uint32_t             size    = 0;
+    double               end     = 0;
+
+    if (query->trace.out == GNSDK_NULL)
+    {
+        return;
+    }
+    end = query_now();
+
+    fclose(query->out);
+    query->out       = query->trace.out;
+    query->trace.out = GNSDK_NULL;
+
+    /* each held record is its length and its encoded fields */
+    held = (const unsigned char*)query->trace.held;
+    left = query->trace.held_size;
+    while (left >= sizeof(size))
+    {
+        memcpy(&size, held, sizeof(size));
+        if (left - sizeof(size) < size)
+        {
+            break;
+        }
+
+        record = query_thread_record();
+        record_clear(record);
+        record_append(record, held + sizeof(size), size);
+        if (query->b_conditioned)
+        {
+            _add_conditioning(record, query);
+        }
+        if (context->b_timing)
+        {
+            _add_timing(record, query, end);
+        }
+        query_write_record(context, record, query->out);
+
+        held += sizeof(size) + size;
+        left -= sizeof(size) + size;
+    }
+
+    free(query->trace.held);
+    query->trace.held      = GNSDK_NULL;
+    query->trace.held_size = 0;
+
+} /* query_trace_finish() */
+
+/******************************************************************
+ *
+ *    _STATE_FILE_PATH
+ *
+ *    Where a piece of SDK state called name is kept between runs:
+ *    ~/.name, or name in the current directory without a HOME.
+ *    Returns a string to free, or GNSDK_NULL if out of memory.
+ *
+ *****************************************************************/
+static char*
+_state_file_path(
+    const char* name
+    )
+{
+    const char* home = getenv("HOME");
+    char*       path = GNSDK_NULL;
+
+    if (home == GNSDK_NULL)
+    {
+        return strdup(name);
+    }
+
+    path = malloc(strlen(home) + strlen(name) + 3);
+    if (path)
+    {
+        sprintf(path, "%s/.%s", home, name);
+    }
+
+    return path;
+
+} /* _state_file_path() */
+
+/******************************************************************
+ *
+ *    _READ_STATE_FILE
+ *
+ *    Read a state file whole, without any trailing newline, with
+ *    its age in seconds in *p_age if that isn't GNSDK_NULL. Returns
+ *    a string to free, or GNSDK_NULL if it can't be read or is empty.
+ *
+ *****************************************************************/
+static char*
+_read_state_file(
+    const char* path,
+    double*     p_age
+    )
+{
+    struct stat st;
+    char*       text = GNSDK_NULL;
+    size_t      got  = 0;
+    FILE*       file = GNSDK_NULL;
+
+    file = fopen(path, "r");
+    if (file == GNSDK_NULL)
+    {
+        return GNSDK_NULL;
+    }
+
+    if (0 == fstat(fileno(file), &st) && st.st_size > 0)
+    {
+        text = malloc((size_t)st.st_size + 1);
+        if (text)
+        {
+            got = fread(text, 1, (size_t)st.st_size, file);
+            while (got > 0 && (text[got - 1] == '\n' || text[got - 1] == '\r'))
+            {
+                got--;
+            }
+            text[got] = '\0';
+            if (got == 0)
+            {
+                free(text);
+                text = GNSDK_NULL;
+            }
+        }
+        if (p_age)
+        {
+            *p_age = difftime(time(GNSDK_NULL), st.st_mtime);
+        }
+    }
+    fclose(file);
+
+    return text;
+
+} /* _read_state_file() */
+
+/******************************************************************
+ *
+ *    _WRITE_STATE_FILE
+ *
+ *    Replace a state file, readable only by us as it holds
+ *    credentials. It is written aside and renamed into place so
+ *    that a run starting meanwhile never reads half of it.
+ *
+ *****************************************************************/
+static void
+_write_state_file(
+    const char* path,
+    const char* text
+    )
+{
+    char*  tmp_path = GNSDK_NULL;
+    size_t size     = strlen(text);
+    int    fd       = -1;
+    int    b_ok     = 0;
+
+    tmp_path = malloc(strlen(path) + 32);
+    if (tmp_path == GNSDK_NULL)
+    {
+        return;
+    }
+    sprintf(tmp_path, "%s.%ld.tmp", path, (long)getpid());
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0)
+    {
+        b_ok = (ssize_t)size == write(fd, text, size);
+        b_ok = (0 == close(fd)) && b_ok;
+        if (!b_ok || 0 != rename(tmp_path, path))
+        {
+            unlink(tmp_path);
+        }
+    }
+    free(tmp_path);
+
+} /* _write_state_file() */
+
+/******************************************************************
+ *
+ *    _GET_USER_HANDLE
+ *
+ *    Load existing user handle, or register new one.
+ *
+ *****************************************************************/
+static int
+_get_user_handle(
+    query_context_t*     context,
+    const char*          client_id,
+    const char*          client_id_tag,
+    const char*          client_app_version,
+    gnsdk_user_handle_t* p_user_handle
+    )
+{
+    gnsdk_user_handle_t user_handle     = GNSDK_NULL;
+    gnsdk_cstr_t        user_reg_mode   = GNSDK_NULL;
+    gnsdk_str_t         serialized_user = GNSDK_NULL;
+    char*               saved_user      = GNSDK_NULL;
+    gnsdk_bool_t        b_localonly     = GNSDK_FALSE;
+    gnsdk_error_t       error           = GNSDK_SUCCESS;
+    int                 rc              = 0;
+    char*               user_file_path  = GNSDK_NULL;
+
+    user_reg_mode = GNSDK_USER_REGISTER_MODE_ONLINE;
+
+    user_file_path = _state_file_path(USER_STATE_FILE);
+    if (user_file_path == GNSDK_NULL)
+    {
+        record_string(query_context_begin_record(context), "error", "Out of memory");
+        query_context_end_record(context);
+        return -1;
+    }
+
+    /* Do we have a user saved locally? */
+    saved_user = _read_state_file(user_file_path, GNSDK_NULL);
+    if (saved_user)
+    {
+        /* Create the user handle from the saved user */
+        error = gnsdk_manager_user_create(saved_user, client_id, &user_handle);
+        free(saved_user);
+        if (GNSDK_SUCCESS == error)
+        {
+            error = gnsdk_manager_user_is_localonly(user_handle, &b_localonly);
+            if (!b_localonly || (strcmp(user_reg_mode, GNSDK_USER_REGISTER_MODE_LOCALONLY) == 0))
+            {
+                free(user_file_path);
+                *p_user_handle = user_handle;
+                return 0;
+            }
+
+            /* else desired regmode is online, but user is localonly - discard and register new online user */
+            gnsdk_manager_user_release(user_handle);
+        }
+
+        if (GNSDK_SUCCESS != error)
+        {
+            _display_sdk_error(context);
+        }
+    }
+
+    /*
+     * Register new user
+     */
+    error = gnsdk_manager_user_register(
+        user_reg_mode,
+        client_id,
+        client_id_tag,
+        client_app_version,
+        &serialized_user
+    );
+    if (GNSDK_SUCCESS == error)
+    {
+        /* Create the user handle from the newly registered user */
+        error = gnsdk_manager_user_create(serialized_user, client_id, &user_handle);
+        if (GNSDK_SUCCESS == error)
+        {
+            /* save newly registered user for use next time */
+            _write_state_file(user_file_path, serialized_user);
+        }
+
+        gnsdk_manager_string_free(serialized_user);
+    }
+    free(user_file_path);
+
+    if (GNSDK_SUCCESS == error)
+    {
+        *p_user_handle = user_handle;
+        rc = 0;
+    }
+    else
+    {
+        _display_sdk_error(context);
+        rc = -1;
+    }
+
+    return rc;
+
+} /* _get_user_handle() */
+
+/******************************************************************
+ *
+ *    _ENABLE_LOGGING
+ *
+ *  Enable logging for the SDK.
+ *
+ ******************************************************************/
+static int
+_enable_logging(
+    query_context_t* context
+    )
+{
+    gnsdk_error_t error = GNSDK_SUCCESS;
+    int           rc    = 0;
+
+    error = gnsdk_manager_logging_enable(
+        "sample.log",                                           /* Log file path */
+        GNSDK_LOG_PKG_ALL,                                      /* Include entries for all packages and subsystems */
+        GNSDK_LOG_LEVEL_ERROR,                                  /* Include only error entries */
+        GNSDK_LOG_OPTION_ALL,                                   /* All logging options: timestamps, thread IDs, etc */
+        0,                                                      /* Max size of log: 0 means a new log file will be created each run */
+        GNSDK_FALSE                                             /* GNSDK_TRUE = old logs will be renamed and saved */
+        );
+    if (GNSDK_SUCCESS != error)
+    {
+        _display_sdk_error(context);
+        rc = -1;
+    }
+
+    return rc;
+
+}  /* _enable_logging() */
+
+
+/*****************************************************************************
+ *
+ *    _USE_LOCALE
+ *
+ *  Make a loaded locale the default for its group, releasing our
+ *  reference to it.
+ *
+ ****************************************************************************/
+static int
+_use_locale(
+    query_context_t*      context,
+    gnsdk_locale_handle_t locale_handle
+    )
+{
+    gnsdk_error_t error = GNSDK_SUCCESS;
+    int           rc    = 0;
+
+    /* Setting the 'locale' as default
+     * If default not set, no locale-specific results would be available
+     */
+    error = gnsdk_manager_locale_set_group_default(locale_handle);
+    if (GNSDK_SUCCESS != error)
+    {
+        _display_sdk_error(context);
+        rc = -1;
+    }
+
+    /* The manager will hold onto the locale when set as default
+     * so it's ok to release our reference to it here
+     */
+    gnsdk_manager_locale_release(locale_handle);
+
+    return rc;
+
+}  /* _use_locale() */
+
+/*****************************************************************************
+ *
+ *    _SET_LOCALE
+ *
+ *  Set application locale. Downloading it is most of the start-up
+ *  time, so the locale is kept serialized in a state file and only
+ *  downloaded again once that is LOCALE_MAX_AGE_SECONDS old (or can't
+ *  be used). A stale copy is still better than none if the download
+ *  fails.
+ *
+ ****************************************************************************/
+static int
+_set_locale(
+    query_context_t*    context,
+    gnsdk_user_handle_t user_handle
+    )
+{
+    gnsdk_locale_handle_t locale_handle = GNSDK_NULL;
+    gnsdk_str_t           serialized    = GNSDK_NULL;
+    gnsdk_error_t         error         = GNSDK_SUCCESS;
+    char*                 locale_path   = _state_file_path(LOCALE_STATE_FILE);
+    char*                 saved_locale  = GNSDK_NULL;
+    double                age           = 0;
+    int                   rc            = 0;
+
+    if (locale_path)
+    {
+        saved_locale = _read_state_file(locale_path, &age);
+    }
+
+    if (saved_locale && age < LOCALE_MAX_AGE_SECONDS
+        && GNSDK_SUCCESS == gnsdk_manager_locale_deserialize(saved_locale, &locale_handle))
+    {
+        s_locale_source = "cache";
+        free(saved_locale);
+        free(locale_path);
+        return _use_locale(context, locale_handle);
+    }
+
+    error = gnsdk_manager_locale_load(
+        GNSDK_LOCALE_GROUP_MUSIC,               /* Locale group */
+        GNSDK_LANG_ENGLISH,                     /* Language */
+        GNSDK_REGION_DEFAULT,                   /* Region */
+        GNSDK_DESCRIPTOR_SIMPLIFIED,            /* Descriptor */
+        user_handle,                            /* User handle */
+        GNSDK_NULL,                             /* User callback function */
+        0,                                      /* Optional data for user callback function */
+        &locale_handle                          /* Return handle */
+        );
+    if (GNSDK_SUCCESS == error)
+    {
+        s_locale_source = "online";
+
+        /* keep it for the runs after this one */
+        if (locale_path && GNSDK_SUCCESS == gnsdk_manager_locale_serialize(locale_handle, &serialized))
+        {
+            _write_state_file(locale_path, serialized);
+            gnsdk_manager_string_free(serialized);
+        }
+
+        rc = _use_locale(context, locale_handle);
+    }
+    else if (saved_locale && GNSDK_SUCCESS == gnsdk_manager_locale_deserialize(saved_locale, &locale_handle))
+    {
+        s_locale_source = "stale cache";
+        rc = _use_locale(context, locale_handle);
+    }
+    else
+    {
+        _display_sdk_error(context);
+        rc = -1;
+    }
+
+    free(saved_locale);
+    free(locale_path);
+
+    return rc;
+
+}  /* _set_locale() */
+
+/****************************************************************************************
+ *
+ *    QUERY_START_SDK
+ *
+ *    The first caller initializes the manager and the libraries, and
+ *    the locale is loaded by the first that looks up metadata. Every
+ *    caller gets a user handle of its own, and the time each step
+ *    took for it is kept in its context for --timing.
+ *
+ ****************************************************************************************/
+int
+query_start_sdk(
+    query_context_t*     context,
+    gnsdk_user_handle_t* p_user_handle
+    )
+{
+    gnsdk_manager_handle_t sdkmgr_handle = GNSDK_NULL;
+    gnsdk_error_t          error         = GNSDK_SUCCESS;
+    gnsdk_user_handle_t    user_handle   = GNSDK_NULL;
+    int                    rc            = 0;
+    double                 start         = query_now();
+    double                 manager       = 0;
+    double                 user          = 0;
+
+    pthread_mutex_lock(&s_sdk_lock);
+
+    if (0 == s_sdk_users)
+    {
+        /* Initialize the GNSDK Manager */
+        error = gnsdk_manager_initialize(
+            &sdkmgr_handle,
+            SAMPLE_LICENSE_DATA,
+            GNSDK_MANAGER_LICENSEDATA_NULLTERMSTRING
+            );
+        if (GNSDK_SUCCESS != error)
+        {
+            pthread_mutex_unlock(&s_sdk_lock);
+            _display_sdk_error(context);
+            return -1;
+        }
+
+        /* Enable logging */
+        rc = _enable_logging(context);
+
+        /* Initialize the DSP Library - used for generating fingerprints */
+        if (0 == rc)
+        {
+            error = gnsdk_dsp_initialize(sdkmgr_handle);
+            if (GNSDK_SUCCESS != error)
+            {
+                _display_sdk_error(context);
+                rc = -1;
+            }
+        }
+
+        /* Initialize the MusicID Library - used for spooled fingerprints */
+        if (0 == rc)
+        {
+            error = gnsdk_musicid_initialize(sdkmgr_handle);
+            if (GNSDK_SUCCESS != error)
+            {
+                _display_sdk_error(context);
+                rc = -1;
+            }
+        }
+
+        /* Initialize the MusicID-Stream Library */
+        if (0 == rc)
+        {
+            error = gnsdk_musicidstream_initialize(sdkmgr_handle);
+            if (GNSDK_SUCCESS != error)
+            {
+                _display_sdk_error(context);
+                rc = -1;
+            }
+        }
+    }
+
+    manager = query_now() - start;
+    start  += manager;
+
+    /* Get a user handle for our client ID.  This will be passed in for all queries */
+    if (0 == rc)
+    {
+        rc = _get_user_handle(
+            context,
+            SAMPLE_CLIENT_ID,
+            SAMPLE_CLIENT_ID_TAG,
+            SAMPLE_CLIENT_APP_VERSION,
+            &user_handle
+            );
+    }
+
+    user   = query_now() - start;
+    start += user;
+
+    /* Set the 'locale' to return locale-specifc results values. This examples loads an English locale. */
+    if (0 == rc && !s_b_locale_set && !context->b_fingerprint_only)
+    {
+        rc = _set_locale(context, user_handle);
+        s_b_locale_set = (0 == rc) ? GNSDK_TRUE : GNSDK_FALSE;
+    }
+
+    /* batch workers may be reading them for --timing */
+    pthread_mutex_lock(&context->stats_lock);
+    context->init_manager_seconds = manager;
+    context->init_user_seconds    = user;
+    context->init_locale_seconds  = query_now() - start;
+    context->locale_source        = s_locale_source;
+    context->b_init_timed         = GNSDK_TRUE;
+    pthread_mutex_unlock(&context->stats_lock);
+
+    if (0 != rc)
+    {
+        /* Clean up on failure. */
+        if (user_handle)
+        {
+            gnsdk_manager_user_release(user_handle);
+        }
+        if (0 == s_sdk_users)
+        {
+            gnsdk_manager_shutdown();
+            s_b_locale_set = GNSDK_FALSE;
+        }
+    }
+    else
+    {
+        /* return the User handle for use at query time */
+        s_sdk_users++;
+        *p_user_handle = user_handle;
+    }
+
+    pthread_mutex_unlock(&s_sdk_lock);
+
+    return rc;
+
+}  /* query_start_sdk() */
+
+
+/***************************************************************************
+ *
+ *    QUERY_STOP_SDK
+ *
+ *    Release the user handle, and shut the SDK down after the last.
+ *
+ ***************************************************************************/
+void
+query_stop_sdk(
+    query_context_t*    context,
+    gnsdk_user_handle_t user_handle
+    )
+{
+    gnsdk_error_t error = GNSDK_SUCCESS;
+
+    pthread_mutex_lock(&s_sdk_lock);
+
+    error = gnsdk_manager_user_release(user_handle);
+    if (GNSDK_SUCCESS != error)
+    {
+        _display_sdk_error(context);
+    }
+
+    if (s_sdk_users > 0 && 0 == --s_sdk_users)
+    {
+        /* Shutdown the Manager to shutdown all libraries */
+        gnsdk_manager_shutdown();
+        s_b_locale_set = GNSDK_FALSE;
+    }
+
+    pthread_mutex_unlock(&s_sdk_lock);
+
+}  /* query_stop_sdk() */
+
+/***************************************************************************
+ *
+ *    _ADD_TRACK_GDO
+ *
+ ***************************************************************************/
+
+static gnsdk_error_t
+_add_track_gdo(
+    record_t*          record,
+    gnsdk_gdo_handle_t track_gdo
+    )
+{
+    gnsdk_error_t      error     = GNSDK_SUCCESS;
+    gnsdk_gdo_handle_t title_gdo = GNSDK_NULL;
+    gnsdk_cstr_t       value     = GNSDK_NULL;
+
+    /* Track Title */
+    error = gnsdk_manager_gdo_child_get( track_gdo, GNSDK_GDO_CHILD_TITLE_OFFICIAL, 1, &title_gdo );
+    if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
+        if (GNSDK_SUCCESS == error)
+        {
+            record_string(record, "track", value);
+        }
+        gnsdk_manager_gdo_release(title_gdo);
+    }
+
+    return error;
+
+}  /* _add_track_gdo() */
+
+/***************************************************************************
+ *
+ *    _ADD_ARTIST_GDO
+ *
+ ***************************************************************************/
+static gnsdk_error_t
+_add_artist_gdo(
+    record_t*          record,
+    gnsdk_gdo_handle_t album_gdo
+    )
+{
+    gnsdk_error_t      error           = GNSDK_SUCCESS;
+    gnsdk_gdo_handle_t artist_gdo      = GNSDK_NULL;
+    gnsdk_gdo_handle_t artist_name_gdo = GNSDK_NULL;
+    gnsdk_cstr_t       value           = GNSDK_NULL;
+
+
+    /* Artist Title */
+    error = gnsdk_manager_gdo_child_get( album_gdo, GNSDK_GDO_CHILD_ARTIST, 1, &artist_gdo );
+    if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_manager_gdo_child_get( artist_gdo, GNSDK_GDO_CHILD_NAME_OFFICIAL, 1, &artist_name_gdo );
+        if (GNSDK_SUCCESS == error)
+        {
+            error = gnsdk_manager_gdo_value_get( artist_name_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
+            if (GNSDK_SUCCESS == error)
+            {
+                record_string(record, "artist", value);
+            }
+            gnsdk_manager_gdo_release(artist_name_gdo);
+        }
+        gnsdk_manager_gdo_release(artist_gdo);
+    }
+
+    return error;
+
+}  /* _add_artist_gdo() */
+
+/***************************************************************************
+ *
+ *    QUERY_ADD_ALBUM_GDO
+ *
+ * An object under key for an album: its title, the matched track and
+ * the artist, and with b_track_number the number of the matched track.
+ * Stops at the first value that can't be read and returns its error,
+ * leaving the record unfinished.
+ *
+ ***************************************************************************/
+gnsdk_error_t
+query_add_album_gdo(
+    record_t*          record,
+    const char*        key,
+    gnsdk_gdo_handle_t album_gdo,
+    gnsdk_bool_t       b_track_number
+    )
+{
+    gnsdk_error_t      error           = GNSDK_SUCCESS;
+    gnsdk_gdo_handle_t title_gdo       = GNSDK_NULL;
+    gnsdk_gdo_handle_t track_gdo       = GNSDK_NULL;
+    gnsdk_cstr_t       value           = GNSDK_NULL;
+
+    record_begin_object(record, key);
+
+    /* Album Title */
+    error = gnsdk_manager_gdo_child_get( album_gdo, GNSDK_GDO_CHILD_TITLE_OFFICIAL, 1, &title_gdo );
+    if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
+        if (GNSDK_SUCCESS == error)
+        {
+            record_string(record, "album", value);
+        }
+        gnsdk_manager_gdo_release(title_gdo);
+    }
+
+    /* Matched track number. */
+    if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_manager_gdo_value_get( album_gdo, GNSDK_GDO_VALUE_TRACK_MATCHED_NUM, 1, &value );
+        if (GNSDK_SUCCESS == error && b_track_number)
+        {
+            record_int(record, "track_number", strtol(value, GNSDK_NULL, 10));
+        }
+    }
+    if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_manager_gdo_child_get( album_gdo, GNSDK_GDO_CHILD_TRACK_MATCHED, 1, &track_gdo );
+        if (GNSDK_SUCCESS == error)
+        {
+            error = _add_track_gdo(record, track_gdo);
+            gnsdk_manager_gdo_release(track_gdo);
+        }
+    }
+
+    if (GNSDK_SUCCESS == error)
+    {
+        error = _add_artist_gdo(record, album_gdo);
+    }
+    if (GNSDK_SUCCESS == error)
+    {
+        record_end_object(record);
+    }
+
+    return error;
+
+}  /* query_add_album_gdo() */
+
+/***************************************************************************
+ *
+ *    QUERY_ADD_RESPONSE
+ *
+ * The result of a MusicID-Stream response: its first album, or null.
+ * With --candidates the first few albums follow in "candidates", in the
+ * order of the response. The number of albums found is returned in
+ * *p_count.
+ *
+ ***************************************************************************/
+gnsdk_error_t
+query_add_response(
+    query_context_t*   context,
+    record_t*          record,
+    gnsdk_gdo_handle_t response_gdo,
+    gnsdk_uint32_t*    p_count
+    )
+{
+    gnsdk_error_t      error     = GNSDK_SUCCESS;
+    gnsdk_gdo_handle_t album_gdo = GNSDK_NULL;
+    gnsdk_uint32_t     ordinal   = 0;
+
+    /* See how many albums were found. */
+    *p_count = 0;
+    error = gnsdk_manager_gdo_child_count(
+        response_gdo,
+        GNSDK_GDO_CHILD_ALBUM,
+        p_count
+        );
+    if (GNSDK_SUCCESS != error)
+    {
+        return error;
+    }
+
+    if (*p_count == 0)
+    {
+        record_null(record, "result");
+        return GNSDK_SUCCESS;
+    }
+
+    /* we display first album result */
+    error = gnsdk_manager_gdo_child_get(
+        response_gdo,
+        GNSDK_GDO_CHILD_ALBUM,
+        1,
+        &album_gdo
+        );
+    if (GNSDK_SUCCESS == error)
+    {
+        error = query_add_album_gdo(record, "result", album_gdo, GNSDK_FALSE);
+        gnsdk_manager_gdo_release(album_gdo);
+    }
+
+    if (GNSDK_SUCCESS == error && context->candidates > 1)
+    {
+        record_int(record, "candidate_count", *p_count);
+        record_begin_array(record, "candidates");
+        for (ordinal = 1; ordinal <= *p_count && ordinal <= (gnsdk_uint32_t)context->candidates && GNSDK_SUCCESS == error; ordinal++)
+        {
+            /* ordinals start at 1 */
+            error = gnsdk_manager_gdo_child_get(
+                response_gdo,
+                GNSDK_GDO_CHILD_ALBUM,
+                ordinal,
+                &album_gdo
+                );
+            if (GNSDK_SUCCESS == error)
+            {
+                error = query_add_album_gdo(record, "", album_gdo, GNSDK_TRUE);
+                gnsdk_manager_gdo_release(album_gdo);
+            }
+        }
+        record_end_array(record);
+    }
+
+    return error;
+
+}  /* query_add_response() */
+
+
+/***************************************************************************
+ *
+ *    _MAP_AUDIO_INPUT
+ *
+ * Map the sample data of a file input into memory so it can be hashed and
+ * written to the channel straight from the page cache, without copying it
+ * through a read buffer. Inputs that can't be mapped are left to be read.
+ *
+ ***************************************************************************/
+static void
+_map_audio_input(
+    audio_input_t* input
+    )
+{
+    gnsdk_size_t frame_size = input->info.block_align;
+    uint64_t     data_size  = input->info.data_size;
+    size_t       lead       = 0;
+    long         page_size  = sysconf(_SC_PAGESIZE);
+    void*        p_map      = GNSDK_NULL;
+
+    if (data_size == WAV_SIZE_UNKNOWN || data_size < frame_size || page_size <= 0)
+    {
+        return;
+    }
+
+    /* mmap offsets must be page aligned */
+    lead  = (size_t)(input->info.data_offset % (uint64_t)page_size);
+    p_map = mmap(
+        GNSDK_NULL,
+        (size_t)data_size + lead,
+        PROT_READ,
+        MAP_PRIVATE,
+        input->fd,
+        (off_t)(input->info.data_offset - lead)
+        );
+    if (p_map == MAP_FAILED)
+    {
+        return;
+    }
+    madvise(p_map, (size_t)data_size + lead, MADV_SEQUENTIAL);
+
+    input->p_map      = p_map;
+    input->map_size   = (size_t)data_size + lead;
+    input->p_audio    = input->p_map + lead;
+    input->audio_size = (gnsdk_size_t)(data_size - (data_size % frame_size));
+
+}  /* _map_audio_input() */
+
+/***************************************************************************
+ *
+ *    QUERY_OPEN_INPUT
+ *
+ * Open the query's audio file ("-" for stdin) and work out the format of
+ * the PCM it carries. WAV input is positioned at the start of the data
+ * chunk. Raw input uses the format given on the command line.
+ *
+ ***************************************************************************/
+int
+query_open_input(
+    query_t*       query,
+    audio_input_t* input
+    )
+{
+    query_context_t*   context      = query->context;
+    const char*        format_error = GNSDK_NULL;
+    unsigned char      magic[WAV_MAGIC_SIZE];
+    size_t             magic_size   = 0;
+    ssize_t            got          = 0;
+    decode_container_t container    = DECODE_NONE;
+    struct stat        st;
+
+    memset(input, 0, sizeof(*input));
+
+    if (0 == strcmp(query->audio_file, "-"))
+    {
+        input->fd = STDIN_FILENO;
+    }
+    else
+    {
+        /* check file for existence */
+        input->fd = open(query->audio_file, O_RDONLY);
+        if (input->fd < 0)
+        {
+            record_stringf(query_begin_record(query), "error", "Failed to open input file: %s", query->audio_file);
+            query_end_record(query);
+            return -1;
+        }
+    }
+
+    if (context->b_raw_input)
+    {
+        input->info.format      = context->raw_format;
+        input->info.format_tag  = context->b_raw_float ? WAV_FORMAT_IEEE_FLOAT : WAV_FORMAT_PCM;
+        input->info.block_align = (uint16_t)AUDIO_FRAME_SIZE(&context->raw_format);
+        input->info.data_size   = WAV_SIZE_UNKNOWN;
+
+        /* a raw file (rather than a pipe) is all audio */
+        if (0 == fstat(input->fd, &st) && S_ISREG(st.st_mode))
+        {
+            input->info.data_size = (uint64_t)st.st_size;
+        }
+    }
+    else
+    {
+        /* the first bytes say whether it needs decoding or is a WAV */
+        while (magic_size < sizeof(magic))
+        {
+            got = read(input->fd, magic + magic_size, sizeof(magic) - magic_size);
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                break;
+            }
+            magic_size += (size_t)got;
+        }
+
+        container = decode_detect(magic, magic_size);
+        if (magic_size < sizeof(magic) && DECODE_NONE == container)
+        {
+            format_error = "File too short for a WAV header";
+        }
+        else if (DECODE_NONE != container)
+        {
+            input->decode = decode_open(input->fd, container, magic, magic_size, &input->info.format, &format_error);
+            if (input->decode)
+            {
+                input->info.format_tag  = WAV_FORMAT_PCM;
+                input->info.block_align = (uint16_t)AUDIO_FRAME_SIZE(&input->info.format);
+                input->info.data_size   = WAV_SIZE_UNKNOWN;
+            }
+        }
+        else
+        {
+            wav_parse_header_after_magic(input->fd, magic, &input->info, &format_error);
+        }
+
+        if (format_error)
+        {
+            record_stringf(query_begin_record(query), "error", "%s: %s", format_error, query->audio_file);
+            query_end_record(query);
+            query_close_input(input);
+            return -1;
+        }
+    }
+
+    _map_audio_input(input);
+
+    return 0;
+
+}  /* query_open_input() */
+
+/***************************************************************************
+ *
+ *    QUERY_CLOSE_INPUT
+ *
+ ***************************************************************************/
+void
+query_close_input(
+    audio_input_t* input
+    )
+{
+    if (input->p_map)
+    {
+        munmap(input->p_map, input->map_size);
+        input->p_map = GNSDK_NULL;
+    }
+
+    decode_close(input->decode);
+    input->decode = GNSDK_NULL;
+
+    /* the reader thread must be gone before its fd is */
+    ingest_close(input->ingest);
+    input->ingest = GNSDK_NULL;
+
+    /* stdin belongs to whoever started us */
+    if (input->fd != STDIN_FILENO)
+    {
+        close(input->fd);
+    }
+    input->fd = -1;
+
+}  /* query_close_input() */
+
+/***************************************************************************
+ *
+ *    QUERY_WRITE_AUDIO
+ *
+ * Hand a block of whole frames to the channel in slices of --feed-size,
+ * through the converter and the conditioner when the query has them.
+ * Each slice then goes to the query's on_audio hook, which with
+ * --monitor may call for the next identification.
+ *
+ ***************************************************************************/
+gnsdk_error_t
+query_write_audio(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    const gnsdk_byte_t*                  p_audio,
+    gnsdk_size_t                         size,
+    gnsdk_size_t                         frame_size
+    )
+{
+    query_context_t*    context    = query->context;
+    gnsdk_error_t       error      = GNSDK_SUCCESS;
+    gnsdk_size_t        slice_size = context->feed_size - (context->feed_size % frame_size);
+    gnsdk_size_t        write_size = 0;
+    const gnsdk_byte_t* p_ready    = GNSDK_NULL;
+    const int16_t*      p_stage    = GNSDK_NULL;
+    size_t              ready      = 0;
+
+    if (0 == slice_size)
+    {
+        slice_size = frame_size;
+    }
+
+    while (size > 0 && GNSDK_SUCCESS == error && !atomic_load(&query->b_identify_ended) && !context->b_stop && !hedge_past_deadline(query))
+    {
+        write_size = (size < slice_size) ? size : slice_size;
+        p_ready    = p_audio;
+        ready      = write_size;
+
+        /* the resampler and the conditioner may hold audio back */
+        if (query->convert)
+        {
+            ready   = convert_process(query->convert, p_ready, ready, &p_stage);
+            p_ready = (const gnsdk_byte_t*)p_stage;
+        }
+        if (query->condition && ready > 0)
+        {
+            ready   = condition_process(query->condition, (const int16_t*)p_ready, ready, &p_stage);
+            p_ready = (const gnsdk_byte_t*)p_stage;
+        }
+
+        if (ready > 0)
+        {
+            /* write audio to the fingerprinter */
+            error = gnsdk_musicidstream_channel_audio_write(
+                channel_handle,
+                p_ready,
+                ready
+                );
+            TRACE_MARK(query, TRACE_FIRST_AUDIO_WRITE);
+        }
+
+        if (query->hooks && query->hooks->on_audio && GNSDK_SUCCESS == error)
+        {
+            query->hooks->on_audio(channel_handle, query, p_audio, write_size);
+        }
+
+        p_audio += write_size;
+        size    -= write_size;
+    }
+
+    return error;
+
+}  /* query_write_audio() */
+
+/***************************************************************************
+ *
+ *    QUERY_FEED_STREAM
+ *
+ * Read audio from fd and write it to the channel as soon as it arrives,
+ * so a pipe can be identified while it is still being filled. Reading
+ * stops once MusicID-Stream has finished identifying.
+ *
+ ***************************************************************************/
+gnsdk_error_t
+query_feed_stream(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    int                                  fd,
+    const wav_info_t*                    p_info
+    )
+{
+    query_context_t* context    = query->context;
+    gnsdk_error_t    error      = GNSDK_SUCCESS;
+    gnsdk_size_t     frame_size = p_info->block_align;
+    gnsdk_size_t     buf_size   = (context->feed_size > frame_size) ? context->feed_size : frame_size;
+    gnsdk_byte_t*    pcm_audio  = GNSDK_NULL;
+    gnsdk_size_t     buffered   = 0;
+    gnsdk_size_t     write_size = 0;
+    uint64_t         remaining  = p_info->data_size;
+    size_t           want       = 0;
+    ssize_t          read_size  = 0;
+
+    pcm_audio = malloc(buf_size);
+    if (pcm_audio == GNSDK_NULL)
+    {
+        return error;
+    }
+
+    while (remaining > 0 && !atomic_load(&query->b_identify_ended) && !context->b_stop)
+    {
+        want = buf_size - buffered;
+        if (remaining != WAV_SIZE_UNKNOWN && remaining < want)
+        {
+            want = (size_t)remaining;
+        }
+
+        read_size = read(fd, pcm_audio + buffered, want);
+        if (read_size < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (read_size <= 0)
+        {
+            break;
+        }
+        if (remaining != WAV_SIZE_UNKNOWN)
+        {
+            remaining -= (uint64_t)read_size;
+        }
+
+        /* pipes hand back whatever is available, so only whole frames are
+         * written and any trailing partial frame waits for the next read */
+        buffered  += (gnsdk_size_t)read_size;
+        write_size = buffered - (buffered % frame_size);
+        if (0 == write_size)
+        {
+            continue;
+        }
+
+        error = query_write_audio(channel_handle, query, pcm_audio, write_size, frame_size);
+        if (GNSDK_SUCCESS != error)
+        {
+            break;
+        }
+
+        buffered -= write_size;
+        memmove(pcm_audio, pcm_audio + write_size, buffered);
+    }
+
+    free(pcm_audio);
+
+    return error;
+
+}  /* query_feed_stream() */
+
+/***************************************************************************
+ *
+ *    _FEED_DECODED
+ *
+ * Decode a compressed input a block at a time and write each block to
+ * the channel, until the input ends or MusicID-Stream has finished
+ * identifying, so the rest of the file is never decoded.
+ *
+ ***************************************************************************/
+static gnsdk_error_t
+_feed_decoded(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    decode_t*                            decode,
+    gnsdk_size_t                         frame_size
+    )
+{
+    query_context_t* context = query->context;
+    gnsdk_error_t    error   = GNSDK_SUCCESS;
+    const void*      p_pcm   = GNSDK_NULL;
+    size_t           size    = 0;
+
+    while (GNSDK_SUCCESS == error && !atomic_load(&query->b_identify_ended) && !context->b_stop)
+    {
+        size = decode_read(decode, &p_pcm);
+        if (0 == size)
+        {
+            break;
+        }
+
+        error = query_write_audio(channel_handle, query, p_pcm, size, frame_size);
+    }
+
+    return error;
+
+}  /* _feed_decoded() */
+
+/***************************************************************************
+ *
+ *    _FEED_INGEST
+ *
+ * Write audio to the channel as a reader thread puts it in its ring,
+ * straight from the ring, until the input ends. The query's on_ingest
+ * hook sees the ring each time round.
+ *
+ ***************************************************************************/
+static gnsdk_error_t
+_feed_ingest(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    ingest_t*                            ingest,
+    gnsdk_size_t                         frame_size
+    )
+{
+    query_context_t* context = query->context;
+    gnsdk_error_t    error   = GNSDK_SUCCESS;
+    const void*      p_pcm   = GNSDK_NULL;
+    long             size    = 0;
+
+    while (GNSDK_SUCCESS == error && !atomic_load(&query->b_identify_ended) && !context->b_stop)
+    {
+        size = ingest_peek(ingest, &p_pcm, CAPTURE_POLL_MS);
+        if (size < 0)
+        {
+            break;
+        }
+        if (size > 0)
+        {
+            error = query_write_audio(channel_handle, query, p_pcm, (gnsdk_size_t)size, frame_size);
+            ingest_consume(ingest, (size_t)size);
+        }
+
+        if (query->hooks && query->hooks->on_ingest)
+        {
+            query->hooks->on_ingest(query, ingest);
+        }
+    }
+
+    return error;
+
+}  /* _feed_ingest() */
+
+/***************************************************************************
+ *
+ *    QUERY_OPEN_STAGES
+ *
+ * Formats the SDK isn't given directly (float, 8/24/32 bit, more than
+ * two channels, other rates) get a converter in query->convert, and with
+ * --condition the audio also goes through query->condition. The format
+ * that comes out of them is put in *p_out_format. Returns -1 (reported)
+ * if the format can't be converted or a stage can't be set up.
+ *
+ ***************************************************************************/
+int
+query_open_stages(
+    query_t*              query,
+    const audio_format_t* p_format,
+    gnsdk_bool_t          b_float,
+    audio_format_t*       p_out_format
+    )
+{
+    query_context_t* context = query->context;
+
+    *p_out_format = *p_format;
+
+    query->convert = GNSDK_NULL;
+    if (convert_needed(p_format, b_float, CHANNEL_SAMPLE_RATE))
+    {
+        query->convert = convert_open(p_format, b_float, CHANNEL_SAMPLE_RATE, p_out_format);
+        if (query->convert == GNSDK_NULL)
+        {
+            record_stringf(query_begin_record(query), "error", "Unsupported audio format: %u Hz, %u bit%s, %u channels",
+                p_format->sample_rate,
+                p_format->bits_per_sample,
+                b_float ? " float" : "",
+                p_format->channels
+                );
+            query_end_record(query);
+            return -1;
+        }
+    }
+
+    query->condition = GNSDK_NULL;
+    if (context->b_condition)
+    {
+        query->condition = condition_open(p_out_format->sample_rate, p_out_format->channels, context->silence_db, context->max_gain_db);
+        if (query->condition == GNSDK_NULL)
+        {
+            record_string(query_begin_record(query), "error", "Failed to set up audio conditioning");
+            query_end_record(query);
+            query_close_stages(query);
+            return -1;
+        }
+    }
+
+    return 0;
+
+}  /* query_open_stages() */
+
+/***************************************************************************
+ *
+ *    _BEGIN_AUDIO
+ *
+ * Start a fingerprint of audio in p_format on the channel, through the
+ * stages query_open_stages() sets up for query_write_audio() to use.
+ *
+ ***************************************************************************/
+static int
+_begin_audio(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    const audio_format_t*                p_format,
+    gnsdk_bool_t                         b_float
+    )
+{
+    query_context_t* context = query->context;
+    gnsdk_error_t    error   = GNSDK_SUCCESS;
+    audio_format_t   out_format;
+
+    if (0 != query_open_stages(query, p_format, b_float, &out_format))
+    {
+        return -1;
+    }
+
+    /* initialize the fingerprinter */
+    error = gnsdk_musicidstream_channel_audio_begin(
+        channel_handle,
+        out_format.sample_rate,
+        out_format.bits_per_sample,
+        out_format.channels
+        );
+    if (GNSDK_SUCCESS != error)
+    {
+        query_display_last_error(query);
+        query_close_stages(query);
+        return -1;
+    }
+    TRACE_MARK(query, TRACE_AUDIO_BEGIN);
+
+    pthread_mutex_lock(&context->stats_lock);
+    if (context->first_audio_begin == 0)
+    {
+        context->first_audio_begin = query_now();
+    }
+    pthread_mutex_unlock(&context->stats_lock);
+
+    return 0;
+
+}  /* _begin_audio() */
+
+/***************************************************************************
+ *
+ *    _END_AUDIO
+ *
+ * Write out whatever the conditioner still holds and tell the channel
+ * the audio is over.
+ *
+ ***************************************************************************/
+static gnsdk_error_t
+_end_audio(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query
+    )
+{
+    gnsdk_error_t  error   = GNSDK_SUCCESS;
+    const int16_t* p_ready = GNSDK_NULL;
+    size_t         ready   = 0;
+
+    if (query->condition)
+    {
+        ready = condition_flush(query->condition, &p_ready);
+        if (ready > 0)
+        {
+            error = gnsdk_musicidstream_channel_audio_write(channel_handle, p_ready, ready);
+            TRACE_MARK(query, TRACE_FIRST_AUDIO_WRITE);
+        }
+    }
+
+    if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_musicidstream_channel_audio_end(channel_handle);
+    }
+
+    return error;
+
+}  /* _end_audio() */
+
+/***************************************************************************
+ *
+ *    QUERY_CLOSE_STAGES
+ *
+ * Free the converter and conditioner of a query, keeping the
+ * conditioning statistics for its records.
+ *
+ ***************************************************************************/
+void
+query_close_stages(
+    query_t* query
+    )
+{
+    convert_close(query->convert);
+    query->convert = GNSDK_NULL;
+
+    if (query->condition)
+    {
+        condition_get_stats(query->condition, &query->condition_stats);
+        query->b_conditioned = GNSDK_TRUE;
+        condition_close(query->condition);
+        query->condition = GNSDK_NULL;
+    }
+
+}  /* query_close_stages() */
+
+/***************************************************************************
+ *
+ *    QUERY_WAIT_FOR_QUOTA
+ *
+ * With --rate-limit, wait in the query's priority class until the
+ * identify request may go to the service. Returns -1 (reported) if we
+ * are asked to stop first.
+ *
+ ***************************************************************************/
+int
+query_wait_for_quota(
+    query_t* query
+    )
+{
+    query_context_t* context = query->context;
+
+    if (context->quota == GNSDK_NULL)
+    {
+        return 0;
+    }
+
+    if (0 != quota_acquire(context->quota, query->priority, &context->b_stop, GNSDK_NULL))
+    {
+        record_string(query_begin_record(query), "error", "Stopped while waiting for the rate limit");
+        query_end_record(query);
+        return -1;
+    }
+    TRACE_MARK(query, TRACE_QUOTA_GRANTED);
+
+    return 0;
+
+}  /* query_wait_for_quota() */
+
+/***************************************************************************
+ *
+ *    QUERY_PROCESS_AUDIO
+ *
+ * This function streams audio into the Channel handle to give
+ * MusicId-Stream audio to identify
+ *
+ ***************************************************************************/
+int
+query_process_audio(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    audio_input_t*                       input
+    )
+{
+    gnsdk_error_t error = GNSDK_SUCCESS;
+    int           rc    = 0;
+
+    if (0 != _begin_audio(channel_handle, query, &input->info.format, input->info.format_tag == WAV_FORMAT_IEEE_FLOAT))
+    {
+        return -1;
+    }
+
+    /* To keep this sample single-threaded, we launch the identification request
+     ** immediately then do the audio processing. Generally we expect this
+     ** call to occur on a separate thread from audio processing thread.
+     **
+     ** MusicId-Stream will actually perform the identification when it
+     ** receives enough audio.
+     **
+     ** With the asynchronous nature of MusicID-Stream this call is non-blocking so it is ok to
+     ** call on the UI thread.
+     **
+     ** With continuous hooks (--monitor) each identification is asked for
+     ** as the stream goes by instead.
+     */
+    atomic_store(&query->b_identify_ended, GNSDK_FALSE);
+    if (!(query->hooks && query->hooks->b_continuous))
+    {
+        if (0 != query_wait_for_quota(query))
+        {
+            query_close_stages(query);
+            return -1;
+        }
+        query->asked = query_now();
+        error = gnsdk_musicidstream_channel_identify(channel_handle);
+        if (GNSDK_SUCCESS != error)
+        {
+            query_display_last_error(query);
+            query_close_stages(query);
+            return -1;
+        }
+    }
+
+    /* mapped files are written in place, compressed ones decoded as they
+     * go, live ones taken from their reader thread; pipes and anything
+     * that couldn't be mapped are read */
+    if (input->p_map)
+    {
+        error = query_write_audio(channel_handle, query, input->p_audio, input->audio_size, input->info.block_align);
+    }
+    else if (input->ingest)
+    {
+        error = _feed_ingest(channel_handle, query, input->ingest, input->info.block_align);
+    }
+    else if (input->decode)
+    {
+        error = _feed_decoded(channel_handle, query, input->decode, input->info.block_align);
+    }
+    else
+    {
+        error = query_feed_stream(channel_handle, query, input->fd, &input->info);
+    }
+
+    if (GNSDK_SUCCESS != error)
+    {
+        if (GNSDKERR_SEVERE(error)) /* 'aborted' warnings could come back from write which should be expected */
+        {
+            query_display_last_error(query);
+        }
+        rc = -1;
+    }
+
+    /*signal that we are done*/
+    if (GNSDK_SUCCESS == error)
+    {
+        error = _end_audio(channel_handle, query);
+        if (GNSDK_SUCCESS != error)
+        {
+            query_display_last_error(query);
+        }
+    }
+
+    query_close_stages(query);
+
+    return rc;
+
+}  /* query_process_audio() */
+
+/***************************************************************************
+ *
+ *    QUERY_CREATE_CHANNEL
+ *
+ * Create a MusicID-Stream channel whose callbacks render into query.
+ * The channel can be reused for any number of identifications as long as
+ * query is updated in between.
+ *
+ ***************************************************************************/
+gnsdk_error_t
+query_create_channel(
+    gnsdk_user_handle_t                   user_handle,
+    query_t*                              query,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle
+    )
+{
+    gnsdk_musicidstream_callbacks_t callbacks = {0};
+
+    /* MusicId-Stream requires callbacks to receive identification results.
+    ** He we set the various callbacks for results ands status.
+    */
+    callbacks.callback_status             = GNSDK_NULL;
+    callbacks.callback_processing_status  = GNSDK_NULL;
+    callbacks.callback_identifying_status = _musicidstream_identifying_status_callback;
+    callbacks.callback_result_available   = _musicidstream_result_available_callback;
+    callbacks.callback_error              = _musicidstream_completed_with_error_callback;
+
+    /* Create the channel handle */
+    return gnsdk_musicidstream_channel_create(
+        user_handle,
+        gnsdk_musicidstream_preset_radio,
+        &callbacks,          /* User callback functions */
+        query,               /* Optional data to be passed to the callbacks */
+        p_channel_handle
+    );
+
+}   /* query_create_channel() */
+
+/***************************************************************************
+ *
+ *    QUERY_OPEN_FINGERPRINT
+ *
+ * Start landmark fingerprints of audio in p_format, with a converter to
+ * LANDMARK_SAMPLE_RATE in *p_convert if it needs one. Returns
+ * GNSDK_NULL if the format can't be converted or memory runs out.
+ *
+ ***************************************************************************/
+landmark_fp_t*
+query_open_fingerprint(
+    const audio_format_t* p_format,
+    gnsdk_bool_t          b_float,
+    convert_t**           p_convert
+    )
+{
+    audio_format_t out_format = *p_format;
+    landmark_fp_t* fp         = GNSDK_NULL;
+
+    *p_convert = GNSDK_NULL;
+    if (convert_needed(p_format, b_float, LANDMARK_SAMPLE_RATE))
+    {
+        *p_convert = convert_open(p_format, b_float, LANDMARK_SAMPLE_RATE, &out_format);
+        if (*p_convert == GNSDK_NULL)
+        {
+            return GNSDK_NULL;
+        }
+    }
+
+    fp = landmark_fp_open(out_format.channels);
+    if (fp == GNSDK_NULL)
+    {
+        convert_close(*p_convert);
+        *p_convert = GNSDK_NULL;
+    }
+
+    return fp;
+
+}   /* query_open_fingerprint() */
+
+/***************************************************************************
+ *
+ *    QUERY_FINGERPRINT
+ *
+ * Add size bytes of whole frames to fp, through convert if it isn't
+ * GNSDK_NULL. Returns -1 if out of memory.
+ *
+ ***************************************************************************/
+int
+query_fingerprint(
+    landmark_fp_t* fp,
+    convert_t*     convert,
+    const void*    p_pcm,
+    size_t         size
+    )
+{
+    const int16_t* p_ready = (const int16_t*)p_pcm;
+
+    if (convert)
+    {
+        size = convert_process(convert, p_pcm, size, &p_ready);
+    }
+
+    return (size > 0) ? landmark_fp_process(fp, p_ready, size) : 0;
+
+}   /* query_fingerprint() */
+
+/***************************************************************************
+ *
+ *    QUERY_FINGERPRINT_INPUT
+ *
+ * Fingerprint an open input from its start, up to max_seconds of audio
+ * (all of it if 0), into *p_fp, with the seconds taken in *p_seconds.
+ * Returns -1 (not reported) if the format can't be converted or memory
+ * runs out.
+ *
+ ***************************************************************************/
+int
+query_fingerprint_input(
+    query_context_t* context,
+    audio_input_t*   input,
+    double           max_seconds,
+    landmark_fp_t**  p_fp,
+    double*          p_seconds
+    )
+{
+    landmark_fp_t* fp         = GNSDK_NULL;
+    convert_t*     convert    = GNSDK_NULL;
+    const void*    p_pcm      = GNSDK_NULL;
+    unsigned char* buffer     = GNSDK_NULL;
+    gnsdk_size_t   frame_size = input->info.block_align;
+    uint64_t       limit      = input->info.data_size;
+    uint64_t       taken      = 0;
+    size_t         size       = 0;
+    size_t         held       = 0;
+    ssize_t        got        = 0;
+    int            rc         = 0;
+
+    fp = query_open_fingerprint(&input->info.format, input->info.format_tag == WAV_FORMAT_IEEE_FLOAT, &convert);
+    if (fp == GNSDK_NULL)
+    {
+        return -1;
+    }
+
+    if (max_seconds > 0 && (uint64_t)(max_seconds * input->info.format.sample_rate) * frame_size < limit)
+    {
+        limit = (uint64_t)(max_seconds * input->info.format.sample_rate) * frame_size;
+    }
+
+    if (input->p_map)
+    {
+        size  = (input->audio_size < limit) ? (size_t)input->audio_size : (size_t)limit;
+        rc    = query_fingerprint(fp, convert, input->p_audio, size);
+        taken = size;
+    }
+    else if (input->decode)
+    {
+        while (0 == rc && taken < limit && 0 < (size = decode_read(input->decode, &p_pcm)))
+        {
+            rc     = query_fingerprint(fp, convert, p_pcm, size);
+            taken += size;
+        }
+    }
+    else
+    {
+        /* read, keeping any part of a frame for the next read */
+        buffer = malloc(context->feed_size + frame_size);
+        rc     = buffer ? 0 : -1;
+        while (0 == rc && taken < limit)
+        {
+            size = context->feed_size;
+            if (limit - taken < size)
+            {
+                size = (size_t)(limit - taken);
+            }
+            got = read(input->fd, buffer + held, size);
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                break;
+            }
+            held  += (size_t)got;
+            taken += (uint64_t)got;
+            size   = held - (held % frame_size);
+            rc     = query_fingerprint(fp, convert, buffer, size);
+            memmove(buffer, buffer + size, held - size);
+            held  -= size;
+        }
+        free(buffer);
+    }
+
+    convert_close(convert);
+
+    if (0 != rc)
+    {
+        landmark_fp_close(fp);
+        return -1;
+    }
+
+    *p_fp      = fp;
+    *p_seconds = (double)taken / ((double)input->info.format.sample_rate * frame_size);
+
+    return 0;
+
+}   /* query_fingerprint_input() */
+
+/***************************************************************************
+ *
+ *    QUERY_ADD_LOCAL_MATCH
+ *
+ * Add a --local-index match as the "result", with where the audio was
+ * and how sure the match is if b_position (--monitor leaves them out so
+ * that the same track always gives the same result).
+ *
+ ***************************************************************************/
+void
+query_add_local_match(
+    record_t*               record,
+    const landmark_match_t* p_match,
+    gnsdk_bool_t            b_position
+    )
+{
+    record_begin_object(record, "result");
+    record_string(record, "local_id", p_match->id);
+    if (b_position)
+    {
+        record_number(record, "offset_s", p_match->offset_seconds, 3);
+    }
+    if (p_match->track_seconds > 0)
+    {
+        record_number(record, "track_s", p_match->track_seconds, 3);
+    }
+    if (b_position)
+    {
+        record_int(record, "score", p_match->score);
+    }
+    record_end_object(record);
+
+}   /* query_add_local_match() */
+
+/***************************************************************************
+ *
+ *    _MATCH_LOCAL
+ *
+ * Match the first LOCAL_MATCH_SECONDS of a mapped input against
+ * --local-index. Returns 1 if the query has been answered, 0 if it is
+ * left to the service.
+ *
+ ***************************************************************************/
+static int
+_match_local(
+    query_t*       query,
+    audio_input_t* input
+    )
+{
+    query_context_t*       context = query->context;
+    landmark_fp_t*         fp      = GNSDK_NULL;
+    const landmark_hash_t* hashes  = GNSDK_NULL;
+    landmark_match_t       match;
+    double                 seconds = 0;
+    size_t                 count   = 0;
+    int                    rc      = 0;
+
+    /* if it can't be fingerprinted the service may still manage */
+    if (0 != query_fingerprint_input(query->context, input, LOCAL_MATCH_SECONDS, &fp, &seconds))
+    {
+        return 0;
+    }
+
+    count = landmark_fp_hashes(fp, &hashes);
+    if (0 == landmark_index_match(context->local_index, hashes, count, LOCAL_MIN_SCORE, &match))
+    {
+        query_add_local_match(query_begin_record(query), &match, GNSDK_TRUE);
+        query_end_record(query);
+        rc = 1;
+    }
+    landmark_fp_close(fp);
+
+    return rc;
+
+}   /* _match_local() */
+
+/***************************************************************************
+ *
+ *    QUERY_CACHE_VARIANT
+ *
+ * The cache_key() variant of answers given with up to candidates albums
+ * listed, from audio fingerprinted with the context's --condition settings.
+ * Answers given any other way are kept apart; plain ones keep variant 0.
+ *
+ ***************************************************************************/
+uint32_t
+query_cache_variant(
+    query_context_t* context,
+    long             candidates
+    )
+{
+    uint32_t variant = (candidates > 1) ? (uint32_t)(candidates & 0xffff) : 0;
+
+    if (context->b_condition)
+    {
+        /* in whole dB, which is as finely as anyone sets them */
+        variant |= 0x80000000u
+            | ((uint32_t)lround(-context->silence_db) & 0x7f) << 24
+            | ((uint32_t)lround(context->max_gain_db) & 0xff) << 16;
+    }
+
+    return variant;
+
+}   /* query_cache_variant() */
+
+/***************************************************************************
+ *
+ *    QUERY_LOOKUP_INPUT
+ *
+ * With --cache, answer the query from the cache if the same audio has
+ * been identified before, or with --local-index from our own catalog if
+ * it is in there. Only a mapped input (or a buffer in memory) can be
+ * looked up, as it can be gone over again when it has to be identified.
+ * Returns 1 if the query has been answered, 0 if it is left to the
+ * service.
+ *
+ ***************************************************************************/
+int
+query_lookup_input(
+    query_t*       query,
+    audio_input_t* input
+    )
+{
+    query_context_t* context = query->context;
+    void*            record  = GNSDK_NULL;
+    size_t           size    = 0;
+
+    query->b_cache_store = GNSDK_FALSE;
+
+    /* only inputs that are mapped can be hashed before they're fed */
+    if (context->cache && input->p_map)
+    {
+        /* answers with candidates or conditioning are kept apart from those without */
+        cache_key(
+            &input->info.format,
+            input->p_audio,
+            input->audio_size,
+            query_cache_variant(context, context->candidates),
+            query->cache_key
+            );
+        if (0 == cache_lookup(context->cache, query->cache_key, &record, &size))
+        {
+            /* anything else was written by an older version; look it up again */
+            if (record_valid(record, size))
+            {
+                record_append(query_begin_record(query), record, size);
+                query_end_record(query);
+                free(record);
+                return 1;
+            }
+            free(record);
+        }
+        query->b_cache_store = GNSDK_TRUE;
+    }
+
+    /* our own catalog only needs the first seconds, which only a mapped
+     * input can give up without them being lost to the channel */
+    if (context->local_index && input->p_map && 1 == _match_local(query, input))
+    {
+        query->b_cache_store = GNSDK_FALSE;
+        return 1;
+    }
+
+    return 0;
+
+}   /* query_lookup_input() */
+
+/***************************************************************************
+ *
+ *    QUERY_PREPARE_INPUT
+ *
+ * Open the query's input and answer it from --cache or --local-index if
+ * it can be (see query_lookup_input()).
+ * Returns 1 if the query has been answered, 0 if the input is ready to be
+ * identified, or -1 on error (already reported).
+ *
+ ***************************************************************************/
+int
+query_prepare_input(
+    query_t*       query,
+    audio_input_t* input
+    )
+{
+    if (0 != query_open_input(query, input))
+    {
+        return -1;
+    }
+
+    if (1 == query_lookup_input(query, input))
+    {
+        query_close_input(input);
+        return 1;
+    }
+
+    return 0;
+
+}   /* query_prepare_input() */
+
+/***************************************************************************
+ *
+ *    QUERY_IDENTIFY_INPUT
+ *
+ * Identify an open input on *p_channel_handle, creating the channel the
+ * first time it's needed so that it can be reused for later queries.
+ *
+ ***************************************************************************/
+void
+query_identify_input(
+    gnsdk_user_handle_t                   user_handle,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle,
+    query_t*                              query,
+    audio_input_t*                        input
+    )
+{
+    query_context_t* context = query->context;
+    gnsdk_error_t    error   = GNSDK_SUCCESS;
+    int              rc      = 0;
+
+    query->asked    = 0;
+    query->deadline = (context->deadline_seconds > 0 && !(query->hooks && query->hooks->b_continuous)) ? query_now() + context->deadline_seconds : 0;
+    atomic_store(&query->answered, ANSWER_NONE);
+
+    if (GNSDK_NULL == *p_channel_handle)
+    {
+        error = query_create_channel(user_handle, query, p_channel_handle);
+        if (GNSDK_SUCCESS != error)
+        {
+            query_display_last_error(query);
+            *p_channel_handle = GNSDK_NULL;
+            return;
+        }
+        TRACE_MARK(query, TRACE_CHANNEL_CREATE);
+    }
+
+    rc = query_process_audio(*p_channel_handle, query, input);
+    if (0 == rc)
+    {
+        /* result will be sent to _musicidstream_result_available_callback */
+    }
+
+    hedge_wait_for_answer(user_handle, p_channel_handle, query, input);
+
+    query->b_cache_store = GNSDK_FALSE;
+
+}   /* query_identify_input() */
+
+/***************************************************************************
+ *
+ *    _RUN_QUERY
+ *
+ ***************************************************************************/
+static void
+_run_query(
+    gnsdk_user_handle_t                   user_handle,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle,
+    query_t*                              query
+    )
+{
+    audio_input_t input;
+
+    if (0 == query_prepare_input(query, &input))
+    {
+        query_identify_input(user_handle, p_channel_handle, query, &input);
+        query_close_input(&input);
+    }
+
+}   /* _run_query() */
+
+/***************************************************************************
+ *
+ *    _IDENTIFY_CAPTURE
+ *
+ *    Identify what is playing: everything in the pre-roll is written to
+ *    the channel at once, then live audio as it arrives, until MusicID-Stream
+ *    is done or CAPTURE_LIVE_SECONDS more have gone by.
+ *
+ ***************************************************************************/
+static void
+_identify_capture(
+    gnsdk_user_handle_t                   user_handle,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle,
+    query_t*                              query
+    )
+{
+    query_context_t* context    = query->context;
+    gnsdk_error_t    error      = GNSDK_SUCCESS;
+    gnsdk_size_t     frame_size = AUDIO_FRAME_SIZE(&context->raw_format);
+    gnsdk_size_t     buf_size   = (gnsdk_size_t)context->raw_format.sample_rate * frame_size;
+    gnsdk_byte_t*    buf        = GNSDK_NULL;
+    uint64_t         position   = 0;
+    uint64_t         start      = 0;
+    uint64_t         limit      = (uint64_t)(context->preroll_seconds + CAPTURE_LIVE_SECONDS) * context->raw_format.sample_rate * frame_size;
+    long             got        = 0;
+
+    query->asked    = 0;
+    query->deadline = (context->deadline_seconds > 0) ? query_now() + context->deadline_seconds : 0;
+    atomic_store(&query->answered, ANSWER_NONE);
+
+    if (GNSDK_NULL == *p_channel_handle)
+    {
+        error = query_create_channel(user_handle, query, p_channel_handle);
+        if (GNSDK_SUCCESS != error)
+        {
+            query_display_last_error(query);
+            *p_channel_handle = GNSDK_NULL;
+            return;
+        }
+        TRACE_MARK(query, TRACE_CHANNEL_CREATE);
+    }
+
+    /* a second of audio at a time keeps up with live input */
+    buf = malloc(buf_size);
+    if (buf == GNSDK_NULL)
+    {
+        record_string(query_begin_record(query), "error", "Out of memory");
+        query_end_record(query);
+        return;
+    }
+
+    if (0 != _begin_audio(*p_channel_handle, query, &context->raw_format, context->b_raw_float))
+    {
+        free(buf);
+        return;
+    }
+
+    atomic_store(&query->b_identify_ended, GNSDK_FALSE);
+    if (0 != query_wait_for_quota(query))
+    {
+        query_close_stages(query);
+        free(buf);
+        return;
+    }
+    query->asked = query_now();
+    error = gnsdk_musicidstream_channel_identify(*p_channel_handle);
+    if (GNSDK_SUCCESS != error)
+    {
+        query_display_last_error(query);
+        query_close_stages(query);
+        free(buf);
+        return;
+    }
+
+    /* start from the oldest audio kept; the first reads return the
+     * whole pre-roll without waiting */
+    position = capture_oldest(context->capture);
+    start    = position;
+    while (!atomic_load(&query->b_identify_ended) && !context->b_stop && position - start < limit && !hedge_past_deadline(query))
+    {
+        got = capture_read(context->capture, &position, buf, buf_size, CAPTURE_POLL_MS);
+        if (got < 0)
+        {
+            break;
+        }
+        if (got > 0)
+        {
+            error = query_write_audio(*p_channel_handle, query, buf, (gnsdk_size_t)got, frame_size);
+            if (GNSDK_SUCCESS != error)
+            {
+                if (GNSDKERR_SEVERE(error))
+                {
+                    query_display_last_error(query);
+                }
+                break;
+            }
+        }
+    }
+
+    if (GNSDK_SUCCESS == error && !atomic_load(&query->b_identify_ended))
+    {
+        error = _end_audio(*p_channel_handle, query);
+        if (GNSDK_SUCCESS != error)
+        {
+            query_display_last_error(query);
+        }
+    }
+
+    hedge_wait_for_answer(user_handle, p_channel_handle, query, GNSDK_NULL);
+
+    query_close_stages(query);
+    free(buf);
+
+}   /* _identify_capture() */
+
+/***************************************************************************
+ *
+ *    QUERY_IDENTIFY
+ *
+ ***************************************************************************/
+void
+query_identify(
+    gnsdk_user_handle_t user_handle,
+    query_t*            query
+    )
+{
+    gnsdk_musicidstream_channel_handle_t channel_handle = GNSDK_NULL;
+
+    if (query->context->capture)
+    {
+        _identify_capture(user_handle, &channel_handle, query);
+    }
+    else
+    {
+        _run_query(user_handle, &channel_handle, query);
+    }
+
+    /* Clean up */
+    if (channel_handle)
+    {
+        gnsdk_musicidstream_channel_release(channel_handle);
+        TRACE_MARK(query, TRACE_RELEASE);
+    }
+
+}   /* query_identify() */
+
+
+/*-----------------------------------------------------------------------------
+ *  _musicidstream_identifying_status_callback
+ */
+static gnsdk_void_t GNSDK_CALLBACK_API
+_musicidstream_identifying_status_callback(
+    gnsdk_void_t*                            callback_data,
+    gnsdk_musicidstream_identifying_status_t status,
+    gnsdk_bool_t*                            pb_abort
+    )
+{
+    query_t*             query = (query_t*)callback_data;
+    const query_hooks_t* hooks = query->hooks;
+
+    if (query->context->b_timing)
+    {
+        switch (status)
+        {
+        case gnsdk_musicidstream_identifying_started:
+            TRACE_MARK(query, TRACE_IDENTIFYING_STARTED);
+            break;
+        case gnsdk_musicidstream_identifying_fp_generated:
+            TRACE_MARK(query, TRACE_FP_GENERATED);
+            break;
+        case gnsdk_musicidstream_identifying_local_query_started:
+            TRACE_MARK(query, TRACE_LOCAL_QUERY_STARTED);
+            break;
+        case gnsdk_musicidstream_identifying_local_query_ended:
+            TRACE_MARK(query, TRACE_LOCAL_QUERY_ENDED);
+            break;
+        case gnsdk_musicidstream_identifying_online_query_started:
+            TRACE_MARK(query, TRACE_ONLINE_QUERY_STARTED);
+            break;
+        case gnsdk_musicidstream_identifying_online_query_ended:
+            TRACE_MARK(query, TRACE_ONLINE_QUERY_ENDED);
+            break;
+        case gnsdk_musicidstream_identifying_ended:
+            TRACE_MARK(query, TRACE_IDENTIFYING_ENDED);
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* A continuous (monitored) stream keeps going; the next identification
+    ** can be asked for once this one is over */
+    if (hooks && hooks->b_continuous && status == gnsdk_musicidstream_identifying_ended)
+    {
+        if (hooks->on_identified)
+        {
+            hooks->on_identified(query);
+        }
+    }
+
+    /* This sample chooses to stop the audio processing when the identification
+    ** is complete so it stops feeding in audio */
+    else if (status == gnsdk_musicidstream_identifying_ended)
+    {
+        atomic_store(&query->b_identify_ended, GNSDK_TRUE);
+        *pb_abort = GNSDK_TRUE;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+ *  _musicidstream_result_available_callback
+ */
+static gnsdk_void_t GNSDK_CALLBACK_API
+_musicidstream_result_available_callback(
+    gnsdk_void_t*                        callback_data,
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    gnsdk_gdo_handle_t                   response_gdo,
+    gnsdk_bool_t*                        pb_abort
+    )
+{
+    query_t*             query  = (query_t*)callback_data;
+    const query_hooks_t* hooks  = query->hooks;
+    gnsdk_uint32_t       count  = 0;
+    gnsdk_error_t        error  = GNSDK_SUCCESS;
+    record_t*            record = GNSDK_NULL;
+    size_t               start  = 0;
+
+    TRACE_MARK(query, TRACE_RESULT);
+
+    /* every answer on a continuous stream is its own */
+    if (hooks && hooks->b_continuous)
+    {
+        if (hooks->on_result)
+        {
+            hooks->on_result(query, response_gdo);
+        }
+        return;
+    }
+
+    /* too late, or its --hedge got there first */
+    if (!hedge_claim_answer(query))
+    {
+        return;
+    }
+
+    if (hooks && hooks->on_result)
+    {
+        hooks->on_result(query, response_gdo);
+        return;
+    }
+
+    /* a response that can't be read is reported instead, never in part */
+    record = query_begin_record(query);
+    start  = record->size;
+    error  = query_add_response(query->context, record, response_gdo, &count);
+    if (GNSDK_SUCCESS != error)
+    {
+        query_display_last_error(query);
+    }
+    else
+    {
+        /* the fields after any file tag are what the same audio gets next time */
+        if (query->b_cache_store && !record->b_failed)
+        {
+            cache_store(query->context->cache, query->cache_key, record->data + start, record->size - start, count == 0);
+        }
+        query_end_record(query);
+    }
+
+    GNSDK_UNUSED(pb_abort);
+    GNSDK_UNUSED(channel_handle);
+}
+
+/*-----------------------------------------------------------------------------
+ *  _musicidstream_completed_with_error_callback
+ */
+static gnsdk_void_t GNSDK_CALLBACK_API
+_musicidstream_completed_with_error_callback(
+    gnsdk_void_t*                        callback_data,
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    const gnsdk_error_info_t*            p_error_info
+    )
+{
+    query_t*             query = (query_t*)callback_data;
+    const query_hooks_t* hooks = query->hooks;
+
+    TRACE_MARK(query, TRACE_ERROR);
+
+    if (hooks && hooks->b_continuous)
+    {
+        if (hooks->on_error)
+        {
+            hooks->on_error(query, p_error_info->error_description);
+        }
+        return;
+    }
+
+    if (hedge_claim_answer(query))
+    {
+        /* hooks (a --tracklist window) count it themselves */
+        if (hooks && hooks->on_error)
+        {
+            hooks->on_error(query, p_error_info->error_description);
+        }
+        else
+        {
+            /* an error occurred during identification */
+            record_string(query_begin_record(query), "error", p_error_info->error_description);
+            query_end_record(query);
+        }
+    }
+
+    /* only once the error is written: the query may be over as soon as
+    ** this is seen */
+    atomic_store(&query->b_identify_ended, GNSDK_TRUE);
+
+    GNSDK_UNUSED(channel_handle);
+}
+
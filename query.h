@@ -0,0 +1,580 @@
+/*
+ *  Name: query.h
+ *  Description:
+ *  Identification of one input on a MusicID-Stream channel, as every
+ *  mode of sample, bench and libidentify does it: opening the input,
+ *  answering it from the cache or the local index, converting and
+ *  conditioning the audio, feeding it to the channel, waiting for the
+ *  answer (with the deadlines and hedges of hedge.h) and rendering the
+ *  records it ends in. Also starting and stopping the SDK, which keeps the user
+ *  and locale between runs.
+ *
+ *  Everything a run shares (its settings, the cache, index, rate limit
+ *  and capture answers come from, and the statistics it reports) is in
+ *  a query_context_t, so any number of them can be in use in a process
+ *  at once. A query_t is one identification, made on behalf of one
+ *  context.
+ */
+
+#ifndef QUERY_H
+#define QUERY_H
+
+/* GNSDK headers
+ *
+ * Define the modules your application needs.
+ * These constants enable inclusion of headers and symbols in gnsdk.h.
+ */
+#define GNSDK_MUSICID_STREAM        1
+#define GNSDK_MUSICID               1
+#define GNSDK_DSP                   1
+#include "gnsdk.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "audio.h"
+#include "cache.h"
+#include "capture.h"
+#include "condition.h"
+#include "convert.h"
+#include "decode.h"
+#include "ingest.h"
+#include "landmark.h"
+#include "quota.h"
+#include "record.h"
+#include "wav.h"
+
+/* Audio is written to MusicID-Stream as 16 bit mono or stereo at this
+ * rate; anything else is converted on the way in */
+#define CHANNEL_SAMPLE_RATE 44100
+
+/* --cache-ttl, --cache-negative-ttl and --cache-max-mb unless given */
+#define CACHE_TTL          (30 * 24 * 60 * 60)
+#define CACHE_NEGATIVE_TTL (24 * 60 * 60)
+#define CACHE_MAX_MB       64
+
+/* seconds of audio matched against --local-index */
+#define LOCAL_MATCH_SECONDS 10
+
+/* hashes that must agree on a track and offset for a local match */
+#define LOCAL_MIN_SCORE 12
+
+/* --hedge: answer times kept for the percentile */
+#define HEDGE_SAMPLES 256
+
+/* Moments in a query recorded for --timing, in the order they normally happen */
+typedef enum
+{
+    TRACE_CHANNEL_CREATE,
+    TRACE_AUDIO_BEGIN,
+    TRACE_QUOTA_GRANTED,
+    TRACE_FIRST_AUDIO_WRITE,
+    TRACE_IDENTIFYING_STARTED,
+    TRACE_FP_GENERATED,
+    TRACE_LOCAL_QUERY_STARTED,
+    TRACE_LOCAL_QUERY_ENDED,
+    TRACE_ONLINE_QUERY_STARTED,
+    TRACE_ONLINE_QUERY_ENDED,
+    TRACE_IDENTIFYING_ENDED,
+    TRACE_RESULT,
+    TRACE_ERROR,
+    TRACE_RELEASE,
+    TRACE_PHASE_COUNT
+
+} trace_phase_t;
+
+/* --timing state of one query. Records are held in memory until the
+ * query is over so that every phase, including the channel release
+ * after the result, can be attached to them. */
+typedef struct
+{
+    double        start;
+    double        at[TRACE_PHASE_COUNT];  /* first time each phase was seen, 0 if not */
+    FILE*         out;                    /* where the held records finally go */
+    char*         held;
+    size_t        held_size;
+
+} query_trace_t;
+
+/* What the queries of a run share. query_context_init() sets the
+ * settings to sample's defaults; the caller changes any it likes and
+ * opens the stores it wants before the first query. */
+typedef struct
+{
+    /* settings */
+    FILE*             output;              /* records that don't belong to a query */
+    record_format_t   record_format;       /* --format */
+    gnsdk_bool_t      b_raw_input;         /* --raw: inputs are headerless PCM in raw_format */
+    gnsdk_bool_t      b_raw_float;
+    audio_format_t    raw_format;
+    gnsdk_size_t      feed_size;           /* --feed-size: bytes handed to each audio_write */
+    gnsdk_bool_t      b_timing;            /* --timing: attach a latency trace to every record */
+    gnsdk_bool_t      b_condition;         /* --condition, with --silence-db and --max-gain-db */
+    double            silence_db;
+    double            max_gain_db;
+    long              candidates;          /* --candidates: albums of a response to list */
+    quota_class_t     priority;            /* --priority of queries that don't say otherwise */
+    double            deadline_seconds;    /* --deadline, 0 for no limit */
+    double            hedge_percentile;    /* --hedge, 0 for never */
+    long              preroll_seconds;     /* --preroll of the capture */
+    gnsdk_bool_t      b_fingerprint_only;  /* nothing is looked up, so the SDK starts without a locale */
+
+    /* where answers come from, GNSDK_NULL for those not used; closed
+     * by query_context_close() */
+    cache_t*          cache;               /* --cache */
+    landmark_index_t* local_index;         /* --local-index */
+    quota_t*          quota;               /* --rate-limit */
+    capture_t*        capture;             /* --capture */
+
+    /* set by SIGINT or SIGTERM after query_stop_on_signals() */
+    volatile sig_atomic_t b_stop;
+
+    /* statistics, kept by query.c under stats_lock */
+    pthread_mutex_t   stats_lock;
+    double            process_start;       /* when the context was set up */
+    double            first_audio_begin;   /* 0 until there is one */
+    gnsdk_bool_t      b_init_timed;        /* how long each step of query_start_sdk() took */
+    double            init_manager_seconds;
+    double            init_user_seconds;
+    double            init_locale_seconds;
+    const char*       locale_source;
+    double            answer_seconds[HEDGE_SAMPLES];  /* the last answer times, */
+    unsigned long     answer_count;        /* and what became of the queries */
+    unsigned long     timeouts;            /* with a --deadline or --hedge */
+    unsigned long     hedges;
+    unsigned long     hedge_wins;
+
+} query_context_t;
+
+typedef struct query_s query_t;
+
+/* For a runner that keeps a channel identifying as audio goes by
+ * (--monitor) or keeps the answers itself (--tracklist), in place of
+ * the usual records. Any may be GNSDK_NULL. They are called with the
+ * query, whose owner says what it is for. */
+typedef struct
+{
+    /* identifications are asked for by on_audio as the audio goes by,
+     * not once up front, and have no --deadline */
+    gnsdk_bool_t b_continuous;
+
+    /* after each slice of input audio is written to the channel */
+    void (*on_audio)(
+        gnsdk_musicidstream_channel_handle_t channel_handle,
+        query_t*                             query,
+        const gnsdk_byte_t*                  p_audio,
+        gnsdk_size_t                         size
+        );
+
+    /* each time a reader thread's ring has been looked at */
+    void (*on_ingest)(
+        query_t*  query,
+        ingest_t* ingest
+        );
+
+    /* b_continuous: an identification is over */
+    void (*on_identified)(
+        query_t* query
+        );
+
+    /* the answer, in place of its record */
+    void (*on_result)(
+        query_t*           query,
+        gnsdk_gdo_handle_t response_gdo
+        );
+
+    /* an identification failed or ran out of time, in place of its record */
+    void (*on_error)(
+        query_t*    query,
+        const char* description
+        );
+
+} query_hooks_t;
+
+/* State for one identification. It is the callback_data of the channel,
+ * so results rendered on SDK threads end up in the right place. */
+struct query_s
+{
+    query_context_t* context;     /* the run it belongs to */
+    const char*   audio_file;     /* input being identified */
+    FILE*         out;            /* records for this query are written here */
+    gnsdk_bool_t  b_tag_file;     /* start each record with the input path */
+    unsigned long records;        /* records written so far */
+    gnsdk_bool_t  b_cache_store;  /* store the answer under cache_key */
+    char          cache_key[CACHE_KEY_SIZE];
+    query_trace_t trace;          /* only used with --timing */
+    atomic_int    b_identify_ended; /* set from the callbacks once MusicID-Stream is done with it */
+    convert_t*    convert;        /* turns the input into what the channel was begun with */
+    condition_t*  condition;      /* --condition stage after convert */
+    gnsdk_bool_t  b_conditioned;  /* condition_stats is for this query */
+    condition_stats_t condition_stats;
+    const query_hooks_t* hooks;   /* --monitor and --tracklist: see query_hooks_t */
+    void*         owner;          /* what the hooks are working for */
+    quota_class_t priority;       /* --rate-limit: queue for the service in this class */
+    double        asked;          /* when the identification was asked for, 0 if it wasn't */
+    double        deadline;       /* --deadline: when to give up on it, 0 for never */
+    atomic_int    answered;       /* who answered it (hedge.h), ANSWER_NONE until someone has */
+    query_t*      primary;        /* --hedge: the query this one is a second try at */
+
+};
+
+/* An opened input, ready to be fed to a channel */
+typedef struct
+{
+    int                 fd;
+    wav_info_t          info;
+    gnsdk_byte_t*       p_map;       /* the sample data mapped into memory, if it could be */
+    size_t              map_size;
+    const gnsdk_byte_t* p_audio;     /* first sample within p_map */
+    gnsdk_size_t        audio_size;  /* bytes of whole frames from p_audio */
+    decode_t*           decode;      /* decoder for compressed inputs, which are never mapped */
+    ingest_t*           ingest;      /* --monitor: reader thread for a stream that is read */
+
+} audio_input_t;
+
+/* Mark a phase of the query. Just a test of b_timing when it is off. */
+#define TRACE_MARK(query, phase) \
+    do { if ((query)->context->b_timing && (query)->trace.at[(phase)] == 0) { (query)->trace.at[(phase)] = query_now(); } } while (0)
+
+/*
+ * Set a context up with sample's defaults, no stores and records going
+ * to stdout.
+ */
+void
+query_context_init(
+    query_context_t* context
+    );
+
+/* Close the stores a context has open */
+void
+query_context_close(
+    query_context_t* context
+    );
+
+/* Report on stderr, as a JSON line each, how the stores a context has
+ * open were used, how its SDK start went and how its deadlines and
+ * hedges did */
+void
+query_display_stats(
+    query_context_t* context
+    );
+
+/*
+ * Have SIGINT and SIGTERM set context->b_stop, without restarting the
+ * call they interrupt, so that whatever is waiting notices.
+ */
+void
+query_stop_on_signals(
+    query_context_t* context
+    );
+
+/*
+ * Start the SDK (registering or reading back the user, and with the
+ * locale unless b_fingerprint_only) and get a user handle for queries.
+ * The SDK is started once for any number of callers. Returns -1 if it
+ * couldn't be (reported).
+ */
+int
+query_start_sdk(
+    query_context_t*     context,
+    gnsdk_user_handle_t* p_user_handle
+    );
+
+/* Release the user handle, shutting the SDK down after its last user */
+void
+query_stop_sdk(
+    query_context_t*    context,
+    gnsdk_user_handle_t user_handle
+    );
+
+/* Monotonic time in seconds */
+double
+query_now(void);
+
+/*
+ * The record being built on this thread, reused from one record to the
+ * next.
+ */
+record_t*
+query_thread_record(void);
+
+/* Render the record in the context's --format and write it to out in one piece */
+void
+query_write_record(
+    query_context_t* context,
+    record_t*        record,
+    FILE*            out
+    );
+
+/*
+ * Start this thread's record for query, tagged with the input path if
+ * the query wants it. The caller adds the fields and then calls
+ * query_end_record().
+ */
+record_t*
+query_begin_record(
+    query_t* query
+    );
+
+void
+query_end_record(
+    query_t* query
+    );
+
+/* The same for a record of the run as a whole, written to context->output */
+record_t*
+query_context_begin_record(
+    query_context_t* context
+    );
+
+void
+query_context_end_record(
+    query_context_t* context
+    );
+
+/* Write the SDK's last error as the query's "error" record */
+void
+query_display_last_error(
+    query_t* query
+    );
+
+/*
+ * With --timing or --condition, start the clock on a query and hold its
+ * records back until query_trace_finish(), which writes them out with
+ * the timing and conditioning statistics added.
+ */
+void
+query_trace_start(
+    query_t* query
+    );
+
+void
+query_trace_finish(
+    query_t* query
+    );
+
+/*
+ * An object under key for an album: its title, the matched track and
+ * the artist, and with b_track_number the number of the matched track.
+ * Stops at the first value that can't be read and returns its error,
+ * leaving the record unfinished.
+ */
+gnsdk_error_t
+query_add_album_gdo(
+    record_t*          record,
+    const char*        key,
+    gnsdk_gdo_handle_t album_gdo,
+    gnsdk_bool_t       b_track_number
+    );
+
+/*
+ * The result of a response: its first album, or null, with the first
+ * --candidates albums after it. The number of albums found is returned
+ * in *p_count.
+ */
+gnsdk_error_t
+query_add_response(
+    query_context_t*   context,
+    record_t*          record,
+    gnsdk_gdo_handle_t response_gdo,
+    gnsdk_uint32_t*    p_count
+    );
+
+/*
+ * A --local-index match as the "result", with where the audio was and
+ * how sure the match is if b_position.
+ */
+void
+query_add_local_match(
+    record_t*               record,
+    const landmark_match_t* p_match,
+    gnsdk_bool_t            b_position
+    );
+
+/*
+ * Open the query's audio file ("-" for stdin) and work out the format
+ * of the PCM it carries, mapping it if it can be. Returns -1
+ * (reported) if it can't be opened or read.
+ */
+int
+query_open_input(
+    query_t*       query,
+    audio_input_t* input
+    );
+
+void
+query_close_input(
+    audio_input_t* input
+    );
+
+/*
+ * Answer the query from --cache or --local-index if its input (mapped,
+ * or a buffer in memory) has been seen before. Returns 1 if it has
+ * been answered, 0 if it is left to the service.
+ */
+int
+query_lookup_input(
+    query_t*       query,
+    audio_input_t* input
+    );
+
+/*
+ * query_open_input() and query_lookup_input(). Returns 1 if the query
+ * has been answered (and the input closed), 0 if the input is ready to
+ * be identified, or -1 on error (reported).
+ */
+int
+query_prepare_input(
+    query_t*       query,
+    audio_input_t* input
+    );
+
+/*
+ * The cache_key() variant of answers given with up to candidates
+ * albums listed, from audio fingerprinted with the context's
+ * --condition settings.
+ */
+uint32_t
+query_cache_variant(
+    query_context_t* context,
+    long             candidates
+    );
+
+/*
+ * Give the query a converter for audio in p_format the SDK doesn't take
+ * directly and with --condition a conditioner, putting the format that
+ * comes out in *p_out_format. Returns -1 (reported) if they can't be
+ * set up.
+ */
+int
+query_open_stages(
+    query_t*              query,
+    const audio_format_t* p_format,
+    gnsdk_bool_t          b_float,
+    audio_format_t*       p_out_format
+    );
+
+/* Free the query's stages, keeping the conditioning statistics for its records */
+void
+query_close_stages(
+    query_t* query
+    );
+
+/*
+ * Create a channel whose callbacks render into query, which can be
+ * reused for any number of identifications as long as query is updated
+ * in between.
+ */
+gnsdk_error_t
+query_create_channel(
+    gnsdk_user_handle_t                   user_handle,
+    query_t*                              query,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle
+    );
+
+/*
+ * Hand a block of whole frames to the channel in feed-size slices,
+ * through the query's stages.
+ */
+gnsdk_error_t
+query_write_audio(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    const gnsdk_byte_t*                  p_audio,
+    gnsdk_size_t                         size,
+    gnsdk_size_t                         frame_size
+    );
+
+/* Read audio from fd and write it to the channel as it arrives */
+gnsdk_error_t
+query_feed_stream(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    int                                  fd,
+    const wav_info_t*                    p_info
+    );
+
+/*
+ * Begin the audio of an open input on the channel, ask for it to be
+ * identified and write it all. Returns -1 if it couldn't be (reported).
+ */
+int
+query_process_audio(
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    query_t*                             query,
+    audio_input_t*                       input
+    );
+
+/*
+ * With --rate-limit, wait in the query's priority class until a request
+ * may go to the service. Returns -1 (reported) if asked to stop first.
+ */
+int
+query_wait_for_quota(
+    query_t* query
+    );
+
+/*
+ * Start landmark fingerprints of audio in p_format, with a converter to
+ * LANDMARK_SAMPLE_RATE in *p_convert if it needs one. Returns
+ * GNSDK_NULL if the format can't be converted or memory runs out.
+ */
+landmark_fp_t*
+query_open_fingerprint(
+    const audio_format_t* p_format,
+    gnsdk_bool_t          b_float,
+    convert_t**           p_convert
+    );
+
+/*
+ * Add size bytes of whole frames to fp, through convert if it isn't
+ * GNSDK_NULL. Returns -1 if out of memory.
+ */
+int
+query_fingerprint(
+    landmark_fp_t* fp,
+    convert_t*     convert,
+    const void*    p_pcm,
+    size_t         size
+    );
+
+/*
+ * Fingerprint an open input from its start, up to max_seconds of audio
+ * (all of it if 0), into *p_fp, with the seconds taken in *p_seconds.
+ * Returns -1 (not reported) if the format can't be converted or memory
+ * runs out.
+ */
+int
+query_fingerprint_input(
+    query_context_t* context,
+    audio_input_t*   input,
+    double           max_seconds,
+    landmark_fp_t**  p_fp,
+    double*          p_seconds
+    );
+
+/*
+ * Identify an open input on *p_channel_handle, creating the channel the
+ * first time it's needed so that it can be reused for later queries.
+ */
+void
+query_identify_input(
+    gnsdk_user_handle_t                   user_handle,
+    gnsdk_musicidstream_channel_handle_t* p_channel_handle,
+    query_t*                              query,
+    audio_input_t*                        input
+    );
+
+/*
+ * Identify the query's input, or with a capture what is playing, on a
+ * channel of its own.
+ */
+void
+query_identify(
+    gnsdk_user_handle_t user_handle,
+    query_t*            query
+    );
+
+#endif /* QUERY_H */
@@ -0,0 +1,420 @@
+/*
+ *  Name: quota.c
+ *  Description:
+ *  Token bucket shared by every channel in the process. Tokens are added
+ *  continuously at the configured rate up to the burst size; each
+ *  identify request takes one. Waiting requests are kept in one FIFO
+ *  per priority class and only the head of the highest class with
+ *  anyone waiting may take the next token.
+ */
+
+#include "quota.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* longest a waiter sleeps before checking whether it was cancelled */
+#define QUOTA_POLL_MS 200
+
+typedef struct quota_waiter_s
+{
+    struct quota_waiter_s* next;
+
+} quota_waiter_t;
+
+struct quota_s
+{
+    double          rate;      /* tokens per second */
+    double          burst;     /* most tokens held */
+    double          tokens;
+    double          refilled;  /* when tokens was last brought up to date */
+    quota_waiter_t* head[QUOTA_CLASS_COUNT];
+    quota_waiter_t* tail[QUOTA_CLASS_COUNT];
+    quota_stats_t   stats;
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;   /* a token was taken or a waiter left */
+};
+
+static const char* s_class_names[QUOTA_CLASS_COUNT] =
+{
+    "interactive",
+    "bulk"
+};
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+/******************************************************************
+ *
+ *    _NOW
+ *
+ *    Monotonic time in seconds, the clock the waits use.
+ *
+ *****************************************************************/
+static double
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+
+} /* _now() */
+
+/******************************************************************
+ *
+ *    _REFILL
+ *
+ *    Add the tokens earned since the last refill. Called with the
+ *    lock held.
+ *
+ *****************************************************************/
+static void
+_refill(
+    quota_t* quota,
+    double   now
+    )
+{
+    quota->tokens += (now - quota->refilled) * quota->rate;
+    if (quota->tokens > quota->burst)
+    {
+        quota->tokens = quota->burst;
+    }
+    quota->refilled = now;
+
+} /* _refill() */
+
+/******************************************************************
+ *
+ *    _AHEAD
+ *
+ *    Whether anyone of class cls or a higher one is waiting. Called
+ *    with the lock held.
+ *
+ *****************************************************************/
+static int
+_ahead(
+    quota_t*      quota,
+    quota_class_t cls
+    )
+{
+    int c = 0;
+
+    for (c = 0; c <= (int)cls; c++)
+    {
+        if (quota->head[c] != NULL)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+
+} /* _ahead() */
+
+/******************************************************************
+ *
+ *    _REMOVE
+ *
+ *    Take a waiter out of its class's queue. Called with the lock
+ *    held.
+ *
+ *****************************************************************/
+static void
+_remove(
+    quota_t*        quota,
+    quota_class_t   cls,
+    quota_waiter_t* waiter
+    )
+{
+    quota_waiter_t** p_link = &quota->head[cls];
+    quota_waiter_t*  prev   = NULL;
+
+    while (*p_link != waiter)
+    {
+        prev   = *p_link;
+        p_link = &(*p_link)->next;
+    }
+    *p_link = waiter->next;
+    if (quota->tail[cls] == waiter)
+    {
+        quota->tail[cls] = prev;
+    }
+
+    quota->stats.classes[cls].depth--;
+
+    /* the next in line may be able to go now */
+    pthread_cond_broadcast(&quota->changed);
+
+} /* _remove() */
+
+/******************************************************************
+ *
+ *    _TAKE
+ *
+ *    Take a token for a request of class cls that waited since
+ *    start. Called with the lock held.
+ *
+ *****************************************************************/
+static void
+_take(
+    quota_t*      quota,
+    quota_class_t cls,
+    double        start,
+    double        now
+    )
+{
+    quota_class_stats_t* stats = &quota->stats.classes[cls];
+    double               wait  = now - start;
+
+    quota->tokens -= 1;
+
+    stats->granted++;
+    stats->total_wait += wait;
+    if (wait > stats->max_wait)
+    {
+        stats->max_wait = wait;
+    }
+
+} /* _take() */
+
+/******************************************************************
+ *
+ *    QUOTA_OPEN
+ *
+ *****************************************************************/
+quota_t*
+quota_open(
+    double rate,
+    double burst
+    )
+{
+    quota_t*           quota = NULL;
+    pthread_condattr_t attr;
+
+    if (!(rate > 0) || !(burst >= 1))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    quota = calloc(1, sizeof(*quota));
+    if (quota == NULL)
+    {
+        return NULL;
+    }
+
+    quota->rate     = rate;
+    quota->burst    = burst;
+    quota->tokens   = burst;
+    quota->refilled = _now();
+
+    pthread_mutex_init(&quota->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&quota->changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return quota;
+
+} /* quota_open() */
+
+/******************************************************************
+ *
+ *    QUOTA_CLOSE
+ *
+ *****************************************************************/
+void
+quota_close(
+    quota_t* quota
+    )
+{
+    if (quota)
+    {
+        pthread_cond_destroy(&quota->changed);
+        pthread_mutex_destroy(&quota->lock);
+        free(quota);
+    }
+
+} /* quota_close() */
+
+/******************************************************************
+ *
+ *    QUOTA_ACQUIRE
+ *
+ *****************************************************************/
+int
+quota_acquire(
+    quota_t*                     quota,
+    quota_class_t                cls,
+    const volatile sig_atomic_t* p_cancel,
+    double*                      p_waited
+    )
+{
+    quota_waiter_t       waiter = { NULL };
+    quota_class_stats_t* stats  = &quota->stats.classes[cls];
+    struct timespec      until;
+    double               start  = _now();
+    double               now    = start;
+    double               sleep  = 0;
+    int                  rc     = 0;
+
+    pthread_mutex_lock(&quota->lock);
+
+    /* join the back of the queue for this class */
+    if (quota->tail[cls])
+    {
+        quota->tail[cls]->next = &waiter;
+    }
+    else
+    {
+        quota->head[cls] = &waiter;
+    }
+    quota->tail[cls] = &waiter;
+    if (++stats->depth > stats->peak_depth)
+    {
+        stats->peak_depth = stats->depth;
+    }
+
+    for (;;)
+    {
+        if (p_cancel && *p_cancel)
+        {
+            stats->cancelled++;
+            rc = -1;
+            break;
+        }
+
+        now   = _now();
+        sleep = QUOTA_POLL_MS / 1e3;
+
+        /* only the first in line of the highest class waiting may go */
+        if (quota->head[cls] == &waiter && (cls == 0 || !_ahead(quota, (quota_class_t)(cls - 1))))
+        {
+            _refill(quota, now);
+            if (quota->tokens >= 1)
+            {
+                _take(quota, cls, start, now);
+                break;
+            }
+
+            /* sleep until the next token is due */
+            if ((1 - quota->tokens) / quota->rate < sleep)
+            {
+                sleep = (1 - quota->tokens) / quota->rate;
+            }
+        }
+
+        now          += sleep;
+        until.tv_sec  = (time_t)now;
+        until.tv_nsec = (long)((now - (double)until.tv_sec) * 1e9);
+        pthread_cond_timedwait(&quota->changed, &quota->lock, &until);
+    }
+
+    _remove(quota, cls, &waiter);
+    pthread_mutex_unlock(&quota->lock);
+
+    if (p_waited)
+    {
+        *p_waited = _now() - start;
+    }
+
+    return rc;
+
+} /* quota_acquire() */
+
+/******************************************************************
+ *
+ *    QUOTA_TRY_ACQUIRE
+ *
+ *****************************************************************/
+int
+quota_try_acquire(
+    quota_t*      quota,
+    quota_class_t cls
+    )
+{
+    double now = _now();
+    int    rc  = -1;
+
+    pthread_mutex_lock(&quota->lock);
+    if (!_ahead(quota, cls))
+    {
+        _refill(quota, now);
+        if (quota->tokens >= 1)
+        {
+            _take(quota, cls, now, now);
+            rc = 0;
+        }
+    }
+    if (0 != rc)
+    {
+        quota->stats.classes[cls].deferred++;
+    }
+    pthread_mutex_unlock(&quota->lock);
+
+    return rc;
+
+} /* quota_try_acquire() */
+
+/******************************************************************
+ *
+ *    QUOTA_GET_STATS
+ *
+ *****************************************************************/
+void
+quota_get_stats(
+    quota_t*       quota,
+    quota_stats_t* p_stats
+    )
+{
+    pthread_mutex_lock(&quota->lock);
+    *p_stats = quota->stats;
+    pthread_mutex_unlock(&quota->lock);
+
+} /* quota_get_stats() */
+
+/******************************************************************
+ *
+ *    QUOTA_CLASS_NAME
+ *
+ *****************************************************************/
+const char*
+quota_class_name(
+    quota_class_t cls
+    )
+{
+    return s_class_names[cls];
+
+} /* quota_class_name() */
+
+/******************************************************************
+ *
+ *    QUOTA_CLASS_PARSE
+ *
+ *****************************************************************/
+int
+quota_class_parse(
+    const char*    name,
+    quota_class_t* p_cls
+    )
+{
+    int cls = 0;
+
+    for (cls = 0; cls < QUOTA_CLASS_COUNT; cls++)
+    {
+        if (0 == strcmp(name, s_class_names[cls]))
+        {
+            *p_cls = (quota_class_t)cls;
+            return 0;
+        }
+    }
+
+    return -1;
+
+} /* quota_class_parse() */
@@ -0,0 +1,106 @@
+/*
+ *  Name: quota.h
+ *  Description:
+ *  Token bucket in front of the identify requests sent to the Gracenote
+ *  service, so that however many channels are busy the requests stay
+ *  under the service's quota. Requests waiting for a token queue by
+ *  priority class: an interactive request goes ahead of any bulk one,
+ *  and requests of the same class are served in the order they came.
+ */
+
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include <signal.h>
+#include <stddef.h>
+
+typedef struct quota_s quota_t;
+
+/* highest priority first */
+typedef enum
+{
+    QUOTA_INTERACTIVE,
+    QUOTA_BULK,
+    QUOTA_CLASS_COUNT
+
+} quota_class_t;
+
+typedef struct
+{
+    unsigned long granted;     /* requests given a token */
+    unsigned long cancelled;   /* gave up waiting */
+    unsigned long deferred;    /* quota_try_acquire() calls turned away */
+    size_t        depth;       /* waiting now */
+    size_t        peak_depth;  /* most ever waiting at once */
+    double        total_wait;  /* seconds, over the granted requests */
+    double        max_wait;
+
+} quota_class_stats_t;
+
+typedef struct
+{
+    quota_class_stats_t classes[QUOTA_CLASS_COUNT];
+
+} quota_stats_t;
+
+/*
+ * Allow rate requests per second on average and at most burst (>= 1)
+ * at once after a quiet spell. Returns NULL if rate or burst is out of
+ * range or on failure.
+ */
+quota_t*
+quota_open(
+    double rate,
+    double burst
+    );
+
+/* Nothing may be waiting */
+void
+quota_close(
+    quota_t* quota
+    );
+
+/*
+ * Wait for a token for a request of class cls, behind any waiting
+ * requests of the same or a higher class. Returns 0 once it has one, with
+ * the seconds waited in *p_waited if that isn't NULL, or -1 if *p_cancel
+ * became non-zero first (it is checked a few times a second).
+ */
+int
+quota_acquire(
+    quota_t*                     quota,
+    quota_class_t                cls,
+    const volatile sig_atomic_t* p_cancel,
+    double*                      p_waited
+    );
+
+/*
+ * Take a token if one is free now and no request of the same or a
+ * higher class is waiting. Returns 0 if it was taken, -1 if not.
+ */
+int
+quota_try_acquire(
+    quota_t*      quota,
+    quota_class_t cls
+    );
+
+void
+quota_get_stats(
+    quota_t*       quota,
+    quota_stats_t* p_stats
+    );
+
+/* "interactive" or "bulk" */
+const char*
+quota_class_name(
+    quota_class_t cls
+    );
+
+/* The class named name; returns -1 if there isn't one */
+int
+quota_class_parse(
+    const char*    name,
+    quota_class_t* p_cls
+    );
+
+#endif /* QUOTA_H */
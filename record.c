@@ -0,0 +1,849 @@
+/*
+ *  Name: record.c
+ *  Description:
+ *  Record builder and its JSON and binary renderings. Strings are only
+ *  escaped when JSON is rendered, so the encoded fields can be kept (in
+ *  the result cache, for --timing) and added to other records as they
+ *  are.
+ */
+
+#include "record.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* most formatted strings fit here without a trip to the heap */
+#define RECORD_FORMAT_BUF 512
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+/******************************************************************
+ *
+ *    _RESERVE
+ *
+ *    Make room for need more bytes after size in a growing buffer.
+ *
+ *****************************************************************/
+static int
+_reserve(
+    void**  p_buf,
+    size_t* p_capacity,
+    size_t  size,
+    size_t  need
+    )
+{
+    size_t capacity = *p_capacity;
+    void*  buf      = NULL;
+
+    if (size + need <= capacity)
+    {
+        return 0;
+    }
+
+    capacity = capacity ? capacity : 256;
+    while (capacity < size + need)
+    {
+        capacity *= 2;
+    }
+
+    buf = realloc(*p_buf, capacity);
+    if (buf == NULL)
+    {
+        return -1;
+    }
+    *p_buf      = buf;
+    *p_capacity = capacity;
+
+    return 0;
+
+} /* _reserve() */
+
+/******************************************************************
+ *
+ *    _PUT
+ *
+ *****************************************************************/
+static void
+_put(
+    record_t*   record,
+    const void* data,
+    size_t      size
+    )
+{
+    if (0 == size)
+    {
+        return;
+    }
+    if (record->b_failed
+        || 0 != _reserve((void**)&record->data, &record->capacity, record->size, size))
+    {
+        record->b_failed = 1;
+        return;
+    }
+
+    memcpy(record->data + record->size, data, size);
+    record->size += size;
+
+} /* _put() */
+
+/******************************************************************
+ *
+ *    _PUT_LE
+ *
+ *    An unsigned integer of the given width, little-endian.
+ *
+ *****************************************************************/
+static void
+_put_le(
+    record_t* record,
+    uint64_t  value,
+    size_t    bytes
+    )
+{
+    unsigned char le[8];
+    size_t        i = 0;
+
+    for (i = 0; i < bytes; i++)
+    {
+        le[i] = (unsigned char)(value >> (8 * i));
+    }
+    _put(record, le, bytes);
+
+} /* _put_le() */
+
+/******************************************************************
+ *
+ *    _GET_LE
+ *
+ *****************************************************************/
+static uint64_t
+_get_le(
+    const unsigned char* p,
+    size_t               bytes
+    )
+{
+    uint64_t value = 0;
+
+    while (bytes-- > 0)
+    {
+        value = (value << 8) | p[bytes];
+    }
+
+    return value;
+
+} /* _get_le() */
+
+/******************************************************************
+ *
+ *    _PUT_HEADER
+ *
+ *    Type and key of a new field.
+ *
+ *****************************************************************/
+static void
+_put_header(
+    record_t*   record,
+    int         type,
+    const char* key
+    )
+{
+    size_t        key_len = strlen(key);
+    unsigned char header[2];
+
+    if (key_len > 255)
+    {
+        record->b_failed = 1;
+        return;
+    }
+
+    header[0] = (unsigned char)type;
+    header[1] = (unsigned char)key_len;
+    _put(record, header, sizeof(header));
+    _put(record, key, key_len);
+
+} /* _put_header() */
+
+/******************************************************************
+ *
+ *    _FIELD_SIZE
+ *
+ *    Size of the encoded field at p, or 0 if it doesn't fit in size
+ *    bytes. *p_value and *p_value_size locate its value.
+ *
+ *****************************************************************/
+static size_t
+_field_size(
+    const unsigned char*  p,
+    size_t                size,
+    const unsigned char** p_value,
+    size_t*               p_value_size
+    )
+{
+    size_t head = 0;
+    size_t len  = 0;
+
+    if (size < 2 || size - 2 < p[1])
+    {
+        return 0;
+    }
+    head = 2 + (size_t)p[1];
+
+    switch (p[0])
+    {
+    case RECORD_NULL:
+        len = 0;
+        break;
+    case RECORD_INT:
+    case RECORD_NUMBER:
+        len = 8;
+        break;
+    case RECORD_STRING:
+    case RECORD_OBJECT:
+    case RECORD_ARRAY:
+        if (size - head < 4)
+        {
+            return 0;
+        }
+        len   = (size_t)_get_le(p + head, 4);
+        head += 4;
+        break;
+    default:
+        return 0;
+    }
+
+    if (size - head < len)
+    {
+        return 0;
+    }
+
+    *p_value      = p + head;
+    *p_value_size = len;
+
+    return head + len;
+
+} /* _field_size() */
+
+/******************************************************************
+ *
+ *    _EMIT
+ *
+ *    Append to the rendering.
+ *
+ *****************************************************************/
+static int
+_emit(
+    record_t*   record,
+    size_t*     p_len,
+    const void* data,
+    size_t      size
+    )
+{
+    if (0 == size)
+    {
+        return 0;
+    }
+    if (0 != _reserve((void**)&record->rendered, &record->rendered_capacity, *p_len, size))
+    {
+        return -1;
+    }
+
+    memcpy(record->rendered + *p_len, data, size);
+    *p_len += size;
+
+    return 0;
+
+} /* _emit() */
+
+/******************************************************************
+ *
+ *    _EMIT_JSON_STRING
+ *
+ *    A quoted JSON string, with quotes, backslashes and control
+ *    characters escaped. Other bytes are passed through as UTF-8.
+ *
+ *****************************************************************/
+static int
+_emit_json_string(
+    record_t*            record,
+    size_t*              p_len,
+    const unsigned char* s,
+    size_t               size
+    )
+{
+    static const char hex[] = "0123456789abcdef";
+    char              escape[6];
+    size_t            run   = 0;
+    size_t            i     = 0;
+    int               rc    = _emit(record, p_len, "\"", 1);
+
+    for (i = 0; i < size && 0 == rc; i++)
+    {
+        if (s[i] >= 0x20 && s[i] != '"' && s[i] != '\\')
+        {
+            continue;
+        }
+
+        /* copy the plain run before this character in one go */
+        rc = _emit(record, p_len, s + run, i - run);
+        run = i + 1;
+
+        escape[0] = '\\';
+        switch (s[i])
+        {
+        case '"':  escape[1] = '"';  break;
+        case '\\': escape[1] = '\\'; break;
+        case '\n': escape[1] = 'n';  break;
+        case '\r': escape[1] = 'r';  break;
+        case '\t': escape[1] = 't';  break;
+        default:
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = hex[s[i] >> 4];
+            escape[5] = hex[s[i] & 0xf];
+            break;
+        }
+        if (0 == rc)
+        {
+            rc = _emit(record, p_len, escape, (escape[1] == 'u') ? 6 : 2);
+        }
+    }
+
+    if (0 == rc)
+    {
+        rc = _emit(record, p_len, s + run, size - run);
+    }
+    if (0 == rc)
+    {
+        rc = _emit(record, p_len, "\"", 1);
+    }
+
+    return rc;
+
+} /* _emit_json_string() */
+
+/******************************************************************
+ *
+ *    _EMIT_JSON_FIELDS
+ *
+ *    The members of a JSON object (without braces) for size bytes of
+ *    encoded fields, or with b_array the elements of an array (their
+ *    keys left out). Returns -1 if they are malformed.
+ *
+ *****************************************************************/
+static int
+_emit_json_fields(
+    record_t*            record,
+    size_t*              p_len,
+    const unsigned char* p,
+    size_t               size,
+    int                  depth,
+    int                  b_array
+    )
+{
+    const unsigned char* value      = NULL;
+    size_t               value_size = 0;
+    size_t               field_size = 0;
+    uint64_t             bits       = 0;
+    double               number     = 0;
+    char                 text[32];
+    int                  len        = 0;
+    int                  rc         = 0;
+    int                  b_first    = 1;
+
+    if (depth > RECORD_MAX_DEPTH)
+    {
+        return -1;
+    }
+
+    while (size > 0 && 0 == rc)
+    {
+        field_size = _field_size(p, size, &value, &value_size);
+        if (0 == field_size)
+        {
+            return -1;
+        }
+
+        if (!b_first)
+        {
+            rc = _emit(record, p_len, ", ", 2);
+        }
+        b_first = 0;
+
+        if (0 == rc && !b_array)
+        {
+            rc = _emit_json_string(record, p_len, p + 2, p[1]);
+            if (0 == rc)
+            {
+                rc = _emit(record, p_len, ": ", 2);
+            }
+        }
+        if (0 != rc)
+        {
+            break;
+        }
+
+        switch (p[0])
+        {
+        case RECORD_NULL:
+            rc = _emit(record, p_len, "null", 4);
+            break;
+        case RECORD_STRING:
+            rc = _emit_json_string(record, p_len, value, value_size);
+            break;
+        case RECORD_INT:
+            len = snprintf(text, sizeof(text), "%lld", (long long)(int64_t)_get_le(value, 8));
+            rc  = _emit(record, p_len, text, (size_t)len);
+            break;
+        case RECORD_NUMBER:
+            bits = _get_le(value, 8);
+            memcpy(&number, &bits, sizeof(number));
+            len = isfinite(number) ? snprintf(text, sizeof(text), "%.15g", number)
+                                   : snprintf(text, sizeof(text), "null");
+            rc  = _emit(record, p_len, text, (size_t)len);
+            break;
+        case RECORD_OBJECT:
+            rc = _emit(record, p_len, "{", 1);
+            if (0 == rc)
+            {
+                rc = _emit_json_fields(record, p_len, value, value_size, depth + 1, 0);
+            }
+            if (0 == rc)
+            {
+                rc = _emit(record, p_len, "}", 1);
+            }
+            break;
+        case RECORD_ARRAY:
+            rc = _emit(record, p_len, "[", 1);
+            if (0 == rc)
+            {
+                rc = _emit_json_fields(record, p_len, value, value_size, depth + 1, 1);
+            }
+            if (0 == rc)
+            {
+                rc = _emit(record, p_len, "]", 1);
+            }
+            break;
+        }
+
+        p    += field_size;
+        size -= field_size;
+    }
+
+    return rc;
+
+} /* _emit_json_fields() */
+
+/******************************************************************
+ *
+ *    _VALID_FIELDS
+ *
+ *****************************************************************/
+static int
+_valid_fields(
+    const unsigned char* p,
+    size_t               size,
+    int                  depth
+    )
+{
+    const unsigned char* value      = NULL;
+    size_t               value_size = 0;
+    size_t               field_size = 0;
+
+    if (depth > RECORD_MAX_DEPTH)
+    {
+        return 0;
+    }
+
+    while (size > 0)
+    {
+        field_size = _field_size(p, size, &value, &value_size);
+        if (0 == field_size
+            || ((p[0] == RECORD_OBJECT || p[0] == RECORD_ARRAY)
+                && !_valid_fields(value, value_size, depth + 1)))
+        {
+            return 0;
+        }
+        p    += field_size;
+        size -= field_size;
+    }
+
+    return 1;
+
+} /* _valid_fields() */
+
+/**********************************************
+ *    Building
+ **********************************************/
+
+/******************************************************************
+ *
+ *    RECORD_INIT
+ *
+ *****************************************************************/
+void
+record_init(
+    record_t* record
+    )
+{
+    memset(record, 0, sizeof(*record));
+
+} /* record_init() */
+
+/******************************************************************
+ *
+ *    RECORD_FREE
+ *
+ *****************************************************************/
+void
+record_free(
+    record_t* record
+    )
+{
+    free(record->data);
+    free(record->rendered);
+    memset(record, 0, sizeof(*record));
+
+} /* record_free() */
+
+/******************************************************************
+ *
+ *    RECORD_CLEAR
+ *
+ *****************************************************************/
+void
+record_clear(
+    record_t* record
+    )
+{
+    record->size     = 0;
+    record->depth    = 0;
+    record->b_failed = 0;
+
+} /* record_clear() */
+
+/******************************************************************
+ *
+ *    RECORD_STRING
+ *
+ *****************************************************************/
+void
+record_string(
+    record_t*   record,
+    const char* key,
+    const char* value
+    )
+{
+    size_t len = value ? strlen(value) : 0;
+
+    _put_header(record, RECORD_STRING, key);
+    _put_le(record, (uint64_t)len, 4);
+    _put(record, value, len);
+
+} /* record_string() */
+
+/******************************************************************
+ *
+ *    RECORD_STRINGF
+ *
+ *****************************************************************/
+void
+record_stringf(
+    record_t*   record,
+    const char* key,
+    const char* format,
+    ...
+    )
+{
+    char    buf[RECORD_FORMAT_BUF];
+    char*   value = buf;
+    va_list args;
+    int     len   = 0;
+
+    va_start(args, format);
+    len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    if (len < 0)
+    {
+        record->b_failed = 1;
+        return;
+    }
+
+    if ((size_t)len >= sizeof(buf))
+    {
+        value = malloc((size_t)len + 1);
+        if (value == NULL)
+        {
+            record->b_failed = 1;
+            return;
+        }
+        va_start(args, format);
+        vsnprintf(value, (size_t)len + 1, format, args);
+        va_end(args);
+    }
+
+    record_string(record, key, value);
+
+    if (value != buf)
+    {
+        free(value);
+    }
+
+} /* record_stringf() */
+
+/******************************************************************
+ *
+ *    RECORD_NULL
+ *
+ *****************************************************************/
+void
+record_null(
+    record_t*   record,
+    const char* key
+    )
+{
+    _put_header(record, RECORD_NULL, key);
+
+} /* record_null() */
+
+/******************************************************************
+ *
+ *    RECORD_INT
+ *
+ *****************************************************************/
+void
+record_int(
+    record_t*   record,
+    const char* key,
+    int64_t     value
+    )
+{
+    _put_header(record, RECORD_INT, key);
+    _put_le(record, (uint64_t)value, 8);
+
+} /* record_int() */
+
+/******************************************************************
+ *
+ *    RECORD_NUMBER
+ *
+ *****************************************************************/
+void
+record_number(
+    record_t*   record,
+    const char* key,
+    double      value,
+    int         decimals
+    )
+{
+    double   scale = pow(10.0, decimals);
+    uint64_t bits  = 0;
+
+    if (isfinite(value) && isfinite(value * scale))
+    {
+        value = round(value * scale) / scale;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+
+    _put_header(record, RECORD_NUMBER, key);
+    _put_le(record, bits, 8);
+
+} /* record_number() */
+
+/******************************************************************
+ *
+ *    RECORD_BEGIN_OBJECT
+ *
+ *****************************************************************/
+void
+record_begin_object(
+    record_t*   record,
+    const char* key
+    )
+{
+    if (record->depth == RECORD_MAX_DEPTH)
+    {
+        record->b_failed = 1;
+        return;
+    }
+
+    _put_header(record, RECORD_OBJECT, key);
+    record->open[record->depth++] = record->size;
+
+    /* the length is filled in by record_end_object() */
+    _put_le(record, 0, 4);
+
+} /* record_begin_object() */
+
+/******************************************************************
+ *
+ *    RECORD_END_OBJECT
+ *
+ *****************************************************************/
+void
+record_end_object(
+    record_t* record
+    )
+{
+    size_t   at  = 0;
+    uint64_t len = 0;
+    size_t   i   = 0;
+
+    if (record->depth == 0)
+    {
+        record->b_failed = 1;
+        return;
+    }
+
+    at = record->open[--record->depth];
+    if (record->b_failed)
+    {
+        return;
+    }
+
+    len = record->size - at - 4;
+    for (i = 0; i < 4; i++)
+    {
+        record->data[at + i] = (unsigned char)(len >> (8 * i));
+    }
+
+} /* record_end_object() */
+
+/******************************************************************
+ *
+ *    RECORD_BEGIN_ARRAY
+ *
+ *****************************************************************/
+void
+record_begin_array(
+    record_t*   record,
+    const char* key
+    )
+{
+    if (record->depth == RECORD_MAX_DEPTH)
+    {
+        record->b_failed = 1;
+        return;
+    }
+
+    _put_header(record, RECORD_ARRAY, key);
+    record->open[record->depth++] = record->size;
+
+    /* the length is filled in by record_end_array() */
+    _put_le(record, 0, 4);
+
+} /* record_begin_array() */
+
+/******************************************************************
+ *
+ *    RECORD_END_ARRAY
+ *
+ *****************************************************************/
+void
+record_end_array(
+    record_t* record
+    )
+{
+    /* both are a length to fill in */
+    record_end_object(record);
+
+} /* record_end_array() */
+
+/******************************************************************
+ *
+ *    RECORD_APPEND
+ *
+ *****************************************************************/
+void
+record_append(
+    record_t*   record,
+    const void* fields,
+    size_t      size
+    )
+{
+    _put(record, fields, size);
+
+} /* record_append() */
+
+/******************************************************************
+ *
+ *    RECORD_VALID
+ *
+ *****************************************************************/
+int
+record_valid(
+    const void* fields,
+    size_t      size
+    )
+{
+    return _valid_fields((const unsigned char*)fields, size, 0);
+
+} /* record_valid() */
+
+/**********************************************
+ *    Rendering
+ **********************************************/
+
+/******************************************************************
+ *
+ *    RECORD_RENDER
+ *
+ *****************************************************************/
+const void*
+record_render(
+    record_t*       record,
+    record_format_t format,
+    size_t*         p_size
+    )
+{
+    unsigned char frame[4];
+    size_t        len = 0;
+    size_t        i   = 0;
+    int           rc  = 0;
+
+    if (record->b_failed || record->depth != 0 || record->size > UINT32_MAX)
+    {
+        return NULL;
+    }
+
+    if (RECORD_FORMAT_BINARY == format)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            frame[i] = (unsigned char)((uint64_t)record->size >> (8 * i));
+        }
+        rc = _emit(record, &len, frame, sizeof(frame));
+        if (0 == rc)
+        {
+            rc = _emit(record, &len, record->data, record->size);
+        }
+    }
+    else
+    {
+        rc = _emit(record, &len, "{", 1);
+        if (0 == rc)
+        {
+            rc = _emit_json_fields(record, &len, record->data, record->size, 0, 0);
+        }
+        if (0 == rc)
+        {
+            rc = _emit(record, &len, "}\n", 2);
+        }
+    }
+
+    if (0 != rc)
+    {
+        return NULL;
+    }
+
+    *p_size = len;
+
+    return record->rendered;
+
+} /* record_render() */
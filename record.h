@@ -0,0 +1,175 @@
+/*
+ *  Name: record.h
+ *  Description:
+ *  Builder for the records sample writes (results, errors, events).
+ *  Fields are added one at a time into a reusable buffer in a compact
+ *  binary encoding, and the finished record is rendered in one piece as
+ *  a line of JSON or as a length-prefixed binary frame, ready to be
+ *  written with a single call.
+ *
+ *  Binary encoding of a field (integers little-endian):
+ *
+ *    u8 type, u8 key length, key bytes, then by type:
+ *    RECORD_NULL    nothing
+ *    RECORD_STRING  u32 length, UTF-8 bytes (no terminator)
+ *    RECORD_INT     i64
+ *    RECORD_NUMBER  f64 (IEEE 754)
+ *    RECORD_OBJECT  u32 length, the fields inside it
+ *    RECORD_ARRAY   u32 length, the elements inside it (fields with
+ *                   empty keys)
+ *
+ *  A record in the binary output format is a u32 length followed by its
+ *  fields.
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RECORD_NULL   0
+#define RECORD_STRING 1
+#define RECORD_INT    2
+#define RECORD_NUMBER 3
+#define RECORD_OBJECT 4
+#define RECORD_ARRAY  5
+
+/* objects and arrays nested inside a record, at most */
+#define RECORD_MAX_DEPTH 8
+
+typedef enum
+{
+    RECORD_FORMAT_JSON,    /* one JSON object per line */
+    RECORD_FORMAT_BINARY   /* u32 length and the encoded fields */
+
+} record_format_t;
+
+typedef struct
+{
+    unsigned char* data;        /* encoded fields added so far */
+    size_t         size;
+    size_t         capacity;
+    size_t         open[RECORD_MAX_DEPTH];  /* where each open object's length goes */
+    int            depth;
+    int            b_failed;    /* something couldn't be added; the record is incomplete */
+    char*          rendered;    /* output of the last record_render() */
+    size_t         rendered_capacity;
+
+} record_t;
+
+void
+record_init(
+    record_t* record
+    );
+
+/* Free the buffers; the record can be initialised again */
+void
+record_free(
+    record_t* record
+    );
+
+/* Start a new record, keeping the buffers */
+void
+record_clear(
+    record_t* record
+    );
+
+void
+record_string(
+    record_t*   record,
+    const char* key,
+    const char* value
+    );
+
+/* A string field formatted like printf() */
+void
+record_stringf(
+    record_t*   record,
+    const char* key,
+    const char* format,
+    ...
+    )
+#if defined(__GNUC__)
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+void
+record_null(
+    record_t*   record,
+    const char* key
+    );
+
+void
+record_int(
+    record_t*   record,
+    const char* key,
+    int64_t     value
+    );
+
+/* A number, rounded to the given decimal places */
+void
+record_number(
+    record_t*   record,
+    const char* key,
+    double      value,
+    int         decimals
+    );
+
+/* Fields added until the matching record_end_object() go inside key */
+void
+record_begin_object(
+    record_t*   record,
+    const char* key
+    );
+
+void
+record_end_object(
+    record_t* record
+    );
+
+/*
+ * Fields added until the matching record_end_array() are the elements
+ * of an array under key. Give them "" as their key.
+ */
+void
+record_begin_array(
+    record_t*   record,
+    const char* key
+    );
+
+void
+record_end_array(
+    record_t* record
+    );
+
+/* Add fields encoded by another record (its data and size) */
+void
+record_append(
+    record_t*   record,
+    const void* fields,
+    size_t      size
+    );
+
+/* Whether size bytes are well-formed encoded fields */
+int
+record_valid(
+    const void* fields,
+    size_t      size
+    );
+
+/*
+ * Render the record in format: JSON ends with a newline, binary is
+ * framed with its length. Returns the output, valid until the record is
+ * next rendered or freed, and its size in *p_size; NULL if the record is
+ * incomplete or out of memory.
+ */
+const void*
+record_render(
+    record_t*       record,
+    record_format_t format,
+    size_t*         p_size
+    );
+
+#endif /* RECORD_H */
@@ -0,0 +1,353 @@
+/*
+ *  Name: server.c
+ *  Description:
+ *  The --server accept loop and its connection threads. A duplicate of
+ *  each connection's socket is kept, as its thread closes its own when
+ *  it likes, so that every conversation can be ended on the way out.
+ */
+
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* The connections one server_run() is serving */
+typedef struct
+{
+    query_context_t*    context;
+    gnsdk_user_handle_t user_handle;
+    pthread_mutex_t     lock;
+    pthread_cond_t      done;                         /* a connection ended */
+    int                 fds[SERVER_MAX_CONNECTIONS];  /* a duplicate of each socket, -1 for none */
+    size_t              count;
+
+} server_t;
+
+/* A --server client, served on a thread of its own */
+typedef struct
+{
+    server_t* server;
+    int       conn_fd;
+    size_t    slot;         /* in server->fds */
+
+} connection_t;
+
+/***************************************************************************
+ *
+ *    _SERVE_CONNECTION
+ *
+ * Answer identify requests from one client. Each request is an audio file
+ * path on its own line, optionally followed by a tab and "interactive" or
+ * "bulk" for its --rate-limit priority, and gets exactly one JSON line
+ * back.
+ *
+ ***************************************************************************/
+static void
+_serve_connection(
+    connection_t* connection
+    )
+{
+    query_context_t* context       = connection->server->context;
+    int              conn_fd       = connection->conn_fd;
+    char             request[4096] = {0};
+    query_t          query         = {0};
+    FILE*            conn_in       = NULL;
+    FILE*            conn_out      = NULL;
+    char*            priority      = NULL;
+    size_t           request_len   = 0;
+    int              out_fd        = -1;
+
+    conn_in = fdopen(conn_fd, "r");
+    if (conn_in == NULL)
+    {
+        close(conn_fd);
+        return;
+    }
+
+    /* separate stream for writing so reads and writes don't share a buffer */
+    out_fd   = dup(conn_fd);
+    conn_out = (out_fd < 0) ? NULL : fdopen(out_fd, "w");
+    if (conn_out == NULL)
+    {
+        if (out_fd >= 0)
+        {
+            close(out_fd);
+        }
+        fclose(conn_in);
+        return;
+    }
+
+    query.context = context;
+    query.out     = conn_out;
+
+    while (!context->b_stop && fgets(request, sizeof(request), conn_in))
+    {
+        request_len = strcspn(request, "\r\n");
+        request[request_len] = '\0';
+        if (0 == request_len)
+        {
+            continue;
+        }
+
+        query.audio_file = request;
+        query.records    = 0;
+        query.priority   = context->priority;
+        query_trace_start(&query);
+
+        priority = strchr(request, '\t');
+        if (priority)
+        {
+            *priority++ = '\0';
+        }
+        if (priority && 0 != quota_class_parse(priority, &query.priority))
+        {
+            record_stringf(query_begin_record(&query), "error", "Unknown priority: %s", priority);
+            query_end_record(&query);
+        }
+        else
+        {
+            query_identify(connection->server->user_handle, &query);
+        }
+
+        /* make sure the client is never left waiting for a line */
+        if (0 == query.records)
+        {
+            record_null(query_begin_record(&query), "result");
+            query_end_record(&query);
+        }
+        query_trace_finish(&query);
+
+        if (ferror(conn_out))
+        {
+            break;
+        }
+    }
+
+    fclose(conn_in);
+    fclose(conn_out);
+
+}   /* _serve_connection() */
+
+/***************************************************************************
+ *
+ *    _CONNECTION_WORKER
+ *
+ ***************************************************************************/
+static void*
+_connection_worker(
+    void* arg
+    )
+{
+    connection_t* connection = (connection_t*)arg;
+    server_t*     server     = connection->server;
+
+    _serve_connection(connection);
+
+    pthread_mutex_lock(&server->lock);
+    close(server->fds[connection->slot]);
+    server->fds[connection->slot] = -1;
+    server->count--;
+    pthread_cond_signal(&server->done);
+    pthread_mutex_unlock(&server->lock);
+
+    free(connection);
+
+    return GNSDK_NULL;
+
+}   /* _connection_worker() */
+
+/***************************************************************************
+ *
+ *    _START_CONNECTION
+ *
+ * Serve a new client on a detached thread of its own. Returns -1 if it
+ * can't be (too many clients or out of resources), closing conn_fd.
+ *
+ ***************************************************************************/
+static int
+_start_connection(
+    server_t* server,
+    int       conn_fd
+    )
+{
+    connection_t*  connection = GNSDK_NULL;
+    pthread_attr_t attr;
+    pthread_t      thread;
+    sigset_t       signals;
+    sigset_t       old_signals;
+    size_t         slot       = 0;
+    int            shared_fd  = -1;
+    int            rc         = -1;
+
+    pthread_mutex_lock(&server->lock);
+    if (server->count < SERVER_MAX_CONNECTIONS)
+    {
+        while (server->fds[slot] >= 0)
+        {
+            slot++;
+        }
+        shared_fd  = dup(conn_fd);
+        connection = (shared_fd < 0) ? GNSDK_NULL : malloc(sizeof(*connection));
+    }
+
+    if (connection)
+    {
+        connection->server  = server;
+        connection->conn_fd = conn_fd;
+        connection->slot    = slot;
+
+        /* leave SIGINT and SIGTERM to the accepting thread, so they
+         * interrupt accept() */
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rc = pthread_create(&thread, &attr, _connection_worker, connection);
+        pthread_attr_destroy(&attr);
+
+        pthread_sigmask(SIG_SETMASK, &old_signals, GNSDK_NULL);
+
+        if (0 == rc)
+        {
+            server->fds[slot] = shared_fd;
+            server->count++;
+        }
+        else
+        {
+            free(connection);
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (0 != rc)
+    {
+        if (shared_fd >= 0)
+        {
+            close(shared_fd);
+        }
+        close(conn_fd);
+    }
+
+    return rc;
+
+}   /* _start_connection() */
+
+/***************************************************************************
+ *
+ *    SERVER_RUN
+ *
+ ***************************************************************************/
+int
+server_run(
+    query_context_t*    context,
+    gnsdk_user_handle_t user_handle,
+    const char*         socket_path
+    )
+{
+    server_t           server    = {0};
+    struct sockaddr_un addr      = {0};
+    int                listen_fd = -1;
+    int                conn_fd   = -1;
+    size_t             slot      = 0;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        record_stringf(query_context_begin_record(context), "error", "Socket path too long: %s", socket_path);
+        query_context_end_record(context);
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to create socket: %s", strerror(errno));
+        query_context_end_record(context);
+        return -1;
+    }
+
+    /* remove a stale socket left behind by a previous run */
+    unlink(socket_path);
+
+    if (0 != bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))
+        || 0 != listen(listen_fd, SOMAXCONN))
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to listen on %s: %s", socket_path, strerror(errno));
+        query_context_end_record(context);
+        close(listen_fd);
+        return -1;
+    }
+
+    /* no SA_RESTART, so accept() returns when we are asked to stop */
+    query_stop_on_signals(context);
+
+    /* a client hanging up early must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    server.context     = context;
+    server.user_handle = user_handle;
+    pthread_mutex_init(&server.lock, GNSDK_NULL);
+    pthread_cond_init(&server.done, GNSDK_NULL);
+    for (slot = 0; slot < SERVER_MAX_CONNECTIONS; slot++)
+    {
+        server.fds[slot] = -1;
+    }
+
+    while (!context->b_stop)
+    {
+        conn_fd = accept(listen_fd, GNSDK_NULL, GNSDK_NULL);
+        if (conn_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            record_stringf(query_context_begin_record(context), "error", "Failed to accept connection: %s", strerror(errno));
+            query_context_end_record(context);
+            break;
+        }
+
+        if (0 != _start_connection(&server, conn_fd))
+        {
+            record_string(query_context_begin_record(context), "error", "Failed to start serving a connection");
+            query_context_end_record(context);
+        }
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    /* end every conversation still going (a request in progress is
+     * finished first) and wait for them */
+    pthread_mutex_lock(&server.lock);
+    for (slot = 0; slot < SERVER_MAX_CONNECTIONS; slot++)
+    {
+        if (server.fds[slot] >= 0)
+        {
+            shutdown(server.fds[slot], SHUT_RD);
+        }
+    }
+    while (server.count > 0)
+    {
+        pthread_cond_wait(&server.done, &server.lock);
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    pthread_cond_destroy(&server.done);
+    pthread_mutex_destroy(&server.lock);
+
+    return 0;
+
+}   /* server_run() */
+
@@ -0,0 +1,32 @@
+/*
+ *  Name: server.h
+ *  Description:
+ *  --server: the SDK, user handle and locale stay loaded while identify
+ *  requests are read from a Unix domain socket, one audio file path per
+ *  line, optionally followed by a tab and the priority of the request.
+ *  Each request is answered with a single line of JSON. Every
+ *  connection is served on a thread of its own.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "query.h"
+
+/* connections served at once, a thread each */
+#define SERVER_MAX_CONNECTIONS 64
+
+/*
+ * Serve identify requests for context on a socket at socket_path, with
+ * user_handle, until SIGINT or SIGTERM. Connections still open then are
+ * ended once the request in progress on each is answered. Returns -1
+ * if the socket couldn't be set up.
+ */
+int
+server_run(
+    query_context_t*    context,
+    gnsdk_user_handle_t user_handle,
+    const char*         socket_path
+    );
+
+#endif /* SERVER_H */
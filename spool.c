@@ -0,0 +1,359 @@
+/*
+ *  Name: spool.c
+ *  Description:
+ *  Fingerprint spool. Appends rely on O_APPEND: each entry goes to the
+ *  end of the file in one write() however many writers there are, so
+ *  there is no lock. Reading takes the whole file into memory and walks
+ *  it entry by entry; anything that isn't a whole entry is stepped over
+ *  a byte at a time until the next magic that starts one.
+ */
+
+#include "spool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SPOOL_MAGIC       0x314C5053u   /* "SPL1" */
+#define SPOOL_HEADER_SIZE 12
+
+/* capture time, attempts and the three terminators */
+#define SPOOL_MIN_BODY    (8 + 4 + 3)
+
+/* larger than any fingerprint, so a damaged size can't swallow the file */
+#define SPOOL_MAX_BODY    (1024 * 1024)
+
+#define FNV32_OFFSET      0x811C9DC5u
+#define FNV32_PRIME       0x01000193u
+
+struct spool_s
+{
+    int fd;
+};
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+static void
+_put_le(
+    unsigned char* p,
+    uint64_t       value,
+    size_t         bytes
+    )
+{
+    size_t i = 0;
+
+    for (i = 0; i < bytes; i++)
+    {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static uint64_t
+_get_le(
+    const unsigned char* p,
+    size_t               bytes
+    )
+{
+    uint64_t value = 0;
+
+    while (bytes-- > 0)
+    {
+        value = (value << 8) | p[bytes];
+    }
+
+    return value;
+}
+
+static uint32_t
+_hash(
+    const unsigned char* p,
+    size_t               size
+    )
+{
+    uint32_t hash = FNV32_OFFSET;
+    size_t   i    = 0;
+
+    for (i = 0; i < size; i++)
+    {
+        hash = (hash ^ p[i]) * FNV32_PRIME;
+    }
+
+    return hash;
+}
+
+/******************************************************************
+ *
+ *    _PARSE_ENTRY
+ *
+ *    The entry at p, if there is a whole one in the size bytes
+ *    there. Returns its size in bytes, or 0 if there isn't.
+ *
+ *****************************************************************/
+static size_t
+_parse_entry(
+    char*          p,
+    size_t         size,
+    spool_entry_t* entry
+    )
+{
+    unsigned char* p_byte    = (unsigned char*)p;
+    char*          body      = p + SPOOL_HEADER_SIZE;
+    char*          end       = NULL;
+    char*          id_end    = NULL;
+    char*          type_end  = NULL;
+    size_t         body_size = 0;
+
+    if (size < SPOOL_HEADER_SIZE + SPOOL_MIN_BODY || SPOOL_MAGIC != (uint32_t)_get_le(p_byte, 4))
+    {
+        return 0;
+    }
+
+    body_size = (size_t)_get_le(p_byte + 4, 4);
+    if (body_size < SPOOL_MIN_BODY || body_size > SPOOL_MAX_BODY || body_size > size - SPOOL_HEADER_SIZE
+        || (uint32_t)_get_le(p_byte + 8, 4) != _hash((unsigned char*)body, body_size))
+    {
+        return 0;
+    }
+
+    /* three strings that fill the rest of the body */
+    end      = body + body_size;
+    id_end   = memchr(body + 12, '\0', (size_t)(end - (body + 12)));
+    type_end = id_end ? memchr(id_end + 1, '\0', (size_t)(end - (id_end + 1))) : NULL;
+    if (type_end == NULL || type_end + 1 >= end || memchr(type_end + 1, '\0', (size_t)(end - (type_end + 1))) != end - 1)
+    {
+        return 0;
+    }
+
+    entry->captured_ms = _get_le((unsigned char*)body, 8);
+    entry->attempts    = (uint32_t)_get_le((unsigned char*)body + 8, 4);
+    entry->id          = body + 12;
+    entry->fp_type     = id_end + 1;
+    entry->fp_data     = type_end + 1;
+
+    return SPOOL_HEADER_SIZE + body_size;
+
+} /* _parse_entry() */
+
+/**********************************************
+ *    Spool
+ **********************************************/
+
+/******************************************************************
+ *
+ *    SPOOL_OPEN
+ *
+ *****************************************************************/
+spool_t*
+spool_open(
+    const char* path
+    )
+{
+    spool_t* spool = calloc(1, sizeof(*spool));
+
+    if (spool == NULL)
+    {
+        return NULL;
+    }
+
+    spool->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (spool->fd < 0)
+    {
+        free(spool);
+        return NULL;
+    }
+
+    return spool;
+
+} /* spool_open() */
+
+/******************************************************************
+ *
+ *    SPOOL_CLOSE
+ *
+ *****************************************************************/
+void
+spool_close(
+    spool_t* spool
+    )
+{
+    if (spool)
+    {
+        close(spool->fd);
+        free(spool);
+    }
+
+} /* spool_close() */
+
+/******************************************************************
+ *
+ *    SPOOL_APPEND
+ *
+ *****************************************************************/
+int
+spool_append(
+    spool_t*             spool,
+    const spool_entry_t* entry
+    )
+{
+    size_t         id_size   = strlen(entry->id) + 1;
+    size_t         type_size = strlen(entry->fp_type) + 1;
+    size_t         fp_size   = strlen(entry->fp_data) + 1;
+    size_t         body_size = 8 + 4 + id_size + type_size + fp_size;
+    unsigned char* buffer    = NULL;
+    unsigned char* body      = NULL;
+    ssize_t        written   = 0;
+
+    if (body_size > SPOOL_MAX_BODY)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    buffer = malloc(SPOOL_HEADER_SIZE + body_size);
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+
+    body = buffer + SPOOL_HEADER_SIZE;
+    _put_le(body, entry->captured_ms, 8);
+    _put_le(body + 8, entry->attempts, 4);
+    memcpy(body + 12, entry->id, id_size);
+    memcpy(body + 12 + id_size, entry->fp_type, type_size);
+    memcpy(body + 12 + id_size + type_size, entry->fp_data, fp_size);
+
+    _put_le(buffer, SPOOL_MAGIC, 4);
+    _put_le(buffer + 4, body_size, 4);
+    _put_le(buffer + 8, _hash(body, body_size), 4);
+
+    /* never finish a short write: the rest would land after someone else's */
+    do
+    {
+        written = write(spool->fd, buffer, SPOOL_HEADER_SIZE + body_size);
+    } while (written < 0 && errno == EINTR);
+    free(buffer);
+
+    if (written >= 0 && (size_t)written != SPOOL_HEADER_SIZE + body_size)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    return (written < 0) ? -1 : 0;
+
+} /* spool_append() */
+
+/******************************************************************
+ *
+ *    SPOOL_READ
+ *
+ *****************************************************************/
+int
+spool_read(
+    const char*       path,
+    spool_contents_t* p_contents
+    )
+{
+    spool_contents_t contents = {0};
+    spool_entry_t*   entries  = NULL;
+    size_t           capacity = 0;
+    size_t           size     = 0;
+    size_t           offset   = 0;
+    size_t           used     = 0;
+    ssize_t          got      = 0;
+    int              fd       = -1;
+    struct stat      st;
+
+    memset(p_contents, 0, sizeof(*p_contents));
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (0 != fstat(fd, &st))
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* one more byte, so an empty spool still has a buffer */
+    contents.data = malloc((size_t)st.st_size + 1);
+    if (contents.data == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    while (size < (size_t)st.st_size)
+    {
+        got = read(fd, contents.data + size, (size_t)st.st_size - size);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+        size += (size_t)got;
+    }
+    close(fd);
+    if (got < 0)
+    {
+        free(contents.data);
+        return -1;
+    }
+
+    while (offset < size)
+    {
+        if (contents.count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 256;
+            entries  = realloc(contents.entries, capacity * sizeof(*entries));
+            if (entries == NULL)
+            {
+                spool_contents_free(&contents);
+                return -1;
+            }
+            contents.entries = entries;
+        }
+
+        used = _parse_entry(contents.data + offset, size - offset, &contents.entries[contents.count]);
+        if (used > 0)
+        {
+            contents.count++;
+            offset += used;
+        }
+        else
+        {
+            contents.damaged++;
+            offset++;
+        }
+    }
+
+    *p_contents = contents;
+
+    return 0;
+
+} /* spool_read() */
+
+/******************************************************************
+ *
+ *    SPOOL_CONTENTS_FREE
+ *
+ *****************************************************************/
+void
+spool_contents_free(
+    spool_contents_t* p_contents
+    )
+{
+    free(p_contents->entries);
+    free(p_contents->data);
+    memset(p_contents, 0, sizeof(*p_contents));
+
+} /* spool_contents_free() */
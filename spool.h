@@ -0,0 +1,90 @@
+/*
+ *  Name: spool.h
+ *  Description:
+ *  Append-only file of fingerprints waiting to be looked up, written by
+ *  sample --fingerprint where the service is out of reach and drained by
+ *  sample --drain where it isn't. An entry is one clip: its ID, when it
+ *  was captured and the fingerprint the SDK made of it, so a clip costs
+ *  the size of its fingerprint rather than of its audio.
+ *
+ *  Each entry is laid out as, with every integer little-endian:
+ *
+ *    u32 magic, u32 size of the body, u32 FNV-1a hash of the body
+ *    body: u64 capture time in ms since the epoch, u32 failed lookups,
+ *          then the ID, fingerprint type and fingerprint data, each
+ *          NUL-terminated
+ *
+ *  An entry is appended in a single write to a file opened O_APPEND, so
+ *  any number of threads and processes can add to one spool. One torn by
+ *  a crash, or damaged, fails its hash and is skipped on reading.
+ */
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct spool_s spool_t;
+
+typedef struct
+{
+    const char* id;           /* the clip, as named to --fingerprint */
+    uint64_t    captured_ms;  /* when it was captured, ms since the epoch */
+    uint32_t    attempts;     /* lookups of it that have failed */
+    const char* fp_type;      /* the SDK's name for the kind of fingerprint */
+    const char* fp_data;
+
+} spool_entry_t;
+
+/* Everything read from a spool by spool_read() */
+typedef struct
+{
+    spool_entry_t* entries;   /* pointing into data */
+    size_t         count;
+    size_t         damaged;   /* bytes skipped as not part of a whole entry */
+    char*          data;
+
+} spool_contents_t;
+
+/*
+ * Open the spool at path for appending, creating it if there isn't one.
+ * Returns NULL with errno set on failure.
+ */
+spool_t*
+spool_open(
+    const char* path
+    );
+
+void
+spool_close(
+    spool_t* spool
+    );
+
+/*
+ * Append an entry. Returns 0 once it is written in full, or -1 with
+ * errno set.
+ */
+int
+spool_append(
+    spool_t*             spool,
+    const spool_entry_t* entry
+    );
+
+/*
+ * Read every whole entry of the spool at path, in the order they were
+ * appended, into *p_contents for spool_contents_free() to free. Returns
+ * -1 with errno set if it can't be read.
+ */
+int
+spool_read(
+    const char*       path,
+    spool_contents_t* p_contents
+    );
+
+void
+spool_contents_free(
+    spool_contents_t* p_contents
+    );
+
+#endif /* SPOOL_H */
@@ -0,0 +1,42 @@
+/*
+ *  Name: check.h
+ *  Description:
+ *  What the unit tests in tests/ check with. A failed check is reported
+ *  on stderr with where it was and the test carries on; the test exits
+ *  with the number of checks that failed.
+ */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <string.h>
+
+static int s_failures;
+
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+            s_failures++;                                                       \
+        }                                                                       \
+    } while (0)
+
+/* size bytes at actual are the string expected */
+#define CHECK_BYTES(actual, size, expected)                                     \
+    do                                                                          \
+    {                                                                           \
+        if ((size) != strlen(expected) || 0 != memcmp((actual), (expected), (size))) \
+        {                                                                       \
+            fprintf(stderr, "%s:%d: got %.*s\n    expected %s\n", __FILE__, __LINE__, \
+                    (int)(size), (const char*)(actual), (expected));            \
+            s_failures++;                                                       \
+        }                                                                       \
+    } while (0)
+
+/* the result of a test: 0 if every check passed */
+#define CHECK_RESULT() ((s_failures > 125) ? 125 : s_failures)
+
+#endif /* CHECK_H */
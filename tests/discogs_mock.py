@@ -0,0 +1,170 @@
+#!/usr/bin/env python
+#
+# A stand-in for the parts of the Discogs API that identify.py calls:
+# master search, master versions and wantlist additions. Point
+# DISCOGS_BASE_URL (and the OAuth URLs) at it. Every call is logged with
+# when it arrived, so a test can check how many calls were made and how
+# far apart; any call can be slowed down, and the first calls for an
+# artist can be turned away with 429 and a Retry-After.
+#
+#   python tests/discogs_mock.py [port]
+#
+
+import json
+import re
+import sys
+import threading
+import time
+
+try:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
+    from urlparse import urlparse, parse_qs
+except ImportError:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
+    from urllib.parse import urlparse, parse_qs
+
+# artist, album -> master; every master has one release, its ID plus 1000
+CATALOG = {
+    ("daft punk", "homework"): {"id": 45131, "title": "Daft Punk - Homework", "year": 1997},
+    ("air", "moon safari"): {"id": 8085, "title": "Air - Moon Safari", "year": 1998},
+    ("massive attack", "mezzanine"): {"id": 6699, "title": "Massive Attack - Mezzanine", "year": 1998},
+    ("portishead", "dummy"): {"id": 2781, "title": "Portishead - Dummy", "year": 1994},
+    ("bjork", "post"): {"id": 3853, "title": "Bjork - Post", "year": 1995},
+    ("moby", "play"): {"id": 1011, "title": "Moby - Play", "year": 1999},
+    ("the orb", "orblivion"): {"id": 4311, "title": "The Orb - Orblivion", "year": 1997},
+    ("leftfield", "leftism"): {"id": 3521, "title": "Leftfield - Leftism", "year": 1995},
+    ("underworld", "second toughest in the infants"): {"id": 5517, "title": "Underworld - Second Toughest In The Infants", "year": 1996},
+    ("orbital", "in sides"): {"id": 1904, "title": "Orbital - In Sides", "year": 1996},
+    ("goldie", "timeless"): {"id": 2260, "title": "Goldie - Timeless", "year": 1995},
+}
+
+
+class Call(object):
+    def __init__(self, method, path, params, artist):
+        self.time = time.time()
+        self.method = method
+        self.path = path
+        self.params = params
+        self.artist = artist
+        self.status = None
+
+
+class DiscogsMock(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+    def __init__(self, port=0):
+        HTTPServer.__init__(self, ("127.0.0.1", port), Handler)
+        self.lock = threading.Lock()
+        self.calls = []
+        self.delays = {}     # artist -> seconds each search for it takes
+        self.throttle = {}   # artist -> [429s still to send, Retry-After]
+        self.thread = None
+
+    @property
+    def url(self):
+        return "http://127.0.0.1:{}/".format(self.server_address[1])
+
+    def start(self):
+        self.thread = threading.Thread(target=self.serve_forever)
+        self.thread.daemon = True
+        self.thread.start()
+        return self
+
+    def stop(self):
+        self.shutdown()
+        self.server_close()
+
+    def reset(self):
+        with self.lock:
+            self.calls = []
+            self.delays = {}
+            self.throttle = {}
+
+    def searches(self, artist=None):
+        with self.lock:
+            return [c for c in self.calls if c.path == "/database/search"
+                    and (artist is None or c.artist == artist)]
+
+    def log(self, call):
+        with self.lock:
+            self.calls.append(call)
+            left = self.throttle.get(call.artist)
+            if left and left[0] > 0:
+                left[0] -= 1
+                return left[1]
+        return None
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def reply(self, status, body=None, headers=None):
+        data = json.dumps(body).encode("utf-8") if body is not None else b""
+        self.send_response(status)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def handle_call(self, method):
+        url = urlparse(self.path)
+        params = dict((k, v[0]) for k, v in parse_qs(url.query).items())
+        length = int(self.headers.get("Content-Length") or 0)
+        if length:
+            self.rfile.read(length)
+        artist = params.get("artist", "").lower() or None
+        call = Call(method, url.path, params, artist)
+        retry_after = self.server.log(call)
+
+        if retry_after is not None:
+            call.status = 429
+            self.reply(429, {"message": "You are making requests too quickly."},
+                       {"Retry-After": str(retry_after)})
+            return
+
+        delay = self.server.delays.get(artist, 0)
+        if delay:
+            time.sleep(delay)
+
+        versions = re.match(r"^/masters/(\d+)/versions$", url.path)
+        wants = re.match(r"^/users/[^/]+/wants/(\d+)$", url.path)
+        if method == "GET" and url.path == "/database/search":
+            master = CATALOG.get((artist or "", params.get("release_title", "").lower()))
+            results = []
+            if master:
+                results.append(dict(master, uri="/master/{}".format(master["id"])))
+            call.status = 200
+            self.reply(200, {"results": results})
+        elif method == "GET" and versions:
+            master_id = int(versions.group(1))
+            titles = [m["title"] for m in CATALOG.values() if m["id"] == master_id]
+            call.status = 200
+            self.reply(200, {"versions": [{"id": master_id + 1000, "title": t} for t in titles]})
+        elif method == "PUT" and wants:
+            call.status = 201
+            self.reply(201, {"id": int(wants.group(1))})
+        else:
+            call.status = 404
+            self.reply(404, {"message": "The requested resource was not found."})
+
+    def do_GET(self):
+        self.handle_call("GET")
+
+    def do_PUT(self):
+        self.handle_call("PUT")
+
+
+if __name__ == "__main__":
+    server = DiscogsMock(int(sys.argv[1]) if len(sys.argv) > 1 else 8765)
+    sys.stderr.write("Discogs mock at {}\n".format(server.url))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Build and run the unit tests of the modules:
+#
+#   tests/run.sh [build dir]
+#
+# Only gnsdk_stub.c needs the SDK headers, from $GNSDK/include; its test
+# is skipped if GNSDK isn't set.
+#
+# Each test_<module>.c is built with <module>.c alone (CC, CFLAGS and
+# LIBS are used if set, e.g. to build the decoders in with
+# CFLAGS=-DSAMPLE_WITH_FLAC LIBS=-lFLAC) and exits with how many of its
+# checks failed.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+BUILD=${1:-build/tests}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2 -Wall -Wextra}
+mkdir -p "$BUILD" || exit 1
+
+failed=0
+for test in tests/test_*.c; do
+    module=$(basename "$test" .c)
+    module=${module#test_}
+    includes=
+    if [ "$module" = gnsdk_stub ]; then
+        if [ -z "$GNSDK" ]; then
+            echo "skip $module (GNSDK not set)"
+            continue
+        fi
+        includes="-I$GNSDK/include"
+    fi
+    if ! $CC $CFLAGS $includes -o "$BUILD/test_$module" "$test" "$module.c" $LIBS -lpthread -lm; then
+        echo "FAIL $module (build)"
+        failed=$((failed + 1))
+    elif "$BUILD/test_$module"; then
+        echo "ok   $module"
+    else
+        echo "FAIL $module"
+        failed=$((failed + 1))
+    fi
+done
+
+exit $failed
@@ -0,0 +1,333 @@
+/*
+ *  Name: test_cache.c
+ *  Description:
+ *  cache.c: the same audio gets the same key whatever silence leads
+ *  into it or whatever follows the keyed window, while a different
+ *  format, variant or length gets another; answers come back as they
+ *  were stored, each kind under its own ttl, and once the cache is too
+ *  big the oldest entries go first.
+ */
+
+#include "../cache.h"
+#include "check.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define RATE 8000
+
+/******************************************************************
+ *
+ *    _TONE
+ *
+ *    seconds of 16 bit mono: silence seconds of silence, then a
+ *    tone that changes every second from first on.
+ *
+ *****************************************************************/
+static int16_t*
+_tone(
+    size_t seconds,
+    size_t silence,
+    int    first,
+    size_t* p_size
+    )
+{
+    int16_t* pcm = calloc(seconds * RATE, sizeof(int16_t));
+    size_t   i   = 0;
+
+    for (i = silence * RATE; pcm && i < seconds * RATE; i++)
+    {
+        pcm[i] = (int16_t)(((int)(i % 50) - 25) * (first + (int)(i / RATE - silence)) * 10);
+    }
+    *p_size = seconds * RATE * sizeof(int16_t);
+
+    return pcm;
+
+} /* _tone() */
+
+/******************************************************************
+ *
+ *    _KEY
+ *
+ *****************************************************************/
+static void
+_key(
+    const int16_t* pcm,
+    size_t         size,
+    uint32_t       bits,
+    uint32_t       variant,
+    char           key[CACHE_KEY_SIZE]
+    )
+{
+    audio_format_t format = { RATE, bits, 1 };
+
+    cache_key(&format, pcm, size, variant, key);
+
+} /* _key() */
+
+/******************************************************************
+ *
+ *    _TEST_KEY
+ *
+ *****************************************************************/
+static void
+_test_key(void)
+{
+    size_t   size      = 0;
+    size_t   lead_size = 0;
+    size_t   long_size = 0;
+    size_t   skip      = 2 * RATE * sizeof(int16_t);
+    int16_t* pcm       = _tone(5, 0, 1, &size);
+    int16_t* lead      = _tone(7, 2, 1, &lead_size);
+    int16_t* longer    = _tone(CACHE_KEY_SECONDS + 10, 0, 1, &long_size);
+    int16_t* other     = _tone(CACHE_KEY_SECONDS + 10, 0, 1, &long_size);
+    char     key[CACHE_KEY_SIZE];
+    char     other_key[CACHE_KEY_SIZE];
+
+    CHECK(pcm && lead && longer && other);
+    if (!(pcm && lead && longer && other))
+    {
+        return;
+    }
+
+    _key(pcm, size, 16, 0, key);
+    CHECK(strlen(key) == CACHE_KEY_SIZE - 1);
+
+    /* two seconds of silence first: the same audio */
+    _key(lead, lead_size, 16, 0, other_key);
+    CHECK(0 == strcmp(key, other_key));
+
+    /* the same bytes in another format, or asked for another variant */
+    _key(pcm, size, 8, 0, other_key);
+    CHECK(0 != strcmp(key, other_key));
+    _key(pcm, size, 16, 1, other_key);
+    CHECK(0 != strcmp(key, other_key));
+
+    /* only starting the same: a different length is different audio */
+    _key(pcm, size - skip, 16, 0, other_key);
+    CHECK(0 != strcmp(key, other_key));
+
+    /* past the window only the length counts */
+    other[(CACHE_KEY_SECONDS + 5) * RATE] ^= 0x1000;
+    _key(longer, long_size, 16, 0, key);
+    _key(other, long_size, 16, 0, other_key);
+    CHECK(0 == strcmp(key, other_key));
+    other[RATE] ^= 0x1000;
+    _key(other, long_size, 16, 0, other_key);
+    CHECK(0 != strcmp(key, other_key));
+    _key(longer, long_size - skip, 16, 0, other_key);
+    CHECK(0 != strcmp(key, other_key));
+
+    free(pcm);
+    free(lead);
+    free(longer);
+    free(other);
+
+} /* _test_key() */
+
+/******************************************************************
+ *
+ *    _AGE
+ *
+ *    Make the entry for key of kind ("match" or "nomatch") seconds
+ *    old.
+ *
+ *****************************************************************/
+static void
+_age(
+    const char* dir,
+    const char* kind,
+    const char* key,
+    long        seconds
+    )
+{
+    char           path[256];
+    struct timeval times[2];
+
+    snprintf(path, sizeof(path), "%s/%s/%.2s/%s", dir, kind, key, key);
+    times[0].tv_sec  = time(NULL) - seconds;
+    times[0].tv_usec = 0;
+    times[1]         = times[0];
+    CHECK(0 == utimes(path, times));
+
+} /* _age() */
+
+/******************************************************************
+ *
+ *    _LOOKS_UP
+ *
+ *    Whether key is found, holding expected.
+ *
+ *****************************************************************/
+static int
+_looks_up(
+    cache_t*    cache,
+    const char* key,
+    const char* expected
+    )
+{
+    void*  record = NULL;
+    size_t size   = 0;
+    int    b_hit  = (0 == cache_lookup(cache, key, &record, &size));
+
+    if (b_hit)
+    {
+        CHECK_BYTES(record, size, expected);
+    }
+    free(record);
+
+    return b_hit;
+
+} /* _looks_up() */
+
+/******************************************************************
+ *
+ *    _TEST_STORE
+ *
+ *****************************************************************/
+static void
+_test_store(
+    const char* dir
+    )
+{
+    cache_t*      cache = cache_open(dir, 100, 10, 1 << 20);
+    cache_t*      other = NULL;
+    cache_stats_t stats;
+
+    CHECK(cache != NULL);
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    CHECK(!_looks_up(cache, "0123456789abcdef0123456789abcdef", ""));
+    cache_store(cache, "0123456789abcdef0123456789abcdef", "matched", 7, 0);
+    cache_store(cache, "fedcba9876543210fedcba9876543210", "none", 4, 1);
+    CHECK(_looks_up(cache, "0123456789abcdef0123456789abcdef", "matched"));
+    CHECK(_looks_up(cache, "fedcba9876543210fedcba9876543210", "none"));
+
+    /* each kind expires on its own ttl, and is gone once it has */
+    _age(dir, "match", "0123456789abcdef0123456789abcdef", 50);
+    _age(dir, "nomatch", "fedcba9876543210fedcba9876543210", 50);
+    CHECK(_looks_up(cache, "0123456789abcdef0123456789abcdef", "matched"));
+    CHECK(!_looks_up(cache, "fedcba9876543210fedcba9876543210", "none"));
+
+    cache_get_stats(cache, &stats);
+    CHECK(stats.hits == 2 && stats.negative_hits == 1 && stats.misses == 2);
+    CHECK(stats.stores == 2 && stats.evictions == 1);
+
+    /* a process keeping no "no match" answers neither stores, looks up
+     * nor expires them, even when it scans the cache: they are someone
+     * else's */
+    cache_store(cache, "00112233445566778899aabbccddeeff", "none", 4, 1);
+    _age(dir, "nomatch", "00112233445566778899aabbccddeeff", 50);
+    other = cache_open(dir, 100, 0, 1 << 20);
+    CHECK(other != NULL);
+    if (other)
+    {
+        cache_store(other, "ffeeddccbbaa99887766554433221100", "none", 4, 1);
+        cache_store(other, "8899aabbccddeeff0011223344556677", "matched", 7, 0);
+        CHECK(!_looks_up(other, "00112233445566778899aabbccddeeff", "none"));
+        CHECK(_looks_up(other, "0123456789abcdef0123456789abcdef", "matched"));
+        cache_get_stats(other, &stats);
+        CHECK(stats.stores == 1 && stats.evictions == 0);
+        cache_close(other);
+    }
+    _age(dir, "nomatch", "00112233445566778899aabbccddeeff", 5);
+    CHECK(_looks_up(cache, "00112233445566778899aabbccddeeff", "none"));
+    CHECK(!_looks_up(cache, "ffeeddccbbaa99887766554433221100", "none"));
+    CHECK(_looks_up(cache, "8899aabbccddeeff0011223344556677", "matched"));
+
+    cache_close(cache);
+
+} /* _test_store() */
+
+/******************************************************************
+ *
+ *    _TEST_TRIM
+ *
+ *****************************************************************/
+static void
+_test_trim(
+    const char* dir
+    )
+{
+    static const char* s_keys[] =
+    {
+        "a0000000000000000000000000000000", "b0000000000000000000000000000000",
+        "c0000000000000000000000000000000", "d0000000000000000000000000000000",
+    };
+    char          record[300];
+    cache_t*      cache = cache_open(dir, 1000, 1000, 1000);
+    cache_stats_t stats;
+    int           i     = 0;
+
+    CHECK(cache != NULL);
+    if (cache == NULL)
+    {
+        return;
+    }
+    memset(record, 'x', sizeof(record) - 1);
+    record[sizeof(record) - 1] = '\0';
+
+    /* storing one key again replaces it rather than adding to the size */
+    for (i = 0; i < 5; i++)
+    {
+        cache_store(cache, s_keys[0], record, sizeof(record) - 1, 0);
+    }
+    cache_get_stats(cache, &stats);
+    CHECK(stats.evictions == 0);
+
+    /* three of 299 bytes fit; the fourth makes room by evicting the
+     * oldest, down to 900 */
+    _age(dir, "match", s_keys[0], 30);
+    cache_store(cache, s_keys[1], record, sizeof(record) - 1, 1);
+    _age(dir, "nomatch", s_keys[1], 20);
+    cache_store(cache, s_keys[2], record, sizeof(record) - 1, 0);
+    _age(dir, "match", s_keys[2], 10);
+    cache_get_stats(cache, &stats);
+    CHECK(stats.evictions == 0);
+
+    cache_store(cache, s_keys[3], record, sizeof(record) - 1, 0);
+    cache_get_stats(cache, &stats);
+    CHECK(stats.evictions == 1);
+    CHECK(!_looks_up(cache, s_keys[0], record));
+    CHECK(_looks_up(cache, s_keys[1], record));
+    CHECK(_looks_up(cache, s_keys[2], record));
+    CHECK(_looks_up(cache, s_keys[3], record));
+
+    cache_close(cache);
+
+} /* _test_trim() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    char dir[] = "/tmp/test_cache.XXXXXX";
+    char path[64];
+    char command[96];
+
+    CHECK(mkdtemp(dir) != NULL);
+
+    _test_key();
+
+    snprintf(path, sizeof(path), "%s/store", dir);
+    _test_store(path);
+
+    snprintf(path, sizeof(path), "%s/trim", dir);
+    _test_trim(path);
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    CHECK(0 == system(command));
+
+    return CHECK_RESULT();
+
+} /* main() */
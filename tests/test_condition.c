@@ -0,0 +1,255 @@
+/*
+ *  Name: test_condition.c
+ *  Description:
+ *  condition.c: silence before the first sound and after the last is
+ *  dropped, silence between sounds is kept (unless it goes on so long
+ *  it can't be held), quiet sound is brought up by no more than the
+ *  maximum gain and never into clipping, and loud sound is left as it
+ *  is, however the audio is split up between calls.
+ */
+
+#include "../condition.h"
+#include "check.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define RATE 8000
+
+/* a little audio to be conditioned */
+typedef struct
+{
+    int16_t* pcm;
+    size_t   count;
+
+} audio_t;
+
+/******************************************************************
+ *
+ *    _ADD
+ *
+ *    seconds of a 440 Hz tone of amplitude (0 for silence), with
+ *    every spike_every-th sample replaced by spike if that's set.
+ *
+ *****************************************************************/
+static void
+_add(
+    audio_t* audio,
+    double   seconds,
+    double   amplitude,
+    size_t   spike_every,
+    int16_t  spike
+    )
+{
+    size_t   count = (size_t)(seconds * RATE);
+    int16_t* grown = realloc(audio->pcm, (audio->count + count) * sizeof(int16_t));
+    size_t   i     = 0;
+
+    CHECK(grown != NULL);
+    if (grown == NULL)
+    {
+        return;
+    }
+    audio->pcm = grown;
+
+    for (i = 0; i < count; i++)
+    {
+        audio->pcm[audio->count + i] = (int16_t)lrint(amplitude * sin(2 * M_PI * 440 * i / RATE));
+        if (spike_every && 0 == i % spike_every)
+        {
+            audio->pcm[audio->count + i] = spike;
+        }
+    }
+    audio->count += count;
+
+} /* _add() */
+
+/******************************************************************
+ *
+ *    _CONDITION
+ *
+ *    Condition audio in chunks of chunk samples, then flush. What
+ *    came out is returned in *p_out (to be freed) and its sample
+ *    count returned; how much came out before the flush is left in
+ *    *p_before_flush.
+ *
+ *****************************************************************/
+static size_t
+_condition(
+    const audio_t*     audio,
+    size_t             chunk,
+    double             max_gain_db,
+    int16_t**          p_out,
+    size_t*            p_before_flush,
+    condition_stats_t* p_stats
+    )
+{
+    condition_t*   condition = condition_open(RATE, 1, -60, max_gain_db);
+    const int16_t* ready     = NULL;
+    int16_t*       out       = malloc(audio->count * sizeof(int16_t));
+    size_t         count     = 0;
+    size_t         size      = 0;
+    size_t         i         = 0;
+    size_t         part      = 0;
+
+    *p_out = out;
+    CHECK(condition != NULL && out != NULL);
+    if (condition == NULL || out == NULL)
+    {
+        condition_close(condition);
+        return 0;
+    }
+
+    for (i = 0; i < audio->count; i += part)
+    {
+        part = (audio->count - i < chunk) ? audio->count - i : chunk;
+        size = condition_process(condition, audio->pcm + i, part * sizeof(int16_t), &ready);
+        CHECK(count + size / sizeof(int16_t) <= audio->count);
+        if (size > 0)
+        {
+            memcpy(out + count, ready, size);
+            count += size / sizeof(int16_t);
+        }
+    }
+    *p_before_flush = count;
+
+    size = condition_flush(condition, &ready);
+    CHECK(count + size / sizeof(int16_t) <= audio->count);
+    if (size > 0)
+    {
+        memcpy(out + count, ready, size);
+        count += size / sizeof(int16_t);
+    }
+
+    condition_get_stats(condition, p_stats);
+    condition_close(condition);
+
+    return count;
+
+} /* _condition() */
+
+/******************************************************************
+ *
+ *    _TEST_TRIM
+ *
+ *****************************************************************/
+static void
+_test_trim(void)
+{
+    static const size_t s_chunks[] = { 400, 333, 4096, 1 };
+    audio_t             audio      = { NULL, 0 };
+    condition_stats_t   stats;
+    int16_t*            out        = NULL;
+    size_t              count      = 0;
+    size_t              before     = 0;
+    size_t              i          = 0;
+
+    /* louder than the target level, so there is no gain: a second of
+     * silence, two of sound, half a second's gap, one of sound and a
+     * second of silence again */
+    _add(&audio, 1, 0, 0, 0);
+    _add(&audio, 2, 8000, 0, 0);
+    _add(&audio, 0.5, 3, 0, 0);
+    _add(&audio, 1, 8000, 0, 0);
+    _add(&audio, 1, 0, 0, 0);
+
+    for (i = 0; i < sizeof(s_chunks) / sizeof(s_chunks[0]); i++)
+    {
+        count = _condition(&audio, s_chunks[i], 20, &out, &before, &stats);
+        CHECK(count == (size_t)(3.5 * RATE));
+        CHECK(before == count);
+        CHECK(out && 0 == memcmp(out, audio.pcm + RATE, count * sizeof(int16_t)));
+        free(out);
+
+        CHECK(fabs(stats.seconds_in - 5.5) < 1e-9);
+        CHECK(fabs(stats.leading_silence_seconds - 1) < 1e-9);
+        CHECK(fabs(stats.trailing_silence_seconds - 1) < 1e-9);
+        CHECK(fabs(stats.level_db - 20 * log10(8000 / sqrt(2) / 32768)) < 0.01);
+        CHECK(stats.mean_gain_db == 0 && stats.max_gain_db == 0);
+    }
+
+    /* silence that goes on too long to hold is written after all, and
+     * only what follows it is trailing */
+    audio.count = 0;
+    _add(&audio, 1, 8000, 0, 0);
+    _add(&audio, 12, 0, 0, 0);
+    count = _condition(&audio, 4096, 20, &out, &before, &stats);
+    CHECK(count > 11 * RATE && count < 11.1 * RATE);
+    CHECK(stats.trailing_silence_seconds > 1.9 && stats.trailing_silence_seconds < 2);
+    free(out);
+
+    /* nothing but silence */
+    audio.count = 0;
+    _add(&audio, 2, 0, 0, 0);
+    count = _condition(&audio, 4096, 20, &out, &before, &stats);
+    CHECK(count == 0);
+    CHECK(fabs(stats.leading_silence_seconds - 2) < 1e-9);
+    CHECK(isinf(stats.level_db) && stats.level_db < 0);
+    free(out);
+
+    free(audio.pcm);
+
+} /* _test_trim() */
+
+/******************************************************************
+ *
+ *    _TEST_GAIN
+ *
+ *****************************************************************/
+static void
+_test_gain(void)
+{
+    audio_t           audio  = { NULL, 0 };
+    condition_stats_t stats;
+    int16_t*          out    = NULL;
+    size_t            count  = 0;
+    size_t            before = 0;
+    size_t            i      = 0;
+    int               high   = 0;
+    double            gain   = pow(10, 12 / 20.0);
+
+    /* -40dBFS: brought up by the most allowed, 12dB */
+    _add(&audio, 3, 463, 0, 0);
+    count = _condition(&audio, 1000, 12, &out, &before, &stats);
+    CHECK(count == audio.count);
+    for (i = 0; out && i < count; i++)
+    {
+        CHECK(fabs(out[i] - audio.pcm[i] * gain) <= 1);
+    }
+    CHECK(fabs(stats.mean_gain_db - 12) < 0.01 && fabs(stats.max_gain_db - 12) < 0.01);
+    free(out);
+
+    /* no more than the peak allows */
+    audio.count = 0;
+    _add(&audio, 3, 100, 400, 20000);
+    count = _condition(&audio, 1000, 40, &out, &before, &stats);
+    CHECK(count == audio.count);
+    for (i = 0; out && i < count; i++)
+    {
+        high = (abs(out[i]) > high) ? abs(out[i]) : high;
+    }
+    CHECK(high <= 32767 && high > 32000);
+    CHECK(stats.max_gain_db <= 20 * log10(32767.0 / 20000) + 0.01);
+    free(out);
+
+    free(audio.pcm);
+
+} /* _test_gain() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    CHECK(NULL == condition_open(RATE, 0, -60, 20));
+    CHECK(NULL == condition_open(10, 1, -60, 20));
+
+    _test_trim();
+    _test_gain();
+
+    return CHECK_RESULT();
+
+} /* main() */
@@ -0,0 +1,300 @@
+/*
+ *  Name: test_convert.c
+ *  Description:
+ *  convert.c: every sample format comes out as the same 16 bit value,
+ *  saturated where it is out of range, more than two channels are mixed
+ *  down to stereo, and resampled audio keeps what is below the new
+ *  Nyquist frequency, loses what is above it, and doesn't depend on how
+ *  the input was split up between calls.
+ */
+
+#include "../convert.h"
+#include "check.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/******************************************************************
+ *
+ *    _CONVERT
+ *
+ *    Convert the frames in pcm in one go; the 16 bit samples are
+ *    copied into out and their count returned.
+ *
+ *****************************************************************/
+static size_t
+_convert(
+    uint32_t    rate,
+    uint32_t    bits,
+    uint32_t    channels,
+    int         b_float,
+    const void* pcm,
+    size_t      size,
+    int16_t*    out
+    )
+{
+    audio_format_t format     = { rate, bits, channels };
+    audio_format_t out_format = { 0, 0, 0 };
+    convert_t*     convert    = convert_open(&format, b_float, rate, &out_format);
+    const int16_t* converted  = NULL;
+    size_t         out_size   = 0;
+
+    CHECK(convert != NULL);
+    if (convert == NULL)
+    {
+        return 0;
+    }
+    CHECK(out_format.sample_rate == rate && out_format.bits_per_sample == 16);
+    CHECK(out_format.channels == ((channels == 1) ? 1u : 2u));
+
+    out_size = convert_process(convert, pcm, size, &converted);
+    memcpy(out, converted, out_size);
+    convert_close(convert);
+
+    return out_size / sizeof(int16_t);
+
+} /* _convert() */
+
+/******************************************************************
+ *
+ *    _TEST_FORMATS
+ *
+ *****************************************************************/
+static void
+_test_formats(void)
+{
+    static const unsigned char s_u8[]  = { 0x80, 0xFF, 0x00, 0xC0 };
+    static const int16_t       s_s16[] = { 0, 32767, -32768, 16384 };
+    static const unsigned char s_s24[] = { 0x00, 0x00, 0x00,  0xFF, 0xFF, 0x7F,  0x00, 0x00, 0x80,  0x56, 0x34, 0x12 };
+    static const int32_t       s_s32[] = { 0, 0x7FFFFFFF, (int32_t)0x80000000, 0x12345678 };
+    static const float         s_f32[] = { 0.0f, 0.5f, -1.0f, 2.0f, -2.0f, 0.25f, 0.125f, -0.125f };
+    int16_t                    out[8];
+    audio_format_t             format  = { 44100, 16, 2 };
+    audio_format_t             out_format;
+
+    /* already what the channel takes, as long as the rate matches */
+    CHECK(!convert_needed(&format, 0, 44100));
+    CHECK(convert_needed(&format, 1, 44100));
+    CHECK(convert_needed(&format, 0, 22050));
+    format.channels = 6;
+    CHECK(convert_needed(&format, 0, 44100));
+    format.channels        = 1;
+    format.bits_per_sample = 24;
+    CHECK(convert_needed(&format, 0, 44100));
+
+    CHECK(4 == _convert(44100, 8, 1, 0, s_u8, sizeof(s_u8), out));
+    CHECK(out[0] == 0 && out[1] == 32512 && out[2] == -32768 && out[3] == 16384);
+
+    CHECK(4 == _convert(44100, 16, 2, 0, s_s16, sizeof(s_s16), out));
+    CHECK(0 == memcmp(out, s_s16, sizeof(s_s16)));
+
+    CHECK(4 == _convert(44100, 24, 1, 0, s_s24, sizeof(s_s24), out));
+    CHECK(out[0] == 0 && out[1] == 32767 && out[2] == -32768 && out[3] == 0x1234);
+
+    CHECK(4 == _convert(44100, 32, 1, 0, s_s32, sizeof(s_s32), out));
+    CHECK(out[0] == 0 && out[1] == 32767 && out[2] == -32768 && out[3] == 0x1234);
+
+    /* float beyond [-1, 1] saturates */
+    CHECK(8 == _convert(44100, 32, 2, 1, s_f32, sizeof(s_f32), out));
+    CHECK(out[0] == 0 && out[1] == 16384 && out[2] == -32768 && out[3] == 32767 && out[4] == -32768);
+    CHECK(out[5] == 8192 && out[6] == 4096 && out[7] == -4096);
+
+    /* nothing else is taken */
+    CHECK(NULL == convert_open(&format, 1, 44100, &out_format));
+    format.bits_per_sample = 12;
+    CHECK(NULL == convert_open(&format, 0, 44100, &out_format));
+    format.bits_per_sample = 16;
+    format.channels        = 0;
+    CHECK(NULL == convert_open(&format, 0, 44100, &out_format));
+
+} /* _test_formats() */
+
+/******************************************************************
+ *
+ *    _TEST_DOWNMIX
+ *
+ *****************************************************************/
+static void
+_test_downmix(void)
+{
+    /* FL FR FC LFE BL BR */
+    static const int16_t s_front_left[] = { 16384, 0, 0, 0, 0, 0 };
+    static const int16_t s_centre[]     = { 0, 0, 16384, 16384, 0, 0 };
+    static const int16_t s_back_right[] = { 0, 0, 0, 0, 0, 16384 };
+    static const int16_t s_three[]      = { 16384, 8192, 4096 };
+    static const int16_t s_four[]       = { 16384, 8192, 4096, 0 };
+    int16_t              out[2];
+
+    CHECK(2 == _convert(48000, 16, 6, 0, s_front_left, sizeof(s_front_left), out));
+    CHECK(out[0] == 8192 && out[1] == 0);
+
+    /* the centre goes to both sides at -3dB, the LFE nowhere */
+    CHECK(2 == _convert(48000, 16, 6, 0, s_centre, sizeof(s_centre), out));
+    CHECK(out[0] == 5793 && out[1] == 5793);
+
+    CHECK(2 == _convert(48000, 16, 6, 0, s_back_right, sizeof(s_back_right), out));
+    CHECK(out[0] == 0 && out[1] == 5793);
+
+    /* other counts: the even channels left, the odd ones right */
+    CHECK(2 == _convert(48000, 16, 3, 0, s_three, sizeof(s_three), out));
+    CHECK(out[0] == 10240 && out[1] == 8192);
+    CHECK(2 == _convert(48000, 16, 4, 0, s_four, sizeof(s_four), out));
+    CHECK(out[0] == 10240 && out[1] == 4096);
+
+} /* _test_downmix() */
+
+/******************************************************************
+ *
+ *    _RESAMPLE
+ *
+ *    A second of a tone at frequency Hz, in_rate mono, resampled to
+ *    out_rate in chunks of chunk frames. The output is left in out
+ *    (room for out_rate samples) and its frame count returned.
+ *
+ *****************************************************************/
+static size_t
+_resample(
+    uint32_t in_rate,
+    uint32_t out_rate,
+    double   frequency,
+    size_t   chunk,
+    int16_t* out
+    )
+{
+    audio_format_t format     = { in_rate, 16, 1 };
+    audio_format_t out_format = { 0, 0, 0 };
+    convert_t*     convert    = convert_open(&format, 0, out_rate, &out_format);
+    int16_t*       pcm        = malloc(in_rate * sizeof(int16_t));
+    const int16_t* converted  = NULL;
+    size_t         out_size   = 0;
+    size_t         produced   = 0;
+    size_t         i          = 0;
+    size_t         frames     = 0;
+
+    CHECK(convert != NULL && pcm != NULL);
+    if (convert == NULL || pcm == NULL)
+    {
+        convert_close(convert);
+        free(pcm);
+        return 0;
+    }
+    CHECK(out_format.sample_rate == out_rate && out_format.channels == 1);
+
+    for (i = 0; i < in_rate; i++)
+    {
+        pcm[i] = (int16_t)lrint(16384 * sin(2 * M_PI * frequency * i / in_rate));
+    }
+    for (i = 0; i < in_rate; i += frames)
+    {
+        frames   = (in_rate - i < chunk) ? in_rate - i : chunk;
+        out_size = convert_process(convert, pcm + i, frames * sizeof(int16_t), &converted);
+        CHECK(produced + out_size / sizeof(int16_t) <= out_rate);
+        memcpy(out + produced, converted, out_size);
+        produced += out_size / sizeof(int16_t);
+    }
+
+    convert_close(convert);
+    free(pcm);
+
+    return produced;
+
+} /* _resample() */
+
+/******************************************************************
+ *
+ *    _AMPLITUDE
+ *
+ *    Of the tone at frequency Hz in count samples at rate, away from
+ *    the edges.
+ *
+ *****************************************************************/
+static double
+_amplitude(
+    const int16_t* pcm,
+    size_t         count,
+    uint32_t       rate,
+    double         frequency
+    )
+{
+    double re = 0;
+    double im = 0;
+    size_t n  = 0;
+    size_t i  = 0;
+
+    for (i = 100; i + 100 < count; i++, n++)
+    {
+        re += pcm[i] * cos(2 * M_PI * frequency * i / rate);
+        im += pcm[i] * sin(2 * M_PI * frequency * i / rate);
+    }
+
+    return 2 * sqrt(re * re + im * im) / n;
+
+} /* _amplitude() */
+
+/******************************************************************
+ *
+ *    _TEST_RESAMPLE
+ *
+ *****************************************************************/
+static void
+_test_resample(void)
+{
+    int16_t* whole   = malloc(44100 * sizeof(int16_t));
+    int16_t* chunked = malloc(44100 * sizeof(int16_t));
+    size_t   count   = 0;
+    size_t   i       = 0;
+    double   error   = 0;
+
+    CHECK(whole != NULL && chunked != NULL);
+    if (whole == NULL || chunked == NULL)
+    {
+        free(whole);
+        free(chunked);
+        return;
+    }
+
+    /* down: the first output frame lines up with the first input frame,
+     * only the last few wait for input that never comes */
+    count = _resample(44100, 11025, 440, 44100, whole);
+    CHECK(count > 11025 - 16 && count <= 11025);
+    for (i = 16; i < count; i++)
+    {
+        error = fmax(error, fabs(whole[i] - 16384 * sin(2 * M_PI * 440 * i / 11025)));
+    }
+    CHECK(error < 16);
+
+    /* the same however the input comes in */
+    CHECK(count == _resample(44100, 11025, 440, 1001, chunked));
+    CHECK(0 == memcmp(whole, chunked, count * sizeof(int16_t)));
+    CHECK(count == _resample(44100, 11025, 440, 3, chunked));
+    CHECK(0 == memcmp(whole, chunked, count * sizeof(int16_t)));
+
+    /* above the new Nyquist frequency is filtered, not folded down */
+    count = _resample(44100, 11025, 9000, 4096, whole);
+    CHECK(_amplitude(whole, count, 11025, 11025 - 9000) < 32);
+
+    /* and up */
+    count = _resample(8000, 44100, 1000, 500, whole);
+    CHECK(count > 44100 - 100 && count <= 44100);
+    CHECK(fabs(_amplitude(whole, count, 44100, 1000) - 16384) < 160);
+
+    free(whole);
+    free(chunked);
+
+} /* _test_resample() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    _test_formats();
+    _test_downmix();
+    _test_resample();
+
+    return CHECK_RESULT();
+
+} /* main() */
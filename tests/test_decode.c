@@ -0,0 +1,147 @@
+/*
+ *  Name: test_decode.c
+ *  Description:
+ *  decode.c: FLAC, Ogg and MP3 (with or without an ID3 tag) are told
+ *  apart from WAV and raw PCM by their first bytes, and a stream that
+ *  can't be decoded, whether it is damaged or its decoder isn't built
+ *  in, is refused with a reason rather than read.
+ */
+
+#include "../decode.h"
+#include "check.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/******************************************************************
+ *
+ *    _TEST_DETECT
+ *
+ *****************************************************************/
+static void
+_test_detect(void)
+{
+    static const struct
+    {
+        const char*        magic;
+        size_t             size;
+        decode_container_t container;
+
+    } s_cases[] =
+    {
+        { "fLaC",             4, DECODE_FLAC },
+        { "OggS",             4, DECODE_VORBIS },
+        { "ID3\x04",          4, DECODE_MP3 },
+        { "\xFF\xFB\x90\x64", 4, DECODE_MP3 },   /* MPEG-1 layer III */
+        { "\xFF\xF3\x48\xC4", 4, DECODE_MP3 },   /* MPEG-2 layer III */
+        { "\xFF\xE0\x00\x00", 4, DECODE_NONE },  /* sync, but no layer */
+        { "\xFF\x7B\x90\x64", 4, DECODE_NONE },
+        { "RIFF",             4, DECODE_NONE },
+        { "fLa",              3, DECODE_NONE },
+        { "ID",               2, DECODE_NONE },
+        { "",                 0, DECODE_NONE },
+    };
+    size_t i = 0;
+
+    for (i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++)
+    {
+        if (s_cases[i].container != decode_detect((const unsigned char*)s_cases[i].magic, s_cases[i].size))
+        {
+            fprintf(stderr, "detecting case %u\n", (unsigned)i);
+            CHECK(0);
+        }
+    }
+
+} /* _test_detect() */
+
+/******************************************************************
+ *
+ *    _OPEN
+ *
+ *    decode_open() a stream of magic followed by some bytes that
+ *    aren't audio, on a pipe. Returns the error it gave, or NULL if it
+ *    opened.
+ *
+ *****************************************************************/
+static const char*
+_open(
+    decode_container_t container,
+    const char*        magic
+    )
+{
+    unsigned char  rest[4096];
+    audio_format_t format  = { 0, 0, 0 };
+    decode_t*      decode  = NULL;
+    const char*    error   = NULL;
+    int            fds[2]  = { -1, -1 };
+    size_t         i       = 0;
+
+    for (i = 0; i < sizeof(rest); i++)
+    {
+        rest[i] = (unsigned char)(i * 7 + 3);
+    }
+
+    CHECK(0 == pipe(fds));
+    CHECK((ssize_t)sizeof(rest) == write(fds[1], rest, sizeof(rest)));
+    close(fds[1]);
+
+    decode = decode_open(fds[0], container, (const unsigned char*)magic, strlen(magic), &format, &error);
+    CHECK((decode == NULL) == (error != NULL));
+    decode_close(decode);
+    close(fds[0]);
+
+    return decode ? NULL : error;
+
+} /* _open() */
+
+/******************************************************************
+ *
+ *    _TEST_OPEN
+ *
+ *****************************************************************/
+static void
+_test_open(void)
+{
+    const char* error = NULL;
+
+    error = _open(DECODE_NONE, "RIFF");
+    CHECK(error != NULL && 0 == strcmp(error, "Unrecognised audio format"));
+
+    error = _open(DECODE_FLAC, "fLaC");
+#if defined(SAMPLE_WITH_FLAC)
+    CHECK(error != NULL);
+#else
+    CHECK(error != NULL && 0 == strcmp(error, "FLAC input is not supported by this build"));
+#endif
+
+    error = _open(DECODE_MP3, "ID3");
+#if defined(SAMPLE_WITH_MP3)
+    CHECK(error != NULL);
+#else
+    CHECK(error != NULL && 0 == strcmp(error, "MP3 input is not supported by this build"));
+#endif
+
+    error = _open(DECODE_VORBIS, "OggS");
+#if defined(SAMPLE_WITH_VORBIS)
+    CHECK(error != NULL);
+#else
+    CHECK(error != NULL && 0 == strcmp(error, "Ogg Vorbis input is not supported by this build"));
+#endif
+
+} /* _test_open() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    _test_detect();
+    _test_open();
+
+    return CHECK_RESULT();
+
+} /* main() */
@@ -0,0 +1,160 @@
+#!/usr/bin/env python
+#
+# identify.py --enrich against the Discogs mock (discogs_mock.py): lines
+# come out in the order they went in however long each takes, each album
+# is looked up once across threads and runs, calls stay under
+# DISCOGS_RATE, and a call turned away with 429 waits out Retry-After.
+# PyAudio, keyring and rauth are replaced by the stand-ins in stubs/.
+#
+#   python tests/test_enrich.py
+#
+
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+
+from discogs_mock import DiscogsMock
+
+TESTS = os.path.dirname(os.path.abspath(__file__))
+IDENTIFY = os.path.join(TESTS, os.pardir, "identify.py")
+
+
+def result(artist, album, path):
+    return {"file": path, "result": {"artist": artist, "album": album, "track": "1"}}
+
+
+class EnrichTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.mock = DiscogsMock().start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.mock.stop()
+
+    def setUp(self):
+        self.mock.reset()
+        self.home = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.home)
+
+    def enrich(self, records, want=False, **config):
+        settings = {
+            "DISCOGS_CONSUMER_KEY": "key",
+            "DISCOGS_CONSUMER_SECRET": "secret",
+            "DISCOGS_KEY": "key",
+            "DISCOGS_SECRET": "secret",
+            "DISCOGS_USERNAME": "tester",
+            "DISCOGS_BASE_URL": self.mock.url,
+            "DISCOGS_REQUEST_TOKEN_URL": self.mock.url + "oauth/request_token",
+            "DISCOGS_ACCESS_TOKEN_URL": self.mock.url + "oauth/access_token",
+            "DISCOGS_AUTHORIZE_URL": self.mock.url + "oauth/authorize",
+            "DISCOGS_CACHE": os.path.join(self.home, "discogs.db"),
+            "DISCOGS_JOBS": "4",
+            "DISCOGS_RATE": "0",
+        }
+        settings.update(config)
+        with open(os.path.join(self.home, ".identifyaudiorc"), "w") as f:
+            for name, value in settings.items():
+                f.write("{} {}\n".format(name, value))
+
+        env = dict(os.environ, HOME=self.home)
+        env["PYTHONPATH"] = os.pathsep.join([os.path.join(TESTS, "stubs")]
+                                            + filter(None, [os.environ.get("PYTHONPATH")]))
+        lines = [r if isinstance(r, str) else json.dumps(r) for r in records]
+        app = subprocess.Popen([sys.executable, IDENTIFY, "--enrich"] + (["--want"] if want else []),
+                               stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                               env=env)
+        out, err = app.communicate("".join(line + "\n" for line in lines))
+        self.assertEqual(app.returncode, 0, err)
+        return out.splitlines()
+
+    def test_order_and_cache(self):
+        # the first album is slow, so later lines are ready long before it
+        self.mock.delays["daft punk"] = 0.5
+        records = [
+            result("Daft Punk", "Homework", "a.wav"),
+            result("Air", "Moon Safari", "b.wav"),
+            "not a record",
+            result("Massive Attack", "Mezzanine", "c.wav"),
+            result("daft punk", "HOMEWORK", "d.wav"),
+            {"file": "e.wav", "result": None},
+            {"file": "mix.wav", "tracklist": [
+                dict(result("Air", "Moon Safari", "mix.wav"), start_s=0),
+                dict(result("Nobody", "Nothing", "mix.wav"), start_s=240)]},
+            result("Portishead", "Dummy", "f.wav"),
+        ]
+        out = self.enrich(records)
+
+        self.assertEqual(len(out), len(records))
+        self.assertEqual(out[2], "not a record")
+        got = [json.loads(line) for i, line in enumerate(out) if i != 2]
+        self.assertEqual([r.get("file") for r in got],
+                         ["a.wav", "b.wav", "c.wav", "d.wav", "e.wav", "mix.wav", "f.wav"])
+        self.assertEqual(got[0]["discogs"]["master_id"], 45131)
+        self.assertEqual(got[0]["discogs"]["url"], "https://discogs.com/master/45131")
+        self.assertEqual(got[3]["discogs"], got[0]["discogs"])
+        self.assertNotIn("discogs", got[4])
+        self.assertEqual(got[5]["tracklist"][0]["discogs"]["master_id"], 8085)
+        self.assertEqual(got[5]["tracklist"][1]["discogs"], {"error": "No Discogs master found"})
+
+        # five albums, each searched once although two were asked for twice at once
+        searched = sorted(c.artist for c in self.mock.searches())
+        self.assertEqual(searched, ["air", "daft punk", "massive attack", "nobody", "portishead"])
+
+        # a second run is answered from the cache file, misses included
+        self.mock.reset()
+        self.assertEqual(self.enrich(records), out)
+        self.assertEqual(self.mock.searches(), [])
+
+    def test_rate(self):
+        albums = [("Daft Punk", "Homework"), ("Air", "Moon Safari"), ("Massive Attack", "Mezzanine"),
+                  ("Portishead", "Dummy"), ("Bjork", "Post"), ("Moby", "Play"),
+                  ("The Orb", "Orblivion"), ("Leftfield", "Leftism"),
+                  ("Orbital", "In Sides"), ("Goldie", "Timeless")]
+        rate = 4.0
+        out = self.enrich([result(artist, album, str(i)) for i, (artist, album) in enumerate(albums)],
+                          DISCOGS_JOBS="8", DISCOGS_RATE=str(rate))
+        self.assertEqual(len(out), len(albums))
+        self.assertTrue(all("master_id" in json.loads(line)["discogs"] for line in out))
+
+        # a second's worth of calls at once, then one every 1/rate seconds
+        times = sorted(c.time for c in self.mock.searches())
+        self.assertEqual(len(times), len(albums))
+        for i, t in enumerate(times):
+            self.assertGreaterEqual(t - times[0], (i + 1 - rate) / rate - 0.05,
+                                    "call {} came {:.3f}s after the first".format(i, t - times[0]))
+
+    def test_retry_after(self):
+        self.mock.throttle["air"] = [2, 1]
+        out = self.enrich([result("Daft Punk", "Homework", "a.wav"),
+                           result("Air", "Moon Safari", "b.wav")])
+        got = [json.loads(line) for line in out]
+        self.assertEqual(got[1]["discogs"]["master_id"], 8085)
+
+        calls = self.mock.searches("air")
+        self.assertEqual([c.status for c in calls], [429, 429, 200])
+        for before, after in zip(calls, calls[1:]):
+            self.assertGreaterEqual(after.time - before.time, 1.0 - 0.05)
+
+    def test_want(self):
+        records = [result("Daft Punk", "Homework", "a.wav"),
+                   result("Air", "Moon Safari", "b.wav"),
+                   result("Daft Punk", "Homework", "c.wav")]
+        out = self.enrich(records, want=True)
+        got = [json.loads(line)["discogs"] for line in out]
+        self.assertEqual([d["release_id"] for d in got], [46131, 9085, 46131])
+        self.assertTrue(all(d["wanted"] for d in got))
+
+        wants = sorted(c.path for c in self.mock.calls if c.method == "PUT")
+        self.assertEqual(wants, ["/users/tester/wants/46131", "/users/tester/wants/9085"])
+
+
+if __name__ == "__main__":
+    unittest.main()
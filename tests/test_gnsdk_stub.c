@@ -0,0 +1,418 @@
+/*
+ *  Name: test_gnsdk_stub.c
+ *  Description:
+ *  gnsdk_stub.c, driven through the MusicID-Stream entry points as
+ *  sample drives them: answers take GNSDK_STUB_LATENCY_MS, or the
+ *  GNSDK_STUB_TAIL time for some, GNSDK_STUB_ERROR_RATE of them end in
+ *  an error, identifications beyond GNSDK_STUB_MAX_IN_FLIGHT are
+ *  refused, GNSDK_STUB_SEED makes all of that repeatable, and inline
+ *  answers arrive before audio_end() returns. Each case starts the stub
+ *  afresh with its own settings.
+ */
+
+#include "gnsdk.h"
+#include "check.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* identifications per case */
+#define ROUNDS 24
+
+/* how late an answer may be over what it was set to take */
+#define LATE_SECONDS 0.05
+
+/* What one channel was told */
+typedef struct
+{
+    double      ended;       /* when the audio was ended */
+    double      answered;    /* when the result or error arrived, 0 if neither has */
+    int         b_error;
+    const char* description; /* of the error */
+
+} answer_t;
+
+/******************************************************************
+ *
+ *    _NOW
+ *
+ *****************************************************************/
+static double
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+
+} /* _now() */
+
+/******************************************************************
+ *
+ *    Callbacks
+ *
+ *****************************************************************/
+static gnsdk_void_t GNSDK_CALLBACK_API
+_result_callback(
+    gnsdk_void_t*                        callback_data,
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    gnsdk_gdo_handle_t                   response_gdo,
+    gnsdk_bool_t*                        pb_abort
+    )
+{
+    answer_t* answer = (answer_t*)callback_data;
+
+    answer->answered = _now();
+
+    GNSDK_UNUSED(channel_handle);
+    GNSDK_UNUSED(response_gdo);
+    GNSDK_UNUSED(pb_abort);
+}
+
+static gnsdk_void_t GNSDK_CALLBACK_API
+_error_callback(
+    gnsdk_void_t*                        callback_data,
+    gnsdk_musicidstream_channel_handle_t channel_handle,
+    const gnsdk_error_info_t*            p_error_info
+    )
+{
+    answer_t* answer = (answer_t*)callback_data;
+
+    answer->answered    = _now();
+    answer->b_error     = 1;
+    answer->description = p_error_info->error_description;
+
+    GNSDK_UNUSED(channel_handle);
+}
+
+/******************************************************************
+ *
+ *    _START
+ *
+ *    Start the stub with settings, a NULL-terminated list of name and
+ *    value pairs; the settings of earlier cases are cleared first.
+ *
+ *****************************************************************/
+static void
+_start(
+    const char** settings
+    )
+{
+    static const char* s_names[] =
+    {
+        "GNSDK_STUB_LATENCY_MS", "GNSDK_STUB_TAIL", "GNSDK_STUB_ERROR_RATE",
+        "GNSDK_STUB_MAX_IN_FLIGHT", "GNSDK_STUB_CALLBACKS", "GNSDK_STUB_SEED"
+    };
+    gnsdk_manager_handle_t manager = GNSDK_NULL;
+    size_t                 i       = 0;
+
+    for (i = 0; i < sizeof(s_names) / sizeof(s_names[0]); i++)
+    {
+        unsetenv(s_names[i]);
+    }
+    for (i = 0; settings[i]; i += 2)
+    {
+        setenv(settings[i], settings[i + 1], 1);
+    }
+
+    CHECK(GNSDK_SUCCESS == gnsdk_manager_initialize(&manager, "", 0));
+
+} /* _start() */
+
+/******************************************************************
+ *
+ *    _STOP
+ *
+ *    Shut the stub down, keeping the counts it writes out of the
+ *    test's output.
+ *
+ *****************************************************************/
+static void
+_stop(void)
+{
+    int saved = dup(STDERR_FILENO);
+    int null  = open("/dev/null", O_WRONLY);
+
+    if (saved >= 0 && null >= 0)
+    {
+        dup2(null, STDERR_FILENO);
+    }
+    gnsdk_manager_shutdown();
+    if (saved >= 0 && null >= 0)
+    {
+        dup2(saved, STDERR_FILENO);
+    }
+    if (saved >= 0)
+    {
+        close(saved);
+    }
+    if (null >= 0)
+    {
+        close(null);
+    }
+
+} /* _stop() */
+
+/******************************************************************
+ *
+ *    _CREATE
+ *
+ *****************************************************************/
+static gnsdk_musicidstream_channel_handle_t
+_create(
+    answer_t* answer
+    )
+{
+    gnsdk_musicidstream_callbacks_t      callbacks;
+    gnsdk_musicidstream_channel_handle_t channel = GNSDK_NULL;
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.callback_result_available = _result_callback;
+    callbacks.callback_error            = _error_callback;
+
+    CHECK(GNSDK_SUCCESS == gnsdk_musicidstream_channel_create(GNSDK_NULL, gnsdk_musicidstream_preset_microphone, &callbacks, answer, &channel));
+    CHECK(GNSDK_SUCCESS == gnsdk_musicidstream_channel_audio_begin(channel, 44100, 16, 2));
+
+    return channel;
+
+} /* _create() */
+
+/******************************************************************
+ *
+ *    _ASK
+ *
+ *    Start an identification of a little audio on channel, which
+ *    the stub answers once the audio is ended.
+ *
+ *****************************************************************/
+static void
+_ask(
+    gnsdk_musicidstream_channel_handle_t channel,
+    answer_t*                            answer
+    )
+{
+    static const unsigned char s_audio[64] = { 1, 2, 3, 4 };
+
+    memset(answer, 0, sizeof(*answer));
+    CHECK(GNSDK_SUCCESS == gnsdk_musicidstream_channel_identify(channel));
+    CHECK(GNSDK_SUCCESS == gnsdk_musicidstream_channel_audio_write(channel, s_audio, sizeof(s_audio)));
+    answer->ended = _now();
+    CHECK(GNSDK_SUCCESS == gnsdk_musicidstream_channel_audio_end(channel));
+
+} /* _ask() */
+
+/******************************************************************
+ *
+ *    _IDENTIFY
+ *
+ *    ROUNDS identifications one after the other on one channel.
+ *    Returns the latency of each in seconds, or -1 for an error, in
+ *    latencies.
+ *
+ *****************************************************************/
+static void
+_identify(
+    double* latencies
+    )
+{
+    gnsdk_musicidstream_channel_handle_t channel = GNSDK_NULL;
+    answer_t                             answer;
+    int                                  i       = 0;
+
+    channel = _create(&answer);
+    for (i = 0; i < ROUNDS; i++)
+    {
+        _ask(channel, &answer);
+        CHECK(GNSDK_SUCCESS == gnsdk_musicidstream_channel_wait_for_identify(channel, 5000));
+        CHECK(answer.answered > 0);
+        latencies[i] = answer.b_error ? -1 : answer.answered - answer.ended;
+        CHECK(!answer.b_error || 0 == strcmp(answer.description, "Injected service error"));
+    }
+    gnsdk_musicidstream_channel_release(channel);
+
+} /* _identify() */
+
+/******************************************************************
+ *
+ *    _TEST_LATENCY
+ *
+ *****************************************************************/
+static void
+_test_latency(void)
+{
+    static const char* s_uniform[] = { "GNSDK_STUB_LATENCY_MS", "40-80", "GNSDK_STUB_SEED", "1", NULL };
+    static const char* s_tail[]    = { "GNSDK_STUB_LATENCY_MS", "10", "GNSDK_STUB_TAIL", "0.5:150", "GNSDK_STUB_SEED", "1", NULL };
+    double             latencies[ROUNDS];
+    int                slow      = 0;
+    int                i         = 0;
+
+    /* every answer between the two */
+    _start(s_uniform);
+    _identify(latencies);
+    for (i = 0; i < ROUNDS; i++)
+    {
+        CHECK(latencies[i] >= 0.040 && latencies[i] <= 0.080 + LATE_SECONDS);
+    }
+    _stop();
+
+    /* some answers take the tail time instead, the rest as set */
+    _start(s_tail);
+    _identify(latencies);
+    for (i = 0; i < ROUNDS; i++)
+    {
+        if (latencies[i] >= 0.150)
+        {
+            CHECK(latencies[i] <= 0.150 + LATE_SECONDS);
+            slow++;
+        }
+        else
+        {
+            CHECK(latencies[i] >= 0.010 && latencies[i] <= 0.010 + LATE_SECONDS);
+        }
+    }
+    CHECK(slow > 0 && slow < ROUNDS);
+    _stop();
+
+} /* _test_latency() */
+
+/******************************************************************
+ *
+ *    _TEST_ERRORS
+ *
+ *****************************************************************/
+static void
+_test_errors(void)
+{
+    static const char* s_none[]  = { "GNSDK_STUB_ERROR_RATE", "0", NULL };
+    static const char* s_half[]  = { "GNSDK_STUB_ERROR_RATE", "0.5", "GNSDK_STUB_SEED", "7", NULL };
+    static const char* s_all[]   = { "GNSDK_STUB_ERROR_RATE", "1", NULL };
+    double             first[ROUNDS];
+    double             again[ROUNDS];
+    int                errors    = 0;
+    int                b_same    = 1;
+    int                i         = 0;
+
+    _start(s_none);
+    _identify(first);
+    for (i = 0; i < ROUNDS; i++)
+    {
+        CHECK(first[i] >= 0);
+    }
+    _stop();
+
+    _start(s_all);
+    _identify(first);
+    for (i = 0; i < ROUNDS; i++)
+    {
+        CHECK(first[i] < 0);
+    }
+    _stop();
+
+    /* some fail, and the same ones again with the same seed */
+    _start(s_half);
+    _identify(first);
+    _stop();
+    _start(s_half);
+    _identify(again);
+    _stop();
+    for (i = 0; i < ROUNDS; i++)
+    {
+        errors += (first[i] < 0);
+        b_same &= ((first[i] < 0) == (again[i] < 0));
+    }
+    CHECK(errors > 0 && errors < ROUNDS);
+    CHECK(b_same);
+
+} /* _test_errors() */
+
+/******************************************************************
+ *
+ *    _TEST_IN_FLIGHT
+ *
+ *****************************************************************/
+static void
+_test_in_flight(void)
+{
+    static const char*                   s_settings[] = { "GNSDK_STUB_LATENCY_MS", "100", "GNSDK_STUB_MAX_IN_FLIGHT", "2", NULL };
+    gnsdk_musicidstream_channel_handle_t channels[4];
+    answer_t                             answers[4];
+    int                                  refused      = 0;
+    int                                  i            = 0;
+
+    _start(s_settings);
+    for (i = 0; i < 4; i++)
+    {
+        channels[i] = _create(&answers[i]);
+        _ask(channels[i], &answers[i]);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        CHECK(GNSDK_SUCCESS == gnsdk_musicidstream_channel_wait_for_identify(channels[i], 5000));
+        CHECK(answers[i].answered > 0);
+        if (answers[i].b_error)
+        {
+            CHECK(0 == strcmp(answers[i].description, "Too many identifications in flight"));
+            refused++;
+        }
+        gnsdk_musicidstream_channel_release(channels[i]);
+    }
+    CHECK(refused == 2);
+
+    /* those in flight have been answered, so there is room again */
+    channels[0] = _create(&answers[0]);
+    _ask(channels[0], &answers[0]);
+    CHECK(GNSDK_SUCCESS == gnsdk_musicidstream_channel_wait_for_identify(channels[0], 5000));
+    CHECK(answers[0].answered > 0 && !answers[0].b_error);
+    gnsdk_musicidstream_channel_release(channels[0]);
+
+    _stop();
+
+} /* _test_in_flight() */
+
+/******************************************************************
+ *
+ *    _TEST_INLINE
+ *
+ *****************************************************************/
+static void
+_test_inline(void)
+{
+    static const char*                   s_settings[] = { "GNSDK_STUB_LATENCY_MS", "20", "GNSDK_STUB_CALLBACKS", "inline", NULL };
+    gnsdk_musicidstream_channel_handle_t channel      = GNSDK_NULL;
+    answer_t                             answer;
+
+    _start(s_settings);
+    channel = _create(&answer);
+    _ask(channel, &answer);
+
+    /* already answered, after its latency, when audio_end() returned */
+    CHECK(answer.answered >= answer.ended + 0.020);
+    CHECK(!answer.b_error);
+    gnsdk_musicidstream_channel_release(channel);
+
+    _stop();
+
+} /* _test_inline() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    unsetenv("GNSDK_STUB_FIXTURES");
+    unsetenv("GNSDK_STUB_TRACE");
+
+    _test_latency();
+    _test_errors();
+    _test_in_flight();
+    _test_inline();
+
+    return CHECK_RESULT();
+
+} /* main() */
@@ -0,0 +1,196 @@
+/*
+ *  Name: test_ingest.c
+ *  Description:
+ *  ingest.c, fed through a pipe: audio that arrives while the ring is
+ *  full is dropped a read at a time and counted as overruns, the
+ *  consumer running dry is counted once each time, only whole frames
+ *  reach it, and the end of the input is seen once it has all been
+ *  consumed.
+ */
+
+#include "../ingest.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+/* bytes in a frame, e.g. 16 bit stereo */
+#define FRAME 4
+
+/******************************************************************
+ *
+ *    _WRITE_PATTERN
+ *
+ *    Write size bytes counting up from first, so a byte read back
+ *    says where in the input it came from.
+ *
+ *****************************************************************/
+static void
+_write_pattern(
+    int    fd,
+    size_t first,
+    size_t size
+    )
+{
+    unsigned char buf[512];
+    size_t        i = 0;
+
+    for (i = 0; i < size; i++)
+    {
+        buf[i] = (unsigned char)(first + i);
+    }
+    CHECK(size <= sizeof(buf) && (ssize_t)size == write(fd, buf, size));
+
+} /* _write_pattern() */
+
+/******************************************************************
+ *
+ *    _TEST_OVERRUN
+ *
+ *****************************************************************/
+static void
+_test_overrun(void)
+{
+    int                  fds[2] = { -1, -1 };
+    ingest_t*            ingest = NULL;
+    const unsigned char* data   = NULL;
+    ingest_stats_t       stats;
+    size_t               taken  = 0;
+    long                 got    = 0;
+    long                 i      = 0;
+    int                  b_ok   = 1;
+
+    CHECK(0 == pipe(fds));
+
+    /* 256 bytes waiting before the reader starts: 16 reads of 16 bytes
+     * into a ring of 64, so the first 4 fit and the other 12 are dropped */
+    _write_pattern(fds[1], 0, 256);
+    close(fds[1]);
+
+    ingest = ingest_open(fds[0], 256, FRAME, 64 + FRAME - 1, 16, -1);
+    CHECK(ingest != NULL);
+    if (ingest == NULL)
+    {
+        close(fds[0]);
+        return;
+    }
+
+    /* nothing is consumed until the reader has stopped at the limit */
+    do
+    {
+        ingest_get_stats(ingest, &stats);
+        usleep(1000);
+    } while (stats.bytes_read < 256);
+    usleep(50 * 1000);
+
+    /* the ring keeps the oldest audio, whole, in order */
+    while ((got = ingest_peek(ingest, (const void**)&data, 1000)) > 0)
+    {
+        CHECK(got % FRAME == 0);
+        for (i = 0; i < got; i++)
+        {
+            b_ok &= (data[i] == (unsigned char)(taken + (size_t)i));
+        }
+        taken += (size_t)got;
+        ingest_consume(ingest, (size_t)got);
+    }
+    CHECK(got == -1);
+    CHECK(b_ok);
+    CHECK(taken == 64);
+
+    ingest_get_stats(ingest, &stats);
+    CHECK(stats.capacity == 64);
+    CHECK(stats.bytes_read == 256);
+    CHECK(stats.bytes_dropped == 192);
+    CHECK(stats.overruns == 12);
+    CHECK(stats.peak_fill == 64);
+
+    /* the end was there as soon as the ring was empty: not an underrun */
+    CHECK(stats.underruns == 0);
+
+    ingest_close(ingest);
+    close(fds[0]);
+
+} /* _test_overrun() */
+
+/******************************************************************
+ *
+ *    _TEST_UNDERRUN
+ *
+ *****************************************************************/
+static void
+_test_underrun(void)
+{
+    int            fds[2] = { -1, -1 };
+    ingest_t*      ingest = NULL;
+    const void*    data   = NULL;
+    ingest_stats_t stats;
+    long           got    = 0;
+
+    CHECK(0 == pipe(fds));
+
+    ingest = ingest_open(fds[0], UINT64_MAX, FRAME, 1024, 256, -1);
+    CHECK(ingest != NULL);
+    if (ingest == NULL)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+
+    /* waiting for the first audio isn't running dry */
+    CHECK(0 == ingest_peek(ingest, &data, 20));
+    ingest_get_stats(ingest, &stats);
+    CHECK(stats.underruns == 0);
+
+    _write_pattern(fds[1], 0, 16);
+    got = ingest_peek(ingest, &data, 1000);
+    CHECK(got == 16);
+    ingest_consume(ingest, (size_t)got);
+
+    /* caught up: one underrun, however many times it looks */
+    CHECK(0 == ingest_peek(ingest, &data, 20));
+    CHECK(0 == ingest_peek(ingest, &data, 20));
+    ingest_get_stats(ingest, &stats);
+    CHECK(stats.underruns == 1);
+
+    /* part of a frame waits for the rest of it */
+    _write_pattern(fds[1], 16, 3);
+    CHECK(0 == ingest_peek(ingest, &data, 100));
+    _write_pattern(fds[1], 19, 1);
+    got = ingest_peek(ingest, &data, 1000);
+    CHECK(got == FRAME);
+    CHECK(got > 0 && ((const unsigned char*)data)[0] == 16 && ((const unsigned char*)data)[3] == 19);
+    ingest_consume(ingest, (size_t)got);
+
+    /* and running dry again is a second one */
+    CHECK(0 == ingest_peek(ingest, &data, 20));
+    ingest_get_stats(ingest, &stats);
+    CHECK(stats.underruns == 2);
+    CHECK(stats.bytes_read == 20);
+    CHECK(stats.bytes_dropped == 0);
+    CHECK(stats.overruns == 0);
+
+    /* the end of the input ends the stream */
+    close(fds[1]);
+    CHECK(-1 == ingest_peek(ingest, &data, 1000));
+
+    ingest_close(ingest);
+    close(fds[0]);
+
+} /* _test_underrun() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    _test_overrun();
+    _test_underrun();
+
+    return CHECK_RESULT();
+
+} /* main() */
@@ -0,0 +1,376 @@
+/*
+ *  Name: test_landmark.c
+ *  Description:
+ *  landmark.c: the hashes of some audio don't depend on how it is split
+ *  up between calls or on whether it is mono or stereo, forgetting the
+ *  old ones drops all of them and nothing else, an excerpt of a
+ *  catalog track is found in an index, quieter and with noise added,
+ *  at the offset it was taken from, audio that isn't in the catalog
+ *  isn't matched, and an index file that is damaged is refused.
+ */
+
+#include "../landmark.h"
+#include "check.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define RATE          LANDMARK_SAMPLE_RATE
+#define TRACK_SECONDS 20
+#define TRACKS        3
+#define MIN_SCORE     12
+
+/******************************************************************
+ *
+ *    _RANDOM
+ *
+ *    A repeatable sequence, whatever the C library.
+ *
+ *****************************************************************/
+static uint32_t
+_random(
+    uint32_t* p_state
+    )
+{
+    *p_state = *p_state * 1664525u + 1013904223u;
+
+    return *p_state >> 8;
+
+} /* _random() */
+
+/******************************************************************
+ *
+ *    _TUNE
+ *
+ *    seconds of mono made of three tones that change every quarter
+ *    of a second, a different tune for each seed.
+ *
+ *****************************************************************/
+static int16_t*
+_tune(
+    uint32_t seed,
+    size_t   seconds
+    )
+{
+    int16_t* pcm   = malloc(seconds * RATE * sizeof(int16_t));
+    double   f[3]  = { 0, 0, 0 };
+    double   value = 0;
+    size_t   i     = 0;
+    int      k     = 0;
+
+    for (i = 0; pcm && i < seconds * RATE; i++)
+    {
+        if (0 == i % (RATE / 4))
+        {
+            for (k = 0; k < 3; k++)
+            {
+                f[k] = 150 + _random(&seed) % 3500;
+            }
+        }
+        for (value = 0, k = 0; k < 3; k++)
+        {
+            value += 3000 * sin(2 * M_PI * f[k] * (double)i / RATE);
+        }
+        pcm[i] = (int16_t)value;
+    }
+
+    return pcm;
+
+} /* _tune() */
+
+/******************************************************************
+ *
+ *    _FINGERPRINT
+ *
+ *    Fingerprint count frames of pcm in chunks of chunk frames.
+ *
+ *****************************************************************/
+static landmark_fp_t*
+_fingerprint(
+    const int16_t* pcm,
+    size_t         count,
+    uint32_t       channels,
+    size_t         chunk
+    )
+{
+    landmark_fp_t* fp   = landmark_fp_open(channels);
+    size_t         i    = 0;
+    size_t         part = 0;
+
+    CHECK(fp != NULL);
+    for (i = 0; fp && i < count; i += part)
+    {
+        part = (count - i < chunk) ? count - i : chunk;
+        CHECK(0 == landmark_fp_process(fp, pcm + i * channels, part * channels * sizeof(int16_t)));
+    }
+
+    return fp;
+
+} /* _fingerprint() */
+
+/******************************************************************
+ *
+ *    _TEST_HASHES
+ *
+ *****************************************************************/
+static void
+_test_hashes(
+    const int16_t* pcm
+    )
+{
+    size_t                 count   = 5 * RATE;
+    int16_t*               stereo  = malloc(2 * count * sizeof(int16_t));
+    landmark_fp_t*         whole   = _fingerprint(pcm, count, 1, count);
+    landmark_fp_t*         chunked = _fingerprint(pcm, count, 1, 777);
+    landmark_fp_t*         both    = NULL;
+    const landmark_hash_t* hashes  = NULL;
+    const landmark_hash_t* other   = NULL;
+    size_t                 n       = 0;
+    size_t                 later   = 0;
+    size_t                 i       = 0;
+
+    CHECK(NULL == landmark_fp_open(0));
+    CHECK(NULL == landmark_fp_open(3) && errno == EINVAL);
+
+    CHECK(stereo && whole && chunked);
+    if (!(stereo && whole && chunked))
+    {
+        free(stereo);
+        landmark_fp_close(whole);
+        landmark_fp_close(chunked);
+        return;
+    }
+    for (i = 0; i < count; i++)
+    {
+        stereo[2 * i]     = pcm[i];
+        stereo[2 * i + 1] = pcm[i];
+    }
+    both = _fingerprint(stereo, count, 2, 1000);
+
+    n = landmark_fp_hashes(whole, &hashes);
+    CHECK(n > 100);
+    CHECK(landmark_fp_frames(whole) == (count - 1024) / LANDMARK_HOP + 1);
+    CHECK(n == landmark_fp_hashes(chunked, &other));
+    CHECK(0 == memcmp(hashes, other, n * sizeof(*hashes)));
+    CHECK(both && n == landmark_fp_hashes(both, &other));
+    CHECK(both && 0 == memcmp(hashes, other, n * sizeof(*hashes)));
+
+    /* forgetting drops every hash that starts too early, wherever it is */
+    for (i = 0; i < n; i++)
+    {
+        later += (hashes[i].frame >= 50);
+    }
+    landmark_fp_forget(whole, 50);
+    n = landmark_fp_hashes(whole, &hashes);
+    CHECK(n > 0 && n == later);
+    for (i = 0; i < n; i++)
+    {
+        CHECK(hashes[i].frame >= 50);
+    }
+    landmark_fp_forget(whole, landmark_fp_frames(whole));
+    CHECK(0 == landmark_fp_hashes(whole, &hashes));
+
+    free(stereo);
+    landmark_fp_close(whole);
+    landmark_fp_close(chunked);
+    landmark_fp_close(both);
+
+} /* _test_hashes() */
+
+/******************************************************************
+ *
+ *    _MATCH
+ *
+ *    Look up count frames of mono pcm. Returns 0 with the match in
+ *    *p_match, or -1.
+ *
+ *****************************************************************/
+static int
+_match(
+    landmark_index_t* index,
+    const int16_t*    pcm,
+    size_t            count,
+    landmark_match_t* p_match
+    )
+{
+    landmark_fp_t*         fp     = _fingerprint(pcm, count, 1, 4096);
+    const landmark_hash_t* hashes = NULL;
+    size_t                 n      = 0;
+    int                    rc     = -1;
+
+    if (fp)
+    {
+        n  = landmark_fp_hashes(fp, &hashes);
+        rc = landmark_index_match(index, hashes, n, MIN_SCORE, p_match);
+        landmark_fp_close(fp);
+    }
+
+    return rc;
+
+} /* _match() */
+
+/******************************************************************
+ *
+ *    _TEST_INDEX
+ *
+ *****************************************************************/
+static void
+_test_index(
+    int16_t**   tracks,
+    const char* path
+    )
+{
+    static const char*     s_ids[TRACKS] = { "first", "second", "third" };
+    landmark_builder_t*    builder       = landmark_builder_open();
+    landmark_index_t*      index         = NULL;
+    landmark_fp_t*         fp            = NULL;
+    const landmark_hash_t* hashes        = NULL;
+    landmark_match_t       match;
+    int16_t*               excerpt       = malloc(5 * RATE * sizeof(int16_t));
+    int16_t*               stranger      = _tune(99, 5);
+    uint32_t               seed          = 5;
+    size_t                 start         = 7 * RATE + 100;
+    size_t                 count         = 0;
+    size_t                 i             = 0;
+
+    CHECK(builder && excerpt && stranger);
+    for (i = 0; builder && i < TRACKS; i++)
+    {
+        fp = _fingerprint(tracks[i], TRACK_SECONDS * RATE, 1, 8192);
+        if (fp)
+        {
+            count = landmark_fp_hashes(fp, &hashes);
+            CHECK(0 == landmark_builder_add(builder, s_ids[i], TRACK_SECONDS, hashes, count));
+            landmark_fp_close(fp);
+        }
+    }
+    CHECK(builder && 0 == landmark_builder_write(builder, path));
+    landmark_builder_close(builder);
+
+    index = landmark_index_open(path);
+    CHECK(index != NULL);
+    if (index == NULL || excerpt == NULL || stranger == NULL)
+    {
+        landmark_index_close(index);
+        free(excerpt);
+        free(stranger);
+        return;
+    }
+    CHECK(landmark_index_tracks(index) == TRACKS);
+
+    /* five seconds from 7s into the second, at half the level and with
+     * noise */
+    for (i = 0; i < 5 * RATE; i++)
+    {
+        excerpt[i] = (int16_t)(tracks[1][start + i] / 2 + (int)(_random(&seed) % 1001) - 500);
+    }
+    CHECK(0 == _match(index, excerpt, 5 * RATE, &match));
+    CHECK(0 == strcmp(match.id, "second"));
+    CHECK(fabs(match.offset_seconds - (double)start / RATE) < 0.1);
+    CHECK(match.track_seconds == TRACK_SECONDS && match.score >= MIN_SCORE);
+
+    CHECK(-1 == _match(index, stranger, 5 * RATE, &match));
+
+    landmark_index_close(index);
+    free(excerpt);
+    free(stranger);
+
+} /* _test_index() */
+
+/******************************************************************
+ *
+ *    _TEST_DAMAGED
+ *
+ *    Copies of the index at path, each damaged in its own way, are
+ *    refused.
+ *
+ *****************************************************************/
+static void
+_test_damaged(
+    const char* path,
+    const char* copy
+    )
+{
+    FILE*          file = fopen(path, "rb");
+    unsigned char* data = NULL;
+    long           size = 0;
+    int            i    = 0;
+
+    CHECK(file != NULL);
+    if (file == NULL)
+    {
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    data = malloc((size_t)size);
+    CHECK(data && size == (long)fread(data, 1, (size_t)size, file));
+    fclose(file);
+
+    /* the magic, then cut short, then with a byte too many */
+    for (i = 0; data && i < 3; i++)
+    {
+        file = fopen(copy, "wb");
+        data[0] ^= (0 == i) ? 0x20 : 0;
+        CHECK(file && (size_t)(size - (1 == i)) == fwrite(data, 1, (size_t)(size - (1 == i)), file));
+        if (2 == i)
+        {
+            CHECK(file && 1 == fwrite(data, 1, 1, file));
+        }
+        data[0] ^= (0 == i) ? 0x20 : 0;
+        fclose(file);
+
+        errno = 0;
+        CHECK(NULL == landmark_index_open(copy) && errno == EINVAL);
+    }
+
+    CHECK(NULL == landmark_index_open("/nonexistent/index") && errno == ENOENT);
+
+    unlink(copy);
+    free(data);
+
+} /* _test_damaged() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    int16_t* tracks[TRACKS];
+    char     path[]  = "/tmp/test_landmark.XXXXXX";
+    char     copy[64];
+    int      fd      = mkstemp(path);
+    int      i       = 0;
+
+    CHECK(fd >= 0);
+    close(fd);
+    snprintf(copy, sizeof(copy), "%s.copy", path);
+
+    for (i = 0; i < TRACKS; i++)
+    {
+        tracks[i] = _tune((uint32_t)i + 1, TRACK_SECONDS);
+        CHECK(tracks[i] != NULL);
+    }
+
+    if (tracks[0] && tracks[1] && tracks[2])
+    {
+        _test_hashes(tracks[0]);
+        _test_index(tracks, path);
+        _test_damaged(path, copy);
+    }
+
+    for (i = 0; i < TRACKS; i++)
+    {
+        free(tracks[i]);
+    }
+    unlink(path);
+
+    return CHECK_RESULT();
+
+} /* main() */
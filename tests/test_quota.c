@@ -0,0 +1,235 @@
+/*
+ *  Name: test_quota.c
+ *  Description:
+ *  quota.c: a burst is let through at once and the rest at the rate,
+ *  an interactive request goes ahead of bulk ones already waiting while
+ *  requests of one class keep their order, a request that can't wait is
+ *  turned away rather than jumping the queue, and a cancelled wait
+ *  gives up and leaves the queue.
+ */
+
+#include "../quota.h"
+#include "check.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* how late a token may come over when it is due */
+#define LATE_SECONDS 0.05
+
+/* a request made on a thread of its own */
+typedef struct
+{
+    quota_t*              quota;
+    quota_class_t         cls;
+    volatile sig_atomic_t cancel;
+    int                   rc;
+    int                   order;    /* in which it was granted, from 1 */
+
+} request_t;
+
+static pthread_mutex_t s_lock    = PTHREAD_MUTEX_INITIALIZER;
+static int             s_granted = 0;
+
+/******************************************************************
+ *
+ *    _NOW
+ *
+ *****************************************************************/
+static double
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+
+} /* _now() */
+
+/******************************************************************
+ *
+ *    _REQUEST
+ *
+ *****************************************************************/
+static void*
+_request(
+    void* arg
+    )
+{
+    request_t* request = (request_t*)arg;
+
+    request->rc = quota_acquire(request->quota, request->cls, &request->cancel, NULL);
+
+    pthread_mutex_lock(&s_lock);
+    request->order = ++s_granted;
+    pthread_mutex_unlock(&s_lock);
+
+    return NULL;
+
+} /* _request() */
+
+/******************************************************************
+ *
+ *    _TEST_RATE
+ *
+ *****************************************************************/
+static void
+_test_rate(void)
+{
+    quota_t*      quota  = quota_open(20, 3);
+    quota_stats_t stats;
+    double        start  = _now();
+    double        waited = 0;
+    int           i      = 0;
+
+    CHECK(NULL == quota_open(0, 3));
+    CHECK(NULL == quota_open(20, 0.5));
+    CHECK(quota != NULL);
+    if (quota == NULL)
+    {
+        return;
+    }
+
+    /* the burst straight away, then nothing to spare */
+    for (i = 0; i < 3; i++)
+    {
+        CHECK(0 == quota_try_acquire(quota, QUOTA_BULK));
+    }
+    CHECK(-1 == quota_try_acquire(quota, QUOTA_INTERACTIVE));
+
+    /* then one every 50ms */
+    for (i = 0; i < 4; i++)
+    {
+        CHECK(0 == quota_acquire(quota, QUOTA_BULK, NULL, &waited));
+        CHECK(waited <= 0.050 + LATE_SECONDS);
+    }
+    CHECK(_now() - start >= 0.200 - 0.050 && _now() - start <= 0.200 + LATE_SECONDS);
+
+    quota_get_stats(quota, &stats);
+    CHECK(stats.classes[QUOTA_BULK].granted == 7 && stats.classes[QUOTA_BULK].deferred == 0);
+    CHECK(stats.classes[QUOTA_INTERACTIVE].granted == 0 && stats.classes[QUOTA_INTERACTIVE].deferred == 1);
+    CHECK(stats.classes[QUOTA_BULK].max_wait <= 0.050 + LATE_SECONDS);
+    CHECK(stats.classes[QUOTA_BULK].peak_depth == 1 && stats.classes[QUOTA_BULK].depth == 0);
+
+    quota_close(quota);
+
+} /* _test_rate() */
+
+/******************************************************************
+ *
+ *    _TEST_PRIORITY
+ *
+ *****************************************************************/
+static void
+_test_priority(void)
+{
+    quota_t*      quota = quota_open(10, 1);
+    request_t     requests[4];
+    pthread_t     threads[4];
+    quota_stats_t stats;
+    int           i     = 0;
+
+    CHECK(quota != NULL);
+    if (quota == NULL)
+    {
+        return;
+    }
+    CHECK(0 == quota_try_acquire(quota, QUOTA_BULK));
+
+    /* three bulk requests queue up in turn, then an interactive one */
+    s_granted = 0;
+    for (i = 0; i < 4; i++)
+    {
+        memset(&requests[i], 0, sizeof(requests[i]));
+        requests[i].quota = quota;
+        requests[i].cls   = (i < 3) ? QUOTA_BULK : QUOTA_INTERACTIVE;
+        CHECK(0 == pthread_create(&threads[i], NULL, _request, &requests[i]));
+        usleep(10000);
+    }
+
+    /* no one may take a token from under those waiting */
+    CHECK(-1 == quota_try_acquire(quota, QUOTA_BULK));
+    CHECK(-1 == quota_try_acquire(quota, QUOTA_INTERACTIVE));
+
+    for (i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CHECK(requests[i].rc == 0);
+    }
+    CHECK(requests[3].order == 1);
+    CHECK(requests[0].order == 2 && requests[1].order == 3 && requests[2].order == 4);
+
+    quota_get_stats(quota, &stats);
+    CHECK(stats.classes[QUOTA_BULK].peak_depth == 3 && stats.classes[QUOTA_INTERACTIVE].peak_depth == 1);
+    CHECK(stats.classes[QUOTA_BULK].deferred == 1 && stats.classes[QUOTA_INTERACTIVE].deferred == 1);
+
+    quota_close(quota);
+
+} /* _test_priority() */
+
+/******************************************************************
+ *
+ *    _TEST_CANCEL
+ *
+ *****************************************************************/
+static void
+_test_cancel(void)
+{
+    quota_t*      quota   = quota_open(0.1, 1);
+    request_t     request;
+    pthread_t     thread;
+    quota_stats_t stats;
+    double        start   = 0;
+
+    CHECK(quota != NULL);
+    if (quota == NULL)
+    {
+        return;
+    }
+    CHECK(0 == quota_try_acquire(quota, QUOTA_INTERACTIVE));
+
+    memset(&request, 0, sizeof(request));
+    request.quota = quota;
+    request.cls   = QUOTA_INTERACTIVE;
+    CHECK(0 == pthread_create(&thread, NULL, _request, &request));
+    usleep(50000);
+
+    /* seen at the next poll, long before the token is due */
+    start          = _now();
+    request.cancel = 1;
+    pthread_join(thread, NULL);
+    CHECK(request.rc == -1);
+    CHECK(_now() - start < 0.5);
+
+    quota_get_stats(quota, &stats);
+    CHECK(stats.classes[QUOTA_INTERACTIVE].cancelled == 1 && stats.classes[QUOTA_INTERACTIVE].depth == 0);
+    CHECK(stats.classes[QUOTA_INTERACTIVE].granted == 1);
+
+    quota_close(quota);
+
+} /* _test_cancel() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    quota_class_t cls = QUOTA_BULK;
+
+    CHECK(0 == quota_class_parse("interactive", &cls) && cls == QUOTA_INTERACTIVE);
+    CHECK(0 == quota_class_parse(quota_class_name(QUOTA_BULK), &cls) && cls == QUOTA_BULK);
+    CHECK(-1 == quota_class_parse("urgent", &cls));
+
+    _test_rate();
+    _test_priority();
+    _test_cancel();
+
+    return CHECK_RESULT();
+
+} /* main() */
@@ -0,0 +1,271 @@
+/*
+ *  Name: test_record.c
+ *  Description:
+ *  record.c: how strings are escaped and numbers written in JSON, that
+ *  a binary frame carries the encoded fields as they are and renders
+ *  the same JSON when appended to another record, and that malformed or
+ *  unfinished records are refused.
+ */
+
+#include "../record.h"
+#include "check.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/******************************************************************
+ *
+ *    _TEST_ESCAPING
+ *
+ *****************************************************************/
+static void
+_test_escaping(void)
+{
+    record_t    record;
+    const char* json = NULL;
+    size_t      size = 0;
+
+    record_init(&record);
+
+    record_string(&record, "title", "a\"b\\c\nd\re\tf\001g\037h \xc3\xa9");
+    record_string(&record, "we\"ird\tkey", "");
+    json = record_render(&record, RECORD_FORMAT_JSON, &size);
+    CHECK(json != NULL);
+    if (json)
+    {
+        CHECK_BYTES(json, size,
+            "{\"title\": \"a\\\"b\\\\c\\nd\\re\\tf\\u0001g\\u001fh \xc3\xa9\", \"we\\\"ird\\tkey\": \"\"}\n");
+    }
+
+    /* a string field formatted like printf(), escaped the same way */
+    record_clear(&record);
+    record_stringf(&record, "error", "Failed to open %s: %d", "C:\\clips\\\"x\".wav", 2);
+    json = record_render(&record, RECORD_FORMAT_JSON, &size);
+    CHECK(json != NULL);
+    if (json)
+    {
+        CHECK_BYTES(json, size, "{\"error\": \"Failed to open C:\\\\clips\\\\\\\"x\\\".wav: 2\"}\n");
+    }
+
+    record_free(&record);
+
+} /* _test_escaping() */
+
+/******************************************************************
+ *
+ *    _TEST_VALUES
+ *
+ *****************************************************************/
+static void
+_test_values(void)
+{
+    record_t    record;
+    const char* json = NULL;
+    size_t      size = 0;
+
+    record_init(&record);
+
+    record_int(&record, "min", INT64_MIN);
+    record_int(&record, "max", INT64_MAX);
+    record_number(&record, "ms", 1.23456, 3);
+    record_number(&record, "rounded", 2.5, 0);
+    record_number(&record, "nan", NAN, 3);
+    record_number(&record, "inf", INFINITY, 1);
+    record_null(&record, "result");
+    json = record_render(&record, RECORD_FORMAT_JSON, &size);
+    CHECK(json != NULL);
+    if (json)
+    {
+        CHECK_BYTES(json, size,
+            "{\"min\": -9223372036854775808, \"max\": 9223372036854775807, \"ms\": 1.235, "
+            "\"rounded\": 3, \"nan\": null, \"inf\": null, \"result\": null}\n");
+    }
+
+    record_free(&record);
+
+} /* _test_values() */
+
+/******************************************************************
+ *
+ *    _BUILD_NESTED
+ *
+ *    A record with every type of field, nested.
+ *
+ *****************************************************************/
+static void
+_build_nested(
+    record_t* record
+    )
+{
+    record_string(record, "file", "clips/0412.wav");
+    record_begin_object(record, "result");
+    record_string(record, "artist", "Daft \"Punk\"");
+    record_int(record, "track", 3);
+    record_begin_array(record, "candidates");
+    record_begin_object(record, "");
+    record_number(record, "score", 0.875, 3);
+    record_null(record, "album");
+    record_end_object(record);
+    record_string(record, "", "tab\there");
+    record_begin_array(record, "");
+    record_end_array(record);
+    record_end_array(record);
+    record_end_object(record);
+    record_begin_object(record, "empty");
+    record_end_object(record);
+
+} /* _build_nested() */
+
+/******************************************************************
+ *
+ *    _TEST_BINARY_ROUND_TRIP
+ *
+ *****************************************************************/
+static void
+_test_binary_round_trip(void)
+{
+    static const char expected[] =
+        "{\"file\": \"clips/0412.wav\", \"result\": {\"artist\": \"Daft \\\"Punk\\\"\", \"track\": 3, "
+        "\"candidates\": [{\"score\": 0.875, \"album\": null}, \"tab\\there\", []]}, \"empty\": {}}\n";
+    record_t             record;
+    record_t             copy;
+    const unsigned char* frame = NULL;
+    const char*          json  = NULL;
+    unsigned char*       saved = NULL;
+    size_t               size  = 0;
+    uint32_t             len   = 0;
+
+    record_init(&record);
+    record_init(&copy);
+
+    _build_nested(&record);
+    json = record_render(&record, RECORD_FORMAT_JSON, &size);
+    CHECK(json != NULL);
+    if (json)
+    {
+        CHECK_BYTES(json, size, expected);
+    }
+
+    /* a u32 length, then the fields exactly as they were encoded */
+    frame = record_render(&record, RECORD_FORMAT_BINARY, &size);
+    CHECK(frame != NULL);
+    if (frame == NULL)
+    {
+        record_free(&record);
+        record_free(&copy);
+        return;
+    }
+    len = (uint32_t)frame[0] | (uint32_t)frame[1] << 8 | (uint32_t)frame[2] << 16 | (uint32_t)frame[3] << 24;
+    CHECK(size == 4 + record.size);
+    CHECK(len == record.size);
+    CHECK(0 == memcmp(frame + 4, record.data, record.size));
+    CHECK(record_valid(frame + 4, len));
+
+    /* read back, the frame's fields render the same JSON */
+    saved = malloc(len);
+    CHECK(saved != NULL);
+    if (saved)
+    {
+        memcpy(saved, frame + 4, len);
+        record_append(&copy, saved, len);
+        json = record_render(&copy, RECORD_FORMAT_JSON, &size);
+        CHECK(json != NULL);
+        if (json)
+        {
+            CHECK_BYTES(json, size, expected);
+        }
+
+        /* and a frame of their own that is the same bytes */
+        frame = record_render(&copy, RECORD_FORMAT_BINARY, &size);
+        CHECK(frame != NULL && size == 4 + len && 0 == memcmp(frame + 4, saved, len));
+        free(saved);
+    }
+
+    /* keeping the buffers, a cleared record starts afresh */
+    record_clear(&record);
+    record_null(&record, "result");
+    json = record_render(&record, RECORD_FORMAT_JSON, &size);
+    CHECK(json != NULL);
+    if (json)
+    {
+        CHECK_BYTES(json, size, "{\"result\": null}\n");
+    }
+
+    record_free(&copy);
+    record_free(&record);
+
+} /* _test_binary_round_trip() */
+
+/******************************************************************
+ *
+ *    _TEST_MALFORMED
+ *
+ *****************************************************************/
+static void
+_test_malformed(void)
+{
+    record_t       record;
+    unsigned char* fields = NULL;
+    size_t         size   = 0;
+    int            i      = 0;
+
+    record_init(&record);
+    _build_nested(&record);
+
+    fields = malloc(record.size);
+    CHECK(fields != NULL);
+    if (fields)
+    {
+        memcpy(fields, record.data, record.size);
+        CHECK(record_valid(fields, record.size));
+
+        /* cut short, or with a length running past the end */
+        CHECK(!record_valid(fields, record.size - 1));
+        CHECK(!record_valid(fields, 1));
+
+        /* an unknown type */
+        fields[0] = 0x7f;
+        CHECK(!record_valid(fields, record.size));
+        free(fields);
+    }
+
+    /* an object left open can't be rendered */
+    record_clear(&record);
+    record_begin_object(&record, "result");
+    CHECK(record_render(&record, RECORD_FORMAT_JSON, &size) == NULL);
+    CHECK(record_render(&record, RECORD_FORMAT_BINARY, &size) == NULL);
+
+    /* nor can one nested too deep */
+    record_clear(&record);
+    for (i = 0; i <= RECORD_MAX_DEPTH; i++)
+    {
+        record_begin_object(&record, "deeper");
+    }
+    for (i = 0; i <= RECORD_MAX_DEPTH; i++)
+    {
+        record_end_object(&record);
+    }
+    CHECK(record.b_failed);
+    CHECK(record_render(&record, RECORD_FORMAT_JSON, &size) == NULL);
+
+    record_free(&record);
+
+} /* _test_malformed() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    _test_escaping();
+    _test_values();
+    _test_binary_round_trip();
+    _test_malformed();
+
+    return CHECK_RESULT();
+
+} /* main() */
@@ -0,0 +1,236 @@
+/*
+ *  Name: test_spool.c
+ *  Description:
+ *  spool.c: entries come back as they were appended, and one that is
+ *  damaged, torn off at the end or surrounded by stray bytes is skipped
+ *  (and its bytes counted) without losing the entries around it.
+ */
+
+#include "../spool.h"
+#include "check.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* an entry's header: magic, body size and hash */
+#define HEADER_SIZE 12
+
+static const spool_entry_t s_entries[] =
+{
+    { "clips/0001.wav", 1700000000123ULL, 0, "gnsdk_fp_stream", "AAECAwQFBgcICQ" },
+    { "clips/0002.wav", 1700000060456ULL, 3, "gnsdk_fp_stream", "ZmluZ2VycHJpbnQgdHdv" },
+    { "clips/0003.wav", 1700000120789ULL, 1, "gnsdk_fp_stream", "dGhyZWU" },
+};
+
+#define ENTRY_COUNT (sizeof(s_entries) / sizeof(s_entries[0]))
+
+/******************************************************************
+ *
+ *    _ENTRY_SIZE
+ *
+ *    Bytes entry takes in a spool.
+ *
+ *****************************************************************/
+static size_t
+_entry_size(
+    const spool_entry_t* entry
+    )
+{
+    return HEADER_SIZE + 8 + 4 + strlen(entry->id) + 1 + strlen(entry->fp_type) + 1 + strlen(entry->fp_data) + 1;
+
+} /* _entry_size() */
+
+/******************************************************************
+ *
+ *    _SAME_ENTRY
+ *
+ *****************************************************************/
+static int
+_same_entry(
+    const spool_entry_t* a,
+    const spool_entry_t* b
+    )
+{
+    return 0 == strcmp(a->id, b->id) && a->captured_ms == b->captured_ms && a->attempts == b->attempts
+           && 0 == strcmp(a->fp_type, b->fp_type) && 0 == strcmp(a->fp_data, b->fp_data);
+
+} /* _same_entry() */
+
+/******************************************************************
+ *
+ *    _WRITE_SPOOL
+ *
+ *    A new spool at path with the entries in s_entries, and junk
+ *    bytes written straight after the first.
+ *
+ *****************************************************************/
+static void
+_write_spool(
+    const char* path,
+    const char* junk
+    )
+{
+    spool_t* spool = NULL;
+    int      fd    = -1;
+    size_t   i     = 0;
+
+    unlink(path);
+    spool = spool_open(path);
+    CHECK(spool != NULL);
+    if (spool == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < ENTRY_COUNT; i++)
+    {
+        CHECK(0 == spool_append(spool, &s_entries[i]));
+        if (0 == i && junk)
+        {
+            fd = open(path, O_WRONLY | O_APPEND);
+            CHECK(fd >= 0 && (ssize_t)strlen(junk) == write(fd, junk, strlen(junk)));
+            close(fd);
+        }
+    }
+    spool_close(spool);
+
+} /* _write_spool() */
+
+/******************************************************************
+ *
+ *    _FLIP_BYTE
+ *
+ *****************************************************************/
+static void
+_flip_byte(
+    const char* path,
+    off_t       offset
+    )
+{
+    unsigned char byte = 0;
+    int           fd   = open(path, O_RDWR);
+
+    CHECK(fd >= 0);
+    CHECK(1 == pread(fd, &byte, 1, offset));
+    byte ^= 0x20;
+    CHECK(1 == pwrite(fd, &byte, 1, offset));
+    close(fd);
+
+} /* _flip_byte() */
+
+/******************************************************************
+ *
+ *    _TEST_ROUND_TRIP
+ *
+ *****************************************************************/
+static void
+_test_round_trip(
+    const char* path
+    )
+{
+    spool_contents_t contents;
+    struct stat      st;
+    size_t           i = 0;
+
+    _write_spool(path, NULL);
+    CHECK(0 == stat(path, &st));
+    CHECK((size_t)st.st_size == _entry_size(&s_entries[0]) + _entry_size(&s_entries[1]) + _entry_size(&s_entries[2]));
+
+    CHECK(0 == spool_read(path, &contents));
+    CHECK(contents.count == ENTRY_COUNT);
+    CHECK(contents.damaged == 0);
+    for (i = 0; i < contents.count && i < ENTRY_COUNT; i++)
+    {
+        CHECK(_same_entry(&contents.entries[i], &s_entries[i]));
+    }
+    spool_contents_free(&contents);
+
+    /* an empty spool has no entries; a missing one can't be read */
+    CHECK(0 == truncate(path, 0));
+    CHECK(0 == spool_read(path, &contents));
+    CHECK(contents.count == 0 && contents.damaged == 0);
+    spool_contents_free(&contents);
+
+    unlink(path);
+    CHECK(-1 == spool_read(path, &contents));
+
+} /* _test_round_trip() */
+
+/******************************************************************
+ *
+ *    _TEST_DAMAGED
+ *
+ *****************************************************************/
+static void
+_test_damaged(
+    const char* path
+    )
+{
+    spool_contents_t contents;
+    size_t           first  = _entry_size(&s_entries[0]);
+    size_t           second = _entry_size(&s_entries[1]);
+    size_t           third  = _entry_size(&s_entries[2]);
+
+    /* a byte of the second entry's fingerprint changed: its hash fails */
+    _write_spool(path, NULL);
+    _flip_byte(path, (off_t)(first + second - 3));
+    CHECK(0 == spool_read(path, &contents));
+    CHECK(contents.count == 2);
+    CHECK(contents.damaged == second);
+    CHECK(contents.count == 2 && _same_entry(&contents.entries[0], &s_entries[0])
+          && _same_entry(&contents.entries[1], &s_entries[2]));
+    spool_contents_free(&contents);
+
+    /* its size changed: the entries after it are still found */
+    _write_spool(path, NULL);
+    _flip_byte(path, (off_t)(first + 4));
+    CHECK(0 == spool_read(path, &contents));
+    CHECK(contents.count == 2);
+    CHECK(contents.damaged == second);
+    CHECK(contents.count == 2 && _same_entry(&contents.entries[1], &s_entries[2]));
+    spool_contents_free(&contents);
+
+    /* the last torn off by a crash part way through its write */
+    _write_spool(path, NULL);
+    CHECK(0 == truncate(path, (off_t)(first + second + third - 5)));
+    CHECK(0 == spool_read(path, &contents));
+    CHECK(contents.count == 2);
+    CHECK(contents.damaged == third - 5);
+    CHECK(contents.count == 2 && _same_entry(&contents.entries[1], &s_entries[1]));
+    spool_contents_free(&contents);
+
+    /* stray bytes between entries */
+    _write_spool(path, "not an entry");
+    CHECK(0 == spool_read(path, &contents));
+    CHECK(contents.count == ENTRY_COUNT);
+    CHECK(contents.damaged == strlen("not an entry"));
+    CHECK(contents.count == ENTRY_COUNT && _same_entry(&contents.entries[1], &s_entries[1]));
+    spool_contents_free(&contents);
+
+    unlink(path);
+
+} /* _test_damaged() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    char dir[] = "/tmp/test_spool.XXXXXX";
+    char path[64];
+
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(path, sizeof(path), "%s/spool", dir);
+
+    _test_round_trip(path);
+    _test_damaged(path);
+
+    rmdir(dir);
+
+    return CHECK_RESULT();
+
+} /* main() */
@@ -0,0 +1,340 @@
+/*
+ *  Name: test_wav.c
+ *  Description:
+ *  wav.c: the chunks ahead of the audio are walked whatever they are,
+ *  odd-sized ones included, the format is read from plain, extensible
+ *  and RF64 headers, a data size that is missing or too big is taken
+ *  from the file where there is one, and broken headers are refused.
+ *  Headers are read from a file and from a pipe.
+ */
+
+#include "../wav.h"
+#include "check.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/* a header being built */
+typedef struct
+{
+    unsigned char bytes[512];
+    size_t        size;
+
+} header_t;
+
+/******************************************************************
+ *
+ *    _PUT
+ *
+ *    Append size bytes of value, little-endian.
+ *
+ *****************************************************************/
+static void
+_put(
+    header_t* header,
+    uint64_t  value,
+    size_t    size
+    )
+{
+    size_t i = 0;
+
+    for (i = 0; i < size; i++)
+    {
+        header->bytes[header->size++] = (i < 8) ? (unsigned char)(value >> (8 * i)) : 0;
+    }
+
+} /* _put() */
+
+static void
+_put_id(
+    header_t*   header,
+    const char* id
+    )
+{
+    memcpy(header->bytes + header->size, id, 4);
+    header->size += 4;
+}
+
+/******************************************************************
+ *
+ *    _PUT_FMT
+ *
+ *    A fmt chunk; with b_extensible, a WAVE_FORMAT_EXTENSIBLE one
+ *    whose sub-format is format_tag.
+ *
+ *****************************************************************/
+static void
+_put_fmt(
+    header_t* header,
+    uint16_t  format_tag,
+    uint16_t  channels,
+    uint32_t  sample_rate,
+    uint16_t  bits,
+    int       b_extensible
+    )
+{
+    _put_id(header, "fmt ");
+    _put(header, b_extensible ? 40 : 16, 4);
+    _put(header, b_extensible ? WAV_FORMAT_EXTENSIBLE : format_tag, 2);
+    _put(header, channels, 2);
+    _put(header, sample_rate, 4);
+    _put(header, sample_rate * channels * (bits / 8), 4);
+    _put(header, channels * (bits / 8), 2);
+    _put(header, bits, 2);
+    if (b_extensible)
+    {
+        _put(header, 22, 2);
+        _put(header, bits, 2);
+        _put(header, 3, 4);
+        _put(header, format_tag, 2);
+        _put(header, 0, 14);
+    }
+
+} /* _put_fmt() */
+
+/******************************************************************
+ *
+ *    _PARSE
+ *
+ *    Parse header followed by audio_size bytes of audio (counting up
+ *    from 1), from a file or a pipe. On success the first byte after
+ *    the header is read back into *p_first.
+ *
+ *****************************************************************/
+static int
+_parse(
+    const header_t* header,
+    size_t          audio_size,
+    int             b_pipe,
+    wav_info_t*     p_info,
+    const char**    p_error,
+    unsigned char*  p_first
+    )
+{
+    unsigned char audio[64];
+    char          path[]  = "/tmp/test_wav.XXXXXX";
+    int           fds[2]  = { -1, -1 };
+    int           rc      = 0;
+    size_t        i       = 0;
+
+    for (i = 0; i < sizeof(audio); i++)
+    {
+        audio[i] = (unsigned char)(i + 1);
+    }
+    CHECK(audio_size <= sizeof(audio));
+
+    if (b_pipe)
+    {
+        CHECK(0 == pipe(fds));
+    }
+    else
+    {
+        fds[0] = mkstemp(path);
+        fds[1] = dup(fds[0]);
+        CHECK(fds[0] >= 0);
+        unlink(path);
+    }
+    CHECK((ssize_t)header->size == write(fds[1], header->bytes, header->size));
+    CHECK((ssize_t)audio_size == write(fds[1], audio, audio_size));
+    close(fds[1]);
+    if (!b_pipe)
+    {
+        lseek(fds[0], 0, SEEK_SET);
+    }
+
+    *p_first = 0;
+    rc = wav_parse_header(fds[0], p_info, p_error);
+    if (0 == rc && audio_size > 0)
+    {
+        CHECK(1 == read(fds[0], p_first, 1));
+    }
+    close(fds[0]);
+
+    return rc;
+
+} /* _parse() */
+
+/******************************************************************
+ *
+ *    _TEST_CHUNKS
+ *
+ *****************************************************************/
+static void
+_test_chunks(void)
+{
+    header_t      header = { {0}, 0 };
+    wav_info_t    info;
+    const char*   error  = NULL;
+    unsigned char first  = 0;
+    int           b_pipe = 0;
+
+    /* a LIST chunk of odd size (so padded), fmt, an unknown chunk, data */
+    _put_id(&header, "RIFF");
+    _put(&header, 0, 4);
+    _put_id(&header, "WAVE");
+    _put_id(&header, "LIST");
+    _put(&header, 5, 4);
+    _put(&header, 0x6f666e49, 4);
+    _put(&header, 0, 2);
+    _put_fmt(&header, WAV_FORMAT_PCM, 2, 44100, 16, 0);
+    _put_id(&header, "fact");
+    _put(&header, 4, 4);
+    _put(&header, 1234, 4);
+    _put_id(&header, "data");
+    _put(&header, 32, 4);
+
+    for (b_pipe = 0; b_pipe < 2; b_pipe++)
+    {
+        CHECK(0 == _parse(&header, 32, b_pipe, &info, &error, &first));
+        CHECK(info.format.sample_rate == 44100);
+        CHECK(info.format.channels == 2);
+        CHECK(info.format.bits_per_sample == 16);
+        CHECK(info.format_tag == WAV_FORMAT_PCM);
+        CHECK(info.block_align == 4);
+        CHECK(info.data_offset == header.size);
+        CHECK(info.data_size == 32);
+
+        /* left at the first sample */
+        CHECK(first == 1);
+    }
+
+    /* a file cut short has only what is there */
+    CHECK(0 == _parse(&header, 20, 0, &info, &error, &first));
+    CHECK(info.data_size == 20);
+
+} /* _test_chunks() */
+
+/******************************************************************
+ *
+ *    _TEST_FORMATS
+ *
+ *****************************************************************/
+static void
+_test_formats(void)
+{
+    header_t      header = { {0}, 0 };
+    wav_info_t    info;
+    const char*   error  = NULL;
+    unsigned char first  = 0;
+
+    /* extensible, float underneath; size left at 0 by a streaming writer */
+    _put_id(&header, "RIFF");
+    _put(&header, 0, 4);
+    _put_id(&header, "WAVE");
+    _put_fmt(&header, WAV_FORMAT_IEEE_FLOAT, 1, 48000, 32, 1);
+    _put_id(&header, "data");
+    _put(&header, 0, 4);
+
+    CHECK(0 == _parse(&header, 16, 1, &info, &error, &first));
+    CHECK(info.format_tag == WAV_FORMAT_IEEE_FLOAT);
+    CHECK(info.format.sample_rate == 48000 && info.format.channels == 1 && info.format.bits_per_sample == 32);
+    CHECK(info.data_size == WAV_SIZE_UNKNOWN);
+    CHECK(first == 1);
+
+    /* the same in a file: its size says how much there is */
+    CHECK(0 == _parse(&header, 16, 0, &info, &error, &first));
+    CHECK(info.data_size == 16);
+
+    /* RF64: the data size is in the ds64 chunk */
+    header.size = 0;
+    _put_id(&header, "RF64");
+    _put(&header, 0xFFFFFFFFu, 4);
+    _put_id(&header, "WAVE");
+    _put_id(&header, "ds64");
+    _put(&header, 28, 4);
+    _put(&header, 0, 8);
+    _put(&header, 24, 8);
+    _put(&header, 0, 8);
+    _put(&header, 0, 4);
+    _put_fmt(&header, WAV_FORMAT_PCM, 2, 22050, 24, 0);
+    _put_id(&header, "data");
+    _put(&header, 0xFFFFFFFFu, 4);
+
+    CHECK(0 == _parse(&header, 24, 1, &info, &error, &first));
+    CHECK(info.format.bits_per_sample == 24 && info.block_align == 6);
+    CHECK(info.data_size == 24);
+    CHECK(first == 1);
+
+    /* and in a file, whatever follows the audio */
+    CHECK(0 == _parse(&header, 40, 0, &info, &error, &first));
+    CHECK(info.data_size == 24);
+
+} /* _test_formats() */
+
+/******************************************************************
+ *
+ *    _EXPECT_ERROR
+ *
+ *****************************************************************/
+static void
+_expect_error(
+    const header_t* header,
+    const char*     expected
+    )
+{
+    wav_info_t    info;
+    const char*   error = NULL;
+    unsigned char first = 0;
+
+    CHECK(-1 == _parse(header, 0, 1, &info, &error, &first));
+    CHECK(error != NULL && 0 == strcmp(error, expected));
+
+} /* _expect_error() */
+
+/******************************************************************
+ *
+ *    _TEST_ERRORS
+ *
+ *****************************************************************/
+static void
+_test_errors(void)
+{
+    header_t header = { {0}, 0 };
+
+    _put_id(&header, "RIFF");
+    _expect_error(&header, "File too short for a WAV header");
+
+    _put(&header, 0, 4);
+    _put_id(&header, "AVI ");
+    _expect_error(&header, "Not a RIFF/WAVE file");
+
+    header.size = 8;
+    _put_id(&header, "WAVE");
+    _expect_error(&header, "No data chunk in WAV file");
+
+    _put_id(&header, "data");
+    _put(&header, 0, 4);
+    _expect_error(&header, "No fmt chunk before the data chunk");
+
+    /* ADPCM */
+    header.size = 12;
+    _put_fmt(&header, 0x0002, 2, 44100, 16, 0);
+    _expect_error(&header, "Unsupported WAV encoding (only PCM and float are supported)");
+
+    /* a frame size that doesn't match the channels and sample size */
+    header.size = 12;
+    _put_fmt(&header, WAV_FORMAT_PCM, 2, 44100, 16, 0);
+    header.bytes[12 + 8 + 12] = 3;
+    _expect_error(&header, "Invalid WAV format");
+
+    /* the header ends inside the fmt chunk */
+    header.size = 12 + 8 + 10;
+    _expect_error(&header, "Truncated WAV header");
+
+} /* _test_errors() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    _test_chunks();
+    _test_formats();
+    _test_errors();
+
+    return CHECK_RESULT();
+
+} /* main() */
@@ -0,0 +1,343 @@
+/*
+ *  Name: test_workq.c
+ *  Description:
+ *  workq.c: units done in any order are merged in the order they were
+ *  split, a merge of a queue not sealed or not finished writes nothing,
+ *  and a lease is kept while its worker renews it and reclaimed once it
+ *  has gone quiet. The other worker is a child process, as leases held
+ *  by this one are never reclaimed by it.
+ */
+
+#include "../workq.h"
+#include "check.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define UNITS 5
+
+/* short, so that a lease expires within the test */
+#define LEASE_SECONDS 0.3
+
+/******************************************************************
+ *
+ *    _NOW
+ *
+ *****************************************************************/
+static double
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+
+} /* _now() */
+
+/******************************************************************
+ *
+ *    _SPLIT
+ *
+ *    A queue at dir of units units of two inputs each, sealed if
+ *    b_seal.
+ *
+ *****************************************************************/
+static void
+_split(
+    const char* dir,
+    size_t      units,
+    int         b_seal
+    )
+{
+    char   first[48];
+    char   second[48];
+    char*  paths[2] = { first, second };
+    size_t i        = 0;
+
+    CHECK(0 == workq_create(dir));
+    for (i = 0; i < units; i++)
+    {
+        snprintf(first, sizeof(first), "clips/%zu-a.wav", i);
+        snprintf(second, sizeof(second), "clips/%zu-b.wav", i);
+        CHECK(0 == workq_add(dir, i, paths, 2));
+    }
+    if (b_seal)
+    {
+        CHECK(0 == workq_seal(dir, units));
+    }
+
+} /* _split() */
+
+/******************************************************************
+ *
+ *    _COMPLETE
+ *
+ *    Store a unit's results: a line per input naming its unit.
+ *
+ *****************************************************************/
+static void
+_complete(
+    workq_t*      workq,
+    workq_unit_t* unit
+    )
+{
+    char   results[256] = {0};
+    size_t len          = 0;
+    size_t i            = 0;
+
+    for (i = 0; i < unit->count; i++)
+    {
+        len += (size_t)snprintf(results + len, sizeof(results) - len, "%s %s\n", unit->name, unit->paths[i]);
+    }
+    CHECK(0 == workq_complete(workq, unit, results, len));
+
+} /* _complete() */
+
+/******************************************************************
+ *
+ *    _MERGE
+ *
+ *    Merge the queue at dir into a string for free(), NULL if it
+ *    failed.
+ *
+ *****************************************************************/
+static char*
+_merge(
+    const char* dir,
+    size_t*     p_missing
+    )
+{
+    char*  merged  = NULL;
+    size_t size    = 0;
+    size_t units   = 0;
+    FILE*  out     = open_memstream(&merged, &size);
+    int    rc      = 0;
+
+    CHECK(out != NULL);
+    if (out == NULL)
+    {
+        return NULL;
+    }
+    rc = workq_merge(dir, out, &units, p_missing);
+    fclose(out);
+    if (0 != rc)
+    {
+        CHECK(size == 0);
+        free(merged);
+        return NULL;
+    }
+
+    return merged;
+
+} /* _merge() */
+
+/******************************************************************
+ *
+ *    _TEST_MERGE_ORDER
+ *
+ *****************************************************************/
+static void
+_test_merge_order(
+    const char* dir
+    )
+{
+    static const char expected[] =
+        "00000000 clips/0-a.wav\n00000000 clips/0-b.wav\n"
+        "00000001 clips/1-a.wav\n00000001 clips/1-b.wav\n"
+        "00000002 clips/2-a.wav\n00000002 clips/2-b.wav\n"
+        "00000003 clips/3-a.wav\n00000003 clips/3-b.wav\n"
+        "00000004 clips/4-a.wav\n00000004 clips/4-b.wav\n";
+    workq_t*      workq   = NULL;
+    workq_unit_t  units[UNITS];
+    workq_stats_t stats;
+    size_t        missing = 0;
+    char*         merged  = NULL;
+    int           leased  = 0;
+
+    /* not sealed: the split may not be over */
+    _split(dir, UNITS, 0);
+    CHECK(_merge(dir, &missing) == NULL && errno == ENOENT);
+    CHECK(0 == workq_seal(dir, UNITS));
+    CHECK(workq_create(dir) == -1 && errno == EEXIST);
+
+    workq = workq_open(dir, 60);
+    CHECK(workq != NULL);
+    if (workq == NULL)
+    {
+        return;
+    }
+
+    while (leased < UNITS && WORKQ_LEASED == workq_lease(workq, &units[leased]))
+    {
+        CHECK(units[leased].count == 2);
+        leased++;
+    }
+    CHECK(leased == UNITS);
+
+    /* sealed but not done: nothing is written */
+    CHECK(_merge(dir, &missing) == NULL && errno == EAGAIN);
+    CHECK(missing == UNITS);
+
+    /* done last to first, merged first to last */
+    while (leased > 0)
+    {
+        _complete(workq, &units[--leased]);
+    }
+    CHECK(WORKQ_FINISHED == workq_lease(workq, &units[0]));
+
+    merged = _merge(dir, &missing);
+    CHECK(merged != NULL && 0 == strcmp(merged, expected));
+    CHECK(missing == 0);
+    free(merged);
+
+    workq_stats(workq, &stats);
+    CHECK(stats.leased == UNITS && stats.completed == UNITS);
+    CHECK(stats.released == 0 && stats.reclaimed == 0 && stats.lost == 0);
+    workq_close(workq);
+
+} /* _test_merge_order() */
+
+/******************************************************************
+ *
+ *    _LEASE_AND_DIE
+ *
+ *    The child: take a unit, say which, renew it for hold seconds and
+ *    exit without finishing it.
+ *
+ *****************************************************************/
+static void
+_lease_and_die(
+    const char* dir,
+    int         fd,
+    double      hold
+    )
+{
+    workq_t*     workq = workq_open(dir, LEASE_SECONDS);
+    workq_unit_t unit;
+
+    if (workq == NULL || WORKQ_LEASED != workq_lease(workq, &unit))
+    {
+        _exit(1);
+    }
+    if ((ssize_t)strlen(unit.name) + 1 != write(fd, unit.name, strlen(unit.name) + 1))
+    {
+        _exit(1);
+    }
+    usleep((useconds_t)(hold * 1e6));
+    _exit(0);
+
+} /* _lease_and_die() */
+
+/******************************************************************
+ *
+ *    _TEST_RECLAIM
+ *
+ *****************************************************************/
+static void
+_test_reclaim(
+    const char* dir
+    )
+{
+    workq_t*      workq      = NULL;
+    workq_unit_t  unit;
+    workq_stats_t stats;
+    char          taken[32]  = {0};
+    size_t        missing    = 0;
+    char*         merged     = NULL;
+    double        until      = 0;
+    int           fds[2]     = { -1, -1 };
+    int           status     = 0;
+    int           b_waited   = 1;
+    pid_t         child      = 0;
+
+    _split(dir, 2, 1);
+
+    CHECK(0 == pipe(fds));
+    child = fork();
+    CHECK(child >= 0);
+    if (child == 0)
+    {
+        close(fds[0]);
+        _lease_and_die(dir, fds[1], 4 * LEASE_SECONDS);
+    }
+    close(fds[1]);
+    CHECK(read(fds[0], taken, sizeof(taken) - 1) > 0);
+    close(fds[0]);
+
+    workq = workq_open(dir, LEASE_SECONDS);
+    CHECK(workq != NULL);
+    if (workq == NULL)
+    {
+        waitpid(child, &status, 0);
+        return;
+    }
+
+    /* the unit the child didn't take */
+    CHECK(WORKQ_LEASED == workq_lease(workq, &unit));
+    CHECK(0 != strcmp(unit.name, taken));
+    _complete(workq, &unit);
+
+    /* the child's is kept from us for as long as it renews it */
+    until = _now() + 2 * LEASE_SECONDS;
+    while (_now() < until)
+    {
+        b_waited &= (WORKQ_WAIT == workq_lease(workq, &unit));
+        usleep(20 * 1000);
+    }
+    CHECK(b_waited);
+
+    /* once it has died, it is ours a lease time later */
+    CHECK(child == waitpid(child, &status, 0) && WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    until = _now() + 10 * LEASE_SECONDS;
+    while (WORKQ_WAIT == workq_lease(workq, &unit) && _now() < until)
+    {
+        usleep(20 * 1000);
+    }
+    CHECK(unit.name != NULL && 0 == strcmp(unit.name, taken));
+    if (unit.name)
+    {
+        _complete(workq, &unit);
+    }
+    CHECK(WORKQ_FINISHED == workq_lease(workq, &unit));
+
+    workq_stats(workq, &stats);
+    CHECK(stats.leased == 2 && stats.completed == 2 && stats.reclaimed == 1);
+    workq_close(workq);
+
+    merged = _merge(dir, &missing);
+    CHECK(merged != NULL && 0 == strcmp(merged,
+        "00000000 clips/0-a.wav\n00000000 clips/0-b.wav\n00000001 clips/1-a.wav\n00000001 clips/1-b.wav\n"));
+    free(merged);
+
+} /* _test_reclaim() */
+
+/******************************************************************
+ *
+ *    MAIN
+ *
+ *****************************************************************/
+int
+main(void)
+{
+    char dir[] = "/tmp/test_workq.XXXXXX";
+    char path[64];
+    char command[96];
+
+    CHECK(mkdtemp(dir) != NULL);
+
+    snprintf(path, sizeof(path), "%s/merge", dir);
+    _test_merge_order(path);
+
+    snprintf(path, sizeof(path), "%s/reclaim", dir);
+    _test_reclaim(path);
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    CHECK(0 == system(command));
+
+    return CHECK_RESULT();
+
+} /* main() */
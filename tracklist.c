@@ -0,0 +1,588 @@
+/*
+ *  Name: tracklist.c
+ *  Description:
+ *  --tracklist. The windows of a mix are inputs of their own sharing
+ *  its mapping; each is answered from the cache or the local index when
+ *  it can be, and otherwise identified on a channel whose answer is kept
+ *  in the window (see s_tracklist_hooks) rather than written out.
+ */
+
+#include "tracklist.h"
+#include "batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* windows in a row without a match that a track may span */
+#define TRACKLIST_MAX_GAP 1
+
+/* One --tracklist window of a mix, the owner of the query identifying
+ * it: where it is and what it was identified as */
+typedef struct
+{
+    size_t          offset;       /* bytes from the first sample */
+    size_t          size;
+    gnsdk_bool_t    b_answered;   /* a result, no match included, came back */
+    unsigned char*  result;       /* its "result" field encoded, GNSDK_NULL if no match */
+    size_t          result_size;
+
+} tracklist_window_t;
+
+/* Shared by the --tracklist workers of one mix */
+typedef struct
+{
+    batch_t*            batch;         /* the SDK, started by the first window that needs it */
+    const char*         path;
+    audio_input_t*      input;         /* the mix, mapped */
+    tracklist_window_t* windows;
+    size_t              window_count;
+    size_t              next_window;   /* first window not yet claimed by a worker */
+    pthread_mutex_t     lock;          /* guards next_window */
+
+} tracklist_t;
+
+/**********************************************
+ *    Local Function Declarations
+ **********************************************/
+static void
+_tracklist_result(
+    query_t*           query,
+    gnsdk_gdo_handle_t response_gdo
+    );
+
+static void
+_tracklist_error(
+    query_t*    query,
+    const char* description
+    );
+
+/* each window's answer is kept for its tracklist */
+static const query_hooks_t s_tracklist_hooks =
+{
+    GNSDK_FALSE,
+    GNSDK_NULL,
+    GNSDK_NULL,
+    GNSDK_NULL,
+    _tracklist_result,
+    _tracklist_error
+};
+
+/***************************************************************************
+ *
+ *    _TRACKLIST_KEEP
+ *
+ * Keep the fields of record as the window's result.
+ *
+ ***************************************************************************/
+static void
+_tracklist_keep(
+    tracklist_window_t* window,
+    record_t*           record
+    )
+{
+    free(window->result);
+    window->result = malloc(record->size);
+    if (window->result)
+    {
+        memcpy(window->result, record->data, record->size);
+        window->result_size = record->size;
+        window->b_answered  = GNSDK_TRUE;
+    }
+
+}   /* _tracklist_keep() */
+
+/***************************************************************************
+ *
+ *    _TRACKLIST_LOOKUP
+ *
+ * Answer a window from --cache or --local-index. Returns 1 if it has
+ * been answered, 0 if it is left to the service (with the cache key
+ * set for its answer).
+ *
+ ***************************************************************************/
+static int
+_tracklist_lookup(
+    query_t*            query,
+    audio_input_t*      input,
+    tracklist_window_t* window
+    )
+{
+    query_context_t*       context = query->context;
+    record_t*              record  = query_thread_record();
+    landmark_fp_t*         fp      = GNSDK_NULL;
+    const landmark_hash_t* hashes  = GNSDK_NULL;
+    landmark_match_t       match;
+    void*                  cached  = GNSDK_NULL;
+    size_t                 size    = 0;
+    double                 seconds = 0;
+    int                    rc      = 0;
+
+    query->b_cache_store = GNSDK_FALSE;
+
+    if (context->cache)
+    {
+        /* the key a file of just this window gets without --candidates */
+        cache_key(&input->info.format, input->p_audio, input->audio_size, query_cache_variant(context, 1), query->cache_key);
+        if (0 == cache_lookup(context->cache, query->cache_key, &cached, &size))
+        {
+            if (record_valid(cached, size))
+            {
+                record_clear(record);
+                record_null(record, "result");
+                if (size != record->size || 0 != memcmp(cached, record->data, size))
+                {
+                    window->result      = cached;
+                    window->result_size = size;
+                    cached              = GNSDK_NULL;
+                }
+                window->b_answered = GNSDK_TRUE;
+                rc = 1;
+            }
+            free(cached);
+            if (1 == rc)
+            {
+                return 1;
+            }
+        }
+        query->b_cache_store = GNSDK_TRUE;
+    }
+
+    if (context->local_index && 0 == query_fingerprint_input(context, input, 0, &fp, &seconds))
+    {
+        size = landmark_fp_hashes(fp, &hashes);
+        if (0 == landmark_index_match(context->local_index, hashes, size, LOCAL_MIN_SCORE, &match))
+        {
+            /* without the offset, so every window of the track agrees */
+            record_clear(record);
+            query_add_local_match(record, &match, GNSDK_FALSE);
+            _tracklist_keep(window, record);
+            query->b_cache_store = GNSDK_FALSE;
+            rc = 1;
+        }
+        landmark_fp_close(fp);
+    }
+
+    return rc;
+
+}   /* _tracklist_lookup() */
+
+/***************************************************************************
+ *
+ *    _TRACKLIST_RESULT
+ *
+ * A response for a window: only the first album is kept, as the same
+ * track must give the same fields in every window for them to be
+ * merged. A response that can't be read leaves the window unanswered.
+ *
+ ***************************************************************************/
+static void
+_tracklist_result(
+    query_t*           query,
+    gnsdk_gdo_handle_t response_gdo
+    )
+{
+    tracklist_window_t* window    = query->owner;
+    record_t*           record    = query_thread_record();
+    gnsdk_gdo_handle_t  album_gdo = GNSDK_NULL;
+    gnsdk_uint32_t      count     = 0;
+    gnsdk_error_t       error     = GNSDK_SUCCESS;
+
+    record_clear(record);
+    error = gnsdk_manager_gdo_child_count(response_gdo, GNSDK_GDO_CHILD_ALBUM, &count);
+    if (GNSDK_SUCCESS == error && count == 0)
+    {
+        record_null(record, "result");
+    }
+    else if (GNSDK_SUCCESS == error)
+    {
+        error = gnsdk_manager_gdo_child_get(response_gdo, GNSDK_GDO_CHILD_ALBUM, 1, &album_gdo);
+        if (GNSDK_SUCCESS == error)
+        {
+            error = query_add_album_gdo(record, "result", album_gdo, GNSDK_FALSE);
+            gnsdk_manager_gdo_release(album_gdo);
+        }
+    }
+    if (GNSDK_SUCCESS != error || record->b_failed || record->depth != 0)
+    {
+        return;
+    }
+
+    if (query->b_cache_store)
+    {
+        cache_store(query->context->cache, query->cache_key, record->data, record->size, count == 0);
+    }
+
+    if (count == 0)
+    {
+        free(window->result);
+        window->result     = GNSDK_NULL;
+        window->b_answered = GNSDK_TRUE;
+    }
+    else
+    {
+        _tracklist_keep(window, record);
+    }
+
+}   /* _tracklist_result() */
+
+/***************************************************************************
+ *
+ *    _TRACKLIST_ERROR
+ *
+ * A window whose identification failed or timed out is left unanswered,
+ * to be counted in its tracklist.
+ *
+ ***************************************************************************/
+static void
+_tracklist_error(
+    query_t*    query,
+    const char* description
+    )
+{
+    GNSDK_UNUSED(query);
+    GNSDK_UNUSED(description);
+
+}   /* _tracklist_error() */
+
+/***************************************************************************
+ *
+ *    _TRACKLIST_WORKER
+ *
+ * Identify windows of the mix until there are none left, each as an
+ * input of its own sharing the mix's mapping, on a channel created when
+ * the first window misses the cache and the local index.
+ *
+ ***************************************************************************/
+static void*
+_tracklist_worker(
+    void* arg
+    )
+{
+    tracklist_t*                         tracklist      = (tracklist_t*)arg;
+    gnsdk_musicidstream_channel_handle_t channel_handle = GNSDK_NULL;
+    query_t                              query          = {0};
+    audio_input_t                        input;
+    tracklist_window_t*                  window         = GNSDK_NULL;
+    size_t                               index          = 0;
+
+    query.context    = tracklist->batch->context;
+    query.hooks      = &s_tracklist_hooks;
+    query.audio_file = tracklist->path;
+    query.out        = query.context->output;
+    query.b_tag_file = GNSDK_TRUE;
+    query.priority   = query.context->priority;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&tracklist->lock);
+        index = tracklist->next_window++;
+        pthread_mutex_unlock(&tracklist->lock);
+
+        if (index >= tracklist->window_count)
+        {
+            break;
+        }
+        window = &tracklist->windows[index];
+
+        input             = *tracklist->input;
+        input.p_audio    += window->offset;
+        input.audio_size  = window->size;
+
+        if (1 == _tracklist_lookup(&query, &input, window))
+        {
+            continue;
+        }
+
+        /* the windows left are counted as errors */
+        if (0 != batch_start_sdk(tracklist->batch))
+        {
+            break;
+        }
+
+        query.owner = window;
+        query_identify_input(tracklist->batch->user_handle, &channel_handle, &query, &input);
+        query.owner = GNSDK_NULL;
+    }
+
+    if (channel_handle)
+    {
+        gnsdk_musicidstream_channel_release(channel_handle);
+    }
+
+    return GNSDK_NULL;
+
+}   /* _tracklist_worker() */
+
+/***************************************************************************
+ *
+ *    _TRACKLIST_SAME
+ *
+ ***************************************************************************/
+static int
+_tracklist_same(
+    const tracklist_window_t* a,
+    const tracklist_window_t* b
+    )
+{
+    return a->result_size == b->result_size && 0 == memcmp(a->result, b->result, a->result_size);
+
+}   /* _tracklist_same() */
+
+/***************************************************************************
+ *
+ *    _TRACKLIST_WRITE
+ *
+ * Merge the identified windows into a tracklist and write it as one
+ * record. A run of windows with the same result (bridging at most
+ * TRACKLIST_MAX_GAP without a match) is one track, from the start of
+ * its first window to the end of its last, or to where the next track's
+ * first window starts if that is sooner.
+ *
+ ***************************************************************************/
+static void
+_tracklist_write(
+    tracklist_t* tracklist,
+    query_t*     query
+    )
+{
+    tracklist_window_t* windows    = tracklist->windows;
+    size_t              count      = tracklist->window_count;
+    double              per_second = (double)tracklist->input->info.format.sample_rate * tracklist->input->info.block_align;
+    record_t*           record     = GNSDK_NULL;
+    size_t              identified = 0;
+    size_t              errors     = 0;
+    size_t              first      = 0;
+    size_t              last       = 0;
+    size_t              next       = 0;
+    double              end        = 0;
+
+    for (first = 0; first < count; first++)
+    {
+        identified += windows[first].result ? 1 : 0;
+        errors     += windows[first].b_answered ? 0 : 1;
+    }
+
+    record = query_begin_record(query);
+    record_number(record, "duration_s", (double)tracklist->input->audio_size / per_second, 3);
+    record_int(record, "windows", (int64_t)count);
+    record_int(record, "identified", (int64_t)identified);
+    record_int(record, "errors", (int64_t)errors);
+    record_begin_array(record, "tracklist");
+
+    for (first = 0; first < count; first = last + 1)
+    {
+        last = first;
+        if (windows[first].result == GNSDK_NULL)
+        {
+            continue;
+        }
+
+        for (next = first + 1; next < count && next - last <= TRACKLIST_MAX_GAP + 1; next++)
+        {
+            if (windows[next].result == GNSDK_NULL)
+            {
+                continue;
+            }
+            if (!_tracklist_same(&windows[first], &windows[next]))
+            {
+                break;
+            }
+            last = next;
+        }
+
+        /* the next track may start before this one's last window ends */
+        end = (double)(windows[last].offset + windows[last].size);
+        for (next = last + 1; next < count && windows[next].result == GNSDK_NULL; next++)
+        {
+        }
+        if (next < count && (double)windows[next].offset < end)
+        {
+            end = (double)windows[next].offset;
+        }
+
+        record_begin_object(record, "");
+        record_number(record, "start_s", (double)windows[first].offset / per_second, 3);
+        record_number(record, "end_s", end / per_second, 3);
+        record_int(record, "windows", (int64_t)(last - first + 1));
+        record_append(record, windows[first].result, windows[first].result_size);
+        record_end_object(record);
+    }
+
+    record_end_array(record);
+    query_end_record(query);
+
+}   /* _tracklist_write() */
+
+/***************************************************************************
+ *
+ *    _TRACKLIST_MIX
+ *
+ * Split a mapped mix into windows of window_seconds every hop_seconds,
+ * identify them on up to jobs channels at once and write its tracklist.
+ * Returns -1 if it couldn't be done (already reported).
+ *
+ ***************************************************************************/
+static int
+_tracklist_mix(
+    batch_t*       batch,
+    query_t*       query,
+    audio_input_t* input,
+    long           jobs,
+    double         window_seconds,
+    double         hop_seconds
+    )
+{
+    tracklist_t  tracklist   = {0};
+    pthread_t*   workers     = GNSDK_NULL;
+    gnsdk_size_t frame_size  = input->info.block_align;
+    size_t       window_size = (size_t)(window_seconds * input->info.format.sample_rate) * frame_size;
+    size_t       hop_size    = (size_t)(hop_seconds * input->info.format.sample_rate) * frame_size;
+    size_t       offset      = 0;
+    size_t       index       = 0;
+    long         started     = 0;
+    int          rc          = 0;
+
+    if (window_size == 0 || hop_size == 0)
+    {
+        window_size = hop_size = frame_size;
+    }
+
+    tracklist.batch        = batch;
+    tracklist.path         = query->audio_file;
+    tracklist.input        = input;
+    tracklist.window_count = 1;
+    if (input->audio_size > window_size)
+    {
+        tracklist.window_count += (input->audio_size - window_size + hop_size - 1) / hop_size;
+    }
+
+    tracklist.windows = calloc(tracklist.window_count, sizeof(tracklist_window_t));
+    if (tracklist.windows == GNSDK_NULL)
+    {
+        record_string(query_begin_record(query), "error", "Out of memory");
+        query_end_record(query);
+        return -1;
+    }
+
+    /* the last window ends with the mix */
+    for (index = 0; index < tracklist.window_count; index++)
+    {
+        offset = index * hop_size;
+        tracklist.windows[index].offset = offset;
+        tracklist.windows[index].size   = (input->audio_size - offset < window_size) ? input->audio_size - offset : window_size;
+    }
+
+    /* the windows are read all over the mix at once */
+    madvise(input->p_map, input->map_size, MADV_NORMAL);
+
+    if (jobs > (long)tracklist.window_count)
+    {
+        jobs = (long)tracklist.window_count;
+    }
+    pthread_mutex_init(&tracklist.lock, GNSDK_NULL);
+
+    workers = calloc((size_t)jobs, sizeof(pthread_t));
+    for (started = 0; workers && started < jobs; started++)
+    {
+        if (0 != pthread_create(&workers[started], GNSDK_NULL, _tracklist_worker, &tracklist))
+        {
+            break;
+        }
+    }
+
+    if (0 == started)
+    {
+        record_string(query_begin_record(query), "error", "Failed to start tracklist workers");
+        query_end_record(query);
+        rc = -1;
+    }
+
+    while (started > 0)
+    {
+        pthread_join(workers[--started], GNSDK_NULL);
+    }
+    free(workers);
+
+    if (0 == rc)
+    {
+        _tracklist_write(&tracklist, query);
+    }
+
+    for (index = 0; index < tracklist.window_count; index++)
+    {
+        free(tracklist.windows[index].result);
+    }
+    free(tracklist.windows);
+    pthread_mutex_destroy(&tracklist.lock);
+
+    return rc;
+
+}   /* _tracklist_mix() */
+
+/***************************************************************************
+ *
+ *    TRACKLIST_RUN
+ *
+ ***************************************************************************/
+int
+tracklist_run(
+    query_context_t* context,
+    long             jobs,
+    double           window_seconds,
+    double           hop_seconds,
+    int              input_count,
+    char**           inputs
+    )
+{
+    batch_t       batch  = {0};
+    query_t       query  = {0};
+    audio_input_t input;
+    size_t        index  = 0;
+    int           rc     = 0;
+
+    batch_init(&batch, context, GNSDK_NULL, GNSDK_NULL);
+    rc = batch_add_inputs(&batch, input_count, inputs);
+
+    if (jobs <= 0)
+    {
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs <= 0)
+    {
+        jobs = 1;
+    }
+
+    query.context    = context;
+    query.b_tag_file = GNSDK_TRUE;
+    query.out        = context->output;
+
+    for (index = 0; 0 == rc && index < batch.file_count; index++)
+    {
+        query.audio_file = batch.files[index];
+        if (0 != query_open_input(&query, &input))
+        {
+            continue;
+        }
+
+        /* windows are cut from the mapping; a stream can't be gone back over */
+        if (input.p_map == GNSDK_NULL)
+        {
+            record_stringf(query_begin_record(&query), "error", "Tracklists need a WAV or raw PCM file that can be mapped: %s", query.audio_file);
+            query_end_record(&query);
+        }
+        else
+        {
+            rc = _tracklist_mix(&batch, &query, &input, jobs, window_seconds, hop_seconds);
+        }
+
+        query_close_input(&input);
+    }
+
+    batch_close(&batch);
+
+    return rc;
+
+}   /* tracklist_run() */
+
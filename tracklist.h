@@ -0,0 +1,33 @@
+/*
+ *  Name: tracklist.h
+ *  Description:
+ *  --tracklist: the tracks of long recordings such as DJ mixes. Each
+ *  mix (a WAV or raw file that can be mapped) is cut into overlapping
+ *  windows, which are identified at once on a pool of channels, and runs
+ *  of windows with the same result are merged into one record per mix
+ *  listing each track with its start and end.
+ */
+
+#ifndef TRACKLIST_H
+#define TRACKLIST_H
+
+#include "query.h"
+
+/*
+ * Write a tracklist for every mix (listed as --batch lists them), one
+ * after another, each cut into windows of window_seconds starting every
+ * hop_seconds and identified on jobs channels at once (one per core if
+ * jobs is 0). The SDK is started by the first window that needs it and
+ * stopped here.
+ */
+int
+tracklist_run(
+    query_context_t* context,
+    long             jobs,
+    double           window_seconds,
+    double           hop_seconds,
+    int              input_count,
+    char**           inputs
+    );
+
+#endif /* TRACKLIST_H */
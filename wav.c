@@ -0,0 +1,331 @@
+
+/*
+ *  Name: wav.c
+ *  Description:
+ *  RIFF/WAVE header parsing. Chunks are walked in order so files with
+ *  LIST, fact or other chunks ahead of the audio, WAVE_FORMAT_EXTENSIBLE
+ *  headers and RF64 files over 4GB are all read correctly.
+ */
+
+#include "wav.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* chunk sizes of 0xFFFFFFFF in RF64 files are given by the ds64 chunk */
+#define RF64_SIZE_IN_DS64 0xFFFFFFFFu
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+static uint16_t
+_le16(
+    const unsigned char* p
+    )
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t
+_le32(
+    const unsigned char* p
+    )
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+_le64(
+    const unsigned char* p
+    )
+{
+    return (uint64_t)_le32(p) | ((uint64_t)_le32(p + 4) << 32);
+}
+
+/******************************************************************
+ *
+ *    _READ_EXACT
+ *
+ *    Read exactly size bytes. Returns -1 on error or early EOF.
+ *
+ *****************************************************************/
+static int
+_read_exact(
+    int    fd,
+    void*  buf,
+    size_t size
+    )
+{
+    unsigned char* p    = buf;
+    ssize_t        got  = 0;
+
+    while (size > 0)
+    {
+        got = read(fd, p, size);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return -1;
+        }
+        p    += got;
+        size -= (size_t)got;
+    }
+
+    return 0;
+
+} /* _read_exact() */
+
+/******************************************************************
+ *
+ *    _SKIP
+ *
+ *    Move forward size bytes, reading and discarding them when fd
+ *    can't seek (stdin or a pipe).
+ *
+ *****************************************************************/
+static int
+_skip(
+    int      fd,
+    uint64_t size
+    )
+{
+    unsigned char discard[4096];
+    size_t        step = 0;
+
+    if (lseek(fd, (off_t)size, SEEK_CUR) >= 0)
+    {
+        return 0;
+    }
+    if (errno != ESPIPE)
+    {
+        return -1;
+    }
+
+    while (size > 0)
+    {
+        step = size < sizeof(discard) ? (size_t)size : sizeof(discard);
+        if (0 != _read_exact(fd, discard, step))
+        {
+            return -1;
+        }
+        size -= step;
+    }
+
+    return 0;
+
+} /* _skip() */
+
+/******************************************************************
+ *
+ *    _PARSE_FMT
+ *
+ *****************************************************************/
+static int
+_parse_fmt(
+    const unsigned char* chunk,
+    uint32_t             chunk_size,
+    wav_info_t*          p_info,
+    const char**         p_error
+    )
+{
+    uint16_t format_tag = 0;
+
+    if (chunk_size < 16)
+    {
+        *p_error = "fmt chunk too short";
+        return -1;
+    }
+
+    format_tag                      = _le16(chunk);
+    p_info->format.channels         = _le16(chunk + 2);
+    p_info->format.sample_rate      = _le32(chunk + 4);
+    p_info->block_align             = _le16(chunk + 12);
+    p_info->format.bits_per_sample  = _le16(chunk + 14);
+
+    /* the real format is the first two bytes of the sub-format GUID */
+    if (format_tag == WAV_FORMAT_EXTENSIBLE)
+    {
+        if (chunk_size < 40)
+        {
+            *p_error = "WAVE_FORMAT_EXTENSIBLE fmt chunk too short";
+            return -1;
+        }
+        format_tag = _le16(chunk + 24);
+    }
+
+    if (format_tag != WAV_FORMAT_PCM && format_tag != WAV_FORMAT_IEEE_FLOAT)
+    {
+        *p_error = "Unsupported WAV encoding (only PCM and float are supported)";
+        return -1;
+    }
+    p_info->format_tag = format_tag;
+
+    if (0 == p_info->format.channels
+        || 0 == p_info->format.sample_rate
+        || 0 == p_info->format.bits_per_sample
+        || 0 != p_info->format.bits_per_sample % 8
+        || p_info->block_align != AUDIO_FRAME_SIZE(&p_info->format))
+    {
+        *p_error = "Invalid WAV format";
+        return -1;
+    }
+
+    return 0;
+
+} /* _parse_fmt() */
+
+/******************************************************************
+ *
+ *    WAV_PARSE_HEADER
+ *
+ *****************************************************************/
+int
+wav_parse_header(
+    int          fd,
+    wav_info_t*  p_info,
+    const char** p_error
+    )
+{
+    unsigned char magic[WAV_MAGIC_SIZE] = {0};
+
+    memset(p_info, 0, sizeof(*p_info));
+
+    if (0 != _read_exact(fd, magic, sizeof(magic)))
+    {
+        *p_error = "File too short for a WAV header";
+        return -1;
+    }
+
+    return wav_parse_header_after_magic(fd, magic, p_info, p_error);
+
+} /* wav_parse_header() */
+
+/******************************************************************
+ *
+ *    WAV_PARSE_HEADER_AFTER_MAGIC
+ *
+ *****************************************************************/
+int
+wav_parse_header_after_magic(
+    int                  fd,
+    const unsigned char* magic,
+    wav_info_t*          p_info,
+    const char**         p_error
+    )
+{
+    unsigned char header[WAV_MAGIC_SIZE] = {0};
+    unsigned char chunk[40]              = {0};
+    uint64_t      position               = 0;
+    uint64_t      ds64_data_size         = WAV_SIZE_UNKNOWN;
+    uint64_t      chunk_size             = 0;
+    uint32_t      read_size              = 0;
+    int           b_rf64                 = 0;
+    int           b_have_fmt             = 0;
+    struct stat   st;
+
+    memset(p_info, 0, sizeof(*p_info));
+
+    memcpy(header, magic, sizeof(header));
+    position = sizeof(header);
+
+    b_rf64 = (0 == memcmp(header, "RF64", 4));
+    if ((!b_rf64 && 0 != memcmp(header, "RIFF", 4)) || 0 != memcmp(header + 8, "WAVE", 4))
+    {
+        *p_error = "Not a RIFF/WAVE file";
+        return -1;
+    }
+
+    for (;;)
+    {
+        if (0 != _read_exact(fd, header, 8))
+        {
+            *p_error = "No data chunk in WAV file";
+            return -1;
+        }
+        position  += 8;
+        chunk_size = _le32(header + 4);
+
+        if (0 == memcmp(header, "data", 4))
+        {
+            break;
+        }
+
+        /* read the chunks we care about, skip everything else */
+        read_size = 0;
+        if (0 == memcmp(header, "fmt ", 4) || (b_rf64 && 0 == memcmp(header, "ds64", 4)))
+        {
+            read_size = chunk_size < sizeof(chunk) ? (uint32_t)chunk_size : (uint32_t)sizeof(chunk);
+            if (0 != _read_exact(fd, chunk, read_size))
+            {
+                *p_error = "Truncated WAV header";
+                return -1;
+            }
+        }
+
+        if (0 == memcmp(header, "fmt ", 4))
+        {
+            if (0 != _parse_fmt(chunk, read_size, p_info, p_error))
+            {
+                return -1;
+            }
+            b_have_fmt = 1;
+        }
+        else if (read_size >= 16)
+        {
+            /* ds64: riff size, then data size */
+            ds64_data_size = _le64(chunk + 8);
+        }
+
+        /* chunks are padded to an even length */
+        chunk_size += chunk_size & 1;
+        if (0 != _skip(fd, chunk_size - read_size))
+        {
+            *p_error = "Truncated WAV header";
+            return -1;
+        }
+        position += chunk_size;
+    }
+
+    if (!b_have_fmt)
+    {
+        *p_error = "No fmt chunk before the data chunk";
+        return -1;
+    }
+
+    p_info->data_offset = position;
+    p_info->data_size   = chunk_size;
+    if (b_rf64 && chunk_size == RF64_SIZE_IN_DS64)
+    {
+        p_info->data_size = ds64_data_size;
+    }
+
+    /* Writers that stream a WAV out leave the size at 0 or 0xFFFFFFFF
+     * until they finish, and truncated files claim more than they hold,
+     * so trust the file size where there is one. */
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode))
+    {
+        if ((uint64_t)st.st_size < position)
+        {
+            p_info->data_size = 0;
+        }
+        else if (0 == p_info->data_size
+                 || p_info->data_size == RF64_SIZE_IN_DS64
+                 || p_info->data_size > (uint64_t)st.st_size - position)
+        {
+            p_info->data_size = (uint64_t)st.st_size - position;
+        }
+    }
+    else if (0 == p_info->data_size || p_info->data_size == RF64_SIZE_IN_DS64)
+    {
+        p_info->data_size = WAV_SIZE_UNKNOWN;
+    }
+
+    return 0;
+
+} /* wav_parse_header_after_magic() */
@@ -0,0 +1,61 @@
+
+/*
+ *  Name: wav.h
+ *  Description:
+ *  RIFF/WAVE header parsing.
+ */
+
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdint.h>
+
+#include "audio.h"
+
+/* format tags from the fmt chunk (or the WAVE_FORMAT_EXTENSIBLE sub-format) */
+#define WAV_FORMAT_PCM        0x0001
+#define WAV_FORMAT_IEEE_FLOAT 0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+/* bytes at the start of a WAVE stream that identify it */
+#define WAV_MAGIC_SIZE        12
+
+/* data_size when the header doesn't say how much audio follows */
+#define WAV_SIZE_UNKNOWN      UINT64_MAX
+
+typedef struct
+{
+    audio_format_t format;
+    uint16_t       format_tag;    /* WAV_FORMAT_PCM or WAV_FORMAT_IEEE_FLOAT */
+    uint16_t       block_align;   /* bytes per frame as written in the file */
+    uint64_t       data_offset;   /* file offset of the first sample */
+    uint64_t       data_size;     /* bytes of sample data, or WAV_SIZE_UNKNOWN */
+
+} wav_info_t;
+
+/*
+ * Walk the RIFF (or RF64) chunks of a WAVE stream from its first byte and
+ * leave fd positioned at the start of the sample data. Works on pipes as
+ * well as files. Returns 0 on success, or -1 with a description of the
+ * problem in *p_error.
+ */
+int
+wav_parse_header(
+    int          fd,
+    wav_info_t*  p_info,
+    const char** p_error
+    );
+
+/*
+ * The same, for a stream whose first WAV_MAGIC_SIZE bytes have already
+ * been read into magic (to tell what kind of file it is).
+ */
+int
+wav_parse_header_after_magic(
+    int                  fd,
+    const unsigned char* magic,
+    wav_info_t*          p_info,
+    const char**         p_error
+    );
+
+#endif /* WAV_H */
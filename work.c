@@ -0,0 +1,452 @@
+/*
+ *  Name: work.c
+ *  Description:
+ *  --split, --work and --merge over a work queue directory. A --work
+ *  process leases one unit at a time for its batch workers to claim the
+ *  inputs of, keeping every unit it has leased until the records of all
+ *  of its inputs are in.
+ */
+
+#include "work.h"
+#include "batch.h"
+#include "workq.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* --work: how often a worker with nothing to take looks again */
+#define WORK_POLL_MS 1000
+
+/* A --work unit being identified */
+typedef struct work_unit_s
+{
+    workq_unit_t        lease;
+    size_t              count;         /* inputs, still known once the lease is freed */
+    size_t              next_file;     /* first input not yet claimed by a worker */
+    size_t              finished;      /* inputs with their records in */
+    char**              records;       /* each input's records, in input order */
+    size_t*             record_sizes;
+    gnsdk_bool_t        b_failed;      /* a record was lost: put the unit back */
+    struct work_unit_s* next;
+
+} work_unit_t;
+
+/* The owner of a --work batch: the queue its inputs come from. Guarded
+ * by the batch's lock. */
+typedef struct
+{
+    workq_t*     workq;
+    work_unit_t* units;            /* leased and not yet stored */
+    work_unit_t* open_unit;        /* the unit inputs are being claimed from */
+    gnsdk_bool_t b_finished;       /* no more units to take */
+
+} work_t;
+
+/**********************************************
+ *    Local Function Declarations
+ **********************************************/
+static const char*
+_work_claim(
+    batch_t* batch,
+    void**   p_unit,
+    size_t*  p_index
+    );
+
+static void
+_work_record(
+    batch_t*    batch,
+    void*       p_unit,
+    size_t      index,
+    const char* record,
+    size_t      size
+    );
+
+/* inputs come from units of the queue and their records go back */
+static const batch_hooks_t s_work_hooks =
+{
+    _work_claim,
+    _work_record,
+    GNSDK_NULL
+};
+
+/***************************************************************************
+ *
+ *    _WORK_UNIT_FREE
+ *
+ ***************************************************************************/
+static void
+_work_unit_free(
+    work_unit_t* unit
+    )
+{
+    size_t i = 0;
+
+    for (i = 0; unit->records && i < unit->count; i++)
+    {
+        free(unit->records[i]);
+    }
+    free(unit->records);
+    free(unit->record_sizes);
+    free(unit);
+
+}   /* _work_unit_free() */
+
+/***************************************************************************
+ *
+ *    _WORK_LEASE
+ *
+ * --work: lease the next unit from the queue for the workers to claim
+ * its inputs. Called with the batch lock held. Returns WORKQ_LEASED once
+ * there is a unit to claim from, or why there isn't.
+ *
+ ***************************************************************************/
+static workq_status_t
+_work_lease(
+    work_t* work
+    )
+{
+    work_unit_t*   unit   = calloc(1, sizeof(*unit));
+    workq_status_t status = unit ? workq_lease(work->workq, &unit->lease) : WORKQ_ERROR;
+
+    if (status != WORKQ_LEASED)
+    {
+        free(unit);
+        return status;
+    }
+
+    /* room for a record of each input, and an empty unit is done at once */
+    unit->count        = unit->lease.count;
+    unit->records      = calloc(unit->count + 1, sizeof(char*));
+    unit->record_sizes = calloc(unit->count + 1, sizeof(size_t));
+    if (unit->records == GNSDK_NULL || unit->record_sizes == GNSDK_NULL)
+    {
+        workq_release(work->workq, &unit->lease);
+        _work_unit_free(unit);
+        errno = ENOMEM;
+        return WORKQ_ERROR;
+    }
+    if (0 == unit->count)
+    {
+        workq_complete(work->workq, &unit->lease, "", 0);
+        _work_unit_free(unit);
+        return WORKQ_WAIT;
+    }
+
+    unit->next      = work->units;
+    work->units     = unit;
+    work->open_unit = unit;
+
+    return WORKQ_LEASED;
+
+}   /* _work_lease() */
+
+/***************************************************************************
+ *
+ *    _WORK_CLAIM
+ *
+ * The next input for a --work worker: the next of the unit being
+ * claimed from, leasing another unit once all of its inputs are claimed
+ * and waiting while there are none to lease but other workers' could
+ * still expire. *p_unit and *p_index say where its records go. Returns
+ * NULL once there are no more, or on a signal.
+ *
+ ***************************************************************************/
+static const char*
+_work_claim(
+    batch_t* batch,
+    void**   p_unit,
+    size_t*  p_index
+    )
+{
+    work_t*        work   = (work_t*)batch->owner;
+    work_unit_t*   unit   = GNSDK_NULL;
+    workq_status_t status = WORKQ_WAIT;
+    const char*    path   = GNSDK_NULL;
+
+    pthread_mutex_lock(&batch->lock);
+
+    while (path == GNSDK_NULL && !work->b_finished && !batch->context->b_stop)
+    {
+        unit = work->open_unit;
+        if (unit && unit->next_file < unit->count)
+        {
+            *p_unit  = unit;
+            *p_index = unit->next_file++;
+            path     = unit->lease.paths[*p_index];
+            continue;
+        }
+
+        status = _work_lease(work);
+        if (status == WORKQ_WAIT)
+        {
+            pthread_mutex_unlock(&batch->lock);
+            usleep(WORK_POLL_MS * 1000);
+            pthread_mutex_lock(&batch->lock);
+        }
+        else if (status == WORKQ_FINISHED)
+        {
+            work->b_finished = GNSDK_TRUE;
+        }
+        else if (status == WORKQ_ERROR)
+        {
+            record_stringf(query_context_begin_record(batch->context), "error", "Failed to take a unit from the work queue: %s", strerror(errno));
+            query_context_end_record(batch->context);
+            work->b_finished = GNSDK_TRUE;
+        }
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+
+    return path;
+
+}   /* _work_claim() */
+
+/***************************************************************************
+ *
+ *    _WORK_RECORD
+ *
+ * --work: keep the records of a unit's input in its place, and once the
+ * unit has them all, store them in the queue in input order and give
+ * up its lease. A unit with a record missing, or cut short by a signal,
+ * goes back on the queue instead.
+ *
+ ***************************************************************************/
+static void
+_work_record(
+    batch_t*    batch,
+    void*       p_unit,
+    size_t      index,
+    const char* record,
+    size_t      size
+    )
+{
+    work_t*       work       = (work_t*)batch->owner;
+    work_unit_t*  unit       = (work_unit_t*)p_unit;
+    work_unit_t** p_link     = GNSDK_NULL;
+    char*         copy       = malloc(size + 1);
+    char*         results    = GNSDK_NULL;
+    char          name[64]   = {0};
+    size_t        total      = 0;
+    size_t        i          = 0;
+    gnsdk_bool_t  b_complete = GNSDK_FALSE;
+
+    pthread_mutex_lock(&batch->lock);
+    if (copy)
+    {
+        memcpy(copy, record, size);
+        unit->records[index]      = copy;
+        unit->record_sizes[index] = size;
+    }
+    if (copy == GNSDK_NULL || batch->context->b_stop)
+    {
+        unit->b_failed = GNSDK_TRUE;
+    }
+    b_complete = (++unit->finished == unit->count);
+    if (b_complete)
+    {
+        p_link = &work->units;
+        while (*p_link != unit)
+        {
+            p_link = &(*p_link)->next;
+        }
+        *p_link = unit->next;
+        if (work->open_unit == unit)
+        {
+            work->open_unit = GNSDK_NULL;
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (!b_complete)
+    {
+        return;
+    }
+
+    for (i = 0; i < unit->count; i++)
+    {
+        total += unit->record_sizes[i];
+    }
+    results = unit->b_failed ? GNSDK_NULL : malloc(total + 1);
+    for (total = 0, i = 0; results && i < unit->count; i++)
+    {
+        memcpy(results + total, unit->records[i], unit->record_sizes[i]);
+        total += unit->record_sizes[i];
+    }
+
+    snprintf(name, sizeof(name), "%s", unit->lease.name);
+    if (results == GNSDK_NULL)
+    {
+        workq_release(work->workq, &unit->lease);
+    }
+    else if (0 != workq_complete(work->workq, &unit->lease, results, total))
+    {
+        record_stringf(query_context_begin_record(batch->context), "error", "Failed to store the results of unit %s: %s", name, strerror(errno));
+        query_context_end_record(batch->context);
+    }
+    free(results);
+    _work_unit_free(unit);
+
+}   /* _work_record() */
+
+/***************************************************************************
+ *
+ *    WORK_SPLIT
+ *
+ ***************************************************************************/
+int
+work_split(
+    query_context_t* context,
+    const char*      queue_dir,
+    long             unit_files,
+    int              input_count,
+    char**           inputs
+    )
+{
+    batch_t batch = {0};
+    size_t  units = 0;
+    size_t  count = 0;
+    size_t  i     = 0;
+    int     rc    = 0;
+
+    if (0 != workq_create(queue_dir))
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to create work queue %s: %s", queue_dir,
+                       (errno == EEXIST) ? "it has been split already" : strerror(errno));
+        query_context_end_record(context);
+        return -1;
+    }
+
+    batch_init(&batch, context, GNSDK_NULL, GNSDK_NULL);
+    rc = batch_add_inputs(&batch, input_count, inputs);
+
+    for (i = 0; 0 == rc && i < batch.file_count; i += count, units++)
+    {
+        count = batch.file_count - i;
+        if (count > (size_t)unit_files)
+        {
+            count = (size_t)unit_files;
+        }
+        if (0 != workq_add(queue_dir, units, batch.files + i, count))
+        {
+            record_stringf(query_context_begin_record(context), "error", "Failed to add unit %lu to %s: %s", (unsigned long)units, queue_dir, strerror(errno));
+            query_context_end_record(context);
+            rc = -1;
+        }
+    }
+
+    /* workers don't call it finished until it is sealed */
+    if (0 == rc && 0 != workq_seal(queue_dir, units))
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to seal work queue %s: %s", queue_dir, strerror(errno));
+        query_context_end_record(context);
+        rc = -1;
+    }
+
+    fprintf(stderr, "{\"split\": {\"files\": %lu, \"units\": %lu}}\n", (unsigned long)batch.file_count, (unsigned long)units);
+
+    batch_close(&batch);
+
+    return rc;
+
+}   /* work_split() */
+
+/***************************************************************************
+ *
+ *    WORK_RUN
+ *
+ ***************************************************************************/
+int
+work_run(
+    query_context_t* context,
+    const char*      queue_dir,
+    long             jobs,
+    double           lease_seconds
+    )
+{
+    work_t        work  = {0};
+    batch_t       batch = {0};
+    workq_stats_t stats = {0};
+    work_unit_t*  unit  = GNSDK_NULL;
+    int           rc    = 0;
+
+    if (jobs <= 0)
+    {
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    work.workq = workq_open(queue_dir, lease_seconds);
+    if (work.workq == GNSDK_NULL)
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to open work queue %s: %s", queue_dir, strerror(errno));
+        query_context_end_record(context);
+        return -1;
+    }
+
+    batch_init(&batch, context, &s_work_hooks, &work);
+
+    /* stop leasing; the inputs in flight are finished */
+    query_stop_on_signals(context);
+
+    rc = batch_run_workers(&batch, jobs);
+
+    /* what wasn't finished is for another worker */
+    while ((unit = work.units) != GNSDK_NULL)
+    {
+        work.units = unit->next;
+        workq_release(work.workq, &unit->lease);
+        _work_unit_free(unit);
+    }
+
+    workq_stats(work.workq, &stats);
+    workq_close(work.workq);
+
+    fprintf(stderr,
+        "{\"work\": {\"leased\": %lu, \"completed\": %lu, \"released\": %lu, \"reclaimed\": %lu, \"leases_lost\": %lu}}\n",
+        stats.leased,
+        stats.completed,
+        stats.released,
+        stats.reclaimed,
+        stats.lost
+        );
+
+    batch_close(&batch);
+
+    return rc;
+
+}   /* work_run() */
+
+/***************************************************************************
+ *
+ *    WORK_MERGE
+ *
+ ***************************************************************************/
+int
+work_merge(
+    query_context_t* context,
+    const char*      queue_dir
+    )
+{
+    size_t units   = 0;
+    size_t missing = 0;
+    int    rc      = workq_merge(queue_dir, context->output, &units, &missing);
+
+    if (0 != rc && errno == EAGAIN)
+    {
+        record_stringf(query_context_begin_record(context), "error", "%lu of the %lu units of %s aren't done yet", (unsigned long)missing, (unsigned long)units, queue_dir);
+        query_context_end_record(context);
+    }
+    else if (0 != rc)
+    {
+        record_stringf(query_context_begin_record(context), "error", "Failed to merge work queue %s: %s", queue_dir,
+                       (errno == ENOENT) ? "it hasn't been split, or not completely" : strerror(errno));
+        query_context_end_record(context);
+    }
+
+    fprintf(stderr, "{\"merge\": {\"units\": %lu, \"missing\": %lu}}\n", (unsigned long)units, (unsigned long)missing);
+
+    return rc;
+
+}   /* work_merge() */
+
@@ -0,0 +1,66 @@
+/*
+ *  Name: work.h
+ *  Description:
+ *  --split, --work and --merge: a batch shared out between any number
+ *  of processes and hosts through a work queue directory (workq.h).
+ *  --split lists the inputs as --batch does and writes them to the queue
+ *  in units; each --work process leases units and identifies their
+ *  inputs on a batch pool (batch.h), storing each unit's records in
+ *  input order once they are all in; --merge writes the records of
+ *  every unit, in the order the inputs were listed.
+ */
+
+#ifndef WORK_H
+#define WORK_H
+
+#include "query.h"
+
+/* --split: inputs in each unit of a work queue */
+#define WORK_UNIT_FILES 64
+
+/* --work: seconds a lease lasts without being renewed; a worker that
+ * has been quiet for longer is taken to have died */
+#define WORK_LEASE_SECONDS 60
+
+/*
+ * List every input as --batch does and write them to a new work queue
+ * at queue_dir in units of unit_files, sealing it once they are all
+ * there. How many of each is reported on stderr.
+ */
+int
+work_split(
+    query_context_t* context,
+    const char*      queue_dir,
+    long             unit_files,
+    int              input_count,
+    char**           inputs
+    );
+
+/*
+ * Identify the inputs of units leased from the work queue at queue_dir
+ * with jobs channels in flight (one per core if jobs is 0), storing
+ * each unit's records in the queue, until every unit is done. The SDK
+ * is started by the first input that needs it. On SIGINT or SIGTERM the
+ * inputs being identified are finished and the units not yet stored put
+ * back. How the leases went is reported on stderr.
+ */
+int
+work_run(
+    query_context_t* context,
+    const char*      queue_dir,
+    long             jobs,
+    double           lease_seconds
+    );
+
+/*
+ * Write the records of every unit of the work queue at queue_dir to the
+ * context's output, in the order the inputs were split, once all of
+ * them are done.
+ */
+int
+work_merge(
+    query_context_t* context,
+    const char*      queue_dir
+    );
+
+#endif /* WORK_H */
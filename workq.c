@@ -0,0 +1,1061 @@
+/*
+ *  Name: workq.c
+ *  Description:
+ *  Work queue directory. Every step that matters is a rename() within the
+ *  directory, which is atomic locally and over NFS alike: a unit is
+ *  taken, reclaimed, put back and its results published each with one,
+ *  so a worker that dies at any point leaves a lease to expire or a
+ *  stray file in tmp/, never a half-written unit or result. Each worker
+ *  keeps the list of units it last saw waiting and works through it
+ *  from a place of its own, so workers started together don't all race
+ *  for the same unit.
+ */
+
+#include "workq.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define WORKQ_NAME_FORMAT "%08zu"
+#define WORKQ_OWNER_SIZE  320
+
+/* renewals per lease time */
+#define WORKQ_RENEWALS    4
+
+struct workq_s
+{
+    char*           dir;
+    double          lease_seconds;
+    char            owner[WORKQ_OWNER_SIZE];  /* host.pid, after the '@' of our leases */
+    char**          todo;          /* units seen waiting at the last look */
+    size_t          todo_count;
+    size_t          todo_tried;
+    size_t          todo_start;    /* where in todo this worker starts */
+    unsigned int    seed;
+    char**          held;          /* lease paths being renewed */
+    size_t          held_count;
+    size_t          held_capacity;
+    workq_stats_t   stats;
+    int             b_stop;        /* set by workq_close() */
+    pthread_t       thread;
+    pthread_mutex_t lock;          /* guards held, stats and b_stop */
+    pthread_cond_t  stop;
+
+};
+
+/**********************************************
+ *    Local Functions
+ **********************************************/
+
+/* dir/part, or dir/part/name; NULL if out of memory */
+static char*
+_path(
+    const char* dir,
+    const char* part,
+    const char* name
+    )
+{
+    size_t size = strlen(dir) + strlen(part) + (name ? strlen(name) : 0) + 3;
+    char*  path = malloc(size);
+
+    if (path)
+    {
+        snprintf(path, size, name ? "%s/%s/%s" : "%s/%s", dir, part, name);
+    }
+
+    return path;
+}
+
+static int
+_compare_names(
+    const void* a,
+    const void* b
+    )
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void
+_free_names(
+    char** names,
+    size_t count
+    )
+{
+    while (count > 0)
+    {
+        free(names[--count]);
+    }
+    free(names);
+}
+
+/******************************************************************
+ *
+ *    _LIST
+ *
+ *    The names in a directory, sorted, leaving out hidden ones.
+ *
+ *****************************************************************/
+static int
+_list(
+    const char* path,
+    char***     p_names,
+    size_t*     p_count
+    )
+{
+    DIR*           dir      = opendir(path);
+    struct dirent* entry    = NULL;
+    char**         names    = NULL;
+    char**         grown    = NULL;
+    size_t         count    = 0;
+    size_t         capacity = 0;
+
+    *p_names = NULL;
+    *p_count = 0;
+    if (dir == NULL)
+    {
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 256;
+            grown    = realloc(names, capacity * sizeof(*names));
+            if (grown == NULL)
+            {
+                break;
+            }
+            names = grown;
+        }
+        names[count] = strdup(entry->d_name);
+        if (names[count] == NULL)
+        {
+            break;
+        }
+        count++;
+    }
+    closedir(dir);
+
+    if (entry != NULL)
+    {
+        _free_names(names, count);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (count > 0)
+    {
+        qsort(names, count, sizeof(*names), _compare_names);
+    }
+    *p_names = names;
+    *p_count = count;
+
+    return 0;
+
+} /* _list() */
+
+/******************************************************************
+ *
+ *    _WRITE_WHOLE
+ *
+ *    Write size bytes to tmp_path, flush them to disk and rename
+ *    the file to path, so path only ever appears complete.
+ *
+ *****************************************************************/
+static int
+_write_whole(
+    const char* tmp_path,
+    const char* path,
+    const void* data,
+    size_t      size
+    )
+{
+    const char* p       = data;
+    ssize_t     written = 0;
+    int         fd      = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int         rc      = 0;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    while (size > 0)
+    {
+        written = write(fd, p, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written < 0)
+        {
+            rc = -1;
+            break;
+        }
+        p    += written;
+        size -= (size_t)written;
+    }
+
+    if (0 == rc)
+    {
+        rc = fsync(fd);
+    }
+    if (0 != close(fd))
+    {
+        rc = -1;
+    }
+    if (0 == rc)
+    {
+        rc = rename(tmp_path, path);
+    }
+    if (0 != rc)
+    {
+        unlink(tmp_path);
+    }
+
+    return rc;
+
+} /* _write_whole() */
+
+/******************************************************************
+ *
+ *    _READ_UNIT
+ *
+ *    The input paths of the unit file at path, one per line.
+ *
+ *****************************************************************/
+static int
+_read_unit(
+    const char*   path,
+    workq_unit_t* unit
+    )
+{
+    struct stat st;
+    char*       line   = NULL;
+    char*       end    = NULL;
+    size_t      size   = 0;
+    ssize_t     got    = 0;
+    int         fd     = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (0 != fstat(fd, &st))
+    {
+        close(fd);
+        return -1;
+    }
+
+    unit->data  = malloc((size_t)st.st_size + 1);
+    unit->paths = calloc((size_t)st.st_size / 2 + 1, sizeof(char*));
+    if (unit->data == NULL || unit->paths == NULL)
+    {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    while (size < (size_t)st.st_size)
+    {
+        got = read(fd, unit->data + size, (size_t)st.st_size - size);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+        size += (size_t)got;
+    }
+    close(fd);
+    if (got < 0)
+    {
+        return -1;
+    }
+    unit->data[size] = '\0';
+
+    for (line = unit->data; line < unit->data + size; line = end + 1)
+    {
+        end = strchr(line, '\n');
+        if (end == NULL)
+        {
+            end = unit->data + size;
+        }
+        *end = '\0';
+        if (end > line)
+        {
+            unit->paths[unit->count++] = line;
+        }
+    }
+
+    return 0;
+
+} /* _read_unit() */
+
+static void
+_unit_free(
+    workq_unit_t* unit
+    )
+{
+    free(unit->name);
+    free(unit->paths);
+    free(unit->data);
+    free(unit->lease_path);
+    memset(unit, 0, sizeof(*unit));
+}
+
+/* Stop renewing lease_path, if it is still held */
+static void
+_drop_held(
+    workq_t*    workq,
+    const char* lease_path
+    )
+{
+    size_t i = 0;
+
+    for (i = 0; i < workq->held_count; i++)
+    {
+        if (0 == strcmp(workq->held[i], lease_path))
+        {
+            free(workq->held[i]);
+            workq->held[i] = workq->held[--workq->held_count];
+            break;
+        }
+    }
+}
+
+/******************************************************************
+ *
+ *    _DIR_NOW
+ *
+ *    The time by the clock of whatever holds the directory, read by
+ *    touching its clock file: on NFS the server sets the time, and
+ *    it is the server that sets the times of the leases too.
+ *
+ *****************************************************************/
+static int
+_dir_now(
+    workq_t*         workq,
+    struct timespec* p_now
+    )
+{
+    struct stat st;
+    char*       path = _path(workq->dir, "clock", NULL);
+    int         fd   = path ? open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644) : -1;
+    int         rc   = -1;
+
+    free(path);
+    if (fd >= 0)
+    {
+        if (0 == futimens(fd, NULL) && 0 == fstat(fd, &st))
+        {
+            *p_now = st.st_mtim;
+            rc     = 0;
+        }
+        close(fd);
+    }
+
+    return rc;
+
+} /* _dir_now() */
+
+/******************************************************************
+ *
+ *    _RECLAIM
+ *
+ *    Put back every lease of another worker's that hasn't been
+ *    renewed within the lease time, or drop it if its unit has been
+ *    done after all. *p_live is set to how many leases are left.
+ *
+ *****************************************************************/
+static int
+_reclaim(
+    workq_t* workq,
+    size_t*  p_live
+    )
+{
+    struct timespec now     = {0};
+    struct stat     st;
+    char*           leased  = _path(workq->dir, "leased", NULL);
+    char**          names   = NULL;
+    char*           owner   = NULL;
+    char*           lease   = NULL;
+    char*           target  = NULL;
+    char*           done    = NULL;
+    size_t          count   = 0;
+    size_t          i       = 0;
+    int             rc      = 0;
+
+    *p_live = 0;
+    if (leased == NULL || 0 != _list(leased, &names, &count) || 0 != _dir_now(workq, &now))
+    {
+        free(leased);
+        _free_names(names, count);
+        return -1;
+    }
+
+    for (i = 0; i < count && 0 == rc; i++)
+    {
+        owner = strchr(names[i], '@');
+        lease = _path(workq->dir, "leased", names[i]);
+        if (lease == NULL)
+        {
+            rc = -1;
+            break;
+        }
+
+        /* ours are renewed by the thread; anything else live is someone's */
+        if (owner == NULL || 0 == strcmp(owner + 1, workq->owner) || 0 != stat(lease, &st)
+            || (double)(now.tv_sec - st.st_mtim.tv_sec) + (now.tv_nsec - st.st_mtim.tv_nsec) / 1e9 < workq->lease_seconds)
+        {
+            (*p_live)++;
+            free(lease);
+            continue;
+        }
+
+        *owner = '\0';
+        target = _path(workq->dir, "todo", names[i]);
+        done   = _path(workq->dir, "done", names[i]);
+        if (target == NULL || done == NULL)
+        {
+            rc = -1;
+        }
+        else if (0 == access(done, F_OK))
+        {
+            unlink(lease);
+        }
+        else if (0 == rename(lease, target))
+        {
+            pthread_mutex_lock(&workq->lock);
+            workq->stats.reclaimed++;
+            pthread_mutex_unlock(&workq->lock);
+        }
+        free(target);
+        free(done);
+        free(lease);
+    }
+
+    _free_names(names, count);
+    free(leased);
+
+    return rc;
+
+} /* _reclaim() */
+
+/******************************************************************
+ *
+ *    _RENEW
+ *
+ *    Keep touching every lease held until workq_close(). A lease
+ *    that has gone was reclaimed from us and isn't renewed again.
+ *
+ *****************************************************************/
+static void*
+_renew(
+    void* arg
+    )
+{
+    workq_t*        workq    = arg;
+    double          interval = workq->lease_seconds / WORKQ_RENEWALS;
+    struct timespec deadline = {0};
+    size_t          i        = 0;
+
+    pthread_mutex_lock(&workq->lock);
+    while (!workq->b_stop)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec  += (time_t)interval;
+        deadline.tv_nsec += (long)((interval - (double)(time_t)interval) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        /* waking early only renews early */
+        pthread_cond_timedwait(&workq->stop, &workq->lock, &deadline);
+
+        for (i = 0; !workq->b_stop && i < workq->held_count; )
+        {
+            if (0 != utimensat(AT_FDCWD, workq->held[i], NULL, 0) && errno == ENOENT)
+            {
+                workq->stats.lost++;
+                _drop_held(workq, workq->held[i]);
+                continue;
+            }
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&workq->lock);
+
+    return NULL;
+
+} /* _renew() */
+
+/**********************************************
+ *    Work queue
+ **********************************************/
+
+/******************************************************************
+ *
+ *    WORKQ_CREATE
+ *
+ *****************************************************************/
+int
+workq_create(
+    const char* dir
+    )
+{
+    static const char* const parts[] = { "todo", "leased", "done", "tmp" };
+    char*                    path    = NULL;
+    size_t                   i       = 0;
+    int                      rc      = 0;
+
+    if (0 != mkdir(dir, 0755) && errno != EEXIST)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(parts) / sizeof(parts[0]) && 0 == rc; i++)
+    {
+        path = _path(dir, parts[i], NULL);
+        if (path == NULL || (0 != mkdir(path, 0755) && errno != EEXIST))
+        {
+            rc = -1;
+        }
+        free(path);
+    }
+
+    path = (0 == rc) ? _path(dir, "units", NULL) : NULL;
+    if (path && 0 == access(path, F_OK))
+    {
+        errno = EEXIST;
+        rc    = -1;
+    }
+    free(path);
+
+    return rc;
+
+} /* workq_create() */
+
+/******************************************************************
+ *
+ *    WORKQ_ADD
+ *
+ *****************************************************************/
+int
+workq_add(
+    const char*  dir,
+    size_t       number,
+    char* const* paths,
+    size_t       count
+    )
+{
+    char    name[32]  = {0};
+    char    tmp[64]   = {0};
+    char*   data      = NULL;
+    char*   tmp_path  = NULL;
+    char*   path      = NULL;
+    size_t  size      = 0;
+    size_t  i         = 0;
+    int     rc        = -1;
+
+    for (i = 0; i < count; i++)
+    {
+        size += strlen(paths[i]) + 1;
+    }
+
+    snprintf(name, sizeof(name), WORKQ_NAME_FORMAT, number);
+    snprintf(tmp, sizeof(tmp), "%s.split.%ld", name, (long)getpid());
+    data     = malloc(size + 1);
+    tmp_path = _path(dir, "tmp", tmp);
+    path     = _path(dir, "todo", name);
+
+    if (data && tmp_path && path)
+    {
+        for (size = 0, i = 0; i < count; i++)
+        {
+            size += (size_t)sprintf(data + size, "%s\n", paths[i]);
+        }
+        rc = _write_whole(tmp_path, path, data, size);
+    }
+    else
+    {
+        errno = ENOMEM;
+    }
+
+    free(data);
+    free(tmp_path);
+    free(path);
+
+    return rc;
+
+} /* workq_add() */
+
+/******************************************************************
+ *
+ *    WORKQ_SEAL
+ *
+ *****************************************************************/
+int
+workq_seal(
+    const char* dir,
+    size_t      units
+    )
+{
+    char  count[32] = {0};
+    char  tmp[64]   = {0};
+    char* tmp_path  = NULL;
+    char* path      = NULL;
+    int   rc        = -1;
+
+    snprintf(count, sizeof(count), "%zu\n", units);
+    snprintf(tmp, sizeof(tmp), "units.%ld", (long)getpid());
+    tmp_path = _path(dir, "tmp", tmp);
+    path     = _path(dir, "units", NULL);
+    if (tmp_path && path)
+    {
+        rc = _write_whole(tmp_path, path, count, strlen(count));
+    }
+    else
+    {
+        errno = ENOMEM;
+    }
+
+    free(tmp_path);
+    free(path);
+
+    return rc;
+
+} /* workq_seal() */
+
+/******************************************************************
+ *
+ *    WORKQ_OPEN
+ *
+ *****************************************************************/
+workq_t*
+workq_open(
+    const char* dir,
+    double      lease_seconds
+    )
+{
+    workq_t* workq     = calloc(1, sizeof(*workq));
+    char     host[256] = {0};
+
+    if (workq == NULL)
+    {
+        return NULL;
+    }
+
+    workq->dir = strdup(dir);
+    if (workq->dir == NULL)
+    {
+        free(workq);
+        return NULL;
+    }
+
+    if (0 != gethostname(host, sizeof(host) - 1))
+    {
+        strcpy(host, "localhost");
+    }
+    snprintf(workq->owner, sizeof(workq->owner), "%s.%ld", host, (long)getpid());
+
+    workq->lease_seconds = lease_seconds;
+    workq->seed          = (unsigned int)getpid() ^ (unsigned int)time(NULL);
+    pthread_mutex_init(&workq->lock, NULL);
+    pthread_cond_init(&workq->stop, NULL);
+
+    if (0 != pthread_create(&workq->thread, NULL, _renew, workq))
+    {
+        pthread_cond_destroy(&workq->stop);
+        pthread_mutex_destroy(&workq->lock);
+        free(workq->dir);
+        free(workq);
+        return NULL;
+    }
+
+    return workq;
+
+} /* workq_open() */
+
+/******************************************************************
+ *
+ *    WORKQ_CLOSE
+ *
+ *****************************************************************/
+void
+workq_close(
+    workq_t* workq
+    )
+{
+    if (workq == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&workq->lock);
+    workq->b_stop = 1;
+    pthread_cond_signal(&workq->stop);
+    pthread_mutex_unlock(&workq->lock);
+    pthread_join(workq->thread, NULL);
+
+    _free_names(workq->held, workq->held_count);
+    _free_names(workq->todo, workq->todo_count);
+    pthread_cond_destroy(&workq->stop);
+    pthread_mutex_destroy(&workq->lock);
+    free(workq->dir);
+    free(workq);
+
+} /* workq_close() */
+
+/******************************************************************
+ *
+ *    WORKQ_LEASE
+ *
+ *****************************************************************/
+workq_status_t
+workq_lease(
+    workq_t*      workq,
+    workq_unit_t* unit
+    )
+{
+    char*  todo     = NULL;
+    char*  name     = NULL;
+    char*  from     = NULL;
+    char*  done     = NULL;
+    char*  units    = NULL;
+    char** held     = NULL;
+    size_t live     = 0;
+    int    b_sealed = 0;
+
+    memset(unit, 0, sizeof(*unit));
+
+    for (;;)
+    {
+        while (workq->todo_tried < workq->todo_count)
+        {
+            name = workq->todo[(workq->todo_start + workq->todo_tried++) % workq->todo_count];
+
+            unit->name       = strdup(name);
+            unit->lease_path = malloc(strlen(workq->dir) + strlen(name) + strlen(workq->owner) + 10);
+            from             = _path(workq->dir, "todo", name);
+            done             = _path(workq->dir, "done", name);
+            if (unit->name == NULL || unit->lease_path == NULL || from == NULL || done == NULL)
+            {
+                free(from);
+                free(done);
+                _unit_free(unit);
+                errno = ENOMEM;
+                return WORKQ_ERROR;
+            }
+            sprintf(unit->lease_path, "%s/leased/%s@%s", workq->dir, name, workq->owner);
+
+            /* whoever renames it first has it */
+            if (0 != rename(from, unit->lease_path))
+            {
+                free(from);
+                free(done);
+                _unit_free(unit);
+                if (errno == ENOENT)
+                {
+                    continue;
+                }
+                return WORKQ_ERROR;
+            }
+
+            /* back from a worker that finished it after all */
+            if (0 == access(done, F_OK))
+            {
+                unlink(unit->lease_path);
+                free(from);
+                free(done);
+                _unit_free(unit);
+                continue;
+            }
+
+            if (0 != _read_unit(unit->lease_path, unit))
+            {
+                rename(unit->lease_path, from);
+                free(from);
+                free(done);
+                _unit_free(unit);
+                return WORKQ_ERROR;
+            }
+            free(from);
+            free(done);
+
+            pthread_mutex_lock(&workq->lock);
+            if (workq->held_count == workq->held_capacity)
+            {
+                workq->held_capacity = workq->held_capacity ? 2 * workq->held_capacity : 16;
+                held = realloc(workq->held, workq->held_capacity * sizeof(*held));
+                if (held)
+                {
+                    workq->held = held;
+                }
+            }
+            if (workq->held_count < workq->held_capacity)
+            {
+                workq->held[workq->held_count] = strdup(unit->lease_path);
+                workq->held_count += (workq->held[workq->held_count] != NULL);
+            }
+            workq->stats.leased++;
+            pthread_mutex_unlock(&workq->lock);
+
+            return WORKQ_LEASED;
+        }
+
+        /* everything seen last time is gone: look again */
+        _free_names(workq->todo, workq->todo_count);
+        workq->todo       = NULL;
+        workq->todo_count = 0;
+        workq->todo_tried = 0;
+        todo = _path(workq->dir, "todo", NULL);
+        if (todo == NULL || 0 != _list(todo, &workq->todo, &workq->todo_count))
+        {
+            free(todo);
+            return WORKQ_ERROR;
+        }
+        free(todo);
+        if (workq->todo_count > 0)
+        {
+            workq->todo_start = (size_t)rand_r(&workq->seed) % workq->todo_count;
+            continue;
+        }
+
+        /* none waiting: take back any whose workers have gone quiet */
+        if (0 != _reclaim(workq, &live))
+        {
+            return WORKQ_ERROR;
+        }
+
+        units    = _path(workq->dir, "units", NULL);
+        b_sealed = (units && 0 == access(units, F_OK));
+        free(units);
+
+        /* a unit reclaimed meanwhile may have been put back */
+        todo = _path(workq->dir, "todo", NULL);
+        if (todo == NULL || 0 != _list(todo, &workq->todo, &workq->todo_count))
+        {
+            free(todo);
+            return WORKQ_ERROR;
+        }
+        free(todo);
+        if (workq->todo_count > 0)
+        {
+            workq->todo_start = (size_t)rand_r(&workq->seed) % workq->todo_count;
+            continue;
+        }
+
+        return (live > 0 || !b_sealed) ? WORKQ_WAIT : WORKQ_FINISHED;
+    }
+
+} /* workq_lease() */
+
+/******************************************************************
+ *
+ *    WORKQ_COMPLETE
+ *
+ *****************************************************************/
+int
+workq_complete(
+    workq_t*      workq,
+    workq_unit_t* unit,
+    const void*   results,
+    size_t        size
+    )
+{
+    char* tmp      = malloc(strlen(unit->name) + strlen(workq->owner) + 2);
+    char* tmp_path = NULL;
+    char* path     = _path(workq->dir, "done", unit->name);
+    int   rc       = -1;
+
+    if (tmp)
+    {
+        sprintf(tmp, "%s@%s", unit->name, workq->owner);
+        tmp_path = _path(workq->dir, "tmp", tmp);
+    }
+
+    if (tmp_path && path)
+    {
+        rc = _write_whole(tmp_path, path, results, size);
+    }
+    free(tmp);
+    free(tmp_path);
+    free(path);
+
+    if (0 != rc)
+    {
+        workq_release(workq, unit);
+        return -1;
+    }
+
+    pthread_mutex_lock(&workq->lock);
+    _drop_held(workq, unit->lease_path);
+    workq->stats.completed++;
+    pthread_mutex_unlock(&workq->lock);
+
+    /* gone already if it was reclaimed while we worked */
+    unlink(unit->lease_path);
+    _unit_free(unit);
+
+    return 0;
+
+} /* workq_complete() */
+
+/******************************************************************
+ *
+ *    WORKQ_RELEASE
+ *
+ *****************************************************************/
+int
+workq_release(
+    workq_t*      workq,
+    workq_unit_t* unit
+    )
+{
+    char* path = _path(workq->dir, "todo", unit->name);
+    int   rc   = 0;
+
+    pthread_mutex_lock(&workq->lock);
+    _drop_held(workq, unit->lease_path);
+    workq->stats.released++;
+    pthread_mutex_unlock(&workq->lock);
+
+    if (path == NULL || (0 != rename(unit->lease_path, path) && errno != ENOENT))
+    {
+        rc = -1;
+    }
+    free(path);
+    _unit_free(unit);
+
+    return rc;
+
+} /* workq_release() */
+
+/******************************************************************
+ *
+ *    WORKQ_STATS
+ *
+ *****************************************************************/
+void
+workq_stats(
+    workq_t*       workq,
+    workq_stats_t* p_stats
+    )
+{
+    pthread_mutex_lock(&workq->lock);
+    *p_stats = workq->stats;
+    pthread_mutex_unlock(&workq->lock);
+
+} /* workq_stats() */
+
+/******************************************************************
+ *
+ *    WORKQ_MERGE
+ *
+ *****************************************************************/
+int
+workq_merge(
+    const char* dir,
+    FILE*       out,
+    size_t*     p_units,
+    size_t*     p_missing
+    )
+{
+    char   name[32]     = {0};
+    char   buffer[65536];
+    char*  path         = _path(dir, "units", NULL);
+    char*  unit_path    = NULL;
+    FILE*  in           = NULL;
+    size_t units        = 0;
+    size_t got          = 0;
+    size_t i            = 0;
+    int    rc           = 0;
+
+    *p_units   = 0;
+    *p_missing = 0;
+
+    in = path ? fopen(path, "r") : NULL;
+    free(path);
+    if (in == NULL)
+    {
+        return -1;
+    }
+    if (1 != fscanf(in, "%zu", &units))
+    {
+        fclose(in);
+        errno = EINVAL;
+        return -1;
+    }
+    fclose(in);
+    *p_units = units;
+
+    /* all or nothing, so a merge never passes for a whole one */
+    for (i = 0; i < units; i++)
+    {
+        snprintf(name, sizeof(name), WORKQ_NAME_FORMAT, i);
+        unit_path = _path(dir, "done", name);
+        if (unit_path == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        if (0 != access(unit_path, F_OK))
+        {
+            (*p_missing)++;
+        }
+        free(unit_path);
+    }
+    if (*p_missing > 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for (i = 0; i < units && 0 == rc; i++)
+    {
+        snprintf(name, sizeof(name), WORKQ_NAME_FORMAT, i);
+        unit_path = _path(dir, "done", name);
+        in        = unit_path ? fopen(unit_path, "rb") : NULL;
+        free(unit_path);
+        if (in == NULL)
+        {
+            return -1;
+        }
+        while ((got = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        {
+            if (got != fwrite(buffer, 1, got, out))
+            {
+                rc = -1;
+                break;
+            }
+        }
+        if (ferror(in))
+        {
+            rc = -1;
+        }
+        fclose(in);
+    }
+
+    if (0 == rc && 0 != fflush(out))
+    {
+        rc = -1;
+    }
+
+    return rc;
+
+} /* workq_merge() */
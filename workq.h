@@ -0,0 +1,158 @@
+/*
+ *  Name: workq.h
+ *  Description:
+ *  A work queue kept in a directory that any number of worker processes,
+ *  on one host or many sharing it over NFS, take units of work from. It
+ *  is made by sample --split, worked through by sample --work and its
+ *  results put back together by sample --merge. The directory holds:
+ *
+ *    todo/<unit>            a unit waiting: one input path per line
+ *    leased/<unit>@<owner>  a unit a worker has taken, renewed while it
+ *                           works by touching it
+ *    done/<unit>            the unit's results, in the order of its inputs
+ *    tmp/                   files being written, renamed into place whole
+ *    units                  how many units there are, once split is done
+ *    clock                  touched to read the time on the directory's
+ *                           own clock, so hosts needn't agree on it
+ *
+ *  Units are named by their number, zero-padded so that they sort in
+ *  order. A unit is taken by renaming it from todo/ to leased/, which
+ *  only one worker can do, and a lease that hasn't been renewed for the
+ *  lease time (its owner having died, say) is renamed back by whichever
+ *  worker finds it first. A unit is therefore done at least once: one
+ *  reclaimed from a worker that was only slow may be done twice, which
+ *  leaves the same results.
+ */
+
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct workq_s workq_t;
+
+/* A unit taken by workq_lease() */
+typedef struct
+{
+    char*   name;           /* the unit's number, as named in todo/ */
+    char**  paths;          /* its inputs, pointing into data */
+    size_t  count;
+    char*   data;
+    char*   lease_path;
+
+} workq_unit_t;
+
+typedef enum
+{
+    WORKQ_LEASED,           /* a unit was taken */
+    WORKQ_WAIT,             /* none to take, but some are still leased */
+    WORKQ_FINISHED,         /* every unit is done */
+    WORKQ_ERROR             /* errno says why */
+
+} workq_status_t;
+
+/* How one worker's leases went, from workq_stats() */
+typedef struct
+{
+    unsigned long leased;
+    unsigned long completed;
+    unsigned long released;   /* put back with workq_release() */
+    unsigned long reclaimed;  /* others' expired leases put back */
+    unsigned long lost;       /* ours, found reclaimed when renewed */
+
+} workq_stats_t;
+
+/*
+ * Make the queue directory at dir (and any of its parts missing) to be
+ * split into. Fails with EEXIST if it has already been split.
+ */
+int
+workq_create(
+    const char* dir
+    );
+
+/* Add unit number number, of count inputs, to the queue being split */
+int
+workq_add(
+    const char*  dir,
+    size_t       number,
+    char* const* paths,
+    size_t       count
+    );
+
+/* Mark the split finished, with units units in all */
+int
+workq_seal(
+    const char* dir,
+    size_t      units
+    );
+
+/*
+ * Open the queue at dir to take units from, with leases that expire
+ * lease_seconds after they were last renewed. A thread renews every
+ * lease held, four times a lease. Returns NULL with errno set on failure.
+ */
+workq_t*
+workq_open(
+    const char* dir,
+    double      lease_seconds
+    );
+
+/* Stop renewing. Units still held are left to expire. */
+void
+workq_close(
+    workq_t* workq
+    );
+
+/*
+ * Take a unit into *unit, reclaiming expired leases first if there are
+ * none waiting. Units already done are skipped. Safe to call from one
+ * thread at a time.
+ */
+workq_status_t
+workq_lease(
+    workq_t*      workq,
+    workq_unit_t* unit
+    );
+
+/*
+ * Store size bytes of results for a unit taken, and give up its lease.
+ * The unit is freed either way.
+ */
+int
+workq_complete(
+    workq_t*      workq,
+    workq_unit_t* unit,
+    const void*   results,
+    size_t        size
+    );
+
+/* Put a unit taken back for another worker, and free it */
+int
+workq_release(
+    workq_t*      workq,
+    workq_unit_t* unit
+    );
+
+void
+workq_stats(
+    workq_t*       workq,
+    workq_stats_t* p_stats
+    );
+
+/*
+ * Write the results of every unit of the queue at dir to out, in unit
+ * order. Nothing is written unless the queue is sealed (errno is ENOENT
+ * if it isn't) and every unit is done; *p_missing says how many aren't,
+ * with errno EAGAIN.
+ */
+int
+workq_merge(
+    const char* dir,
+    FILE*       out,
+    size_t*     p_units,
+    size_t*     p_missing
+    );
+
+#endif /* WORKQ_H */